@@ -50,9 +50,10 @@ res brk(void *addr_in, uint64_t *page_break_state, mmap_Protection prot)
 
     uint64_t map_size = addr_aligned - page_break_aligned;
 
-    // Initially, never mmap with ring3.
-    const mmap_Protection actual_prot = prot & ~MMAP_PROT_RING_3;
-    res rs = mmap((void *)page_break_aligned, map_size, actual_prot);
+    // User memory is backed only once it's accessed, already zeroed.
+    const bool is_user_memory = (prot & MMAP_PROT_RING_3) != 0;
+    res rs = is_user_memory ? mmap_lazy((void *)page_break_aligned, map_size, prot)
+                            : mmap((void *)page_break_aligned, map_size, prot);
     if (!IS_OK(rs))
     {
         return rs;
@@ -60,18 +61,6 @@ res brk(void *addr_in, uint64_t *page_break_state, mmap_Protection prot)
 
     *page_break_state = addr;
 
-    // If ring3 is actually needed, we first memset everything to 0
-    //  and mprotect to ring3.
-    if (prot & MMAP_PROT_RING_3)
-    {
-        memset((void *)page_break_aligned, 0, map_size);
-        rs = mprotect((void *)page_break_aligned, map_size, prot);
-        if (!IS_OK(rs))
-        {
-            return rs;
-        }
-    }
-
     return res_OK;
 }
 
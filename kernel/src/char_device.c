@@ -1,5 +1,6 @@
 #include "char_device.h"
 #include "FAT16.h"
+#include "poll.h"
 #include "assert.h"
 
 static char_device_Descriptor *g_head;
@@ -56,6 +57,42 @@ size_t char_device_read(fat16_File *file, uint8_t *buffer, uint64_t buffer_size,
     return desc->read(buffer, buffer_size, file_offset, minor_number, block);
 }
 
+uint32_t char_device_poll(fat16_File *file, PCB *pcb, WaitQueue **out_wait_queue)
+{
+    *out_wait_queue = NULL;
+
+    char_device_Descriptor *desc = find_descriptor(file);
+    if (desc == NULL)
+    {
+        return POLL_NVAL;
+    }
+
+    if (desc->poll == NULL)
+    {
+        return POLL_IN | POLL_OUT;
+    }
+
+    return desc->poll(file->file_entry.firstClusterLow, pcb, out_wait_queue);
+}
+
+void char_device_ref(fat16_File *file)
+{
+    char_device_Descriptor *desc = find_descriptor(file);
+    if (desc != NULL && desc->ref != NULL)
+    {
+        desc->ref(file->file_entry.firstClusterLow);
+    }
+}
+
+void char_device_unref(fat16_File *file)
+{
+    char_device_Descriptor *desc = find_descriptor(file);
+    if (desc != NULL && desc->unref != NULL)
+    {
+        desc->unref(file->file_entry.firstClusterLow);
+    }
+}
+
 void char_device_register(char_device_Descriptor *desc)
 {
     desc->next = g_head;
@@ -2,7 +2,15 @@
 
 #include "FAT16.h"
 
+typedef struct PCB PCB;
+typedef struct WaitQueue WaitQueue;
+
 typedef size_t (*char_device_ReadWriteFunc)(uint8_t *buffer, uint64_t buffer_size, uint64_t file_offset, int minor_number, bool block);
+typedef void (*char_device_ReferenceFunc)(int minor_number);
+
+// Returns the POLL_ events (@see poll.h) the device is ready for, for `pcb`. If they may change,
+//  `out_wait_queue` is set to the queue that is woken when they do, otherwise it's left NULL.
+typedef uint32_t (*char_device_PollFunc)(int minor_number, PCB *pcb, WaitQueue **out_wait_queue);
 
 typedef struct char_device_Descriptor {
     int major_number;
@@ -10,6 +18,14 @@ typedef struct char_device_Descriptor {
     char_device_ReadWriteFunc read;
     char_device_ReadWriteFunc write;
 
+    // Optional. Called for every new file descriptor of the device (a copy
+    //  made by fork or execute), and for every closed one.
+    char_device_ReferenceFunc ref;
+    char_device_ReferenceFunc unref;
+
+    // Optional. Without it, the device is always ready for both reading and writing.
+    char_device_PollFunc poll;
+
     struct char_device_Descriptor *next;
 } char_device_Descriptor;
 
@@ -33,6 +49,24 @@ size_t char_device_write(fat16_File *file, uint8_t *buffer, uint64_t buffer_size
  */
 size_t char_device_read(fat16_File *file, uint8_t *buffer, uint64_t buffer_size, uint64_t file_offset, bool block);
 
+/**
+ * @brief - Get the POLL_ events the device of `file` is ready for, for `pcb`.
+ * @see   - char_device_Descriptor.poll
+ */
+uint32_t char_device_poll(fat16_File *file, PCB *pcb, WaitQueue **out_wait_queue);
+
+/**
+ * @brief - Let the device of `file` know another file descriptor refers to it.
+ * @see   - char_device_Descriptor.ref
+ */
+void char_device_ref(fat16_File *file);
+
+/**
+ * @brief - Let the device of `file` know a file descriptor that referred to it was closed.
+ * @see   - char_device_Descriptor.unref
+ */
+void char_device_unref(fat16_File *file);
+
 /**
  * @brief   - Register a character device. The of the descriptor should
  *              not be freed until the device is unregistered.
@@ -6,18 +6,21 @@
 #include "fs.h"
 #include "assert.h"
 #include "io_keyboard.h"
-#include "kmalloc.h"
+#include "io.isr.h"
+#include "slab.h"
 #include "memory.h"
 #include <stdint.h>
 #include <stddef.h>
 #include "io.h"
 #include "pcb.h"
+#include "poll.h"
 #include "scheduler.h"
 #include "vga.h"
 #include "window.h"
 
 static size_t handle_write(uint8_t *buffer, uint64_t buffer_size, uint64_t file_offset, int minor_number, bool block);
 static size_t handle_read(uint8_t *buffer, uint64_t buffer_size, uint64_t file_offset, int minor_number, bool block);
+static uint32_t handle_poll(int minor_number, PCB *pcb, WaitQueue **out_wait_queue);
 
 static void create_char_device_file(const char *path, char_special_device_MinorDeviceType minor_number)
 {
@@ -39,6 +42,7 @@ void char_special_device_init()
     static char_device_Descriptor desc = {
         .read = handle_read,
         .write = handle_write,
+        .poll = handle_poll,
         .major_number = char_special_device_MAJOR_NUMBER,
     };
 
@@ -130,6 +134,8 @@ typedef struct {
     uint64_t current_index; /* = 0 (initial) */
 } TTYReadRefreshArgument;
 
+static slab_Cache g_tty_read_argument_cache = SLAB_CACHE_INIT("tty read argument", TTYReadRefreshArgument);
+
 // @see pcb_IORefresh
 static pcb_IORefreshResult pcb_refresh_tty_read(PCB *pcb)
 {
@@ -145,46 +151,47 @@ static pcb_IORefreshResult pcb_refresh_tty_read(PCB *pcb)
         return PCB_IO_REFRESH_CONTINUE;
     }
 
-    if (!io_keyboard_is_key_ready())
-    {
-        return PCB_IO_REFRESH_CONTINUE;
-    }
-
     TTYReadRefreshArgument *arg = pcb->refresh_arg;
     assert(arg != NULL);
-    assert(arg->current_index <= arg->buffer_size);
 
-    char ch = io_keyboard_key_to_char(io_keyboard_wait_key());
-    if ((uint8_t)ch == IO_KEY_UNKNOWN)
+    // We are woken once per key press, but more keys might have arrived since then.
+    while (io_keyboard_is_key_ready())
     {
-        return PCB_IO_REFRESH_CONTINUE;
-    }
+        assert(arg->current_index <= arg->buffer_size);
 
-    // syscall checked that the buffer is safe to write to.
-    asm volatile ("stac" ::: "memory");
-    arg->buffer[arg->current_index] = ch;
-    asm volatile ("clac" ::: "memory");
-    if (ch == '\b')
-    {
-        if (arg->current_index > 0)
+        char ch = io_keyboard_key_to_char(io_keyboard_wait_key());
+        if ((uint8_t)ch == IO_KEY_UNKNOWN)
         {
-            putc_window(window, '\b');
-            window_notify_update(window);
-            arg->current_index--;
+            continue;
+        }
+
+        // syscall checked that the buffer is safe to write to.
+        asm volatile ("stac" ::: "memory");
+        arg->buffer[arg->current_index] = ch;
+        asm volatile ("clac" ::: "memory");
+        if (ch == '\b')
+        {
+            if (arg->current_index > 0)
+            {
+                putc_window(window, '\b');
+                window_notify_update(window);
+                arg->current_index--;
+            }
+            continue;
         }
-        return PCB_IO_REFRESH_CONTINUE;
-    }
 
-    putc_window(window, ch); // TODO: add a way to configure the displaying/not-displaying. Maybe it should be a shell feature instead of being a kernel feature.
-    window_notify_update(window);
+        putc_window(window, ch); // TODO: add a way to configure the displaying/not-displaying. Maybe it should be a shell feature instead of being a kernel feature.
+        window_notify_update(window);
 
-    arg->current_index++;
+        arg->current_index++;
 
-    if (ch == '\n' || arg->current_index == arg->buffer_size)
-    {
-        pcb->regs.rax = arg->current_index;
-        kfree(arg);
-        return PCB_IO_REFRESH_DONE;
+        if (ch == '\n' || arg->current_index == arg->buffer_size)
+        {
+            pcb->regs.rax = arg->current_index;
+            pcb->stats.bytes_read += arg->current_index;
+            slab_free(&g_tty_read_argument_cache, arg);
+            return PCB_IO_REFRESH_DONE;
+        }
     }
 
     return PCB_IO_REFRESH_CONTINUE;
@@ -194,7 +201,7 @@ static size_t tty_read_blocking(uint8_t *buffer, uint64_t buffer_size)
 {
     PCB *pcb = scheduler_current_pcb();
 
-    TTYReadRefreshArgument *arg = kcalloc(1, sizeof(*arg));
+    TTYReadRefreshArgument *arg = slab_alloc(&g_tty_read_argument_cache);
     if (arg == NULL)
     {
         return 0; // Failed
@@ -205,13 +212,12 @@ static size_t tty_read_blocking(uint8_t *buffer, uint64_t buffer_size)
 
     pcb->refresh_arg = arg;
 
-    scheduler_move_current_process_to_io_queue_and_context_switch(pcb_refresh_tty_read);
+    scheduler_move_current_process_to_io_queue_and_context_switch(&io_keyboard_wait_queue, pcb_refresh_tty_read, SCHEDULER_NO_DEADLINE);
 }
 
-static size_t tty_read_nonblocking(uint8_t *buffer, uint64_t buffer_size)
+// The window whose keys a non-blocking read (or a poll) of the process gets. NULL if there's none.
+static Window *tty_nonblocking_window(PCB *pcb)
 {
-    PCB *pcb = scheduler_current_pcb();
-
     // We are ok with pcb's window (both text and graphics), or parent's text window (but not graphics).
     //  If we allowed parent's graphics, GUIs with multiple windows would "eat" each other's keys.
     Window *window = pcb->window;
@@ -220,6 +226,12 @@ static size_t tty_read_nonblocking(uint8_t *buffer, uint64_t buffer_size)
         window = PCB_get_window_in_mode(pcb, WINDOW_TEXT);
     }
 
+    return window;
+}
+
+static size_t tty_read_nonblocking(uint8_t *buffer, uint64_t buffer_size)
+{
+    Window *window = tty_nonblocking_window(scheduler_current_pcb());
     if (window == NULL)
     {
         return -2;
@@ -250,6 +262,25 @@ static size_t tty_read_nonblocking(uint8_t *buffer, uint64_t buffer_size)
     return buffer_size;
 }
 
+static uint32_t handle_poll(int minor_number, PCB *pcb, WaitQueue **out_wait_queue)
+{
+    if ((char_special_device_MinorDeviceType)minor_number != char_special_device_MINOR_TTY)
+    {
+        return POLL_IN | POLL_OUT;
+    }
+
+    Window *window = tty_nonblocking_window(pcb);
+    if (window == NULL)
+    {
+        return POLL_ERR;
+    }
+
+    *out_wait_queue = &io_keyboard_wait_queue; // Also woken on focus switch.
+
+    const bool is_key_ready = window_is_in_focus(window) && io_keyboard_is_key_ready();
+    return is_key_ready ? POLL_IN | POLL_OUT : POLL_OUT;
+}
+
 size_t handle_read(uint8_t *buffer, uint64_t buffer_size, uint64_t file_offset, int minor_number, bool block)
 {
     switch ((char_special_device_MinorDeviceType)minor_number)
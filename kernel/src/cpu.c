@@ -0,0 +1,149 @@
+#include "cpu.h"
+#include "IDT.h"
+#include "gdt.h"
+#include "kernel_memory_info.h"
+#include "memory.h"
+#include "assert.h"
+
+CPU g_cpus[CPU_MAX_COUNT] = {0}; // Init with 0 so it's placed in .data and not in .bss, cpu_init_gdt runs before the bss is mapped.
+static uint32_t g_cpu_count;
+
+mmu_PageMapEntry *g_kernel_pml4;
+
+// null segment, two ring 0 segments, two ring 3 segments, then a TSS segment (which takes 2 entries) for every CPU
+#define GDT_FIRST_TSS_INDEX 5
+static gdt_entry g_gdt[GDT_FIRST_TSS_INDEX + CPU_MAX_COUNT * 2] = {0}; // Not in .bss, like g_cpus.
+
+#define TSS_SEGMENT(cpu_index) ((GDT_FIRST_TSS_INDEX + (cpu_index) * 2) * 8) // The first is 0x28
+
+static void cpu_load_gdt_and_tss(uint32_t index)
+{
+    gdt_descriptor gdt_desc = {
+        .size = sizeof(g_gdt) - 1,
+        .offset = (uint64_t)g_gdt,
+    };
+    asm ("lgdt %0" : : "m"(gdt_desc) : "memory");
+
+    asm ("ltr %0" : : "r"((uint16_t)TSS_SEGMENT(index)) : "memory");
+}
+
+void cpu_init_gdt()
+{
+    // NOTE: the order must be: Kernel Code, Kernel Data, User Data, User Code
+    //  otherwise syscall/sysret would not work.
+    //  @see 5.8.8 in the Intel® 64 and IA-32 Architectures Software Developer’s Manual, Volume 3A
+
+    // Ring 0 (aka our (kernel) segments).
+
+    // Code (ring 0)
+    g_gdt[1] = (gdt_entry){
+        .limit_low = 0xffff,
+        .base_low = 0,
+        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(0) | GDT_SEG_CODE_EXRD | GDT_SEG_ACCESSED,
+        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
+        .limit_high = 0xf,
+        .base_high = 0,
+    };
+
+    // Data (ring 0)
+    g_gdt[2] = (gdt_entry){
+        .limit_low = 0xffff,
+        .base_low = 0,
+        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(0) | GDT_SEG_DATA_RDWR | GDT_SEG_ACCESSED,
+        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
+        .limit_high = 0xf,
+        .base_high = 0,
+    };
+
+    // Data (ring 3)
+    g_gdt[3] = (gdt_entry){
+        .limit_low = 0xffff,
+        .base_low = 0,
+        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(3) | GDT_SEG_DATA_RDWR | GDT_SEG_ACCESSED,
+        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
+        .limit_high = 0xf,
+        .base_high = 0,
+    };
+
+    // Code (ring 3)
+    g_gdt[4] = (gdt_entry){
+        .limit_low = 0xffff,
+        .base_low = 0,
+        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(3) | GDT_SEG_CODE_EXRD | GDT_SEG_ACCESSED,
+        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
+        .limit_high = 0xf,
+        .base_high = 0,
+    };
+
+    // Every CPU has its own TSS, as each has its own kernel stack to enter on interrupts from usermode.
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        TSS *tss = &g_cpus[i].tss;
+
+        gdt_system_segment system_segment = {
+            .limit_low = sizeof(TSS) - 1,
+
+            .type = GDT_SYS_SEG_64BIT_TSS,
+            .present = 1,
+
+            .base_low =  ((uint64_t)tss >> 0)  & 0xffffff,
+            .base_mid =  ((uint64_t)tss >> 24) & 0xff,
+            .base_high = ((uint64_t)tss >> 32) & 0xffffffff,
+        };
+        memmove(&g_gdt[GDT_FIRST_TSS_INDEX + i * 2], &system_segment, sizeof(system_segment));
+    }
+
+    g_cpus[0].tss.rsp0 = KERNEL_STACK_BASE;
+    cpu_load_gdt_and_tss(0);
+}
+
+static void cpu_init(CPU *cpu, uint32_t index, uint64_t kernel_stack_top)
+{
+    cpu->self = cpu;
+    cpu->index = index;
+    cpu->kernel_stack_top = kernel_stack_top;
+    cpu->tss.rsp0 = kernel_stack_top;
+    cpu->pml4 = g_pml4;
+    cpu->tick_deadline_ms = UINT64_MAX;
+    cpu->is_online = true;
+
+    // While in the kernel, the kernel GS base is the usermode one. They are swapped on every usermode<->kernel switch.
+    cpu_write_msr(MSR_GS_BASE, (uint64_t)cpu);
+    cpu_write_msr(MSR_KERNEL_GS_BASE, 0);
+
+    __atomic_add_fetch(&g_cpu_count, 1, __ATOMIC_SEQ_CST);
+}
+
+void cpu_init_bsp()
+{
+    g_kernel_pml4 = g_pml4;
+    cpu_init(&g_cpus[0], 0, KERNEL_STACK_BASE);
+}
+
+CPU *cpu_init_ap(uint32_t index, uint64_t kernel_stack_top)
+{
+    assert(index > 0 && index < CPU_MAX_COUNT);
+
+    cpu_load_gdt_and_tss(index);
+
+    IDTDescriptor idtd = {
+        .limit = IDT_LENGTH * sizeof(IDTEntry),
+        .base = (uint64_t)g_idt,
+    };
+    asm volatile("lidt %0" : : "m"(idtd));
+
+    CPU *cpu = &g_cpus[index];
+    cpu_init(cpu, index, kernel_stack_top);
+
+    return cpu;
+}
+
+uint64_t cpu_kernel_stack_top(uint32_t index)
+{
+    return KERNEL_STACK_BASE - (uint64_t)index * CPU_KERNEL_STACK_STRIDE;
+}
+
+uint32_t cpu_count()
+{
+    return g_cpu_count;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "mmap.h"
+#include "mmu.h"
+#include "tss.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct PCB PCB;
+typedef struct FpuState FpuState;
+
+#define CPU_MAX_COUNT 16
+
+#define CPU_KERNEL_STACK_SIZE   (5 * 0x1000)  // Same as the stack the bootloader maps for the BSP.
+#define CPU_KERNEL_STACK_STRIDE (16 * 0x1000) // The pages between the stacks are left unmapped, as guard pages.
+
+// NOTE: the offsets are hardcoded in inline assembly, which reaches the fields through $gs.
+#define CPU_OFFSET_KERNEL_STACK_TOP 8
+#define CPU_OFFSET_USER_RSP         16
+#define CPU_OFFSET_SCRATCH          24
+#define CPU_OFFSET_CURRENT_PROCESS  32
+#define CPU_OFFSET_SHOULD_PREEMPT   40
+
+// The data of a single CPU. While in the kernel, $gs base points to the
+//  `CPU` of the CPU we are running on (while in usermode, it's swapped out with `swapgs`).
+typedef struct CPU {
+    struct CPU *self; // Used to get a regular pointer from $gs.
+    uint64_t kernel_stack_top;
+    uint64_t user_rsp; // The usermode $rsp, saved on syscall entry.
+    uint64_t scratch; // Temporary storage for naked ISRs, which can't touch the stack or registers.
+
+    PCB *current_process; // The process queue head (the running process).
+    bool should_preempt; // Set by `scheduler_tick` once the current process used its time slice.
+    PCB *process_queue_tail;
+    uint64_t slice_start_ms; // When the current process got the CPU.
+
+    uint32_t index;
+    uint32_t lapic_id;
+
+    uint32_t kernel_lock_depth; // @see kernel_lock.h
+    mmu_PageMapEntry *pml4; // The `g_pml4` of this CPU, while it doesn't hold the kernel lock.
+
+    uint64_t idle_ms; // Time spent halted, with nothing to run.
+    bool is_idle; // Halted with nothing to run, to be woken with LAPIC_VECTOR_WAKEUP.
+    bool is_online;
+
+    uint64_t tick_deadline_ms; // @see lapic_timer_arm
+
+    FpuState *fpu_owner; // Whose state the FPU/SSE registers were last loaded with. @see fpu.h
+
+    mmap_HotPages hot_pages; // @see mmap_HotPages
+
+    PCB *accounted_process; // Who the CPU time is charged to. @see scheduler_account_time
+    uint64_t accounted_since_tsc;
+
+    TSS tss;
+} CPU;
+
+_Static_assert(offsetof(CPU, kernel_stack_top) == CPU_OFFSET_KERNEL_STACK_TOP, "Update CPU_OFFSET_KERNEL_STACK_TOP");
+_Static_assert(offsetof(CPU, user_rsp) == CPU_OFFSET_USER_RSP, "Update CPU_OFFSET_USER_RSP");
+_Static_assert(offsetof(CPU, scratch) == CPU_OFFSET_SCRATCH, "Update CPU_OFFSET_SCRATCH");
+_Static_assert(offsetof(CPU, current_process) == CPU_OFFSET_CURRENT_PROCESS, "Update CPU_OFFSET_CURRENT_PROCESS");
+_Static_assert(offsetof(CPU, should_preempt) == CPU_OFFSET_SHOULD_PREEMPT, "Update CPU_OFFSET_SHOULD_PREEMPT");
+
+extern CPU g_cpus[CPU_MAX_COUNT];
+
+// The page tables of the kernel, without any process mapped.
+extern mmu_PageMapEntry *g_kernel_pml4;
+
+/**
+ * @brief - Get the data of the CPU we are running on. Must be called only from the kernel $gs.
+ */
+__attribute__((always_inline))
+static inline CPU *cpu_current()
+{
+    CPU *cpu;
+    asm volatile("mov %0, gs:[0]" : "=r"(cpu));
+    return cpu;
+}
+
+/**
+ * @brief - The amount of CPUs that are online (the BSP included).
+ */
+uint32_t cpu_count();
+
+/**
+ * @brief - Build the GDT, with a TSS for every possible CPU, and load it on the BSP.
+ *          Must be called before any other `cpu_` function.
+ */
+void cpu_init_gdt();
+
+/**
+ * @brief - Initialize the `CPU` of the BSP and point $gs at it.
+ */
+void cpu_init_bsp();
+
+/**
+ * @brief - Initialize the CPU we are running on as the `index`th CPU: load
+ *            the GDT, its TSS and the IDT, and point $gs at its `CPU`.
+ *          Called by the application processors once they reach long mode.
+ *
+ * @param kernel_stack_top - The top of the kernel stack of the CPU.
+ */
+CPU *cpu_init_ap(uint32_t index, uint64_t kernel_stack_top);
+
+/**
+ * @brief - Get the top of the kernel stack of the `index`th CPU.
+ *          The stack of the BSP is mapped by the bootloader, the rest are not mapped by this function.
+ */
+uint64_t cpu_kernel_stack_top(uint32_t index);
+
+#define MSR_GS_BASE        0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+static inline void cpu_write_msr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "d"((uint32_t)(value >> 32)), "a"((uint32_t)value) : "memory");
+}
+
+static inline uint64_t cpu_read_msr(uint32_t msr)
+{
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
@@ -1,5 +1,6 @@
 #include "donut.h"
 #include "math.h"
+#include "fpu.h"
 
 extern volatile uint8_t *g_vga_it;
 void donut() {
@@ -10,6 +11,8 @@ void donut() {
     char b[1760];
     io_clear_vga();
 
+    fpu_kernel_begin(); // Never ends, we draw until a reboot.
+
     for(;;) {
         memset(b, 32, 1760);
         memset(z, 0, 7040);
@@ -148,7 +148,8 @@ res elf_load(FILE *file, void **entry_point_ptr)
                 }
 
                 // TODO: check that virtual address doesn't overlap with any of the kernel pages.
-                res rs = mmap((void *)entry.segment_virtual_address, entry.segment_size_in_memory, MMAP_PROT_READ | MMAP_PROT_WRITE);
+                // Only the pages we read the file into are backed now. The rest (like .bss) once they are accessed, already zeroed.
+                res rs = mmap_lazy((void *)entry.segment_virtual_address, entry.segment_size_in_memory, MMAP_PROT_READ | MMAP_PROT_WRITE);
                 if (!IS_OK(rs))
                 {
                     return rs;
@@ -166,9 +167,10 @@ res elf_load(FILE *file, void **entry_point_ptr)
                     return res_elf_INVALID_ELF;
                 }
 
-
-
-                memset((char *)entry.segment_virtual_address + entry.segment_size_in_file, 0, entry.segment_size_in_memory - entry.segment_size_in_file);
+                // A lazy page is zeroed when it's backed, but the last page we read into might be shared with another segment.
+                const uint64_t file_end = entry.segment_virtual_address + entry.segment_size_in_file;
+                const uint64_t memory_end = entry.segment_virtual_address + entry.segment_size_in_memory;
+                memset((void *)file_end, 0, MIN(PAGE_ALIGN_UP(file_end), memory_end) - file_end);
 
                 rs = mprotect((void *)entry.segment_virtual_address, entry.segment_size_in_memory, elf_flags_to_mmap_flags(entry.flags));
                 if (!IS_OK(rs))
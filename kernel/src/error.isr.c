@@ -1,6 +1,8 @@
 #include "error.isr.h"
 #include "io.h"
 #include "isr.h"
+#include "mmap.h"
+#include "program.h"
 #include "scheduler.h"
 #include "vga.h"
 #include "assert.h"
@@ -104,15 +106,44 @@ typedef struct
 void __attribute__((used, sysv_abi))
 error_isr_page_fault_impl(isr_InterruptFrame *frame, PageFaultErrorCode error)
 {
+    uint64_t cr2;
+    asm volatile ("mov %0, cr2" : "=r"(cr2));
+
+    PCB *pcb = scheduler_current_pcb();
+    if (pcb != NULL)
+    {
+        pcb->stats.page_faults++;
+    }
+
+    // The first write to a page shared by fork. Can come from the kernel too, when it writes to a user buffer.
+    if (error.present && error.write && mmap_copy_on_write((void *)cr2))
+    {
+        return;
+    }
+
+    // The first access to a page reserved by mmap_lazy. Can come from the kernel too.
+    if (!error.present && mmap_populate((void *)cr2))
+    {
+        return;
+    }
+
+    // Ran past the bottom of the stack. Nothing to recover, the process is terminated.
+    if (error.user && program_is_stack_guard(cr2))
+    {
+        printf("\nStack overflow: PID=0x%llx; RIP=0x%llx; RSP=0x%llx; Virtual address cause: %llx\n",
+               pcb->id, frame->rip, frame->rsp, cr2);
+
+        pcb->return_code = PROGRAM_STACK_OVERFLOW_RETURN_CODE;
+        scheduler_process_dequeue_current_and_context_switch();
+        assert(false && "Unreachable");
+    }
+
     if (vga_current_mode() != VGA_MODE_TYPE_TEXT)
     {
         vga_mode_text();
         io_clear_vga();
     }
 
-    uint64_t cr2;
-    asm volatile ("mov %0, cr2" : "=r"(cr2));
-
     printf("\nPage Fault: RIP=0x%llx; ", frame->rip);
     print_pid_if_usermode(frame);
     printf("Virtual address cause: %llx\n", cr2);
@@ -1,13 +1,12 @@
 #include "fs.h"
 #include "mmu.h"
+#include "pcb.h"
 #include "program.h"
 #include "res.h"
 #include <stdbool.h>
 #include <stdint.h>
 
-static uint64_t id = 1;
-
-res execve(const char *path, const char *const *argv, PCB *parent, uint64_t *out_pid)
+res execve(const char *path, const char *const *argv, PCB *parent, FileDescriptor *const *stdio, uint64_t *out_pid)
 {
     const char *empty_argv[] = {path, NULL};
     if (argv == NULL)
@@ -17,14 +16,14 @@ res execve(const char *path, const char *const *argv, PCB *parent, uint64_t *out
         argv = empty_argv;
     }
 
-    res rs = program_setup_from_drive(id, parent, g_pml4, &g_fs_fat16, path, (char **)argv); // const-cast here is safe. @see - program_setup_from_drive
+    const uint64_t id = pcb_allocate_pid();
+    res rs = program_setup_from_drive(id, parent, g_pml4, &g_fs_fat16, path, (char **)argv, stdio); // const-cast here is safe. @see - program_setup_from_drive
     if (!IS_OK(rs))
     {
         return rs;
     }
 
     if (out_pid) *out_pid = id;
-    id++;
 
     return res_OK;
 }
@@ -12,8 +12,9 @@
  *                  it's safe to pass temporary strings, and there's no need
  *                  to store them.
  * @param parent - Parent of the process. Can be NULL.
+ * @param stdio - Nullable. Copied into the file descriptors of the process, @see program_setup_from_drive
  * @param out_pid[out] - The pid of the newly executued process, if successful. Nullable.
  *
  * @return res_OK on success, one of the fail codes on failure.
  */
-res execve(const void *path, const char *const *argv, PCB *parent, uint64_t *out_pid);
+res execve(const void *path, const char *const *argv, PCB *parent, FileDescriptor *const *stdio, uint64_t *out_pid);
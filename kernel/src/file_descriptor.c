@@ -0,0 +1,32 @@
+#include "file_descriptor.h"
+#include "char_device.h"
+#include "FAT16.h"
+#include "poll.h"
+#include <stddef.h>
+
+void file_descriptor_ref(FileDescriptor *fd)
+{
+    if (fat16_get_mdscore_flags(&fd->file.file) == fat16_MDSCoreFlags_DEVICE)
+    {
+        char_device_ref(&fd->file.file);
+    }
+}
+
+void file_descriptor_unref(FileDescriptor *fd)
+{
+    if (fat16_get_mdscore_flags(&fd->file.file) == fat16_MDSCoreFlags_DEVICE)
+    {
+        char_device_unref(&fd->file.file);
+    }
+}
+
+uint32_t file_descriptor_poll(FileDescriptor *fd, PCB *pcb, WaitQueue **out_wait_queue)
+{
+    if (fat16_get_mdscore_flags(&fd->file.file) == fat16_MDSCoreFlags_DEVICE)
+    {
+        return char_device_poll(&fd->file.file, pcb, out_wait_queue);
+    }
+
+    *out_wait_queue = NULL;
+    return POLL_IN | POLL_OUT;
+}
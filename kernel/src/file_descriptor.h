@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include "file.h"
 
+typedef struct PCB PCB;
+typedef struct WaitQueue WaitQueue;
+
 typedef struct {
     uint64_t num; // fd number
     FILE file;
@@ -13,3 +16,24 @@ typedef struct {
     } perms;
     bool is_buffered;
 } FileDescriptor;
+
+/**
+ * @brief - Must be called for every copy of a file descriptor that is put in a process,
+ *            so devices that track their users (like pipes) know it's open.
+ */
+void file_descriptor_ref(FileDescriptor *fd);
+
+/**
+ * @brief - Must be called for every file descriptor that is closed, or whose process is gone.
+ * @see   - file_descriptor_ref
+ */
+void file_descriptor_unref(FileDescriptor *fd);
+
+/**
+ * @brief - Get the POLL_ events (@see poll.h) the file descriptor is ready for, for `pcb`.
+ *          Regular files are always ready.
+ *
+ * @param out_wait_queue - Set to the queue that is woken when the events may change,
+ *                           or NULL if they never do.
+ */
+uint32_t file_descriptor_poll(FileDescriptor *fd, PCB *pcb, WaitQueue **out_wait_queue);
@@ -19,6 +19,30 @@ bool file_descriptor_hashmap_init(FileDescriptorHashmap *map)
     return true;
 }
 
+bool file_descriptor_hashmap_copy(FileDescriptorHashmap *to, const FileDescriptorHashmap *from)
+{
+    typeof(to->buf) buf = kcalloc(from->capacity, sizeof(*buf));
+    if (buf == NULL)
+    {
+        return false;
+    }
+
+    // Same capacity, so every element hashes to the same index.
+    memmove(buf, from->buf, from->capacity * sizeof(*buf));
+    to->buf = buf;
+    to->capacity = from->capacity;
+
+    for (size_t i = 0; i < to->capacity; i++)
+    {
+        if (to->buf[i].is_used)
+        {
+            file_descriptor_ref(&to->buf[i].fd);
+        }
+    }
+
+    return true;
+}
+
 static bool file_descriptor_hashmap_resize(FileDescriptorHashmap *map)
 {
     assert(map->capacity != 0 && "How did we get here?");
@@ -140,6 +164,14 @@ bool file_descriptor_hashmap_remove(FileDescriptorHashmap *map, uint64_t fd)
 
 void file_descriptor_hashmap_cleanup(FileDescriptorHashmap *map)
 {
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        if (map->buf[i].is_used)
+        {
+            file_descriptor_unref(&map->buf[i].fd);
+        }
+    }
+
     kfree(map->buf);
     map->buf = NULL;
     map->capacity = 0;
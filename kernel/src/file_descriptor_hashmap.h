@@ -40,4 +40,8 @@ bool file_descriptor_hashmap_remove(FileDescriptorHashmap *map, uint64_t fd) WUR
 // Returns true on success and false on failure.
 bool file_descriptor_hashmap_init(FileDescriptorHashmap *map) WUR;
 
+// Initialize `to` with a copy of every element of `from` (@see file_descriptor_ref). Returns true on success and false on failure.
+bool file_descriptor_hashmap_copy(FileDescriptorHashmap *to, const FileDescriptorHashmap *from) WUR;
+
+// Close every file descriptor in the map (@see file_descriptor_unref), and release it.
 void file_descriptor_hashmap_cleanup(FileDescriptorHashmap *map);
@@ -0,0 +1,82 @@
+#include "fork.h"
+#include "file_descriptor_hashmap.h"
+#include "fpu.h"
+#include "memory.h"
+#include "mmu.h"
+#include "pcb.h"
+#include "res.h"
+#include "scheduler.h"
+#include "shm.h"
+#include "user_mmap.h"
+#include "vdso.h"
+#include "assert.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+static void fork_cleanup_child(PCB *parent, PCB *child)
+{
+    size_t child_idx = pcb_ProcessChildrenArray_find(&parent->children, child->id);
+    if (child_idx != parent->children.length)
+    {
+        pcb_ProcessChildrenArray_remove(&parent->children, child_idx);
+    }
+
+    PCB_cleanup(child);
+}
+
+res fork(PCB *parent, uint64_t *out_pid)
+{
+    assert(parent == scheduler_current_pcb());
+
+    PCB *child = PCB_init(pcb_allocate_pid(), parent, parent->rip, g_pml4);
+    if (child == NULL)
+    {
+        return res_fork_OUT_OF_MEMORY;
+    }
+
+    // PCB_init gave the child an empty map, replace it with a copy of ours.
+    file_descriptor_hashmap_cleanup(&child->fd_map);
+    if (!file_descriptor_hashmap_copy(&child->fd_map, &parent->fd_map))
+    {
+        fork_cleanup_child(parent, child);
+        return res_fork_OUT_OF_MEMORY;
+    }
+    child->last_fd = parent->last_fd;
+
+    bool success = pcb_clone_user_pages(child, parent);
+    mmu_tlb_flush_all(); // Our writable pages became read-only, even if we failed halfway.
+    if (!success)
+    {
+        fork_cleanup_child(parent, child);
+        return res_fork_OUT_OF_MEMORY;
+    }
+
+    if (!shm_fork(child, parent) || !user_mmap_fork(child, parent))
+    {
+        fork_cleanup_child(parent, child);
+        return res_fork_OUT_OF_MEMORY;
+    }
+
+    // The pages of the parent are mapped, but the child needs its own process page.
+    mmu_load_virt_pml4(child->paging);
+    res rs = vdso_map(child, true);
+    mmu_load_virt_pml4(parent->paging);
+    if (!IS_OK(rs))
+    {
+        fork_cleanup_child(parent, child);
+        return rs;
+    }
+
+    child->regs = parent->regs;
+    child->regs.rax = 0; // fork returns 0 in the child.
+    child->page_break = parent->page_break;
+    child->priority_level = parent->priority_level;
+    memmove(child->exe_path, parent->exe_path, sizeof(child->exe_path));
+    fpu_state_copy(&child->fpu, &parent->fpu);
+
+    scheduler_process_enqueue(child);
+
+    if (out_pid) *out_pid = child->id;
+
+    return res_OK;
+}
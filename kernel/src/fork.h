@@ -0,0 +1,19 @@
+#pragma once
+
+#include "pcb.h"
+#include "res.h"
+
+#define res_fork_OUT_OF_MEMORY "Ran out of memory forking the process"
+
+/**
+ * @brief - Create a copy of `parent`, which continues from the same point, and
+ *              add it to the scheduler queue. The user pages are shared
+ *              copy-on-write (@see mmap_copy_on_write), so they are copied
+ *              only once either of the processes writes to them.
+ *
+ * @param parent - The process to copy, must be the current process.
+ * @param out_pid[out] - The pid of the child, if successful. Nullable.
+ *
+ * @return res_OK on success, one of the fail codes on failure.
+ */
+res fork(PCB *parent, uint64_t *out_pid);
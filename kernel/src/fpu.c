@@ -0,0 +1,224 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "IDT.h"
+#include "isr.h"
+#include "kmalloc.h"
+#include "math.h"
+#include "memory.h"
+#include "pcb.h"
+#include "assert.h"
+#include <cpuid.h>
+#include <stdint.h>
+
+#define IDT_VECTOR_DEVICE_NOT_AVAILABLE 0x7
+
+#define CR0_TS (1 << 3)
+
+#define CPUID_XSAVE_LEAF 0xd
+#define CPUID_XSAVE_FEATURES_SUB_LEAF 0 // EAX: the supported XCR0 bits. EBX: the size of the area for the enabled bits.
+#define CPUID_XSAVE_EXTENSIONS_SUB_LEAF 1
+#define CPUID_XSAVE_EXTENSIONS_EAX_XSAVEOPT (1 << 0)
+
+#define XCR0_X87 (1 << 0)
+#define XCR0_SSE (1 << 1)
+#define XCR0_AVX (1 << 2)
+
+#define FPU_AREA_ALIGNMENT 64 // Required by XSAVE
+
+// In the legacy region of the XSAVE area (same layout as FXSAVE).
+#define FPU_AREA_FCW_OFFSET   0
+#define FPU_AREA_MXCSR_OFFSET 24
+#define FPU_FCW_DEFAULT   0x37f // Same as after `fninit`
+#define FPU_MXCSR_DEFAULT 0x1f80 // All SSE exceptions masked
+
+static uint64_t g_xcr0;
+static uint64_t g_area_size;
+static bool g_has_xsaveopt;
+
+static inline bool fpu_is_trapping()
+{
+    uint64_t cr0;
+    asm volatile("mov %0, cr0" : "=r"(cr0));
+    return cr0 & CR0_TS;
+}
+
+static inline void fpu_trap_on_next_use()
+{
+    uint64_t cr0;
+    asm volatile("mov %0, cr0\n"
+                 "or %0, %1\n"
+                 "mov cr0, %0"
+                 : "=&r"(cr0)
+                 : "i"(CR0_TS)
+                 : "memory");
+}
+
+static inline void fpu_allow_use()
+{
+    asm volatile("clts" ::: "memory");
+}
+
+static void fpu_save(FpuState *state)
+{
+    // XSAVEOPT skips the components that weren't modified since they were restored from this area.
+    if (g_has_xsaveopt)
+    {
+        asm volatile("xsaveopt64 [%0]" : : "r"(state->area), "a"((uint32_t)g_xcr0), "d"((uint32_t)(g_xcr0 >> 32)) : "memory");
+    }
+    else
+    {
+        asm volatile("xsave64 [%0]" : : "r"(state->area), "a"((uint32_t)g_xcr0), "d"((uint32_t)(g_xcr0 >> 32)) : "memory");
+    }
+}
+
+static void fpu_restore(const FpuState *state)
+{
+    asm volatile("xrstor64 [%0]" : : "r"(state->area), "a"((uint32_t)g_xcr0), "d"((uint32_t)(g_xcr0 >> 32)) : "memory");
+}
+
+// XCR0 is per CPU. The bootloader already set CR4.OSXSAVE, which the application processors copy from the BSP.
+static void fpu_init_current_cpu()
+{
+    asm volatile("xsetbv" : : "c"(0), "a"((uint32_t)g_xcr0), "d"((uint32_t)(g_xcr0 >> 32)));
+    asm volatile("fninit");
+
+    cpu_current()->fpu_owner = NULL;
+    fpu_trap_on_next_use();
+}
+
+void fpu_init_bsp()
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+
+    __cpuid_count(CPUID_XSAVE_LEAF, CPUID_XSAVE_FEATURES_SUB_LEAF, eax, ebx, ecx, edx);
+    g_xcr0 = XCR0_X87 | XCR0_SSE | (eax & XCR0_AVX);
+
+    __cpuid_count(CPUID_XSAVE_LEAF, CPUID_XSAVE_EXTENSIONS_SUB_LEAF, eax, ebx, ecx, edx);
+    g_has_xsaveopt = eax & CPUID_XSAVE_EXTENSIONS_EAX_XSAVEOPT;
+
+    fpu_init_current_cpu();
+
+    // Now that XCR0 is set, EBX is the size of the area for the features we enabled.
+    __cpuid_count(CPUID_XSAVE_LEAF, CPUID_XSAVE_FEATURES_SUB_LEAF, eax, ebx, ecx, edx);
+    g_area_size = ebx;
+    assert(g_area_size >= 512 + 64 && "XSAVE area smaller than the legacy region and the header");
+
+    idt_register(IDT_VECTOR_DEVICE_NOT_AVAILABLE, IDT_gate_type_INTERRUPT, fpu_isr_device_not_available);
+}
+
+void fpu_init_ap()
+{
+    fpu_init_current_cpu();
+}
+
+bool fpu_state_init(FpuState *state)
+{
+    assert(g_area_size != 0 && "fpu_init_bsp wasn't called");
+
+    state->buffer = kcalloc(1, g_area_size + FPU_AREA_ALIGNMENT - 1);
+    if (state->buffer == NULL)
+    {
+        return false;
+    }
+
+    state->area = (void *)math_ALIGN_UP((uint64_t)state->buffer, FPU_AREA_ALIGNMENT);
+    state->last_cpu = FPU_NO_CPU;
+
+    // The XSAVE header is zeroed, so every component is restored to its initial
+    //  state, but these two are always loaded from the area.
+    *(uint16_t *)((uint8_t *)state->area + FPU_AREA_FCW_OFFSET) = FPU_FCW_DEFAULT;
+    *(uint32_t *)((uint8_t *)state->area + FPU_AREA_MXCSR_OFFSET) = FPU_MXCSR_DEFAULT;
+
+    return true;
+}
+
+void fpu_state_cleanup(FpuState *state)
+{
+    // The memory might be reused for another state, so no CPU may think it still has it in its registers.
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        FpuState *expected = state;
+        __atomic_compare_exchange_n(&g_cpus[i].fpu_owner, &expected, NULL, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+
+    kfree(state->buffer);
+    memset(state, 0, sizeof(*state));
+}
+
+void fpu_state_copy(FpuState *to, FpuState *from)
+{
+    if (cpu_current()->fpu_owner == from && !fpu_is_trapping())
+    {
+        fpu_save(from); // The area is outdated, the registers were used since it was restored.
+    }
+
+    memmove(to->area, from->area, g_area_size);
+}
+
+void fpu_switch_out(const FpuState *next)
+{
+    CPU *cpu = cpu_current();
+
+    if (fpu_is_trapping() || cpu->fpu_owner == next)
+    {
+        return; // Not used since they were last saved, or the same process keeps running.
+    }
+
+    if (cpu->fpu_owner != NULL)
+    {
+        fpu_save(cpu->fpu_owner);
+    }
+
+    fpu_trap_on_next_use();
+}
+
+void fpu_kernel_begin()
+{
+    CPU *cpu = cpu_current();
+
+    if (!fpu_is_trapping() && cpu->fpu_owner != NULL)
+    {
+        fpu_save(cpu->fpu_owner);
+    }
+    cpu->fpu_owner = NULL; // We are about to overwrite the registers.
+
+    fpu_allow_use();
+}
+
+void fpu_kernel_end()
+{
+    fpu_trap_on_next_use();
+}
+
+// Runs without the kernel lock, it touches only the current CPU and process.
+static void __attribute__((used, sysv_abi)) fpu_on_device_not_available(isr_InterruptFrame *frame)
+{
+    fpu_allow_use();
+
+    CPU *cpu = cpu_current();
+    PCB *pcb = cpu->current_process;
+    assert(pcb != NULL && "The kernel used the FPU outside of fpu_kernel_begin");
+
+    FpuState *state = &pcb->fpu;
+    if (cpu->fpu_owner == state && state->last_cpu == cpu->index)
+    {
+        return; // Still in the registers.
+    }
+
+    fpu_restore(state);
+    state->last_cpu = cpu->index;
+    __atomic_store_n(&cpu->fpu_owner, state, __ATOMIC_SEQ_CST);
+}
+
+void __attribute__((naked)) fpu_isr_device_not_available()
+{
+    asm volatile(isr_SWAPGS_IF_USERMODE(8)
+                 "push offset fpu_on_device_not_available\n"
+                 "call isr_trampoline_without_lock\n"
+                 "add rsp, 0x8\n"
+                 isr_SWAPGS_IF_USERMODE(8)
+                 "iretq" : : : "memory", "cc");
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// The FPU/SSE/AVX registers are switched lazily. The kernel doesn't use them (it's built
+//  with -mno-sse), so they stay loaded with the state of a process across kernel entries,
+//  and it's saved and restored only for the processes that actually use them:
+//  - While a process runs, CR0.TS is set until it touches the registers. The first
+//      access traps with #NM, where we restore its state (unless it's still in the registers).
+//  - On a context switch, if the process used the registers (CR0.TS is clear), they
+//      are saved, as it might continue on another CPU.
+//  Processes that never use the registers never pay for them.
+
+#define FPU_NO_CPU UINT32_MAX
+
+typedef struct FpuState {
+    void *area; // The XSAVE area, aligned to 64 bytes inside of `buffer`.
+    void *buffer;
+    uint32_t last_cpu; // The index of the CPU whose registers were last loaded from `area`, or FPU_NO_CPU.
+} FpuState;
+
+/**
+ * @brief - Enable XSAVE of the x87, SSE and (where supported) AVX registers, set
+ *            up the #NM handler and find the size of the XSAVE area.
+ *          Must be called before any FpuState is initialized.
+ */
+void fpu_init_bsp();
+
+/**
+ * @brief - Enable the same XSAVE features on the application processor we are running on.
+ */
+void fpu_init_ap();
+
+/**
+ * @brief - Initialize `state` to the initial state of the registers (as after `fninit`).
+ * @return - true on success, false if ran out of memory.
+ */
+bool fpu_state_init(FpuState *state) WUR;
+
+void fpu_state_cleanup(FpuState *state);
+
+/**
+ * @brief - Set `to` to the current state of the registers of `from`, which might still be loaded in the registers.
+ */
+void fpu_state_copy(FpuState *to, FpuState *from);
+
+/**
+ * @brief - Called when the current CPU is about to run `next` (NULL if it's going idle).
+ *          Saves the registers of the process that ran before, if it used them, and makes
+ *            the next access to the registers trap.
+ */
+void fpu_switch_out(const FpuState *next);
+
+/**
+ * @brief - Allow the kernel to use the FPU/SSE registers, until fpu_kernel_end.
+ *          Only code compiled with SSE enabled (@see FPU_CFILES in the Makefile) may need it.
+ */
+void fpu_kernel_begin();
+void fpu_kernel_end();
+
+/**
+ * @brief - ISR of #NM (Device Not Available), the first access to the registers while CR0.TS is set.
+ */
+void __attribute__((naked)) fpu_isr_device_not_available();
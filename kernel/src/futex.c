@@ -0,0 +1,151 @@
+#include "futex.h"
+#include "hashmap_utils.h"
+#include "slab.h"
+#include "memory.h"
+#include "mmap.h"
+#include "mmu.h"
+#include "pcb.h"
+#include "pit.h"
+#include "scheduler.h"
+#include "wait_queue.h"
+#include "assert.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUTEX_BUCKET_COUNT 64
+
+// Every waiter is in the bucket of its key. Different keys may share a bucket,
+//  so the waiters are matched by their key, not by the queue they are in.
+static WaitQueue g_futex_buckets[FUTEX_BUCKET_COUNT];
+
+typedef struct {
+    uint64_t key; // The physical address of the word.
+    bool is_woken;
+} FutexWaitArgument;
+
+static slab_Cache g_futex_argument_cache = SLAB_CACHE_INIT("futex argument", FutexWaitArgument);
+
+static WaitQueue *futex_bucket(uint64_t key)
+{
+    return &g_futex_buckets[hash_u64(key) % FUTEX_BUCKET_COUNT];
+}
+
+/**
+ * @brief - Get the key of the word at `address` in the current process, and its value.
+ *
+ * @return - true on success, false if `address` isn't a valid, aligned, user address.
+ */
+static bool futex_key(usermode_mem *address, uint64_t *out_key, uint32_t *out_value)
+{
+    if ((uint64_t)address % sizeof(uint32_t) != 0)
+    {
+        return false; // Might cross a page, and there's no atomic access to it in usermode anyway.
+    }
+
+    res rs = usermode_copy_from_user(out_value, address, sizeof(*out_value));
+    if (!IS_OK(rs))
+    {
+        return false;
+    }
+
+    // A page shared by fork is copied on the first write to it, which would
+    //  change the key. Copy it now, so the key stays the same while we wait.
+    mmu_PageTableEntry *page = mmu_page_find(address);
+    assert(page != NULL && "We just read from it");
+    if (page->copy_on_write && !mmap_copy_on_write(address))
+    {
+        return false;
+    }
+
+    *out_key = mmu_page_table_entry_address_get(page) + (uint64_t)address % PAGE_SIZE;
+    return true;
+}
+
+// @see pcb_IORefresh
+static pcb_IORefreshResult pcb_refresh_futex_wait(PCB *pcb)
+{
+    FutexWaitArgument *arg = pcb->refresh_arg;
+    assert(arg != NULL);
+
+    if (arg->is_woken)
+    {
+        pcb->regs.rax = FUTEX_WAIT_WOKEN;
+    }
+    else if (pcb->io_timed_out)
+    {
+        pcb->regs.rax = FUTEX_WAIT_TIMED_OUT;
+    }
+    else
+    {
+        return PCB_IO_REFRESH_CONTINUE;
+    }
+
+    slab_free(&g_futex_argument_cache, arg);
+    return PCB_IO_REFRESH_DONE;
+}
+
+uint64_t futex_wait(usermode_mem *address, uint32_t expected, uint64_t timeout_ms)
+{
+    uint64_t key;
+    uint32_t value;
+    if (!futex_key(address, &key, &value))
+    {
+        return -1;
+    }
+
+    // We hold the kernel lock, so no one can wake the futex between the check and blocking.
+    if (value != expected)
+    {
+        return FUTEX_WAIT_VALUE_CHANGED;
+    }
+
+    FutexWaitArgument *arg = slab_alloc(&g_futex_argument_cache);
+    if (arg == NULL)
+    {
+        return -1;
+    }
+    arg->key = key;
+
+    uint64_t deadline;
+    if (timeout_ms == FUTEX_NO_TIMEOUT || __builtin_add_overflow(pit_ms_counter(), timeout_ms, &deadline))
+    {
+        deadline = SCHEDULER_NO_DEADLINE;
+    }
+
+    PCB *pcb = scheduler_current_pcb();
+    pcb->refresh_arg = arg;
+
+    scheduler_move_current_process_to_io_queue_and_context_switch(futex_bucket(key), pcb_refresh_futex_wait, deadline);
+}
+
+uint64_t futex_wake(usermode_mem *address, uint64_t count)
+{
+    uint64_t key;
+    uint32_t value;
+    if (!futex_key(address, &key, &value))
+    {
+        return -1;
+    }
+
+    uint64_t woken = 0;
+    WaitQueueEntry *it = futex_bucket(key)->head;
+    while (it != NULL && woken < count)
+    {
+        WaitQueueEntry *next = it->next;
+
+        FutexWaitArgument *arg = it->pcb->refresh_arg;
+        if (arg->key == key)
+        {
+            // Out of the queue, so it isn't counted by another wake before it's refreshed.
+            arg->is_woken = true;
+            wait_queue_remove(it);
+            scheduler_io_wake(it->pcb);
+            woken++;
+        }
+
+        it = next;
+    }
+
+    return woken;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "usermode.h"
+#include <stdint.h>
+
+// Wait/wake on a 32 bit word in user memory, the building block of the usermode
+//  mutexes, condition variables and semaphores. The waiters are keyed by the physical
+//  address of the word, so processes that map the same memory share the futex.
+
+#define FUTEX_WAIT_WOKEN         0
+#define FUTEX_WAIT_VALUE_CHANGED 1 // The word didn't hold the expected value, didn't block.
+#define FUTEX_WAIT_TIMED_OUT     2
+
+#define FUTEX_NO_TIMEOUT UINT64_MAX
+
+/**
+ * @brief - Block the current process while the word at `address` is `expected`,
+ *            until futex_wake is called on it, or `timeout_ms` passes.
+ *          Checking the value and blocking is atomic with futex_wake.
+ *
+ * @return - One of the FUTEX_WAIT_ values, or -1 if `address` is invalid.
+ *             If the process blocks, the value is returned through its $rax.
+ */
+uint64_t futex_wait(usermode_mem *address, uint32_t expected, uint64_t timeout_ms);
+
+/**
+ * @brief - Wake up to `count` of the processes waiting on the word at `address`, the longest waiting first.
+ *
+ * @return - The amount of woken processes, or -1 if `address` is invalid.
+ */
+uint64_t futex_wake(usermode_mem *address, uint64_t count);
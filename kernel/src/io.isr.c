@@ -12,6 +12,7 @@
 volatile io_Key io_keyboard_buffer[IO_KEYBOARD_BUFFER_SIZE];
 volatile uint8_t io_keyboard_buffer_head;
 volatile uint8_t io_keyboard_buffer_tail;
+WaitQueue io_keyboard_wait_queue;
 
 #define TAB_KEY 0xf
 
@@ -54,6 +55,7 @@ static void __attribute__((used, sysv_abi)) io_isr_keyboard_event_impl(isr_Inter
     if (key == TAB_KEY)
     {
         window_switch_focus();
+        wait_queue_wake_all(&io_keyboard_wait_queue);
         return;
     }
     bool is_ringbuffer_full = ((io_keyboard_buffer_head + 1) %
@@ -71,6 +73,8 @@ static void __attribute__((used, sysv_abi)) io_isr_keyboard_event_impl(isr_Inter
     io_keyboard_buffer[io_keyboard_buffer_head] = (io_Key){key, key_modifiers};
     io_keyboard_buffer_head++;
     io_keyboard_buffer_head %= IO_KEYBOARD_BUFFER_SIZE;
+
+    wait_queue_wake_all(&io_keyboard_wait_queue);
 }
 
 void __attribute__((naked)) io_isr_keyboard_event()
@@ -2,6 +2,7 @@
 #include "isr.h"
 
 #include "io_keyboard.h"
+#include "wait_queue.h"
 
 #define IO_KEYBOARD_BUFFER_SIZE 0x11 // 0x10+1 for ring buffer impl (is-full detection)
 extern volatile io_Key io_keyboard_buffer[IO_KEYBOARD_BUFFER_SIZE];
@@ -9,6 +10,9 @@ extern volatile io_Key io_keyboard_buffer[IO_KEYBOARD_BUFFER_SIZE];
 extern volatile uint8_t io_keyboard_buffer_head;
 extern volatile uint8_t io_keyboard_buffer_tail;
 
+// Woken on every key press and on focus switch.
+extern WaitQueue io_keyboard_wait_queue;
+
 /**
  * @brief - Handle the keyboard interrupt from the PIC
  */
@@ -20,11 +20,13 @@ io_Key io_keyboard_wait_key()
         is_ringbuffer_empty = io_keyboard_buffer_head == io_keyboard_buffer_tail;
     } while (is_ringbuffer_empty);
 
+    // Might be called with interrupts disabled (IO refresh), so restore instead of `sti`.
+    uint64_t flags = get_cpu_flags();
     cli();
     io_Key key = io_keyboard_buffer[io_keyboard_buffer_tail];
     io_keyboard_buffer_tail++;
     io_keyboard_buffer_tail %= IO_KEYBOARD_BUFFER_SIZE;
-    sti();
+    set_cpu_flags(flags);
 
     return key;
 }
@@ -1,4 +1,29 @@
 #include "isr.h"
+#include "kernel_lock.h"
+#include "scheduler.h"
+#include <stdbool.h>
+
+typedef void (*isr_Handler)(isr_InterruptFrame *frame, uint64_t error);
+
+// Every interrupt handler runs under the kernel lock, like the rest of the kernel.
+static void __attribute__((used, sysv_abi)) isr_call_with_kernel_lock(isr_Handler handler, isr_InterruptFrame *frame, uint64_t error)
+{
+    kernel_lock_acquire();
+
+    const bool from_usermode = (frame->cs & 3) == 3;
+    if (from_usermode)
+    {
+        scheduler_account_time(true);
+    }
+
+    handler(frame, error);
+
+    if (from_usermode)
+    {
+        scheduler_account_time(false);
+    }
+    kernel_lock_release();
+}
 
 void __attribute__((naked)) isr_trampoline()
 {
@@ -6,15 +31,35 @@ void __attribute__((naked)) isr_trampoline()
     asm volatile ("push rbp\n"
                   "mov rbp, rsp\n"
                   // 16 byte align the stack
-                  "and rsp, ~0xf\n" : : : "memory");
+                  "and rsp, ~0xf\n"
+                  "cld\n" : : : "memory"); // The C code expects it clear, it might have been set where we interrupted.
+    PUSH_CALLER_STORED();
+
+    asm volatile (
+        "mov rdi, [rbp + 16]\n"
+        "lea rsi, [rbp + 24]\n"
+        "xor edx, edx\n"
+        "call isr_call_with_kernel_lock" : : : "memory");
+
+    POP_CALLER_STORED();
+    asm volatile ("leave\n"
+                  "ret" : : : "memory");
+}
+
+void __attribute__((naked)) isr_trampoline_without_lock()
+{
+
+    asm volatile ("push rbp\n"
+                  "mov rbp, rsp\n"
+                  // 16 byte align the stack
+                  "and rsp, ~0xf\n"
+                  "cld\n" : : : "memory"); // The C code expects it clear, it might have been set where we interrupted.
     PUSH_CALLER_STORED();
-    STORE_SSE();
 
     asm volatile (
         "lea rdi, [rbp + 24]\n"
         "call [rbp + 16]" : : : "memory");
 
-    RESTORE_SSE();
     POP_CALLER_STORED();
     asm volatile ("leave\n"
                   "ret" : : : "memory");
@@ -26,16 +71,16 @@ void __attribute__((naked)) isr_trampoline_error()
     asm volatile ("push rbp\n"
                   "mov rbp, rsp\n"
                   // 16 byte align the stack
-                  "and rsp, ~0xf\n" : : : "memory");
+                  "and rsp, ~0xf\n"
+                  "cld\n" : : : "memory"); // The C code expects it clear, it might have been set where we interrupted.
     PUSH_CALLER_STORED();
-    STORE_SSE(); // Modifies RAX, must be after the push
 
     asm volatile (
-        "lea rdi, [rbp + 32]\n"
-        "mov rsi, [rbp + 24]\n"
-        "call [rbp + 16]" : : : "memory");
+        "mov rdi, [rbp + 16]\n"
+        "lea rsi, [rbp + 32]\n"
+        "mov rdx, [rbp + 24]\n"
+        "call isr_call_with_kernel_lock" : : : "memory");
 
-    RESTORE_SSE();
     POP_CALLER_STORED();
     asm volatile ("leave\n"
                   "ret" : : : "memory");
@@ -24,29 +24,6 @@ typedef struct {
     uint64_t rax;
 } isr_CallerRegsFrame;
 
-#define SSE_STATE_SIZE_BYTES "512"
-
-/*
- * @brief   - Store the SSE state on the stack
- * @warning - The stack must be 16 byte aligned
- */
-#define STORE_SSE()                                                            \
-        asm volatile(                                                          \
-            /* XSAVE on an aligned address */                                  \
-           "sub rsp, "SSE_STATE_SIZE_BYTES";                                   \
-            fxsave [rsp];                                                      \
-        " : : : "memory")
-
-/*
- * @brief   - Restore the SSE state
- * @see     - STORE_SSE
- */
-#define RESTORE_SSE()                                                          \
-        asm volatile("                                                         \
-            fxrstor [rsp];                                                     \
-            add rsp, "SSE_STATE_SIZE_BYTES";                                   \
-        " : : : "memory")
-
 #define PUSH_CALLER_STORED()                                                   \
         asm volatile("                                                         \
             push rax;                                                          \
@@ -76,7 +53,7 @@ typedef struct {
         " : : : "memory")
 
 /**
- * @brief - Trampolines to the provided function.
+ * @brief - Trampolines to the provided function, under the kernel lock.
  *
  * @param func - pointer to the function to trampoline to. Passed on the stack (first on the stack, aka at [rsp]).
  * @param frame - isr_InterruptFrame from the interrupt. Passed on the stack (second on the stack, aka [rsp+8])
@@ -86,7 +63,13 @@ typedef struct {
 void __attribute__((naked)) isr_trampoline();
 
 /**
- * @brief - Trampolines to the provided function.
+ * @brief - Same as isr_trampoline, without taking the kernel lock. For the hot paths
+ *            of interrupts, which touch only the data of the CPU they run on.
+ */
+void __attribute__((naked)) isr_trampoline_without_lock();
+
+/**
+ * @brief - Trampolines to the provided function, under the kernel lock.
  *
  * @param func - pointer to the function to trampoline to. Passed on the stack (first on the stack, aka at [rsp]).
  * @param error - uint64_t of the error code. Passed on the stack (second on the stack, aka [rsp+8])
@@ -96,14 +79,30 @@ void __attribute__((naked)) isr_trampoline();
  */
 void __attribute__((naked)) isr_trampoline_error();
 
+/**
+ * @brief - Switch $gs to the per-CPU data (@see cpu.h) if the interrupt came from usermode,
+ *            or back to the usermode $gs if it's returning to usermode.
+ *
+ * @param cs_offset - The offset of the CS of the isr_InterruptFrame from $rsp.
+ */
+#define isr_SWAPGS_IF_USERMODE(cs_offset)                                      \
+    "test byte ptr [rsp + " #cs_offset "], 3\n"                               \
+    "jz 1f\n"                                                                  \
+    "swapgs\n"                                                                 \
+    "1:\n"
+
 #define isr_IMPL_INTERRUPT(c_function)                                         \
-    asm volatile ("push offset " # c_function  "\n"                                   \
+    asm volatile (isr_SWAPGS_IF_USERMODE(8)                                    \
+                  "push offset " # c_function  "\n"                                   \
                   "call isr_trampoline\n"                                      \
                   "add rsp, 0x8\n"                                             \
+                  isr_SWAPGS_IF_USERMODE(8)                                    \
                   "iretq" : : : "memory", "cc");
 
 #define isr_IMPL_INTERRUPT_ERROR(c_function)                                   \
-    asm volatile ("push offset " # c_function  "\n"                                   \
+    asm volatile (isr_SWAPGS_IF_USERMODE(16)                                   \
+                  "push offset " # c_function  "\n"                                   \
                   "call isr_trampoline_error\n"                                      \
                   "add rsp, 0x10\n"                                            \
+                  isr_SWAPGS_IF_USERMODE(8)                                    \
                   "iretq" : : : "memory", "cc");
@@ -0,0 +1,121 @@
+#include "kernel_lock.h"
+#include "cpu.h"
+#include "io.h"
+#include "mmu.h"
+#include "assert.h"
+#include <stdint.h>
+
+#define KERNEL_LOCK_NO_OWNER ((uint32_t)-1)
+
+// The index of the CPU holding the lock.
+static volatile uint32_t g_kernel_lock_owner = KERNEL_LOCK_NO_OWNER;
+
+// `g_pml4` is shared by all the CPUs, so it must match the $cr3 of whoever holds the lock.
+static void kernel_lock_on_acquire(CPU *cpu)
+{
+    g_pml4 = cpu->pml4;
+}
+
+static void kernel_lock_on_release(CPU *cpu)
+{
+    cpu->pml4 = g_pml4;
+}
+
+// Must be called with interrupts disabled.
+static bool kernel_lock_try_acquire_no_interrupts(CPU *cpu)
+{
+    if (g_kernel_lock_owner == cpu->index)
+    {
+        cpu->kernel_lock_depth++;
+        return true;
+    }
+
+    uint32_t expected = KERNEL_LOCK_NO_OWNER;
+    if (!__atomic_compare_exchange_n(&g_kernel_lock_owner, &expected, cpu->index, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return false;
+    }
+
+    assert(cpu->kernel_lock_depth == 0);
+    cpu->kernel_lock_depth = 1;
+    kernel_lock_on_acquire(cpu);
+
+    return true;
+}
+
+bool kernel_lock_try_acquire()
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    bool success = kernel_lock_try_acquire_no_interrupts(cpu_current());
+
+    set_cpu_flags(flags);
+
+    return success;
+}
+
+void kernel_lock_acquire()
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    CPU *cpu = cpu_current();
+    while (!kernel_lock_try_acquire_no_interrupts(cpu))
+    {
+        // Let interrupts in while we wait, unless we were called with them disabled.
+        set_cpu_flags(flags);
+        asm volatile("pause" ::: "memory");
+        cli();
+    }
+
+    set_cpu_flags(flags);
+}
+
+void kernel_lock_release()
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    CPU *cpu = cpu_current();
+    assert(g_kernel_lock_owner == cpu->index && cpu->kernel_lock_depth > 0);
+
+    cpu->kernel_lock_depth--;
+    if (cpu->kernel_lock_depth == 0)
+    {
+        kernel_lock_on_release(cpu);
+        __atomic_store_n(&g_kernel_lock_owner, KERNEL_LOCK_NO_OWNER, __ATOMIC_RELEASE);
+    }
+
+    set_cpu_flags(flags);
+}
+
+uint32_t kernel_lock_release_all()
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    CPU *cpu = cpu_current();
+    assert(g_kernel_lock_owner == cpu->index && cpu->kernel_lock_depth > 0);
+
+    uint32_t depth = cpu->kernel_lock_depth;
+    cpu->kernel_lock_depth = 1;
+    kernel_lock_release();
+
+    set_cpu_flags(flags);
+
+    return depth;
+}
+
+void kernel_lock_reacquire(uint32_t depth)
+{
+    assert(depth > 0);
+
+    kernel_lock_acquire();
+    cpu_current()->kernel_lock_depth = depth;
+}
+
+bool kernel_lock_is_held()
+{
+    return g_kernel_lock_owner == cpu_current()->index;
+}
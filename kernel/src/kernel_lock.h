@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The big kernel lock. The kernel was written for a single CPU, so only one
+//  CPU at a time may run kernel code; the rest run usermode, or halt.
+//
+// It's taken on every entry into the kernel (syscalls and interrupts) and
+//  released on the way back to usermode, or before halting. It's recursive,
+//  so an interrupt of kernel code on the CPU that holds it just goes deeper.
+//
+// WARNING: the holder must never wait for an interrupt (`hlt`), as the CPU that
+//  should send it may be spinning on the lock with interrupts disabled.
+//  `wait_until_a_process_is_ready` and `sleep_ms` release the lock before waiting.
+//  The BSP may `sleep_ms` while holding it, as every device interrupt is delivered to
+//  the BSP, and its timer is its own, so nothing it waits for depends on another CPU.
+
+/**
+ * @brief - Take the lock, spinning until it's free.
+ *          If the interrupts were enabled, they are enabled while spinning.
+ */
+void kernel_lock_acquire();
+
+/**
+ * @brief - Take the lock if it's free, or if we are already holding it.
+ *
+ * @return - true if the lock was taken, false if another CPU is holding it.
+ */
+bool kernel_lock_try_acquire();
+
+void kernel_lock_release();
+
+/**
+ * @brief - Release the lock completely, however deep we are holding it.
+ *          Used when leaving to usermode, as the kernel stack is abandoned.
+ *
+ * @return - How deep the lock was held, to restore it with `kernel_lock_reacquire`.
+ */
+uint32_t kernel_lock_release_all();
+
+/**
+ * @brief - Take the lock back after `kernel_lock_release_all`, at the depth it was held.
+ */
+void kernel_lock_reacquire(uint32_t depth);
+
+bool kernel_lock_is_held();
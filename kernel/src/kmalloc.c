@@ -167,7 +167,54 @@ typedef malloc_chunk malloc_bin;
    128) - 1)
 
 
+/* Tcache
+ * ------
+ * Recently freed small chunks are cached in the tcache, and checked before
+ * anything else. Each tcache bin is a singly linked list of up to
+ * `tcache_count` chunks of a single size, from MIN_CHUNK_SIZE up to
+ * TCACHE_MAX_CHUNK_SIZE. Chunks in the tcache are still marked in use, so they
+ * are never consolidated, and both putting and taking one is a list push/pop.
+ *
+ * Fastbins
+ * --------
+ * Small chunks freed when their tcache bin is full go to a fastbin. Like the
+ * tcache bins, each fastbin is a singly linked list of chunks of a single size
+ * which are still marked in use. That is, consolidating them with their
+ * neighbours is deferred until `malloc_consolidate`, which is called when a
+ * large chunk is requested or freed, or before growing the heap.
+ *
+ * The links of both are stored protected (@see TCACHE_PTR_PROTECT), so a
+ * corrupted link (say, by a use after free) is caught rather than followed.
+ */
+
+#define TCACHE_BIN_COUNT        64
+#define TCACHE_FILL_COUNT       7 // The default max amount of chunks in a tcache bin
+#define TCACHE_MAX_CHUNK_SIZE   (MIN_CHUNK_SIZE + (TCACHE_BIN_COUNT - 1) * CHUNK_SIZE_ALIGN)
+#define tcache_index(chunk_size) (((size_t)(chunk_size) - MIN_CHUNK_SIZE) / CHUNK_SIZE_ALIGN)
+
+#define FASTBIN_COUNT           7
+#define MAX_FAST_CHUNK_SIZE     (MIN_CHUNK_SIZE + (FASTBIN_COUNT - 1) * CHUNK_SIZE_ALIGN) // 0x80
+#define fastbin_index(chunk_size) (((size_t)(chunk_size) - MIN_CHUNK_SIZE) / CHUNK_SIZE_ALIGN)
+
+#define FASTBIN_CONSOLIDATION_THRESHOLD 0x10000 // Freeing a chunk at least this large consolidates the fastbins
+
 #define TCACHE_PTR_PROTECT(location, ptr) (((uint64_t)(location) >> 12) ^ (uint64_t)(ptr))
+#define TCACHE_PTR_REVEAL(location) ((void *)TCACHE_PTR_PROTECT((location), *(location)))
+
+// Put in the `key` of chunks in the tcache, to detect double frees.
+#define TCACHE_KEY 0x7463616368656b79
+
+typedef struct tcache_entry
+{
+    struct tcache_entry *next; // Protected
+    uint64_t key; // TCACHE_KEY while in the tcache
+} tcache_entry;
+
+typedef struct
+{
+    uint16_t counts[TCACHE_BIN_COUNT];
+    tcache_entry *entries[TCACHE_BIN_COUNT];
+} tcache_state;
 
 struct malloc_state
 {
@@ -177,6 +224,18 @@ struct malloc_state
         malloc_chunk *fd;
         malloc_chunk *bk;
     } bins[BIN_COUNT];
+
+    malloc_chunk *fastbins[FASTBIN_COUNT]; // Linked by `fd`, protected.
+    bool has_fast_chunks;
+};
+
+static struct
+{
+    size_t tcache_count; // The max amount of chunks in a tcache bin
+    size_t max_fast; // The largest chunk put in a fastbin, 0 for none
+} malloc_params = {
+    .tcache_count = TCACHE_FILL_COUNT,
+    .max_fast = MAX_FAST_CHUNK_SIZE,
 };
 
 /**
@@ -228,6 +287,7 @@ void bin_insert_unsorted(malloc_bin *unsorted_bin, malloc_chunk *chunk)
 
 
 static malloc_state main_arena;
+static tcache_state tcache;
 static bool is_malloc_initialized = false;
 
 static void unlink_large_chunk(malloc_chunk *chunk)
@@ -695,6 +755,186 @@ malloc_chunk *try_consolidate(malloc_chunk *chunk, malloc_state *arena)
     return chunk;
 }
 
+/**
+ * @brief - Free a chunk into the unsorted bin, consolidating it with its free
+ *              neighbours first.
+ *
+ * @param chunk - An in use chunk.
+ */
+static void free_chunk_into_bins(malloc_chunk *chunk)
+{
+    malloc_chunk *next = next_chunk(chunk);
+    next->prev_chunk_size = chunk_size(chunk);
+    next->chunk_size &= (~MALLOC_CHUNK_PREV_IN_USE);
+
+    malloc_bin *unsorted_bin = bin_at(&main_arena, 0);
+
+    chunk = try_consolidate(chunk, &main_arena);
+
+    if (chunk != main_arena.top)
+    {
+        bin_insert_unsorted(unsorted_bin, chunk);
+    }
+}
+
+static void tcache_put(malloc_chunk *chunk)
+{
+    size_t index = tcache_index(chunk_size(chunk));
+    tcache_entry *entry = chunk2addr(chunk);
+
+    entry->key = TCACHE_KEY;
+    entry->next = (tcache_entry *)TCACHE_PTR_PROTECT(&entry->next, tcache.entries[index]);
+    tcache.entries[index] = entry;
+    tcache.counts[index]++;
+}
+
+static void *tcache_get(size_t index)
+{
+    tcache_entry *entry = tcache.entries[index];
+    assert(((uint64_t)entry & (CHUNK_SIZE_ALIGN - 1)) == 0 && "unaligned tcache chunk detected");
+
+    tcache.entries[index] = TCACHE_PTR_REVEAL(&entry->next);
+    tcache.counts[index]--;
+    entry->key = 0;
+
+    return entry;
+}
+
+/**
+ * @brief - Put the given chunk in the tcache, if there's room for it in the bin
+ *              of its size.
+ *
+ * @return - Whether the chunk was put in the tcache.
+ */
+static bool tcache_try_put(malloc_chunk *chunk)
+{
+    size_t size = chunk_size(chunk);
+    if (size > TCACHE_MAX_CHUNK_SIZE)
+    {
+        return false;
+    }
+
+    size_t index = tcache_index(size);
+    tcache_entry *entry = chunk2addr(chunk);
+    if (entry->key == TCACHE_KEY)
+    {
+        // Probably a double free, but the user might have just put the key there.
+        for (tcache_entry *cur = tcache.entries[index]; cur != NULL; cur = TCACHE_PTR_REVEAL(&cur->next))
+        {
+            assert(cur != entry && "double free detected in tcache");
+        }
+    }
+
+    if (tcache.counts[index] >= malloc_params.tcache_count)
+    {
+        return false;
+    }
+
+    tcache_put(chunk);
+    return true;
+}
+
+/**
+ * @brief - Malloc from the tcache, if possible.
+ *
+ * @param victim_size The size of the **chunk** (not the user request)
+ *                        that needs allocating
+ * @return - Pointer to the allocated memory (not chunk) or NULL.
+ */
+static void *malloc_from_tcache(size_t victim_size)
+{
+    if (victim_size > TCACHE_MAX_CHUNK_SIZE)
+    {
+        return NULL;
+    }
+
+    size_t index = tcache_index(victim_size);
+    if (tcache.counts[index] == 0)
+    {
+        return NULL;
+    }
+
+    return tcache_get(index);
+}
+
+static void fastbin_push(malloc_chunk *chunk)
+{
+    malloc_chunk **fastbin = &main_arena.fastbins[fastbin_index(chunk_size(chunk))];
+    assert(*fastbin != chunk && "double free or corruption (fasttop)");
+
+    chunk->fd = (malloc_chunk *)TCACHE_PTR_PROTECT(&chunk->fd, *fastbin);
+    *fastbin = chunk;
+    main_arena.has_fast_chunks = true;
+}
+
+static malloc_chunk *fastbin_pop(size_t index)
+{
+    malloc_chunk *chunk = main_arena.fastbins[index];
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+
+    assert(((uint64_t)chunk & (CHUNK_SIZE_ALIGN - 1)) == 0 && "unaligned fastbin chunk detected");
+    assert(fastbin_index(chunk_size(chunk)) == index && "memory corruption (fast)");
+
+    main_arena.fastbins[index] = TCACHE_PTR_REVEAL(&chunk->fd);
+    return chunk;
+}
+
+/**
+ * @brief - Malloc from the fastbins, if possible. The rest of the chunks in the
+ *              fastbin are moved to the tcache, while there's room for them.
+ *
+ * @param victim_size The size of the **chunk** (not the user request)
+ *                        that needs allocating
+ * @return - Pointer to the allocated memory (not chunk) or NULL.
+ */
+static void *malloc_from_fastbin(size_t victim_size)
+{
+    if (victim_size > MAX_FAST_CHUNK_SIZE)
+    {
+        return NULL;
+    }
+
+    size_t index = fastbin_index(victim_size);
+    malloc_chunk *victim = fastbin_pop(index);
+    if (victim == NULL)
+    {
+        return NULL;
+    }
+
+    size_t tcache_bin = tcache_index(victim_size);
+    while (tcache.counts[tcache_bin] < malloc_params.tcache_count && main_arena.fastbins[index] != NULL)
+    {
+        tcache_put(fastbin_pop(index));
+    }
+
+    return chunk2addr(victim);
+}
+
+/**
+ * @brief - Free the chunks of all of the fastbins into the regular bins,
+ *              consolidating them with their free neighbours.
+ */
+static void malloc_consolidate()
+{
+    if (!main_arena.has_fast_chunks)
+    {
+        return;
+    }
+    main_arena.has_fast_chunks = false;
+
+    for (size_t i = 0; i < FASTBIN_COUNT; i++)
+    {
+        malloc_chunk *chunk;
+        while ((chunk = fastbin_pop(i)) != NULL)
+        {
+            free_chunk_into_bins(chunk);
+        }
+    }
+}
+
 /*
                    kmalloc / kfree
 */
@@ -708,12 +948,40 @@ void *kmalloc(size_t size)
 
     size_t victim_size = request_size_to_chunk_size(size);
 
-    void *victim = malloc_from_bins(victim_size);
+    void *victim = malloc_from_tcache(victim_size);
+    if (victim != NULL)
+    {
+        return victim;
+    }
+
+    victim = malloc_from_fastbin(victim_size);
+    if (victim != NULL)
+    {
+        return victim;
+    }
+
+    if (!is_small_bin_size(victim_size))
+    {
+        malloc_consolidate(); // The fast chunks might consolidate into a large enough one.
+    }
+
+    victim = malloc_from_bins(victim_size);
     if (victim != NULL)
     {
         return victim;
     }
 
+    if (main_arena.has_fast_chunks && !is_heap_big_enough_for_chunk(victim_size))
+    {
+        malloc_consolidate(); // Before growing the heap, as it might merge into top.
+
+        victim = malloc_from_bins(victim_size);
+        if (victim != NULL)
+        {
+            return victim;
+        }
+    }
+
     return malloc_from_top(victim_size);
 }
 
@@ -730,16 +998,23 @@ void kfree(void *addr)
     malloc_chunk *next = next_chunk(chunk);
     assert((next->chunk_size & MALLOC_CHUNK_PREV_IN_USE) == 1 && "next chunk doesn't think this one exists");
 
-    next->prev_chunk_size = chunk_size(chunk);
-    next->chunk_size &= (~MALLOC_CHUNK_PREV_IN_USE);
+    if (tcache_try_put(chunk))
+    {
+        return;
+    }
 
-    malloc_bin *unsorted_bin = bin_at(&main_arena, 0);
+    size_t size = chunk_size(chunk);
+    if (size <= malloc_params.max_fast)
+    {
+        fastbin_push(chunk);
+        return;
+    }
 
-    chunk = try_consolidate(chunk, &main_arena);
+    free_chunk_into_bins(chunk);
 
-    if (chunk != main_arena.top)
+    if (size >= FASTBIN_CONSOLIDATION_THRESHOLD)
     {
-        bin_insert_unsorted(unsorted_bin, chunk);
+        malloc_consolidate();
     }
 }
 
@@ -811,11 +1086,82 @@ static void *circumvent_use_after_free_compiler_check(uint64_t address)
     return (void *)new_address;
 }
 
+// Free every chunk in the tcache into the bins.
+static void tcache_flush()
+{
+    for (size_t i = 0; i < TCACHE_BIN_COUNT; i++)
+    {
+        while (tcache.counts[i] > 0)
+        {
+            free_chunk_into_bins(addr2chunk(tcache_get(i)));
+        }
+    }
+}
+
+static void test_kmalloc_tcache()
+{
+    // Freed small chunks are reused from the tcache, LIFO
+    void *addr = kmalloc(40);
+    void *addr2 = kmalloc(40);
+    const uint64_t chunk_size = chunk_size(addr2chunk(addr));
+    const uint64_t first = (uint64_t)addr;
+    const uint64_t second = (uint64_t)addr2;
+    kfree(addr);
+    kfree(addr2);
+    assert(tcache.counts[tcache_index(chunk_size)] == 2);
+    addr2 = kmalloc(40);
+    addr = kmalloc(40);
+    assert((uint64_t)addr2 == second && (uint64_t)addr == first);
+    assert(tcache.counts[tcache_index(chunk_size)] == 0);
+
+    // Once the tcache bin is full, they go to a fastbin
+    uint64_t chunks[TCACHE_FILL_COUNT + 2];
+    for (int i = 0; i < TCACHE_FILL_COUNT + 2; i++)
+    {
+        chunks[i] = (uint64_t)kmalloc(40);
+    }
+    for (int i = 0; i < TCACHE_FILL_COUNT + 2; i++)
+    {
+        kfree((void *)chunks[i]);
+    }
+    assert(tcache.counts[tcache_index(chunk_size)] == TCACHE_FILL_COUNT);
+    assert((uint64_t)main_arena.fastbins[fastbin_index(chunk_size)] == (uint64_t)addr2chunk(chunks[TCACHE_FILL_COUNT + 1]));
+
+    // Draining the tcache, then allocating from the fastbin moves the rest of it to the tcache
+    for (int i = TCACHE_FILL_COUNT - 1; i >= 0; i--)
+    {
+        assert((uint64_t)kmalloc(40) == chunks[i]);
+    }
+    assert((uint64_t)kmalloc(40) == chunks[TCACHE_FILL_COUNT + 1]);
+    assert(main_arena.fastbins[fastbin_index(chunk_size)] == NULL);
+    assert(tcache.counts[tcache_index(chunk_size)] == 1);
+    assert((uint64_t)kmalloc(40) == chunks[TCACHE_FILL_COUNT]);
+
+    // A large request consolidates the fastbins
+    for (int i = 0; i < TCACHE_FILL_COUNT + 2; i++)
+    {
+        kfree((void *)chunks[i]);
+    }
+    assert(main_arena.has_fast_chunks);
+    void *large = kmalloc(MIN_LARGE_BIN_SIZE);
+    assert(!main_arena.has_fast_chunks);
+    assert(main_arena.fastbins[fastbin_index(chunk_size)] == NULL);
+    kfree(large);
+    kfree(addr);
+    kfree(addr2);
+}
+
 void test_kmalloc()
 {
     uint64_t target = 0xdeadbeef;
     assert((uint64_t)circumvent_use_after_free_compiler_check(target) == target);
 
+    // The bins are tested on their own, without the tcache and the fastbins in front of them
+    tcache_flush();
+    malloc_consolidate();
+    malloc_params.tcache_count = 0;
+    malloc_params.max_fast = 0;
+
     // Malloc correctly gets the size
     void *addr = kmalloc(1);
     void *pad = kmalloc(1);
@@ -880,5 +1226,9 @@ void test_kmalloc()
     addr3 = kmalloc(3000);
     assert(addr3 == addr2);
     kfree(addr3);
+
+    malloc_params.tcache_count = TCACHE_FILL_COUNT;
+    malloc_params.max_fast = MAX_FAST_CHUNK_SIZE;
+    test_kmalloc_tcache();
 }
 #pragma GCC diagnostic pop
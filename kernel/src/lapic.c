@@ -0,0 +1,239 @@
+#include "lapic.h"
+#include "cpu.h"
+#include "IDT.h"
+#include "io.h"
+#include "macro_utils.h"
+#include "mmu.h"
+#include "memory.h"
+#include "pit.h"
+#include "time.h"
+#include "assert.h"
+#include <stdint.h>
+
+#define MSR_APIC_BASE 0x1b
+#define MSR_APIC_BASE_ENABLE (1 << 11)
+
+#define LAPIC_REG_ID  0x20
+#define LAPIC_REG_SPURIOUS 0xf0
+#define LAPIC_REG_ICR_LOW  0x300
+#define LAPIC_REG_ICR_HIGH 0x310
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_LVT_LINT0 0x350
+#define LAPIC_REG_LVT_LINT1 0x360
+#define LAPIC_REG_TIMER_INITIAL_COUNT 0x380
+#define LAPIC_REG_TIMER_CURRENT_COUNT 0x390
+#define LAPIC_REG_TIMER_DIVIDE 0x3e0
+
+#define LAPIC_SPURIOUS_ENABLE (1 << 8)
+
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_LVT_DELIVERY_NMI    (0b100 << 8)
+#define LAPIC_LVT_DELIVERY_EXTINT (0b111 << 8)
+
+#define LAPIC_ICR_DELIVERY_INIT    (0b101 << 8)
+#define LAPIC_ICR_DELIVERY_STARTUP (0b110 << 8)
+#define LAPIC_ICR_DELIVERY_PENDING (1 << 12)
+#define LAPIC_ICR_LEVEL_ASSERT     (1 << 14)
+
+// Destination shorthand in the ICR
+#define LAPIC_ICR_ALL_EXCLUDING_SELF (0b11 << 18)
+
+#define LAPIC_TIMER_DIVIDE_BY_16 0b0011
+#define LAPIC_TIMER_CALIBRATION_MS 40
+
+static uint64_t g_lapic_timer_ticks_per_ms; // 0 until the timer is calibrated.
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return *(volatile uint32_t *)(LAPIC_VIRT_ADDR + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t *)(LAPIC_VIRT_ADDR + reg) = value;
+}
+
+static void lapic_wait_for_delivery()
+{
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_DELIVERY_PENDING)
+    {
+        asm volatile("pause");
+    }
+}
+
+static void lapic_enable()
+{
+    lapic_write(LAPIC_REG_SPURIOUS, LAPIC_SPURIOUS_ENABLE | LAPIC_VECTOR_SPURIOUS);
+}
+
+void lapic_init_bsp()
+{
+    uint64_t apic_base = cpu_read_msr(MSR_APIC_BASE);
+    cpu_write_msr(MSR_APIC_BASE, apic_base | MSR_APIC_BASE_ENABLE);
+
+    uint64_t phys = PAGE_ALIGN_DOWN(apic_base);
+    mmu_map_range(phys, phys + PAGE_SIZE, LAPIC_VIRT_ADDR, MMU_READ_WRITE | MMU_EXECUTE_DISABLE);
+
+    // Memory mapped IO, must not be cached.
+    mmu_PageTableEntry *page = mmu_page_existing((void *)LAPIC_VIRT_ADDR);
+    page->cache_disable = 1;
+    page->write_through = 1;
+    mmu_tlb_flush((void *)LAPIC_VIRT_ADDR);
+
+    lapic_enable();
+
+    idt_register(LAPIC_VECTOR_WAKEUP, IDT_gate_type_INTERRUPT, lapic_isr_wakeup);
+    idt_register(LAPIC_VECTOR_SPURIOUS, IDT_gate_type_INTERRUPT, lapic_isr_spurious);
+
+    // Virtual wire mode: the PIC interrupts arrive as external interrupts through LINT0.
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_DELIVERY_EXTINT);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_DELIVERY_NMI);
+
+    g_cpus[0].lapic_id = lapic_id();
+}
+
+void lapic_init_ap()
+{
+    lapic_enable();
+
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_DELIVERY_NMI);
+}
+
+uint32_t lapic_id()
+{
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_send_eoi()
+{
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    lapic_wait_for_delivery();
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, vector); // Writing the low dword sends the IPI.
+}
+
+void lapic_broadcast_ipi(uint8_t vector)
+{
+    lapic_wait_for_delivery();
+    lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_EXCLUDING_SELF | vector);
+}
+
+void lapic_broadcast_init_startup(uint64_t startup_page_address)
+{
+    lapic_wait_for_delivery();
+    lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_EXCLUDING_SELF | LAPIC_ICR_LEVEL_ASSERT | LAPIC_ICR_DELIVERY_INIT);
+    lapic_wait_for_delivery();
+    sleep_ms(10);
+
+    // The vector of a STARTUP IPI is the page number the CPU starts at.
+    uint8_t vector = startup_page_address / PAGE_SIZE;
+    for (int i = 0; i < 2; i++)
+    {
+        lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_EXCLUDING_SELF | LAPIC_ICR_LEVEL_ASSERT | LAPIC_ICR_DELIVERY_STARTUP | vector);
+        lapic_wait_for_delivery();
+        sleep_ms(1); // 200 microseconds are enough, but that's our resolution.
+    }
+}
+
+static void lapic_timer_setup()
+{
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_VECTOR_TIMER); // One-shot
+}
+
+void lapic_timer_init_bsp()
+{
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    // Start counting right on a PIT tick, not somewhere in the middle of one.
+    uint64_t start_ms = pit_ms_counter();
+    while (pit_ms_counter() == start_ms)
+    {
+        asm volatile("pause");
+    }
+    start_ms = pit_ms_counter();
+
+    const uint64_t tsc_start = __builtin_ia32_rdtsc();
+    lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, UINT32_MAX);
+
+    while (pit_ms_counter() < start_ms + LAPIC_TIMER_CALIBRATION_MS)
+    {
+        asm volatile("pause");
+    }
+
+    const uint32_t lapic_ticks = UINT32_MAX - lapic_read(LAPIC_REG_TIMER_CURRENT_COUNT);
+    const uint64_t tsc_ticks = __builtin_ia32_rdtsc() - tsc_start;
+    lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, 0);
+
+    g_lapic_timer_ticks_per_ms = lapic_ticks / LAPIC_TIMER_CALIBRATION_MS;
+    assert(g_lapic_timer_ticks_per_ms > 0 && "LAPIC timer calibration failed");
+
+    pit_switch_to_tsc(tsc_ticks / LAPIC_TIMER_CALIBRATION_MS);
+
+    idt_register(LAPIC_VECTOR_TIMER, IDT_gate_type_INTERRUPT, pit_isr_lapic_timer);
+    lapic_timer_setup();
+}
+
+void lapic_timer_init_ap()
+{
+    lapic_timer_setup();
+}
+
+void lapic_timer_arm(uint64_t deadline_ms)
+{
+    if (g_lapic_timer_ticks_per_ms == 0 || deadline_ms == UINT64_MAX)
+    {
+        return;
+    }
+
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    CPU *cpu = cpu_current();
+    if (deadline_ms < cpu->tick_deadline_ms)
+    {
+        cpu->tick_deadline_ms = deadline_ms;
+
+        const uint64_t now = pit_ms_counter();
+        const uint64_t delay_ms = deadline_ms > now ? deadline_ms - now : 0;
+
+        uint64_t count = delay_ms * g_lapic_timer_ticks_per_ms;
+        if (delay_ms > UINT32_MAX / g_lapic_timer_ticks_per_ms)
+        {
+            count = UINT32_MAX; // Fires early, and is armed again.
+        }
+        if (count == 0)
+        {
+            count = 1; // 0 stops the timer
+        }
+
+        lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, count);
+    }
+
+    set_cpu_flags(flags);
+}
+
+void lapic_timer_expired()
+{
+    cpu_current()->tick_deadline_ms = UINT64_MAX;
+}
+
+void __attribute__((naked)) lapic_isr_wakeup()
+{
+    asm volatile("push rax\n"
+                 "mov rax, " STR(LAPIC_VIRT_ADDR) "\n"
+                 "mov dword ptr [rax + " STR(LAPIC_REG_EOI) "], 0\n"
+                 "pop rax\n"
+                 "iretq");
+}
+
+void __attribute__((naked)) lapic_isr_spurious()
+{
+    asm volatile("iretq");
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+// Local APIC - every CPU has one. We use it to start the application
+//  processors, to send them inter-processor interrupts (IPIs), and as the timer of every CPU.
+//  The devices are still routed through the PIC, to the BSP only.
+
+#define LAPIC_VIRT_ADDR 0xffff8000fee00000 // Virtual address of the LAPIC registers (the physical address is 0xfee00000 by default).
+
+#define LAPIC_REG_EOI 0xb0
+
+// Vectors of the interrupts the LAPIC delivers.
+#define LAPIC_VECTOR_TIMER    0xf0 // @see pit_isr_lapic_timer
+#define LAPIC_VECTOR_WAKEUP   0xf1 // @see lapic_isr_wakeup
+#define LAPIC_VECTOR_SPURIOUS 0xff
+
+/**
+ * @brief - Map the LAPIC registers and enable the LAPIC of the BSP, keeping
+ *            the PIC interrupts coming through LINT0.
+ */
+void lapic_init_bsp();
+
+/**
+ * @brief - Enable the LAPIC of the application processor we are running on.
+ *            The PIC is not connected to it, so LINT0 is masked.
+ */
+void lapic_init_ap();
+
+uint32_t lapic_id();
+
+void lapic_send_eoi();
+
+/**
+ * @brief - Send the interrupt `vector` to the CPU with the LAPIC `apic_id`.
+ */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/**
+ * @brief - Send the interrupt `vector` to every CPU but us.
+ */
+void lapic_broadcast_ipi(uint8_t vector);
+
+/**
+ * @brief - Send INIT, then twice STARTUP (INIT-SIPI-SIPI) to every CPU but us,
+ *            as described in the Intel® 64 and IA-32 Architectures Software
+ *            Developer’s Manual, Volume 3A, 9.4.4.1.
+ *
+ * @param startup_page_address - Page aligned physical address below 1 MiB,
+ *                                 where the application processors start executing in real mode.
+ */
+void lapic_broadcast_init_startup(uint64_t startup_page_address);
+
+/**
+ * @brief - Calibrate the LAPIC timer (and the TSC, @see pit_switch_to_tsc) against the PIT,
+ *            then stop the PIT; from now on, every CPU is woken by its own one-shot LAPIC timer.
+ *          Must be called on the BSP, with the interrupts enabled.
+ */
+void lapic_timer_init_bsp();
+
+/**
+ * @brief - Set up the LAPIC timer of the application processor we are running on,
+ *            with the calibration of the BSP.
+ */
+void lapic_timer_init_ap();
+
+/**
+ * @brief - Make the timer of the current CPU fire (LAPIC_VECTOR_TIMER) once pit_ms_counter() reaches `deadline_ms`.
+ *          Does nothing if it's already armed for an earlier deadline, or `deadline_ms` is UINT64_MAX.
+ *          The timer is one-shot, so it must be armed again after it fires.
+ */
+void lapic_timer_arm(uint64_t deadline_ms);
+
+/**
+ * @brief - Mark the timer of the current CPU as not armed. Called when it fires.
+ */
+void lapic_timer_expired();
+
+/**
+ * @brief - ISR of LAPIC_VECTOR_WAKEUP. Does nothing, it's sent only to wake a halted CPU.
+ */
+void __attribute__((naked)) lapic_isr_wakeup();
+
+/**
+ * @brief - ISR of LAPIC_VECTOR_SPURIOUS. Spurious interrupts must not be acknowledged with an EOI.
+ */
+void __attribute__((naked)) lapic_isr_spurious();
@@ -1,16 +1,21 @@
 #include "IDT.h"
 #include "mouse.h"
 #include "mouse_char_device.h"
+#include "pipe.h"
 #include "char_special_device.h"
 #include "mmu_config.h"
 #include "fs.h"
 #include "rtl8139.h"
 #include "scheduler.h"
 #include "syscall.h"
-#include "tss.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "vdso.h"
+#include "kernel_lock.h"
+#include "lapic.h"
+#include "smp.h"
 #include "kmalloc.h"
 #include "test.h"
-#include "gdt.h"
 #include "mmap.h"
 #include "file.h"
 #include "FAT16.h"
@@ -27,6 +32,7 @@
 #include "pit.h"
 #include "shell.h"
 #include "memory.h"
+#include "string.h"
 #include "RTC.h"
 #include "PCI.h"
 #include "assert.h"
@@ -59,7 +65,6 @@ extern char __entry_start;
 extern char __entry_end;
 
 static void init_idt();
-static void init_gdt_and_tss();
 
 
 IDEChannelRegisters channels[2];
@@ -98,6 +103,8 @@ void __attribute__((section(".entry"), sysv_abi)) kernel_main(uint32_t param_mmu
 
     init_idt();
     syscall_initialize();
+    fpu_init_bsp();
+    vdso_init();
 
     init_pic_keyboard_mouse_and_timer();
     init_drive_devices();
@@ -111,6 +118,7 @@ void __attribute__((section(".entry"), sysv_abi)) kernel_main(uint32_t param_mmu
     char_special_device_init();
     vga_char_device_init();
     mouse_char_device_init();
+    pipe_init();
 
     res rs = rtl8139_init();
     assert(IS_OK(rs) && "RTL8139 was not found");
@@ -118,8 +126,12 @@ void __attribute__((section(".entry"), sysv_abi)) kernel_main(uint32_t param_mmu
 
     usermode_init_smp();
 
+    lapic_init_bsp();
+    lapic_timer_init_bsp();
+    smp_init();
+
     io_clear_vga();
-    rs = execve("/bin/init", NULL, NULL, NULL);
+    rs = execve("/bin/init", NULL, NULL, NULL, NULL);
     assert(IS_OK(rs) && "Starting the main process failed");
 
     scheduler_start();
@@ -155,87 +167,11 @@ static void init_idt()
     asm volatile("lidt %0" : : "m"(idtd));
 }
 
-static void init_gdt_and_tss()
-{
-    static gdt_entry gdt[7] = {0}; // null segment, two ring 0 segments, two ring 3 segments, TSS segment (which takes 2 entries)
-
-    // NOTE: the order must be: Kernel Code, Kernel Data, User Data, User Code
-    //  otherwise syscall/sysret would not work.
-    //  @see 5.8.8 in the Intel® 64 and IA-32 Architectures Software Developer’s Manual, Volume 3A
-
-    // Ring 0 (aka our (kernel) segments).
-
-    // Code (ring 0)
-    gdt[1] = (gdt_entry){
-        .limit_low = 0xffff,
-        .base_low = 0,
-        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(0) | GDT_SEG_CODE_EXRD | GDT_SEG_ACCESSED,
-        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
-        .limit_high = 0xf,
-        .base_high = 0,
-    };
-
-    // Data (ring 0)
-    gdt[2] = (gdt_entry){
-        .limit_low = 0xffff,
-        .base_low = 0,
-        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(0) | GDT_SEG_DATA_RDWR | GDT_SEG_ACCESSED,
-        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
-        .limit_high = 0xf,
-        .base_high = 0,
-    };
-
-    // Data (ring 3)
-    gdt[3] = (gdt_entry){
-        .limit_low = 0xffff,
-        .base_low = 0,
-        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(3) | GDT_SEG_DATA_RDWR | GDT_SEG_ACCESSED,
-        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
-        .limit_high = 0xf,
-        .base_high = 0,
-    };
-
-    // Code (ring 3)
-    gdt[4] = (gdt_entry){
-        .limit_low = 0xffff,
-        .base_low = 0,
-        .access = GDT_SEG_PRES | GDT_SEG_DESCTYPE_NOT_SYSTEM | GDT_SEG_PRIV(3) | GDT_SEG_CODE_EXRD | GDT_SEG_ACCESSED,
-        .flags = GDT_SEG_GRAN | GDT_SEG_LONG,
-        .limit_high = 0xf,
-        .base_high = 0,
-    };
-
-    static TSS tss = {
-        .rsp0 = KERNEL_STACK_BASE,
-    };
-
-    gdt_system_segment system_segment = {
-        .limit_low = sizeof(TSS) - 1,
-
-        .type = GDT_SYS_SEG_64BIT_TSS,
-        .present = 1,
-
-        .base_low =  ((uint64_t)&tss >> 0)  & 0xffffff,
-        .base_mid =  ((uint64_t)&tss >> 24) & 0xff,
-        .base_high = ((uint64_t)&tss >> 32) & 0xffffffff,
-    };
-#define TSS_SEGMENT (5*8) // 0x28
-    memmove(&gdt[5], &system_segment, sizeof(system_segment));
-
-    gdt_descriptor gdt_desc = {
-        .size = sizeof(gdt) - 1,
-        .offset = (uint64_t)gdt,
-    };
-    asm ("lgdt %0" : : "m"(gdt_desc) : "memory");
-
-    asm ("ltr %0" : : "r"((uint16_t)TSS_SEGMENT) : "memory");
-}
-
 void init_kernel_memory(uint64_t mmu_map_base_address, range_Range *memory_map, uint64_t memory_map_length)
 {
     mmu_init_post_init(mmu_map_base_address);
 
-    init_gdt_and_tss();
+    cpu_init_gdt();
 
     mmu_unmap_bootloader();
 
@@ -261,9 +197,10 @@ void init_kernel_memory(uint64_t mmu_map_base_address, range_Range *memory_map,
 
     memset(&__bss_start, 0, (uint64_t)&__bss_end - (uint64_t)&__bss_start);
 
-#define MMU_VIRT_ADDR (void *)0xfffff00000000000
+    cpu_init_bsp();
 
-    mmu_migrate_to_virt_mem(MMU_VIRT_ADDR);
+    // Until the BSP first leaves to usermode, it's the only one running kernel code.
+    kernel_lock_acquire();
 }
 
 static void init_pic_keyboard_mouse_and_timer()
@@ -431,31 +368,73 @@ void display_boot_logo(int boot_style, const char *video_path)
     io_clear_vga();
 }
 
+#define BOOT_CONFIG_MAX_SIZE 512
+
+// Get the value of `key` in the `key=value` lines of the boot config, or NULL if it's missing.
+//  The value ends at the end of its line.
+static const char *boot_config_get(const char *config, const char *key)
+{
+    const int key_length = strlen(key);
+
+    for (const char *line = config; line != NULL; line = strchr(line, '\n'))
+    {
+        if (*line == '\n')
+        {
+            line++;
+        }
+
+        if (strncasecmp(line, key, key_length) == 0 && line[key_length] == '=')
+        {
+            return &line[key_length + 1];
+        }
+    }
+
+    return NULL;
+}
+
+static uint64_t boot_config_parse_number(const char *value)
+{
+    uint64_t number = 0;
+    for (; *value >= '0' && *value <= '9'; value++)
+    {
+        number = number * 10 + (*value - '0');
+    }
+
+    return number;
+}
+
 static void parse_boot_config_and_play_logo()
 {
     FILE file = {0};
     bool success = fat16_open(&g_fs_fat16, "/boot/conf/kernel.cfg", &file.file);
     assert(success && "fat16_open: kernel.cfg not found");
 
-    success = fseek(&file, sizeof("boot_style=") - 1, SEEK_CUR) == 0;
-    assert(success && "kernel.cfg is invalid");
-    char boot_style_char;
-    assert(fread(&boot_style_char, 1, 1, &file) == 1 && "couldn't read kernel.cfg");
+    char config[BOOT_CONFIG_MAX_SIZE + 1] = {0};
+    fread(config, 1, BOOT_CONFIG_MAX_SIZE, &file);
+
+    const char *time_slice_ms = boot_config_get(config, "time_slice_ms");
+    if (time_slice_ms != NULL)
+    {
+        uint64_t time_slice = boot_config_parse_number(time_slice_ms);
+        assert(time_slice > 0 && "kernel.cfg is invalid: time_slice_ms must be a positive number");
+        scheduler_set_time_slice_ms(time_slice);
+    }
+
+    const char *boot_style = boot_config_get(config, "boot_style");
+    assert(boot_style != NULL && "kernel.cfg is invalid");
+    char boot_style_char = *boot_style;
 
-    success = fseek(&file, sizeof("\nenable_boot_logo=") - 1, SEEK_CUR) == 0;
-    assert(success && "kernel.cfg is invalid");
-    char enable_boot_logo;
-    assert(fread(&enable_boot_logo, 1, 1, &file) == 1 && "couldn't read kernel.cfg");
+    const char *enable_boot_logo = boot_config_get(config, "enable_boot_logo");
+    assert(enable_boot_logo != NULL && "kernel.cfg is invalid");
 
-    if (enable_boot_logo != '1')
+    if (*enable_boot_logo != '1')
     {
         return;
     }
 
-    success = fseek(&file, sizeof("\nboot_video=") - 1, SEEK_CUR) == 0;
-    assert(success && "kernel.cfg is invalid");
-    char boot_video;
-    assert(fread(&boot_video, 1, 1, &file) == 1 && "couldn't read kernel.cfg");
+    const char *boot_video_value = boot_config_get(config, "boot_video");
+    assert(boot_video_value != NULL && "kernel.cfg is invalid");
+    char boot_video = *boot_video_value;
 
     const char *boot_video_path = NULL;
     switch (boot_video)
@@ -1,30 +1,181 @@
 #include "memory.h"
+#include "kmalloc.h"
+#include "io.h"
+#include "assert.h"
+#include <cpuid.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+// The kernel is built without SSE (@see fpu.h), so we copy with the string instructions.
+//  With ERMS (Enhanced REP MOVSB/STOSB), `rep movsb`/`rep stosb` are the fastest at any size,
+//  without it we move 8 bytes at a time, to an aligned destination.
+#define CPUID_EXTENDED_FEATURES_LEAF 7
+#define CPUID_EXTENDED_FEATURES_EBX_ERMS (1 << 9)
+
+#define MEMORY_QWORDS_MIN_SIZE 32 // Smaller than that, aligning the destination isn't worth it.
+
+#define MEMORY_SMALL_SIZE 32 // Up to that, the string instructions take longer to start than to just copy.
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) memory_UnalignedQword;
+typedef uint32_t __attribute__((may_alias, aligned(1))) memory_UnalignedDword;
+
+static int8_t g_memory_has_erms = -1; // Unknown until the first use.
+
+static bool memory_has_erms()
+{
+    if (g_memory_has_erms < 0)
+    {
+        uint32_t eax, ebx, ecx, edx;
+        g_memory_has_erms = __get_cpuid_max(0, NULL) >= CPUID_EXTENDED_FEATURES_LEAF &&
+                            __get_cpuid_count(CPUID_EXTENDED_FEATURES_LEAF, 0, &eax, &ebx, &ecx, &edx) &&
+                            (ebx & CPUID_EXTENDED_FEATURES_EBX_ERMS) != 0;
+    }
+
+    return g_memory_has_erms;
+}
+
+static void memory_copy_forward(uint8_t *dest, const uint8_t *src, size_t len)
+{
+    if (!memory_has_erms() && len >= MEMORY_QWORDS_MIN_SIZE)
+    {
+        size_t head = -(uint64_t)dest & 7;
+        len -= head;
+        asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(head) : : "memory");
+
+        size_t qwords = len / 8;
+        len %= 8;
+        asm volatile("rep movsq" : "+D"(dest), "+S"(src), "+c"(qwords) : : "memory");
+    }
+
+    asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(len) : : "memory");
+}
+
+// Copy up to MEMORY_SMALL_SIZE bytes with a few (possibly overlapping) loads, all done
+//  before the stores, so `dest` and `src` may overlap either way.
+static void memory_copy_small(uint8_t *dest, const uint8_t *src, size_t len)
+{
+    if (len >= 16)
+    {
+        const uint64_t a = *(const memory_UnalignedQword *)src;
+        const uint64_t b = *(const memory_UnalignedQword *)(src + 8);
+        const uint64_t c = *(const memory_UnalignedQword *)(src + len - 16);
+        const uint64_t d = *(const memory_UnalignedQword *)(src + len - 8);
+        *(memory_UnalignedQword *)dest = a;
+        *(memory_UnalignedQword *)(dest + 8) = b;
+        *(memory_UnalignedQword *)(dest + len - 16) = c;
+        *(memory_UnalignedQword *)(dest + len - 8) = d;
+    }
+    else if (len >= 8)
+    {
+        const uint64_t a = *(const memory_UnalignedQword *)src;
+        const uint64_t b = *(const memory_UnalignedQword *)(src + len - 8);
+        *(memory_UnalignedQword *)dest = a;
+        *(memory_UnalignedQword *)(dest + len - 8) = b;
+    }
+    else if (len >= 4)
+    {
+        const uint32_t a = *(const memory_UnalignedDword *)src;
+        const uint32_t b = *(const memory_UnalignedDword *)(src + len - 4);
+        *(memory_UnalignedDword *)dest = a;
+        *(memory_UnalignedDword *)(dest + len - 4) = b;
+    }
+    else if (len > 0)
+    {
+        const uint8_t a = src[0];
+        const uint8_t b = src[len / 2];
+        const uint8_t c = src[len - 1];
+        dest[0] = a;
+        dest[len / 2] = b;
+        dest[len - 1] = c;
+    }
+}
+
+// For when `dest` overlaps the end of `src`, so the end is copied first.
+static void memory_copy_backward(uint8_t *dest, const uint8_t *src, size_t len)
+{
+    // The string instructions go down while the direction flag is set. Interrupts are kept off
+    //  meanwhile, the ISRs expect it to be clear like any C code.
+    uint64_t flags;
+    asm volatile("pushfq\n"
+                 "pop %0\n"
+                 "cli\n"
+                 "std" : "=r"(flags) : : "memory", "cc");
+
+    size_t qwords = len / 8;
+    size_t head = len % 8; // Copied last
+    uint8_t *d = dest + len - 8;
+    const uint8_t *s = src + len - 8;
+    asm volatile("rep movsq" : "+D"(d), "+S"(s), "+c"(qwords) : : "memory");
+
+    d = dest + head - 1;
+    s = src + head - 1;
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(head) : : "memory");
+
+    asm volatile("push %0\n"
+                 "popfq" : : "r"(flags) : "memory", "cc"); // Clears the direction flag, and restores the interrupt flag.
+}
+
 void *memmove(void *dest, const void *src, int len)
 {
-  char *d = dest;
-  const char *s = src;
-  if (d < s)
-    while (len--)
-      *d++ = *s++;
-  else
-    {
-      const char *lasts = s + (len-1);
-      char *lastd = d + (len-1);
-      while (len--)
-        *lastd-- = *lasts--;
-    }
-  return dest;
+    if (len <= 0 || dest == src)
+    {
+        return dest;
+    }
+
+    if (len <= MEMORY_SMALL_SIZE)
+    {
+        memory_copy_small(dest, src, len);
+        return dest;
+    }
+
+    // Copying forward is safe, unless `dest` is inside `src`, past its beginning.
+    if ((uint64_t)dest - (uint64_t)src >= (uint64_t)len)
+    {
+        memory_copy_forward(dest, src, len);
+    }
+    else
+    {
+        memory_copy_backward(dest, src, len);
+    }
+
+    return dest;
 }
 
+void memcpy_nontemporal(void *dest_in, const void *src_in, size_t len)
+{
+    uint8_t *dest = dest_in;
+    const uint8_t *src = src_in;
+
+    size_t head = MIN(-(uint64_t)dest & 7, len);
+    len -= head;
+    asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(head) : : "memory");
+
+    for (; len >= 8; len -= 8, dest += 8, src += 8)
+    {
+        asm volatile("movnti %0, %1" : "=m"(*(uint64_t *)dest) : "r"(*(const memory_UnalignedQword *)src));
+    }
+    asm volatile("sfence" : : : "memory"); // The non-temporal stores are weakly ordered.
+
+    asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(len) : : "memory");
+}
 
 int memcmp(const void *ptr1, const void *ptr2, size_t num)
 {
     const unsigned char *p1 = (const unsigned char *)ptr1;
     const unsigned char *p2 = (const unsigned char *)ptr2;
 
+    // 8 bytes at a time, until the ones that differ.
+    for (; num >= 8; num -= 8, p1 += 8, p2 += 8)
+    {
+        const uint64_t difference = *(const memory_UnalignedQword *)p1 ^ *(const memory_UnalignedQword *)p2;
+        if (difference != 0)
+        {
+            const size_t i = __builtin_ctzll(difference) / 8; // Little endian, the lowest byte is first.
+            return p1[i] - p2[i];
+        }
+    }
+
     for (size_t i = 0; i < num; i++)
     {
         if (p1[i] != p2[i])
@@ -37,10 +188,57 @@ int memcmp(const void *ptr1, const void *ptr2, size_t num)
 
 void *memset(void *dest, int val, int len)
 {
-  unsigned char *ptr = dest;
-  while (len-- > 0)
-    *ptr++ = val;
-  return dest;
+    if (len <= 0)
+    {
+        return dest;
+    }
+
+    uint8_t *d = dest;
+    size_t n = len;
+
+    if (n <= MEMORY_SMALL_SIZE)
+    {
+        // A few (possibly overlapping) stores.
+        const uint64_t qword = 0x0101010101010101 * (uint8_t)val;
+        if (n >= 16)
+        {
+            *(memory_UnalignedQword *)d = qword;
+            *(memory_UnalignedQword *)(d + 8) = qword;
+            *(memory_UnalignedQword *)(d + n - 16) = qword;
+            *(memory_UnalignedQword *)(d + n - 8) = qword;
+        }
+        else if (n >= 8)
+        {
+            *(memory_UnalignedQword *)d = qword;
+            *(memory_UnalignedQword *)(d + n - 8) = qword;
+        }
+        else if (n >= 4)
+        {
+            *(memory_UnalignedDword *)d = qword;
+            *(memory_UnalignedDword *)(d + n - 4) = qword;
+        }
+        else
+        {
+            d[0] = val;
+            d[n / 2] = val;
+            d[n - 1] = val;
+        }
+        return dest;
+    }
+
+    if (!memory_has_erms() && n >= MEMORY_QWORDS_MIN_SIZE)
+    {
+        size_t head = -(uint64_t)d & 7;
+        n -= head;
+        asm volatile("rep stosb" : "+D"(d), "+c"(head) : "a"(val) : "memory");
+
+        size_t qwords = n / 8;
+        n %= 8;
+        asm volatile("rep stosq" : "+D"(d), "+c"(qwords) : "a"(0x0101010101010101 * (uint8_t)val) : "memory");
+    }
+
+    asm volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+    return dest;
 }
 
 void *memchr(const void *s_in, int c_in, size_t n)
@@ -78,3 +276,117 @@ void *memrchr(const void *s_in, int c_in, size_t n)
 
     return NULL;
 }
+
+// The byte at a time versions, to check and compare against.
+__attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+static void test_memory_reference_move(uint8_t *dest, const uint8_t *src, size_t len)
+{
+    if (dest < src)
+    {
+        for (size_t i = 0; i < len; i++) dest[i] = src[i];
+    }
+    else
+    {
+        for (size_t i = len; i > 0; i--) dest[i - 1] = src[i - 1];
+    }
+}
+
+__attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+static void test_memory_reference_set(uint8_t *dest, uint8_t val, size_t len)
+{
+    for (size_t i = 0; i < len; i++) dest[i] = val;
+}
+
+__attribute__((noinline))
+static int test_memory_reference_compare(const uint8_t *p1, const uint8_t *p2, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (p1[i] != p2[i]) return p1[i] - p2[i];
+    }
+    return 0;
+}
+
+static void test_memory_fill(uint8_t *buffer, size_t len, uint8_t seed)
+{
+    for (size_t i = 0; i < len; i++) buffer[i] = (uint8_t)(i * 131 + seed);
+}
+
+#define TEST_MEMORY_BENCH_SIZE (64 * 1024)
+#define TEST_MEMORY_BENCH_ROUNDS 8
+
+static volatile int g_test_memory_sink; // So the compared results aren't optimized away.
+
+#define TEST_MEMORY_BENCH(name, size, call, reference_name, reference_call)                             \
+    do {                                                                                                 \
+        uint64_t start = __builtin_ia32_rdtsc();                                                         \
+        for (int round = 0; round < TEST_MEMORY_BENCH_ROUNDS; round++) { call; }                         \
+        const uint64_t tuned = (__builtin_ia32_rdtsc() - start) / TEST_MEMORY_BENCH_ROUNDS;              \
+        start = __builtin_ia32_rdtsc();                                                                  \
+        for (int round = 0; round < TEST_MEMORY_BENCH_ROUNDS; round++) { reference_call; }               \
+        const uint64_t reference = (__builtin_ia32_rdtsc() - start) / TEST_MEMORY_BENCH_ROUNDS;          \
+        printf("%s of %lld bytes: %lld cycles, %lld with %s\n", name, (long long)(size),                   \
+               (long long)tuned, (long long)reference, reference_name);                                  \
+    } while (0)
+
+void test_memory()
+{
+    uint8_t *buffer = kmalloc(TEST_MEMORY_BENCH_SIZE * 2);
+    uint8_t *expected = kmalloc(TEST_MEMORY_BENCH_SIZE * 2);
+    assert(buffer != NULL && expected != NULL);
+
+    // Every small size, at every alignment, forward and backward (overlapping both ways)
+    for (size_t len = 0; len < 80; len++)
+    {
+        for (size_t src = 0; src < 16; src++)
+        {
+            for (size_t dest = 0; dest < 16; dest++)
+            {
+                test_memory_fill(buffer, 128, len);
+                test_memory_fill(expected, 128, len);
+                memmove(buffer + dest, buffer + src, len);
+                test_memory_reference_move(expected + dest, expected + src, len);
+                assert(test_memory_reference_compare(buffer, expected, 128) == 0);
+
+                memset(buffer + dest, src, len);
+                test_memory_reference_set(expected + dest, src, len);
+                assert(test_memory_reference_compare(buffer, expected, 128) == 0);
+            }
+
+            // Differing at every position, the first difference decides.
+            test_memory_fill(buffer, 128, 0);
+            test_memory_fill(expected, 128, 0);
+            assert(memcmp(buffer + src, expected + src, len) == 0);
+            if (len > 0)
+            {
+                expected[src + len - 1] += 1;
+                expected[src + len / 2] -= 1;
+                assert(memcmp(buffer + src, expected + src, len) == test_memory_reference_compare(buffer + src, expected + src, len));
+            }
+        }
+    }
+
+    test_memory_fill(buffer, TEST_MEMORY_BENCH_SIZE * 2, 0);
+    memcpy_nontemporal(expected + 3, buffer, TEST_MEMORY_BENCH_SIZE);
+    assert(memcmp(expected + 3, buffer, TEST_MEMORY_BENCH_SIZE) == 0);
+
+    uint8_t *src = buffer;
+    uint8_t *dest = buffer + TEST_MEMORY_BENCH_SIZE;
+    const size_t sizes[] = {64, 4096, TEST_MEMORY_BENCH_SIZE};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        const size_t size = sizes[i];
+        TEST_MEMORY_BENCH("memmove", size, memmove(dest, src, size),
+                          "a byte loop", test_memory_reference_move(dest, src, size));
+        TEST_MEMORY_BENCH("memset", size, memset(dest, round, size),
+                          "a byte loop", test_memory_reference_set(dest, round, size));
+        memmove(dest, src, size);
+        TEST_MEMORY_BENCH("memcmp", size, g_test_memory_sink = memcmp(dest, src, size),
+                          "a byte loop", g_test_memory_sink = test_memory_reference_compare(dest, src, size));
+    }
+    TEST_MEMORY_BENCH("memcpy_nontemporal", TEST_MEMORY_BENCH_SIZE, memcpy_nontemporal(dest, src, TEST_MEMORY_BENCH_SIZE),
+                      "memmove", memmove(dest, src, TEST_MEMORY_BENCH_SIZE));
+
+    kfree(buffer);
+    kfree(expected);
+}
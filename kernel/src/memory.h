@@ -14,6 +14,14 @@ void *memset(void *dest, int val, int len);
 void *memchr(const void *s, int c, size_t n);
 void *memrchr(const void *s, int c, size_t n);
 
+/**
+ * @brief - Copy with non-temporal stores, which bypass the caches. For copies to memory
+ *            the CPU won't read back soon, like the framebuffer. `dest` and `src` must not overlap.
+ */
+void memcpy_nontemporal(void *dest, const void *src, size_t len);
+
+void test_memory();
+
 __attribute__((always_inline))
 static inline uint8_t mem_bit_test_set(volatile uint32_t *val, int bit) // NOLINT: ignore false positive on `val` being a non-const pointer
 {
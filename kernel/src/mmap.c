@@ -1,4 +1,5 @@
 #include "kernel_memory_info.h"
+#include "cpu.h"
 #include "io.h"
 #include "memory.h"
 #include "mmap.h"
@@ -7,56 +8,506 @@
 #include "mmu.h"
 #include "math.h"
 #include "res.h"
+#include "smp.h"
 
 #define PAGE_SIZE 0x1000
 #define PAGE_ALIGN_UP(address)   math_ALIGN_UP(address, PAGE_SIZE)
 #define PAGE_ALIGN_DOWN(address) math_ALIGN_DOWN(address, PAGE_SIZE)
 
 #define MEMORY_MAP_MAX_LENGTH (0x1000 / sizeof(range_Range)) // NOTE: this has to be synced with the define in the bootloader (same macro name).
-struct {
-    range_Range *base;
-    uint64_t length;
-} g_phys_memory_map = {0}; // Init with 0 so it's placed in .data and not in .bss
+
+// The free physical pages are managed by a buddy allocator: every free block is 2^order
+//  pages, aligned to its size, in the free list of its order. A freed block is merged
+//  with its buddy (the other half of the block twice its size) while the buddy is free too.
+#define MMAP_MAX_ORDER 10 // Blocks of up to 4 MiB.
+#define MMAP_ORDER_COUNT (MMAP_MAX_ORDER + 1)
+#define MMAP_NO_FRAME UINT32_MAX
+
+// Every physical page of the RAM we manage.
+typedef struct {
+    uint32_t next; // The free list links, if it's the first page of a free block.
+    uint32_t prev;
+    uint16_t extra_references; // Beyond the first. Only pages shared copy-on-write (or shared memory) have more than one.
+    uint8_t order; // Of the free block, if it's the first page of one.
+    bool is_free; // Set only on the first page of a free block.
+} PageFrame;
+
+// NOTE: all of these are set by mmap_init, before the kernel bss is mapped (and zeroed), so they are
+//  initialized with 0 to be placed in .data and not in .bss.
+static PageFrame *g_frames = 0; // NULL until the buddy allocator is initialized.
+static uint64_t g_page_count = 0; // Pages from this one on are not in the RAM we manage, and always have a single reference.
+static uint32_t g_free_lists[MMAP_ORDER_COUNT] = {0};
+static uint64_t g_free_page_count = 0; // In the free lists, not counting the hot pages.
+
+// The memory map from the bootloader. Used only to allocate the frames, then handed to the buddy allocator.
+static range_Range *g_boot_memory_map = 0;
+static uint64_t g_boot_memory_map_length = 0;
+
+static uint8_t floor_log2(uint64_t value)
+{
+    return 63 - __builtin_clzll(value);
+}
+
+static uint8_t ceil_log2(uint64_t value)
+{
+    return value <= 1 ? 0 : floor_log2(value - 1) + 1;
+}
+
+static void buddy_list_push(uint64_t index, uint8_t order)
+{
+    PageFrame *frame = &g_frames[index];
+    frame->order = order;
+    frame->is_free = true;
+    frame->prev = MMAP_NO_FRAME;
+    frame->next = g_free_lists[order];
+
+    if (frame->next != MMAP_NO_FRAME)
+    {
+        g_frames[frame->next].prev = index;
+    }
+    g_free_lists[order] = index;
+}
+
+static void buddy_list_remove(uint64_t index)
+{
+    PageFrame *frame = &g_frames[index];
+    assert(frame->is_free);
+
+    if (frame->prev != MMAP_NO_FRAME)
+    {
+        g_frames[frame->prev].next = frame->next;
+    }
+    else
+    {
+        g_free_lists[frame->order] = frame->next;
+    }
+
+    if (frame->next != MMAP_NO_FRAME)
+    {
+        g_frames[frame->next].prev = frame->prev;
+    }
+
+    frame->is_free = false;
+}
+
+static void buddy_free_block(uint64_t index, uint8_t order)
+{
+    assert(!g_frames[index].is_free && "Double free of a physical page");
+    g_free_page_count += 1ull << order;
+
+    while (order < MMAP_MAX_ORDER)
+    {
+        const uint64_t buddy = index ^ (1ull << order);
+        if (buddy >= g_page_count || !g_frames[buddy].is_free || g_frames[buddy].order != order)
+        {
+            break;
+        }
+
+        buddy_list_remove(buddy);
+        index &= ~(1ull << order);
+        order++;
+    }
+
+    buddy_list_push(index, order);
+}
+
+/**
+ * @brief - Free `count` pages from the page `index` on, in the largest aligned blocks they can make.
+ *          Pages that are not in the RAM we manage are ignored.
+ */
+static void buddy_free_range(uint64_t index, uint64_t count)
+{
+    if (index >= g_page_count)
+    {
+        return;
+    }
+    count = MIN(count, g_page_count - index);
+
+    while (count > 0)
+    {
+        uint8_t order = MIN(MMAP_MAX_ORDER, floor_log2(count));
+        while (index & ((1ull << order) - 1))
+        {
+            order--;
+        }
+
+        buddy_free_block(index, order);
+        index += 1ull << order;
+        count -= 1ull << order;
+    }
+}
+
+static bool buddy_allocate_block(uint8_t order, uint64_t *out_index)
+{
+    uint8_t found = order;
+    while (found <= MMAP_MAX_ORDER && g_free_lists[found] == MMAP_NO_FRAME)
+    {
+        found++;
+    }
+
+    if (found > MMAP_MAX_ORDER)
+    {
+        return false;
+    }
+
+    const uint64_t index = g_free_lists[found];
+    buddy_list_remove(index);
+
+    // Split it, giving back the upper halves.
+    while (found > order)
+    {
+        found--;
+        buddy_list_push(index + (1ull << found), found);
+    }
+
+    g_free_page_count -= 1ull << order;
+    *out_index = index;
+    return true;
+}
+
+// Allocate exactly `count` contiguous pages: the smallest block that fits, without its tail.
+static bool buddy_allocate(uint64_t count, uint64_t *out_index)
+{
+    const uint8_t order = ceil_log2(count);
+    if (order > MMAP_MAX_ORDER || !buddy_allocate_block(order, out_index))
+    {
+        return false;
+    }
+
+    buddy_free_range(*out_index + count, (1ull << order) - count);
+    return true;
+}
+
+// Find the free block the page `index` is in. Returns false if it's not free.
+static bool buddy_find_free_block(uint64_t index, uint64_t *out_head)
+{
+    for (uint8_t order = 0; order <= MMAP_MAX_ORDER; order++)
+    {
+        const uint64_t head = index & ~((1ull << order) - 1);
+        if (g_frames[head].is_free && index - head < (1ull << g_frames[head].order))
+        {
+            *out_head = head;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool buddy_is_range_free(uint64_t index, uint64_t count)
+{
+    if (index + count > g_page_count)
+    {
+        return false;
+    }
+
+    uint64_t head;
+    for (uint64_t i = index; i < index + count; i++)
+    {
+        if (!buddy_find_free_block(i, &head))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Take the free page `index` out of the block it's in.
+static void buddy_claim_page(uint64_t index)
+{
+    uint64_t head;
+    bool found = buddy_find_free_block(index, &head);
+    assert(found);
+
+    uint8_t order = g_frames[head].order;
+    buddy_list_remove(head);
+
+    // Give back every half the page is not in.
+    while (order > 0)
+    {
+        order--;
+        const uint64_t half = 1ull << order;
+        if (index < head + half)
+        {
+            buddy_list_push(head + half, order);
+        }
+        else
+        {
+            buddy_list_push(head, order);
+            head += half;
+        }
+    }
+
+    g_free_page_count--;
+}
+
+// The hot pages of the current CPU. NULL until the CPUs are initialized.
+static mmap_HotPages *mmap_hot_pages()
+{
+    return cpu_count() > 0 ? &cpu_current()->hot_pages : NULL;
+}
+
+static void mmap_hot_pages_drain(mmap_HotPages *hot)
+{
+    for (uint32_t i = 0; i < hot->count; i++)
+    {
+        buddy_free_block(hot->pages[i] / PAGE_SIZE, 0);
+    }
+    hot->count = 0;
+}
+
+static void mmap_hot_pages_drain_all()
+{
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        mmap_hot_pages_drain(&g_cpus[i].hot_pages);
+    }
+}
+
+// Allocate a single page, the most recently freed on this CPU if there's one (it's likely still in the caches).
+static bool mmap_allocate_page(uint64_t *out_phys)
+{
+    assert(g_frames != NULL);
+
+    uint64_t index;
+    mmap_HotPages *hot = mmap_hot_pages();
+    if (hot == NULL)
+    {
+        if (!buddy_allocate_block(0, &index))
+        {
+            return false;
+        }
+
+        *out_phys = index * PAGE_SIZE;
+        return true;
+    }
+
+    while (hot->count < MMAP_HOT_PAGES_BATCH && buddy_allocate_block(0, &index))
+    {
+        hot->pages[hot->count++] = index * PAGE_SIZE;
+    }
+
+    if (hot->count == 0)
+    {
+        return false;
+    }
+
+    *out_phys = hot->pages[--hot->count];
+    return true;
+}
+
+static void mmap_free_page(uint64_t phys)
+{
+    assert(g_frames != NULL);
+
+    const uint64_t index = phys / PAGE_SIZE;
+    if (index >= g_page_count)
+    {
+        return; // Not in the RAM we manage.
+    }
+
+    mmap_HotPages *hot = mmap_hot_pages();
+    if (hot == NULL)
+    {
+        buddy_free_block(index, 0);
+        return;
+    }
+
+    if (hot->count == MMAP_HOT_PAGES_CAPACITY)
+    {
+        // Give the coldest back.
+        for (uint32_t i = 0; i < MMAP_HOT_PAGES_BATCH; i++)
+        {
+            buddy_free_block(hot->pages[i] / PAGE_SIZE, 0);
+        }
+        memmove(hot->pages, hot->pages + MMAP_HOT_PAGES_BATCH, (MMAP_HOT_PAGES_CAPACITY - MMAP_HOT_PAGES_BATCH) * sizeof(*hot->pages));
+        hot->count -= MMAP_HOT_PAGES_BATCH;
+    }
+
+    hot->pages[hot->count++] = phys;
+}
+
+static void mmap_frames_init()
+{
+    g_boot_memory_map_length = range_defragment(g_boot_memory_map, g_boot_memory_map_length);
+
+    uint64_t phys_end = 0;
+    for (uint64_t i = 0; i < g_boot_memory_map_length; i++)
+    {
+        const range_Range *range = &g_boot_memory_map[i];
+        phys_end = MAX(phys_end, range->begin + range->size);
+    }
+
+    g_page_count = phys_end / PAGE_SIZE;
+    assert(g_page_count < MMAP_NO_FRAME && "Too much RAM for the page frames");
+    const uint64_t size = PAGE_ALIGN_UP(g_page_count * sizeof(*g_frames));
+
+    // Allocated from the boot memory map, as there are no frames yet.
+    res rs = mmap((void *)KERNEL_PAGE_FRAMES, size, MMAP_PROT_READ | MMAP_PROT_WRITE);
+    assert(IS_OK(rs) && "No memory for the page frames");
+    memset((void *)KERNEL_PAGE_FRAMES, 0, size);
+
+    for (uint8_t order = 0; order <= MMAP_MAX_ORDER; order++)
+    {
+        g_free_lists[order] = MMAP_NO_FRAME;
+    }
+    g_frames = (void *)KERNEL_PAGE_FRAMES;
+
+    for (uint64_t i = 0; i < g_boot_memory_map_length; i++)
+    {
+        const range_Range *range = &g_boot_memory_map[i];
+        const uint64_t begin = PAGE_ALIGN_UP(range->begin);
+        const uint64_t end = PAGE_ALIGN_DOWN(range->begin + range->size);
+        if (begin < end)
+        {
+            buddy_free_range(begin / PAGE_SIZE, (end - begin) / PAGE_SIZE);
+        }
+    }
+
+    g_boot_memory_map = NULL;
+    g_boot_memory_map_length = 0;
+}
+
+// Take [begin, begin + size) out of the boot memory map, so it's never allocated.
+static void mmap_boot_memory_map_remove(uint64_t begin, uint64_t size)
+{
+    const uint64_t end = begin + size;
+    const uint64_t length = g_boot_memory_map_length;
+    for (uint64_t i = 0; i < length; i++)
+    {
+        range_Range *range = &g_boot_memory_map[i];
+        const uint64_t range_end = range->begin + range->size;
+        if (range_end <= begin || range->begin >= end)
+        {
+            continue;
+        }
+
+        if (range_end > end)
+        {
+            assert(g_boot_memory_map_length < MEMORY_MAP_MAX_LENGTH && "No room to split the memory map");
+            g_boot_memory_map[g_boot_memory_map_length++] = (range_Range){.begin = end, .size = range_end - end};
+        }
+        range->size = range->begin < begin ? begin - range->begin : 0; // Empty ranges are dropped by range_defragment
+    }
+}
 
 void mmap_init(range_Range *mmap_base, uint64_t length)
 {
     assert(length <= MEMORY_MAP_MAX_LENGTH && "length larger than one page is not supported\n");
-    g_phys_memory_map.base = mmap_base;
-    g_phys_memory_map.length = length;
+    g_boot_memory_map = mmap_base;
+    g_boot_memory_map_length = length;
 
-    res rs = mmap((void *)KERNEL_MEMORY_MAP, PAGE_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE);
-    assert(IS_OK(rs));
+    // The page must be free when the APs are started, long after the first allocations. @see smp_init
+    mmap_boot_memory_map_remove(SMP_TRAMPOLINE_PHYS, PAGE_SIZE);
 
-    memmove((void *)KERNEL_MEMORY_MAP, mmap_base, length * sizeof(range_Range));
-    g_phys_memory_map.base = (void *)KERNEL_MEMORY_MAP;
+    mmap_frames_init();
+
+    // The page tables are allocated like any other page from now on.
+    mmu_init_direct_map(KERNEL_DIRECT_MAP, g_page_count * PAGE_SIZE, mmap_allocate_page, mmap_free_page);
 
     munmap(mmap_base, PAGE_SIZE);
 }
 
-// WARNING: this invalidates all g_phys_memory_map.base iterators and moves indexes
+// Free the pages of `range`, a single page to the hot pages of the CPU.
+static void mmap_phys_memory_free(const range_Range *range)
+{
+    if (range->size == PAGE_SIZE)
+    {
+        mmap_free_page(range->begin);
+    }
+    else
+    {
+        buddy_free_range(range->begin / PAGE_SIZE, range->size / PAGE_SIZE);
+    }
+}
+
 void mmap_phys_memory_add(const range_Range *range)
 {
-    uint64_t *const len = &g_phys_memory_map.length;
-    range_Range *const base = g_phys_memory_map.base;
+    assert(g_frames != NULL);
+    assert(range->begin % PAGE_SIZE == 0 && range->size % PAGE_SIZE == 0);
+
+    buddy_free_range(range->begin / PAGE_SIZE, range->size / PAGE_SIZE);
+}
 
-    assert(!(*len > MEMORY_MAP_MAX_LENGTH) && "How did len become larger than allowed?");
-    if (*len == MEMORY_MAP_MAX_LENGTH)
+void mmap_phys_page_ref(uint64_t phys)
+{
+    const uint64_t index = phys / PAGE_SIZE;
+    assert(index < g_page_count && "Only RAM pages can be shared");
+    assert(g_frames[index].extra_references < UINT16_MAX && "Too many references to a page");
+
+    g_frames[index].extra_references++;
+}
+
+// Returns true if it was the last reference, and the page should be freed.
+static bool mmap_phys_page_drop_reference(uint64_t phys)
+{
+    const uint64_t index = phys / PAGE_SIZE;
+    if (g_frames == NULL || index >= g_page_count || g_frames[index].extra_references == 0)
     {
-        *len = range_defragment(base, *len);
+        return true;
     }
 
-    assert(*len < MEMORY_MAP_MAX_LENGTH && "Ran out of memory for the physical memory map. Dynamic memory map is unsupported"); // TODO: support resizing the memory map
+    g_frames[index].extra_references--;
+    return false;
+}
 
-    base[*len] = *range;
-    (*len)++;
+void mmap_phys_page_unref(uint64_t phys)
+{
+    if (mmap_phys_page_drop_reference(phys))
+    {
+        mmap_free_page(phys);
+    }
+}
+
+bool mmap_phys_page_is_shared(uint64_t phys)
+{
+    const uint64_t index = phys / PAGE_SIZE;
+    return index < g_page_count && g_frames[index].extra_references != 0;
 }
 
 bool mmap_allocate_contiguous(uint64_t want_size, uint64_t *out_result)
 {
-    assert(g_phys_memory_map.base);
+    assert(g_frames != NULL);
+    assert(want_size % PAGE_SIZE == 0 && want_size != 0);
+
+    if (want_size == PAGE_SIZE)
+    {
+        return mmap_allocate_page(out_result);
+    }
 
-    return range_pop_of_size(g_phys_memory_map.base, g_phys_memory_map.length,
-                                     want_size, out_result);
+    uint64_t index;
+    if (!buddy_allocate(want_size / PAGE_SIZE, &index))
+    {
+        return false;
+    }
+
+    *out_result = index * PAGE_SIZE;
+    return true;
+}
+
+bool mmap_phys_memory_claim(uint64_t begin, uint64_t size)
+{
+    assert(g_frames != NULL);
+
+    const uint64_t index = begin / PAGE_SIZE;
+    const uint64_t count = size / PAGE_SIZE;
+    if (!buddy_is_range_free(index, count))
+    {
+        // Might be one of the hot pages.
+        mmap_hot_pages_drain_all();
+        if (!buddy_is_range_free(index, count))
+        {
+            return false;
+        }
+    }
+
+    for (uint64_t i = index; i < index + count; i++)
+    {
+        buddy_claim_page(i);
+    }
+
+    return true;
 }
 
 /**
@@ -75,10 +526,43 @@ bool mmap_allocate_contiguous(uint64_t want_size, uint64_t *out_result)
  */
 bool allocate_physical_memory(uint64_t want_size, uint64_t *out_result, uint64_t *out_result_size)
 {
-    assert(g_phys_memory_map.base);
+    if (g_frames == NULL)
+    {
+        assert(g_boot_memory_map != NULL);
+        return range_pop_of_size_or_less(g_boot_memory_map, g_boot_memory_map_length,
+                                         want_size, out_result, out_result_size);
+    }
+
+    const uint64_t pages = want_size / PAGE_SIZE;
+    if (pages == 1)
+    {
+        *out_result_size = PAGE_SIZE;
+        return mmap_allocate_page(out_result);
+    }
+
+    // The largest block that isn't larger than wanted. Smaller ones are taken only once there are no larger ones.
+    int highest = MMAP_MAX_ORDER;
+    while (highest >= 0 && g_free_lists[highest] == MMAP_NO_FRAME)
+    {
+        highest--;
+    }
+
+    if (highest < 0)
+    {
+        // There might be hot pages left.
+        *out_result_size = PAGE_SIZE;
+        return mmap_allocate_page(out_result);
+    }
+
+    const uint8_t order = MIN(floor_log2(pages), (uint8_t)highest);
 
-    return range_pop_of_size_or_less(g_phys_memory_map.base, g_phys_memory_map.length,
-                                     want_size, out_result, out_result_size);
+    uint64_t index;
+    bool success = buddy_allocate_block(order, &index);
+    assert(success);
+
+    *out_result = index * PAGE_SIZE;
+    *out_result_size = PAGE_SIZE << order;
+    return true;
 }
 
 int prot_to_mmu_flags(mmap_Protection prot)
@@ -94,7 +578,6 @@ int prot_to_mmu_flags(mmap_Protection prot)
 
 res mmap(void *addr, size_t size, mmap_Protection prot)
 {
-    assert(g_phys_memory_map.base);
     assert(((uint64_t)addr & 0xfff) == 0 && "addr must be page aligned");
 
     if ((prot & MMAP_PROT_READ) == 0) return res_mmap_MUST_BE_READABLE;
@@ -125,6 +608,66 @@ res mmap(void *addr, size_t size, mmap_Protection prot)
     return res_OK;
 }
 
+res mmap_lazy(void *addr, size_t size, mmap_Protection prot)
+{
+    assert(((uint64_t)addr & 0xfff) == 0 && "addr must be page aligned");
+
+    if ((prot & MMAP_PROT_READ) == 0) return res_mmap_MUST_BE_READABLE;
+    const int mmu_flags = prot_to_mmu_flags(prot);
+
+    if (size == 0) return res_mmap_INVALID_SIZE;
+
+    for (uint64_t it = (uint64_t)addr; it < (uint64_t)addr + size; it += PAGE_SIZE)
+    {
+        mmu_PageTableEntry *page = mmu_page(it);
+        if (page->present)
+        {
+            continue; // Already backed, e.g. a page shared by two ELF segments.
+        }
+
+        *page = (mmu_PageTableEntry){.demand = 1};
+        mmu_page_entry_set_flags(page, mmu_flags);
+    }
+
+    return res_OK;
+}
+
+bool mmap_allocate_zeroed_page(uint64_t *out_phys)
+{
+    if (!mmap_allocate_contiguous(PAGE_SIZE, out_phys))
+    {
+        return false;
+    }
+
+    memset(mmu_phys_to_virt(*out_phys), 0, PAGE_SIZE);
+
+    return true;
+}
+
+bool mmap_populate(void *address)
+{
+    void *page_address = (void *)PAGE_ALIGN_DOWN((uint64_t)address);
+
+    mmu_PageTableEntry *page = mmu_page_entry_find(page_address);
+    if (page == NULL || page->present || !page->demand)
+    {
+        return false;
+    }
+
+    uint64_t phys;
+    if (!mmap_allocate_zeroed_page(&phys))
+    {
+        return false;
+    }
+
+    mmu_page_table_entry_address_set(page, phys);
+    page->demand = 0;
+    page->present = 1;
+    mmu_tlb_flush(page_address);
+
+    return true;
+}
+
 void munmap(void *in_addr, size_t size)
 {
     uint8_t *addr = in_addr;
@@ -135,12 +678,38 @@ void munmap(void *in_addr, size_t size)
 
     for (uint8_t *it = addr; it < addr + size; it += PAGE_SIZE)
     {
-        mmu_PageTableEntry *page = mmu_page_existing(it);
+        // A whole 2 MiB page is freed as one block. It's never shared, fork splits it first.
+        mmu_PageMapEntry *huge_page = mmu_huge_page_covered((uint64_t)it, (uint64_t)(addr + size));
+        if (huge_page != NULL)
+        {
+            const range_Range huge_range = {.begin = mmu_get_phys_addr_of(it), .size = MMU_HUGE_PAGE_SIZE};
+            huge_page->present = 0;
+            mmu_tlb_flush(it);
+            mmap_phys_memory_free(&huge_range);
+            it += MMU_HUGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+
+        mmu_PageTableEntry *page = mmu_page_entry_find(it);
+        assert(page != NULL && (page->present || page->demand) && "The page must be mapped");
+        if (!page->present)
+        {
+            page->demand = 0; // Never accessed, there's nothing to free.
+            continue;
+        }
+
         uint64_t physical_page_addr = mmu_page_table_entry_address_get(page);
 
         page->present = 0;
+        page->copy_on_write = 0;
+        page->shared = 0;
         mmu_tlb_flush(it);
 
+        if (!mmap_phys_page_drop_reference(physical_page_addr))
+        {
+            continue; // Still mapped by another process.
+        }
+
         bool is_right_after_current_range = cur.begin + cur.size == physical_page_addr;
         if (is_right_after_current_range)
         {
@@ -148,7 +717,7 @@ void munmap(void *in_addr, size_t size)
             continue;
         }
 
-        mmap_phys_memory_add(&cur);
+        mmap_phys_memory_free(&cur);
 
         cur.begin = physical_page_addr;
         cur.size = PAGE_SIZE;
@@ -156,7 +725,7 @@ void munmap(void *in_addr, size_t size)
 
     if (cur.size != 0)
     {
-        mmap_phys_memory_add(&cur);
+        mmap_phys_memory_free(&cur);
     }
 }
 
@@ -167,7 +736,116 @@ res mprotect(void *addr, size_t size, mmap_Protection prot)
     if ((prot & MMAP_PROT_READ) == 0) return res_mmap_MUST_BE_READABLE;
     const int mmu_flags = prot_to_mmu_flags(prot);
 
-    mmu_page_range_set_flags(addr, addr + size, mmu_flags);
+    for (uint64_t it = (uint64_t)addr; it < (uint64_t)addr + size; it += PAGE_SIZE)
+    {
+        mmu_PageMapEntry *huge_page = mmu_huge_page_covered(it, (uint64_t)addr + size);
+        if (huge_page != NULL)
+        {
+            mmu_page_entry_set_flags((mmu_PageTableEntry *)huge_page, mmu_flags); // Never shared, so never copy-on-write.
+            mmu_tlb_flush((void *)it);
+            it += MMU_HUGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+
+        mmu_PageTableEntry *page = mmu_page_entry_find((void *)it); // Splits a 2 MiB page it's a part of.
+        assert(page != NULL && (page->present || page->demand) && "The page must be mapped");
+        mmu_page_entry_set_flags(page, mmu_flags);
+        if (!page->present)
+        {
+            continue; // Backed with the new flags once accessed.
+        }
+
+        // A page shared by fork stays read-only until it's copied on the first write.
+        page->copy_on_write = page->read_write && !page->shared && mmap_phys_page_is_shared(mmu_page_table_entry_address_get(page));
+        if (page->copy_on_write)
+        {
+            page->read_write = 0;
+        }
+        mmu_tlb_flush((void *)it);
+    }
 
     return res_OK;
 }
+
+bool mmap_copy_on_write(void *address)
+{
+    void *page_address = (void *)PAGE_ALIGN_DOWN((uint64_t)address);
+
+    mmu_PageTableEntry *page = mmu_page_find(page_address);
+    if (page == NULL || !page->copy_on_write)
+    {
+        return false;
+    }
+
+    const uint64_t phys = mmu_page_table_entry_address_get(page);
+    if (mmap_phys_page_is_shared(phys))
+    {
+        uint64_t copy_phys;
+        if (!mmap_allocate_contiguous(PAGE_SIZE, &copy_phys))
+        {
+            return false;
+        }
+
+        memmove(mmu_phys_to_virt(copy_phys), mmu_phys_to_virt(phys), PAGE_SIZE);
+
+        mmu_page_table_entry_address_set(page, copy_phys);
+        mmap_phys_page_drop_reference(phys); // Not the last one, it's shared.
+    }
+    // Otherwise, everyone else already copied it, so it's ours alone.
+
+    page->copy_on_write = 0;
+    page->read_write = 1;
+    mmu_tlb_flush(page_address);
+
+    return true;
+}
+
+void test_mmap()
+{
+    mmap_hot_pages_drain_all(); // So every free page is in the free lists.
+    const uint64_t free_pages = g_free_page_count;
+
+    // Not a power of 2, the tail of the block is given back right away.
+    uint64_t phys;
+    assert(mmap_allocate_contiguous(3 * PAGE_SIZE, &phys));
+    const uint64_t index = phys / PAGE_SIZE;
+    assert(g_free_page_count == free_pages - 3);
+    assert(!buddy_is_range_free(index, 1) && !buddy_is_range_free(index + 2, 1));
+
+    // Freed in pieces, it's merged back with its buddies.
+    mmap_phys_memory_add(&(range_Range){.begin = phys + PAGE_SIZE, .size = 2 * PAGE_SIZE});
+    mmap_phys_memory_add(&(range_Range){.begin = phys, .size = PAGE_SIZE});
+    assert(g_free_page_count == free_pages);
+    uint64_t head;
+    assert(buddy_find_free_block(index, &head) && g_frames[head].order >= 2);
+
+    // A page from the middle of a free block.
+    assert(mmap_phys_memory_claim(phys + PAGE_SIZE, PAGE_SIZE));
+    assert(!mmap_phys_memory_claim(phys + PAGE_SIZE, PAGE_SIZE));
+    assert(buddy_is_range_free(index, 1) && buddy_is_range_free(index + 2, 1));
+    assert(g_free_page_count == free_pages - 1);
+    mmap_phys_memory_add(&(range_Range){.begin = phys + PAGE_SIZE, .size = PAGE_SIZE});
+    assert(buddy_find_free_block(index, &head) && g_frames[head].order >= 2);
+
+    // The last freed page is the first to be reused.
+    uint64_t page;
+    uint64_t page_again;
+    assert(mmap_allocate_contiguous(PAGE_SIZE, &page));
+    mmap_phys_page_unref(page);
+    assert(mmap_allocate_contiguous(PAGE_SIZE, &page_again));
+    assert(page == page_again);
+    mmap_phys_page_unref(page_again);
+
+    // A page is reached through the direct map, where the tables agree it is.
+    assert(mmap_allocate_zeroed_page(&page));
+    uint64_t *words = mmu_phys_to_virt(page);
+    assert(mmu_virt_to_phys(words) == page && mmu_get_phys_addr_of(words) == page);
+    for (uint64_t i = 0; i < PAGE_SIZE / sizeof(*words); i++)
+    {
+        assert(words[i] == 0);
+    }
+    mmap_phys_page_unref(page);
+
+    mmap_hot_pages_drain_all();
+    assert(g_free_page_count == free_pages);
+}
@@ -14,6 +14,16 @@ typedef enum {
     MMAP_PROT_RING_3= 0x8,
 } mmap_Protection;
 
+// Every CPU keeps the single pages it freed last, and hands them out first, while
+//  they are still likely in its caches. Pages move between it and the buddy allocator in batches.
+#define MMAP_HOT_PAGES_CAPACITY 32
+#define MMAP_HOT_PAGES_BATCH    8
+
+typedef struct {
+    uint32_t count;
+    uint64_t pages[MMAP_HOT_PAGES_CAPACITY]; // Physical addresses, the hottest last.
+} mmap_HotPages;
+
 #define res_mmap_OUT_OF_MEMORY    "cannot allocate memory"
 #define res_mmap_INVALID_SIZE     "size cannot be 0"
 #define res_mmap_MUST_BE_READABLE "non readable prot is not supported"
@@ -38,6 +48,29 @@ void mmap_init(range_Range *mmap_base, uint64_t length);
  */
 res mmap(void *addr, size_t size, mmap_Protection prot) WUR;
 
+/**
+ * @brief Reserve a memory region, without backing it with physical memory yet: every
+ *          page is backed by a zeroed page on its first access (@see mmap_populate),
+ *          so the pages that are never accessed cost nothing.
+ *        Pages of the region that are already mapped are left as they are.
+ * @note  Only for memory that may fault, like user memory. The kernel doesn't fault in its own memory.
+ *
+ * @param addr The (page aligned) beginning of the (virtual) memory region.
+ * @param size The size of the region.
+ * @param prot The protections for the region.
+ * @return res_OK or one of the errors defined above.
+ */
+res mmap_lazy(void *addr, size_t size, mmap_Protection prot) WUR;
+
+/**
+ * @brief - Back the page at `address`, if it was reserved by mmap_lazy and not accessed yet.
+ *          Called on page faults.
+ *
+ * @return - true if the access may be retried, false if `address` is not in such a page,
+ *             or we ran out of memory.
+ */
+bool mmap_populate(void *address);
+
 /**
  * @brief Unmap memory pages.
  * @note  Ideally, only call it on addresses and sizes from mmap.
@@ -66,12 +99,59 @@ res mprotect(void *addr, size_t size, mmap_Protection prot);
  * @brief - Allocate contiguous physical memory of size `wanted_size`.
  *
  * @param want_size The size of the contiguous memory to allocate.
- *                      Must be page aligned
+ *                      Must be page aligned, and at most 4 MiB (the largest buddy block).
  * @param out_result[out]      - The start address of the allocated physical memory.
  * @return - true on success, false otherwise. If the function didn't succeed
  *              there's no free contiguous memory range of the requested size.
  */
 bool mmap_allocate_contiguous(uint64_t want_size, uint64_t *out_result);
 
-// NOTE: you really shouldn't use this function unless you are manually unmapping the mmu tables
+/**
+ * @brief - Allocate a single physical page, and zero it.
+ * @return - true on success, false if we ran out of memory.
+ */
+bool mmap_allocate_zeroed_page(uint64_t *out_phys);
+
+/**
+ * @brief - Remove a specific range from the free physical memory, for memory that
+ *            has to be at a specific address (e.g. below 1 MiB for real mode code).
+ *          Return it with `mmap_phys_memory_add` when done.
+ *
+ * @param begin - Page aligned physical address.
+ * @param size  - Page aligned size.
+ * @return - true on success, false if the range (or part of it) is not free.
+ */
+bool mmap_phys_memory_claim(uint64_t begin, uint64_t size);
+
+// NOTE: you really shouldn't use this function unless you are manually unmapping the mmu tables.
+//  `range` must be page aligned.
 void mmap_phys_memory_add(const range_Range *range);
+
+/**
+ * @brief - Add a reference to the physical page at `phys`, for when it's mapped once more (@see pcb_clone_user_pages).
+ *          Every allocated page starts with a single reference.
+ */
+void mmap_phys_page_ref(uint64_t phys);
+
+/**
+ * @brief - Drop a reference to the physical page at `phys`, returning it to the
+ *            free physical memory if it was the last one.
+ */
+void mmap_phys_page_unref(uint64_t phys);
+
+/**
+ * @brief - Whether the physical page at `phys` has more than a single reference.
+ */
+bool mmap_phys_page_is_shared(uint64_t phys);
+
+/**
+ * @brief - Handle a write to a copy-on-write page of the current address space:
+ *            copy it if it's still shared, and make it writable.
+ *
+ * @param address - The address that was written to.
+ * @return - true if the write may be retried, false if `address` is not in a
+ *             copy-on-write page, or we ran out of memory.
+ */
+bool mmap_copy_on_write(void *address);
+
+void test_mmap();
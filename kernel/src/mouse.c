@@ -1,3 +1,4 @@
+#include "mouse.h"
 #include "assert.h"
 #include "smartptr.h"
 #include "isr.h"
@@ -28,8 +29,11 @@ static struct
     uint8_t buttons;
     uint8_t packet[3];
     uint8_t byte_count;
+    bool is_updated; // @see mouse_is_updated
 } g_mouse_state = {0};
 
+WaitQueue mouse_wait_queue;
+
 /**
  * @brief Sends a command or data byte to the PS/2 mouse via the controller.
  * @param data The byte to send to the mouse.
@@ -131,6 +135,8 @@ static void __attribute__((used, sysv_abi)) mouse_isr_impl(isr_InterruptFrame *f
 
         g_mouse_state.byte_count = 0;
 
+        g_mouse_state.is_updated = true;
+        wait_queue_wake_all(&mouse_wait_queue);
     }
 }
 
@@ -156,3 +162,15 @@ uint8_t mouse_get_buttons()
 {
     return g_mouse_state.buttons;
 }
+
+
+bool mouse_is_updated()
+{
+    return g_mouse_state.is_updated;
+}
+
+
+void mouse_mark_read()
+{
+    g_mouse_state.is_updated = false;
+}
@@ -1,7 +1,12 @@
 #pragma once
 
+#include "wait_queue.h"
+#include <stdbool.h>
 #include <stdint.h>
 
+// Woken on every mouse packet.
+extern WaitQueue mouse_wait_queue;
+
 /**
  * @brief Initializes the PS/2 mouse, assuming the keyboard is already initialized.
  *        Enables the mouse port, resets the device, sets defaults, and enables
@@ -32,3 +37,14 @@ int16_t mouse_get_y();
  * @return Button state (bit 0: left, 1: right, 2: middle).
  */
 uint8_t mouse_get_buttons();
+
+/**
+ * @brief Whether a packet arrived since the state was last read.
+ * @see mouse_mark_read
+ */
+bool mouse_is_updated();
+
+/**
+ * @brief Marks the current state as read, until the next packet arrives.
+ */
+void mouse_mark_read();
@@ -7,6 +7,7 @@
 #include "math.h"
 #include "mouse.h"
 #include "memory.h"
+#include "poll.h"
 
 typedef struct __attribute__((packed)) {
     int16_t x;
@@ -39,6 +40,7 @@ static size_t handle_read(uint8_t *buffer, uint64_t buffer_size, uint64_t file_o
 
             assert(buffer_size == sizeof(data));
             memmove(buffer, &data, sizeof(data));
+            mouse_mark_read();
 
             return buffer_size;
         }
@@ -47,6 +49,18 @@ static size_t handle_read(uint8_t *buffer, uint64_t buffer_size, uint64_t file_o
     }
 }
 
+// The mouse is readable once it moved (or a button changed) since it was last read, by anyone.
+static uint32_t handle_poll(int minor_number, PCB *pcb, WaitQueue **out_wait_queue)
+{
+    if (minor_number != mouse_char_device_MINOR_MOUSE)
+    {
+        return POLL_NVAL;
+    }
+
+    *out_wait_queue = &mouse_wait_queue;
+    return mouse_is_updated() ? POLL_IN : 0;
+}
+
 static void create_mouse_device_file(const char *path, mouse_char_device_MinorDeviceType minor_number, size_t file_size)
 {
     uint16_t parent_cluster;
@@ -68,6 +82,7 @@ void mouse_char_device_init()
     static char_device_Descriptor desc = {
         .read = handle_read,
         .write = handle_write,
+        .poll = handle_poll,
         .major_number = mouse_char_device_MAJOR_NUMBER,
     };
 
@@ -1,10 +1,15 @@
 #include "pcb.h"
+#include "shm.h"
+#include "user_mmap.h"
+#include "cpu.h"
 #include "mmap.h"
 #include "file_descriptor_hashmap.h"
+#include "pid_hashmap.h"
 #include "mmu.h"
 #include "mmu_config.h"
 #include "assert.h"
 #include "kmalloc.h"
+#include "slab.h"
 #include "memory.h"
 #include "res.h"
 #include <stdint.h>
@@ -12,11 +17,23 @@
 #include "window.h"
 
 const static int kernel_start_index = 256;
+
+static PidHashmap g_pcbs; // Every PCB, by pid. Initialized on the first PCB_init.
+static slab_Cache g_pcb_cache = SLAB_CACHE_INIT("pcb", PCB);
+
+// @see timer_Callback
+static void pcb_io_timeout(Timer *timer)
+{
+    PCB *pcb = timer->arg;
+    pcb->io_timed_out = true;
+    scheduler_io_wake(pcb);
+}
+
 PCB* PCB_init(uint64_t id, PCB *parent, uint64_t entry_point, mmu_PageMapEntry *kernel_pml)
 {
     const int kernel_end_index = 512;
 
-    PCB* created_pcb = kcalloc(1, sizeof(struct PCB));
+    PCB* created_pcb = slab_alloc(&g_pcb_cache);
     if (created_pcb == NULL)
     {
         return NULL;
@@ -24,29 +41,47 @@ PCB* PCB_init(uint64_t id, PCB *parent, uint64_t entry_point, mmu_PageMapEntry *
 
     if (!file_descriptor_hashmap_init(&created_pcb->fd_map))
     {
-        kfree(created_pcb);
+        slab_free(&g_pcb_cache, created_pcb);
         return NULL;
     }
 
     if (!pcb_ProcessChildrenArray_init(&created_pcb->children))
     {
         file_descriptor_hashmap_cleanup(&created_pcb->fd_map);
-        kfree(created_pcb);
+        slab_free(&g_pcb_cache, created_pcb);
+        return NULL;
+    }
+
+    if (!fpu_state_init(&created_pcb->fpu))
+    {
+        pcb_ProcessChildrenArray_cleanup(&created_pcb->children);
+        file_descriptor_hashmap_cleanup(&created_pcb->fd_map);
+        slab_free(&g_pcb_cache, created_pcb);
+        return NULL;
+    }
+
+    created_pcb->id = id;
+    if ((g_pcbs.capacity == 0 && !pid_hashmap_init(&g_pcbs)) || !pid_hashmap_insert(&g_pcbs, created_pcb))
+    {
+        fpu_state_cleanup(&created_pcb->fpu);
+        pcb_ProcessChildrenArray_cleanup(&created_pcb->children);
+        file_descriptor_hashmap_cleanup(&created_pcb->fd_map);
+        slab_free(&g_pcb_cache, created_pcb);
         return NULL;
     }
 
     if (parent != NULL)
     {
         memmove(created_pcb->cwd, parent->cwd, sizeof(created_pcb->cwd));
+        created_pcb->nice = parent->nice;
         pcb_ProcessChildrenArray_push(&parent->children, created_pcb);
     }
     else
     {
-        created_pcb->cwd[0] = '/'; // NULL terminated because of kcalloc.
+        created_pcb->cwd[0] = '/'; // NULL terminated because of slab_alloc.
     }
 
     created_pcb->state = PCB_STATE_READY;
-    created_pcb->id = id;
     created_pcb->rip = entry_point;
     created_pcb->parent = parent;
     created_pcb->page_break = UINT64_MAX;
@@ -63,6 +98,8 @@ PCB* PCB_init(uint64_t id, PCB *parent, uint64_t entry_point, mmu_PageMapEntry *
     }
 
     created_pcb->queue_next = NULL;
+    created_pcb->wait_entry.pcb = created_pcb;
+    timer_init(&created_pcb->io_timer, pcb_io_timeout, created_pcb);
 
     return created_pcb;
 }
@@ -74,6 +111,21 @@ void PCB_cleanup(PCB *pcb)
         return;
     }
 
+    PCB *removed = pid_hashmap_remove(&g_pcbs, pcb->id);
+    assert(removed == pcb);
+
+    timer_cancel(&pcb->io_timer);
+
+    // Whoever still waits for us will find out we are gone on its next refresh.
+    wait_queue_wake_all(&pcb->exit_wait_queue);
+    while (!wait_queue_is_empty(&pcb->exit_wait_queue))
+    {
+        wait_queue_remove(pcb->exit_wait_queue.head);
+    }
+
+    shm_detach_all(pcb); // The pages it mapped are released with the rest.
+    user_mmap_detach_all(pcb);
+
     mmu_PageMapEntry *paging = pcb->paging;
 
     for (int level4 = 0; level4 < kernel_start_index; level4++)
@@ -87,15 +139,21 @@ void PCB_cleanup(PCB *pcb)
             for (int level2 = 0; level2 < TABLE_LENGTH; level2++)
             {
                 if (l2[level2].present == 0) continue;
+                if (l2[level2].page_size)
+                {
+                    const uint64_t huge_page = mmu_page_table_entry_address_get((mmu_PageTableEntry *)&l2[level2]);
+                    for (int page = 0; page < TABLE_LENGTH; page++)
+                    {
+                        mmap_phys_page_unref(huge_page + page * PAGE_SIZE);
+                    }
+                    continue;
+                }
                 mmu_PageTableEntry *l1 = (void *)mmu_page_table_entry_address_get_virt(&l2[level2]);
 
                 for (int level1 = 0; level1 < TABLE_LENGTH; level1++)
                 {
                     if (l1[level1].present == 0) continue;
-                    mmap_phys_memory_add(&(range_Range){
-                        .begin = mmu_page_table_entry_address_get(&l1[level1]),
-                        .size = PAGE_SIZE,
-                    });
+                    mmap_phys_page_unref(mmu_page_table_entry_address_get(&l1[level1])); // Might be shared with a forked process
                 }
 
                 mmu_map_deallocate(l1);
@@ -122,14 +180,96 @@ void PCB_cleanup(PCB *pcb)
         }
     }
 
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        if (g_cpus[i].accounted_process == pcb)
+        {
+            g_cpus[i].accounted_process = NULL;
+        }
+    }
+
     file_descriptor_hashmap_cleanup(&pcb->fd_map);
     pcb_ProcessChildrenArray_cleanup(&pcb->children);
+    fpu_state_cleanup(&pcb->fpu);
     if (pcb->window)
     {
         window_unregister(pcb->window);
         window_destroy(pcb->window);
     }
-    kfree(pcb);
+    slab_free(&g_pcb_cache, pcb);
+}
+
+uint64_t pcb_allocate_pid()
+{
+    static uint64_t next_pid = 1;
+    return next_pid++;
+}
+
+// Allocate a table for `to`, with the same flags as `from`. Returns NULL if ran out of tables.
+static void *pcb_clone_table_entry(mmu_PageMapEntry *to, const mmu_PageMapEntry *from)
+{
+    void *table = mmu_map_allocate(); // Zeroed
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    *to = *from;
+    mmu_page_table_entry_address_set_virt(to, (uint64_t)table);
+    return table;
+}
+
+bool pcb_clone_user_pages(PCB *to, PCB *from)
+{
+    for (int level4 = 0; level4 < kernel_start_index; level4++)
+    {
+        if (from->paging[level4].present == 0) continue;
+        mmu_PageMapEntry *from_l3 = (void *)mmu_page_table_entry_address_get_virt(&from->paging[level4]);
+        mmu_PageMapEntry *to_l3 = pcb_clone_table_entry(&to->paging[level4], &from->paging[level4]);
+        if (to_l3 == NULL) return false;
+
+        for (int level3 = 0; level3 < TABLE_LENGTH; level3++)
+        {
+            if (from_l3[level3].present == 0) continue;
+            mmu_PageMapEntry *from_l2 = (void *)mmu_page_table_entry_address_get_virt(&from_l3[level3]);
+            mmu_PageMapEntry *to_l2 = pcb_clone_table_entry(&to_l3[level3], &from_l3[level3]);
+            if (to_l2 == NULL) return false;
+
+            for (int level2 = 0; level2 < TABLE_LENGTH; level2++)
+            {
+                if (from_l2[level2].present == 0) continue;
+                if (from_l2[level2].page_size)
+                {
+                    mmu_huge_page_split(&from_l2[level2]); // Shared copy-on-write page by page.
+                }
+                mmu_PageTableEntry *from_l1 = (void *)mmu_page_table_entry_address_get_virt(&from_l2[level2]);
+                mmu_PageTableEntry *to_l1 = pcb_clone_table_entry(&to_l2[level2], &from_l2[level2]);
+                if (to_l1 == NULL) return false;
+
+                for (int level1 = 0; level1 < TABLE_LENGTH; level1++)
+                {
+                    mmu_PageTableEntry *page = &from_l1[level1];
+                    if (page->demand)
+                    {
+                        to_l1[level1] = *page; // Each is backed by its own page once accessed.
+                        continue;
+                    }
+                    if (page->present == 0) continue;
+
+                    if (page->read_write && !page->shared)
+                    {
+                        page->read_write = 0;
+                        page->copy_on_write = 1;
+                    }
+
+                    to_l1[level1] = *page;
+                    mmap_phys_page_ref(mmu_page_table_entry_address_get(page));
+                }
+            }
+        }
+    }
+
+    return true;
 }
 
 bool pcb_ProcessChildrenArray_init(pcb_ProcessChildrenArray *arr)
@@ -184,6 +324,7 @@ static void pcb_ProcessChildrenArray_push_to_end(pcb_ProcessChildrenArray *arr,
     bool has_free_elements = pcb_ProcessChildrenArray_have_free_elements(arr);
 
     arr->arr[arr->length].pcb = el;
+    el->index_in_parent = arr->length;
     arr->length++;
 
     if (!has_free_elements)
@@ -214,6 +355,7 @@ res pcb_ProcessChildrenArray_push(pcb_ProcessChildrenArray *arr, PCB *el)
 
         arr->arr[index].pcb = el;
         assert(arr->arr[index].is_used); // Set by setting .pcb
+        el->index_in_parent = index;
         return res_OK;
     }
 
@@ -249,18 +391,37 @@ PCB *pcb_ProcessChildrenArray_remove(pcb_ProcessChildrenArray *arr, size_t index
 
 size_t pcb_ProcessChildrenArray_find(pcb_ProcessChildrenArray *arr, uint64_t pid)
 {
-    for (size_t i = 0; i < arr->length; i++)
+    PCB *pcb = pcb_find_by_pid(pid);
+    if (pcb == NULL)
     {
-        if (arr->arr[i].is_used && arr->arr[i].pcb->id == pid)
-        {
-            assert(arr->arr[i].is_used);
-            return i;
-        }
+        return arr->length;
+    }
+
+    // The index is stale once the PCB is removed from the array, so make sure it's still there.
+    size_t i = pcb->index_in_parent;
+    if (i < arr->length && arr->arr[i].is_used && arr->arr[i].pcb == pcb)
+    {
+        return i;
     }
 
     return arr->length;
 }
 
+PCB *pcb_find_by_pid(uint64_t pid)
+{
+    return pid_hashmap_get(&g_pcbs, pid);
+}
+
+PCB *pcb_next(size_t *cursor)
+{
+    return pid_hashmap_next(&g_pcbs, cursor);
+}
+
+size_t pcb_count()
+{
+    return g_pcbs.count;
+}
+
 Window *PCB_get_window_in_mode(PCB *pcb, WindowMode mode)
 {
     assert(pcb != NULL);
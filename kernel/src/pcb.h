@@ -1,11 +1,14 @@
 #pragma once
 
 #include "file_descriptor_hashmap.h"
+#include "fpu.h"
 #include "window.h"
 #include "mmu.h"
 #include "fs.h"
 #include "regs.h"
 #include "res.h"
+#include "wait_queue.h"
+#include "timer.h"
 #include <stdint.h>
 
 typedef enum
@@ -19,6 +22,22 @@ typedef enum
 
 typedef struct PCB PCB;
 
+// What the process did since it started. @see ProcessInfo
+typedef struct {
+    uint64_t user_cycles;   // TSC cycles spent in usermode.
+    uint64_t kernel_cycles; // TSC cycles spent in the kernel, in syscalls and interrupts of the process.
+    uint64_t voluntary_switches;   // Gave up the CPU, to block.
+    uint64_t involuntary_switches; // Preempted at the end of its time slice.
+    uint64_t syscalls;
+    uint64_t page_faults;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} pcb_Stats;
+
+// Like in unix, a lower nice value gets more of the CPU. @see scheduler.c
+#define PCB_NICE_MIN -20
+#define PCB_NICE_MAX 19
+
 typedef enum {
     PCB_IO_REFRESH_DONE,
     PCB_IO_REFRESH_CONTINUE,
@@ -30,6 +49,8 @@ typedef enum {
  *            That is, this function should update the state of the process
  *            in the given PCB, returning true if and only if the process is
  *            ready to get back into the process queue.
+ *          Called once when the process blocks, and then again every time
+ *            one of the wait queues it waits on is woken.
  * @param pcb - the PCB to refresh. The PCB is in the IO queue.
  * @return - PCB_IO_REFRESH_DONE if the PCB is ready to be executed. PCB_IO_REFRESH_CONTINUE otherwise.
  */
@@ -56,6 +77,7 @@ PCB *pcb_ProcessChildrenArray_remove(pcb_ProcessChildrenArray *arr, size_t index
 res pcb_ProcessChildrenArray_push(pcb_ProcessChildrenArray *arr, PCB *el);
 void pcb_ProcessChildrenArray_cleanup(pcb_ProcessChildrenArray *arr);
 // Returns the index of the PCB with `pid` if found. Otherwise arr->length;
+//  O(1), through the PID hashmap and the `index_in_parent` of the PCB.
 size_t pcb_ProcessChildrenArray_find(pcb_ProcessChildrenArray *arr, uint64_t pid);
 
 struct PCB
@@ -67,23 +89,37 @@ struct PCB
     uint64_t    id;
     struct PCB *parent;
     Regs        regs;
+    FpuState    fpu;
     uint64_t    rip;
     uint64_t    page_break;
     pcb_State   state;
     int         return_code; // Accessible only if state is PCB_STATE_ZOMBIE
+    int         nice; // PCB_NICE_MIN to PCB_NICE_MAX, inherited from the parent.
+    uint8_t     priority_level; // The scheduling level, 0 is the highest. Changes with the behavior of the process.
+    pcb_Stats   stats;
 
     char exe_path[FS_MAX_FILEPATH_LEN];
     char cwd[FS_MAX_FILEPATH_LEN];
     pcb_IORefresh refresh; // Used only in IO doubly-linked list
     void *refresh_arg;
+    WaitQueueEntry wait_entry; // Used only in IO doubly-linked list, the entry in the wait queue the process is blocked on.
+    struct PCB *io_woken_next; // Used only in the woken IO list, the processes that need an IO refresh.
+    bool is_io_woken;
+    Timer io_timer; // Used only in IO doubly-linked list, fires at the deadline of the IO operation.
+    bool io_timed_out; // Set when the deadline of the IO operation passed.
+    WaitQueue exit_wait_queue; // Processes waiting for this process to exit.
 
     mmu_PageMapEntry *paging;
 
     pcb_ProcessChildrenArray children;
+    size_t index_in_parent; // Where we are in `parent->children`. Valid only while we are in it.
 
     FileDescriptorHashmap fd_map;
     uint64_t last_fd;
 
+    struct shm_Mapping *shm_mappings; // @see shm.h
+    struct user_mmap_Mapping *user_mappings; // @see user_mmap.h
+
     Window *window;
     // TODO: signal info
 };
@@ -91,6 +127,41 @@ struct PCB
 void PCB_cleanup(PCB *pcb);
 PCB* PCB_init(uint64_t id, PCB *parent, uint64_t entry_point, mmu_PageMapEntry *kernel_pml);
 
+/**
+ * @brief - Find the PCB with the given pid, in O(1). Every PCB from PCB_init
+ *            until PCB_cleanup can be found, zombies included.
+ * @return - The PCB if found, NULL otherwise.
+ */
+PCB *pcb_find_by_pid(uint64_t pid);
+
+/**
+ * @brief - Iterate over all the PCBs, zombies included, in no particular order.
+ *          The kernel lock must be held during the whole iteration, and no
+ *            PCB may be created or cleaned up in the middle of it.
+ *
+ * @param cursor - Set to 0 to get the first PCB.
+ * @return - The next PCB, or NULL once all of them were returned.
+ */
+PCB *pcb_next(size_t *cursor);
+
+/**
+ * @brief - The amount of PCBs, zombies included.
+ */
+size_t pcb_count();
+
+uint64_t pcb_allocate_pid();
+
+/**
+ * @brief - Map every user page of `from` in `to` too, at the same address, sharing
+ *            the physical pages. The writable pages of both become copy-on-write.
+ *          The TLB of `from` must be flushed afterwards, even on failure.
+ *
+ * @param to - A PCB without any user pages.
+ * @return - true on success, false if ran out of page tables. On failure, `to` has
+ *             only part of the pages, and PCB_cleanup releases them.
+ */
+bool pcb_clone_user_pages(PCB *to, PCB *from);
+
 /**
  * @brief - Walks up the parent list until finds a window with the given mode.
  *
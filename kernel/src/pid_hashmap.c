@@ -0,0 +1,165 @@
+#include "pid_hashmap.h"
+#include "pcb.h"
+#include "hashmap_utils.h"
+#include "kmalloc.h"
+#include "assert.h"
+
+#define STARTING_CAPACITY 16
+#define HASH_LOOP_HARD_LIMIT 50
+
+bool pid_hashmap_init(PidHashmap *map)
+{
+    map->count = 0;
+    map->capacity = STARTING_CAPACITY;
+    map->buf = kcalloc(map->capacity, sizeof(*map->buf));
+    if (map->buf == NULL)
+    {
+        map->capacity = 0;
+        return false;
+    }
+
+    return true;
+}
+
+static bool pid_hashmap_resize(PidHashmap *map)
+{
+    assert(map->capacity != 0 && "How did we get here?");
+    const size_t old_capacity = map->capacity;
+    const size_t old_count = map->count;
+    PCB **old_buf = map->buf;
+
+    PCB **new_buf = kcalloc(old_capacity * 2, sizeof(*new_buf));
+    if (new_buf == NULL)
+    {
+        return false;
+    }
+
+    map->buf = new_buf;
+    map->capacity = old_capacity * 2;
+    map->count = 0;
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_buf[i] == NULL)
+        {
+            continue;
+        }
+
+        if (!pid_hashmap_insert(map, old_buf[i]))
+        {
+            kfree(map->buf);
+            map->buf = old_buf;
+            map->capacity = old_capacity;
+            map->count = old_count;
+            return false;
+        }
+    }
+
+    kfree(old_buf);
+
+    return true;
+}
+
+bool pid_hashmap_insert(PidHashmap *map, PCB *pcb)
+{
+    assert(pcb != NULL);
+    assert(map->capacity != 0);
+
+    int iteration_counter = 0;
+    uint64_t hash_state = pcb->id;
+    size_t index;
+    do
+    {
+        iteration_counter++;
+        if (iteration_counter > HASH_LOOP_HARD_LIMIT)
+        {
+            if (!pid_hashmap_resize(map))
+            {
+                return false;
+            }
+
+            iteration_counter = 0;
+            hash_state = pcb->id;
+        }
+        hash_state = hash_u64(hash_state);
+        index = hash_state % map->capacity;
+    }
+    while (map->buf[index] != NULL);
+
+    map->buf[index] = pcb;
+    map->count++;
+
+    return true;
+}
+
+// Returns the cell of `pid`, or NULL if it's not in the map.
+static PCB **pid_hashmap_find_cell(const PidHashmap *map, uint64_t pid)
+{
+    if (map->capacity == 0)
+    {
+        return NULL;
+    }
+
+    int iteration_counter = 0;
+    uint64_t hash_state = pid;
+    do
+    {
+        hash_state = hash_u64(hash_state);
+
+        size_t index = hash_state % map->capacity;
+        if (map->buf[index] != NULL && map->buf[index]->id == pid)
+        {
+            return &map->buf[index];
+        }
+
+        iteration_counter++;
+    }
+    while (iteration_counter <= HASH_LOOP_HARD_LIMIT);
+
+    return NULL;
+}
+
+PCB *pid_hashmap_get(const PidHashmap *map, uint64_t pid)
+{
+    PCB **cell = pid_hashmap_find_cell(map, pid);
+    return cell != NULL ? *cell : NULL;
+}
+
+PCB *pid_hashmap_remove(PidHashmap *map, uint64_t pid)
+{
+    PCB **cell = pid_hashmap_find_cell(map, pid);
+    if (cell == NULL)
+    {
+        return NULL;
+    }
+
+    PCB *pcb = *cell;
+    *cell = NULL;
+    map->count--;
+
+    return pcb;
+}
+
+PCB *pid_hashmap_next(const PidHashmap *map, size_t *cursor)
+{
+    while (*cursor < map->capacity)
+    {
+        PCB *pcb = map->buf[*cursor];
+        (*cursor)++;
+
+        if (pcb != NULL)
+        {
+            return pcb;
+        }
+    }
+
+    return NULL;
+}
+
+void pid_hashmap_cleanup(PidHashmap *map)
+{
+    kfree(map->buf);
+    map->buf = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
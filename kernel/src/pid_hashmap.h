@@ -0,0 +1,44 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct PCB PCB;
+
+// PCBs keyed by their pid. Same open addressing scheme as FileDescriptorHashmap.
+typedef struct {
+    PCB **buf; // NULL cells are free
+
+    size_t capacity;
+    size_t count;
+} PidHashmap;
+
+// Returns true on success and false on failure.
+bool pid_hashmap_init(PidHashmap *map) WUR;
+
+/*
+ * @brief - Insert `pcb` to the hashmap, keyed by `pcb->id`, which must not already be in it.
+ *
+ * @WARN: invalidates all previous cursors.
+ *
+ * @return - true on success, false if ran out of memory.
+ */
+bool pid_hashmap_insert(PidHashmap *map, PCB *pcb) WUR;
+
+// Returns the PCB whose pid is `pid`. If no matching PCB is found, returns NULL.
+PCB *pid_hashmap_get(const PidHashmap *map, uint64_t pid) WUR;
+
+// If a PCB with `pid` exists, removes it and returns it. Otherwise, NULL.
+PCB *pid_hashmap_remove(PidHashmap *map, uint64_t pid);
+
+/*
+ * @brief - Iterate over the PCBs in the hashmap, in no particular order.
+ *
+ * @param cursor - Set to 0 to get the first PCB. Advanced past the returned PCB.
+ * @return - The next PCB, or NULL once all of them were returned.
+ */
+PCB *pid_hashmap_next(const PidHashmap *map, size_t *cursor);
+
+void pid_hashmap_cleanup(PidHashmap *map);
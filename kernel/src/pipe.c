@@ -0,0 +1,320 @@
+#include "pipe.h"
+#include "char_device.h"
+#include "FAT16.h"
+#include "kmalloc.h"
+#include "slab.h"
+#include "math.h"
+#include "memory.h"
+#include "pcb.h"
+#include "poll.h"
+#include "scheduler.h"
+#include "wait_queue.h"
+#include "assert.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIPE_BUFFER_SIZE PAGE_SIZE
+#define PIPE_MAX_COUNT   256
+
+#define PIPE_MINOR(index, end) ((index) * pipe_END_COUNT + (end))
+#define PIPE_INDEX(minor)      ((minor) / pipe_END_COUNT)
+#define PIPE_END(minor)        ((minor) % pipe_END_COUNT)
+
+_Static_assert(PIPE_MINOR(PIPE_MAX_COUNT, 0) <= UINT16_MAX, "The minor number must fit in `firstClusterLow`");
+
+typedef struct {
+    uint8_t *buffer; // Ring of PIPE_BUFFER_SIZE bytes.
+    uint64_t read_count; // Bytes read since the pipe was created. Modulo the size, it's where the next read starts.
+    uint64_t write_count;
+
+    uint32_t references[pipe_END_COUNT]; // The file descriptors of every end. Once both are 0, the pipe is released.
+    WaitQueue wait_queues[pipe_END_COUNT]; // The processes blocked on every end.
+} Pipe;
+
+static Pipe *g_pipes[PIPE_MAX_COUNT];
+
+typedef struct {
+    Pipe *pipe;
+    uint8_t *buffer; // Usermode buffer, checked by the syscall.
+    uint64_t buffer_size;
+    uint64_t transferred; /* = 0 (initial) */
+} PipeRefreshArgument;
+
+static slab_Cache g_pipe_cache = SLAB_CACHE_INIT("pipe", Pipe);
+static slab_Cache g_pipe_argument_cache = SLAB_CACHE_INIT("pipe argument", PipeRefreshArgument);
+
+static Pipe *pipe_from_minor(int minor_number, pipe_End expected_end)
+{
+    if (minor_number < 0 || PIPE_INDEX(minor_number) >= PIPE_MAX_COUNT || PIPE_END(minor_number) != expected_end)
+    {
+        return NULL;
+    }
+
+    return g_pipes[PIPE_INDEX(minor_number)];
+}
+
+// Move up to `size` bytes out of the ring into `buffer`. Returns how many were moved.
+static uint64_t pipe_take(Pipe *pipe, uint8_t *buffer, uint64_t size)
+{
+    const uint64_t count = MIN(size, pipe->write_count - pipe->read_count);
+
+    for (uint64_t done = 0; done < count;)
+    {
+        const uint64_t offset = pipe->read_count % PIPE_BUFFER_SIZE;
+        const uint64_t chunk = MIN(count - done, PIPE_BUFFER_SIZE - offset);
+        memmove(buffer + done, pipe->buffer + offset, chunk);
+
+        pipe->read_count += chunk;
+        done += chunk;
+    }
+
+    if (count > 0)
+    {
+        wait_queue_wake_all(&pipe->wait_queues[pipe_END_WRITE]);
+    }
+
+    return count;
+}
+
+// Move up to `size` bytes from `buffer` into the ring. Returns how many were moved.
+static uint64_t pipe_put(Pipe *pipe, const uint8_t *buffer, uint64_t size)
+{
+    const uint64_t count = MIN(size, PIPE_BUFFER_SIZE - (pipe->write_count - pipe->read_count));
+
+    for (uint64_t done = 0; done < count;)
+    {
+        const uint64_t offset = pipe->write_count % PIPE_BUFFER_SIZE;
+        const uint64_t chunk = MIN(count - done, PIPE_BUFFER_SIZE - offset);
+        memmove(pipe->buffer + offset, buffer + done, chunk);
+
+        pipe->write_count += chunk;
+        done += chunk;
+    }
+
+    if (count > 0)
+    {
+        wait_queue_wake_all(&pipe->wait_queues[pipe_END_READ]);
+    }
+
+    return count;
+}
+
+// @see pcb_IORefresh
+static pcb_IORefreshResult pcb_refresh_pipe_read(PCB *pcb)
+{
+    PipeRefreshArgument *arg = pcb->refresh_arg;
+    assert(arg != NULL);
+
+    asm volatile("stac" ::: "memory");
+    arg->transferred = pipe_take(arg->pipe, arg->buffer, arg->buffer_size);
+    asm volatile("clac" ::: "memory");
+
+    if (arg->transferred == 0 && arg->pipe->references[pipe_END_WRITE] > 0)
+    {
+        return PCB_IO_REFRESH_CONTINUE;
+    }
+
+    pcb->regs.rax = arg->transferred;
+    pcb->stats.bytes_read += arg->transferred;
+    slab_free(&g_pipe_argument_cache, arg);
+    return PCB_IO_REFRESH_DONE;
+}
+
+// @see pcb_IORefresh
+static pcb_IORefreshResult pcb_refresh_pipe_write(PCB *pcb)
+{
+    PipeRefreshArgument *arg = pcb->refresh_arg;
+    assert(arg != NULL);
+
+    if (arg->pipe->references[pipe_END_READ] == 0)
+    {
+        // No one will ever read the rest.
+        pcb->regs.rax = arg->transferred > 0 ? arg->transferred : -1;
+    }
+    else
+    {
+        asm volatile("stac" ::: "memory");
+        arg->transferred += pipe_put(arg->pipe, arg->buffer + arg->transferred, arg->buffer_size - arg->transferred);
+        asm volatile("clac" ::: "memory");
+
+        if (arg->transferred < arg->buffer_size)
+        {
+            return PCB_IO_REFRESH_CONTINUE;
+        }
+
+        pcb->regs.rax = arg->transferred;
+    }
+
+    pcb->stats.bytes_written += arg->transferred;
+    slab_free(&g_pipe_argument_cache, arg);
+    return PCB_IO_REFRESH_DONE;
+}
+
+static void pipe_block(Pipe *pipe, pipe_End end, uint8_t *buffer, uint64_t buffer_size, uint64_t transferred)
+{
+    PipeRefreshArgument *arg = slab_alloc(&g_pipe_argument_cache);
+    if (arg == NULL)
+    {
+        return; // Failed
+    }
+
+    arg->pipe = pipe;
+    arg->buffer = buffer;
+    arg->buffer_size = buffer_size;
+    arg->transferred = transferred;
+
+    scheduler_current_pcb()->refresh_arg = arg;
+
+    scheduler_move_current_process_to_io_queue_and_context_switch(&pipe->wait_queues[end], end == pipe_END_READ ? pcb_refresh_pipe_read : pcb_refresh_pipe_write, SCHEDULER_NO_DEADLINE);
+}
+
+static size_t handle_read(uint8_t *buffer, uint64_t buffer_size, uint64_t file_offset, int minor_number, bool block)
+{
+    Pipe *pipe = pipe_from_minor(minor_number, pipe_END_READ);
+    if (pipe == NULL)
+    {
+        return -1;
+    }
+
+    const uint64_t count = pipe_take(pipe, buffer, buffer_size);
+    if (count > 0 || buffer_size == 0 || pipe->references[pipe_END_WRITE] == 0 || !block)
+    {
+        return count;
+    }
+
+    pipe_block(pipe, pipe_END_READ, buffer, buffer_size, 0);
+    return -1; // Couldn't block
+}
+
+static size_t handle_write(uint8_t *buffer, uint64_t buffer_size, uint64_t file_offset, int minor_number, bool block)
+{
+    Pipe *pipe = pipe_from_minor(minor_number, pipe_END_WRITE);
+    if (pipe == NULL || pipe->references[pipe_END_READ] == 0)
+    {
+        return -1;
+    }
+
+    const uint64_t count = pipe_put(pipe, buffer, buffer_size);
+    if (count == buffer_size || !block)
+    {
+        return count;
+    }
+
+    pipe_block(pipe, pipe_END_WRITE, buffer, buffer_size, count);
+    return -1; // Couldn't block
+}
+
+static uint32_t handle_poll(int minor_number, PCB *pcb, WaitQueue **out_wait_queue)
+{
+    Pipe *pipe = g_pipes[PIPE_INDEX(minor_number)];
+    assert(pipe != NULL);
+
+    const pipe_End end = PIPE_END(minor_number);
+    *out_wait_queue = &pipe->wait_queues[end];
+
+    const uint64_t used = pipe->write_count - pipe->read_count;
+    if (end == pipe_END_READ)
+    {
+        const uint32_t events = used > 0 ? POLL_IN : 0;
+        return pipe->references[pipe_END_WRITE] == 0 ? events | POLL_HUP : events;
+    }
+
+    if (pipe->references[pipe_END_READ] == 0)
+    {
+        return POLL_ERR;
+    }
+    return used < PIPE_BUFFER_SIZE ? POLL_OUT : 0;
+}
+
+static void handle_ref(int minor_number)
+{
+    Pipe *pipe = g_pipes[PIPE_INDEX(minor_number)];
+    assert(pipe != NULL);
+
+    pipe->references[PIPE_END(minor_number)]++;
+}
+
+static void handle_unref(int minor_number)
+{
+    Pipe *pipe = g_pipes[PIPE_INDEX(minor_number)];
+    assert(pipe != NULL);
+
+    const pipe_End end = PIPE_END(minor_number);
+    assert(pipe->references[end] > 0);
+    pipe->references[end]--;
+
+    if (pipe->references[end] > 0)
+    {
+        return;
+    }
+
+    // The other end sees EOF (or fails to write) now, instead of waiting forever.
+    const pipe_End other_end = end == pipe_END_READ ? pipe_END_WRITE : pipe_END_READ;
+    wait_queue_wake_all(&pipe->wait_queues[other_end]);
+
+    if (pipe->references[other_end] == 0)
+    {
+        // Whoever blocks (or polls) on an end holds a reference to it.
+        assert(wait_queue_is_empty(&pipe->wait_queues[pipe_END_READ]) && wait_queue_is_empty(&pipe->wait_queues[pipe_END_WRITE]));
+
+        g_pipes[PIPE_INDEX(minor_number)] = NULL;
+        kfree(pipe->buffer);
+        slab_free(&g_pipe_cache, pipe);
+    }
+}
+
+void pipe_init()
+{
+    static char_device_Descriptor desc = {
+        .read = handle_read,
+        .write = handle_write,
+        .ref = handle_ref,
+        .unref = handle_unref,
+        .poll = handle_poll,
+        .major_number = pipe_MAJOR_NUMBER,
+    };
+
+    char_device_register(&desc);
+}
+
+res pipe_create(FILE out_ends[static pipe_END_COUNT])
+{
+    size_t index = 0;
+    while (index < PIPE_MAX_COUNT && g_pipes[index] != NULL)
+    {
+        index++;
+    }
+
+    if (index == PIPE_MAX_COUNT)
+    {
+        return res_pipe_TOO_MANY_PIPES;
+    }
+
+    Pipe *pipe = slab_alloc(&g_pipe_cache);
+    if (pipe == NULL)
+    {
+        return res_pipe_OUT_OF_MEMORY;
+    }
+
+    pipe->buffer = kmalloc(PIPE_BUFFER_SIZE);
+    if (pipe->buffer == NULL)
+    {
+        slab_free(&g_pipe_cache, pipe);
+        return res_pipe_OUT_OF_MEMORY;
+    }
+
+    for (pipe_End end = 0; end < pipe_END_COUNT; end++)
+    {
+        pipe->references[end] = 1;
+
+        memset(&out_ends[end], 0, sizeof(out_ends[end]));
+        out_ends[end].file.file_entry.reserved = fat16_MDSCoreFlags_DEVICE;
+        out_ends[end].file.file_entry.firstClusterHigh = pipe_MAJOR_NUMBER;
+        out_ends[end].file.file_entry.firstClusterLow = PIPE_MINOR(index, end);
+    }
+
+    g_pipes[index] = pipe;
+
+    return res_OK;
+}
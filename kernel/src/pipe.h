@@ -0,0 +1,36 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include "file.h"
+#include "res.h"
+
+// Anonymous pipes. Each end is a character device which isn't on the drive,
+//  and is reached only through the file descriptors `pipe_create` made for it.
+//  The minor number is the index of the pipe, and which end it is.
+
+#define pipe_MAJOR_NUMBER 4
+
+#define res_pipe_OUT_OF_MEMORY  "Ran out of memory allocating a pipe"
+#define res_pipe_TOO_MANY_PIPES "Reached the maximum amount of pipes"
+
+typedef enum {
+    pipe_END_READ,
+    pipe_END_WRITE,
+    pipe_END_COUNT,
+} pipe_End;
+
+/**
+ * @brief - Register the pipe character device.
+ */
+void pipe_init();
+
+/**
+ * @brief - Create a pipe: a kernel ring buffer written to from one end, and read from the other.
+ *          Reading blocks while the pipe is empty and has writers; once it has none, it returns 0 (EOF).
+ *          Writing blocks until everything is written, and fails once the pipe has no readers.
+ *
+ * @param out_ends[out] - The files of the ends, indexed by pipe_End. Each is already
+ *                          referenced once, by the file descriptor it's to be put in.
+ *                          @see file_descriptor_ref
+ */
+res pipe_create(FILE out_ends[static pipe_END_COUNT]) WUR;
@@ -2,9 +2,15 @@
 #include "io.h"
 #include "isr.h"
 #include "macro_utils.h"
-#include "window.h"
 #include "scheduler.h"
 #include "smartptr.h"
+#include "timer.h"
+#include "vdso.h"
+#include "cpu.h"
+#include "kernel_lock.h"
+#include "lapic.h"
+#include "pic.h"
+#include "assert.h"
 #include <stdint.h>
 
 #define PIT_CHANNEL_0 0x40
@@ -20,30 +26,50 @@
 static volatile uint64_t g_pit_ms_counter;
 static volatile bool     g_special_event_enabled;
 
-static void __attribute__((used, sysv_abi)) handle_special_time_event_impl()
+// Once the PIT is stopped, the time is measured with the TSC, from the last PIT tick.
+static uint64_t g_tsc_per_ms; // 0 while the PIT is running.
+static uint64_t g_tsc_at_switch;
+static uint64_t g_ms_at_switch;
+
+static void __attribute__((used, sysv_abi)) pit_run_timers(isr_InterruptFrame *frame)
 {
+    timer_run_expired(g_pit_ms_counter);
 }
 
-static volatile isr_InterruptFrame *g_interrupt_frame_ptr_tmp; // Temp place to store the pointer to isr_InterruptFrame.
+// Runs on every CPU, without the kernel lock unless there are timers to run.
+static void __attribute__((used, sysv_abi)) pit_on_lapic_timer(isr_InterruptFrame *frame)
+{
+    lapic_timer_expired();
+
+    const uint64_t now = pit_ms_counter();
+    if (now >= g_timer_next_deadline_ms)
+    {
+        kernel_lock_acquire();
+        timer_run_expired(now);
+        kernel_lock_release();
+    }
+
+    scheduler_tick(frame);
+    scheduler_arm_tick();
+}
 
 static void __attribute__((naked, used)) handle_special_time_event()
 {
-    // NOTE: we will not return to pit_isr_clock. We are now on our own. Although the timer was already
-    // incremented for us.
-    // Our special "time event" is a round robin interrupt, so we won't actually iretq back to the same process.
+    // NOTE: we will not return to pit_isr_lapic_timer. We are now on our own.
+    // Our special "time event" is a context switch, so we won't actually iretq back to the same process.
     // Instead we will store all the current process data, and iretq to another process. So the scheduler
-    // will be responsible for sending IRQ EOI.
+    // will be responsible for sending the EOI (to the LAPIC).
+    //
+    // We haven't pushed anything yet, so $rsp is the isr_InterruptFrame.
 
     asm volatile(
-                "mov %[g_interrupt_frame_ptr_tmp], rsp\n" // We haven't pushed anything yet, so rsp is actually the interrupt frame.
+                "mov gs:[" STR(CPU_OFFSET_SCRATCH) "], rsp\n"
                 // 16 byte align the stack
                 "and rsp, ~0xf\n"
 
                 // Put the `Regs` struct on to the stack. We will pass a pointer to it.
 
-                "sub rsp, 512\n"
-                "fxsave [rsp]\n"
-                "push 0\n" // Padding before the SSE (stack aligned)
+                "push 0\n" // Padding, to keep the stack aligned
 
                 "push 0\n" // Skip RFALGS, will set them via the isr_InterruptFrame.
                 "push r15\n"
@@ -63,58 +89,78 @@ static void __attribute__((naked, used)) handle_special_time_event()
                 "push rcx\n"
                 "push rax\n"
 
+                "cld\n" // The C code expects it clear.
                 "mov rdi, rsp\n"
-                "mov rsi, %[g_interrupt_frame_ptr_tmp]\n"
-                "mov rdx, 0\n" // args.pic_number = pic_IRQ_TIMER
+                "mov rsi, gs:[" STR(CPU_OFFSET_SCRATCH) "]\n"
+                "mov rdx, " STR(SCHEDULER_LAPIC_INTERRUPT) "\n"
 
                 "call scheduler_context_switch_from" // Does not return. We use call and not jmp to keep the stack 16 byte aligned.
-        : [g_interrupt_frame_ptr_tmp] "+m"(g_interrupt_frame_ptr_tmp) : : "memory");
+                ::: "memory");
 }
 
 void __attribute__((naked)) pit_isr_clock()
 {
-#define USERMODE_CS 0x20 | 3
     asm volatile(
+                isr_SWAPGS_IF_USERMODE(8)
+
                 "add %[ms_counter], 4\n"
 
+                "push rax\n"
+                "mov rax, %[ms_counter]\n"
+                "cmp rax, %[timer_next_deadline]\n"
+                "pop rax\n"
+                "jb .no_expired_timers\n"
+                "push offset pit_run_timers\n"
+                "call isr_trampoline\n"
+                "add rsp, 0x8\n"
+                ".no_expired_timers:\n"
+
+                "push rax\n"
+
+                "mov al, 0x20\n" // Send EOI to PIC
+                "out 0x20, al\n"
+
+                "pop rax\n"
+                isr_SWAPGS_IF_USERMODE(8)
+                "iretq\n"
+                : [ms_counter] "+m"(g_pit_ms_counter),
+                  [timer_next_deadline] "+m"(g_timer_next_deadline_ms)
+                :
+                : "memory", "cc");
+}
+
+void __attribute__((naked)) pit_isr_lapic_timer()
+{
+#define USERMODE_CS 0x20 | 3
+    asm volatile(
+                isr_SWAPGS_IF_USERMODE(8)
+
+                "push offset pit_on_lapic_timer\n"
+                "call isr_trampoline_without_lock\n"
+                "add rsp, 0x8\n"
+
+                // Whether to preempt the current process. `scheduler_tick` marks the CPU once its time slice ends.
                 "test %[special_event_enabled], 1\n"
-                "jz .regular\n"
+                "jz .lapic_timer_regular\n"
 
                 // Do not context-switch from the kernel
                 "cmp qword ptr [rsp + 8], " STR(USERMODE_CS) "\n"   // if (interrupt_frame.cs != USERMODE_CS) {
-                "jnz .regular\n"                                    //      goto .regular
+                "jnz .lapic_timer_regular\n"                        //      goto regular
                                                                     // }
 
-                "test %[ms_counter], (1 << 3) - 1\n" // if (ms_counter % 8 != 0)
-                "jnz .regular\n"                     //      goto .regular
+                "test byte ptr gs:[" STR(CPU_OFFSET_SHOULD_PREEMPT) "], 1\n"
+                "jnz handle_special_time_event\n" // Does not return
 
+                ".lapic_timer_regular:\n"
                 "push rax\n"
-                "push rbx\n"
-                "mov rax, %[focused_window]\n"
-                "mov rbx, %[current_process]\n"
-
-                "cmp [rbx + 1304], rax\n"
-                "pop rbx\n"
+                "mov rax, " STR(LAPIC_VIRT_ADDR) "\n"
+                "mov dword ptr [rax + " STR(LAPIC_REG_EOI) "], 0\n" // Send EOI to the LAPIC
                 "pop rax\n"
-                "jnz handle_special_time_event\n"
-
-                "test %[ms_counter], (1 << 5) - 1\n" // if (ms_counter % 32 == 0)
-                "jz handle_special_time_event\n"     //     handle_special_time_event(); (Does not return)
-
-                 ".regular:\n"
-                 "push rax\n"
-
-                 "mov al, 0x20\n" // Send EOI to PIC
-                 "out 0x20, al\n"
-
-                 "pop rax\n"
-                 "iretq\n"
-                 : [ms_counter] "+m"(g_pit_ms_counter),
-                   [special_event_enabled] "+m"(g_special_event_enabled),
-                   [focused_window] "+m"(g_focused_window),
-                   [current_process] "+m"(g_current_process)
-                 :
-                 : "memory", "cc");
+                isr_SWAPGS_IF_USERMODE(8)
+                "iretq\n"
+                : [special_event_enabled] "+m"(g_special_event_enabled)
+                :
+                : "memory", "cc");
 }
 
 
@@ -135,7 +181,29 @@ void pit_init()
 
 uint64_t pit_ms_counter()
 {
-    return g_pit_ms_counter;
+    if (g_tsc_per_ms == 0)
+    {
+        return g_pit_ms_counter;
+    }
+
+    return g_ms_at_switch + (__builtin_ia32_rdtsc() - g_tsc_at_switch) / g_tsc_per_ms;
+}
+
+void pit_switch_to_tsc(uint64_t tsc_per_ms)
+{
+    assert(tsc_per_ms > 0);
+
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    g_tsc_at_switch = __builtin_ia32_rdtsc();
+    g_ms_at_switch = g_pit_ms_counter;
+    g_tsc_per_ms = tsc_per_ms;
+    vdso_set_tsc_calibration(g_tsc_at_switch, g_ms_at_switch, g_tsc_per_ms);
+
+    pic_set_mask(pic_IRQ_TIMER);
+
+    set_cpu_flags(flags);
 }
 
 void pit_enable_special_event()
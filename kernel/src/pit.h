@@ -3,21 +3,39 @@
 #include <stdint.h>
 
 /**
- * @brief - Handle the PIT clock interrupt from the PIC
+ * @brief - Handle the PIT clock interrupt from the PIC, until the PIT is stopped. Runs the expired timers.
+ * @see timer_run_expired
+ * @see pit_switch_to_tsc
  */
 void __attribute__((naked)) pit_isr_clock();
 
+/**
+ * @brief - Handle the one-shot LAPIC timer (LAPIC_VECTOR_TIMER) of any CPU, which takes the job
+ *            of the PIT once it's stopped. Runs the expired timers, preempts the current process
+ *            once its time slice ends, and arms the timer for the next deadline.
+ * @see scheduler_arm_tick
+ */
+void __attribute__((naked)) pit_isr_lapic_timer();
+
 /**
  * @brief - Initialize the pit to precomputed values to work with the clock.
  */
 void pit_init();
 
 /**
- * @brief - Get the PIT millisecond counter.
+ * @brief - Get the millisecond counter. It's counted by the PIT ticks, and once the PIT
+ *            is stopped, derived from the TSC.
  */
 uint64_t pit_ms_counter();
 
-// Enable/disable the PIT from executing a special event every few milliseconds.
+/**
+ * @brief - Stop the PIT interrupts, and count the milliseconds with the TSC from now on.
+ *
+ * @param tsc_per_ms - The TSC ticks in a millisecond, calibrated against the PIT.
+ */
+void pit_switch_to_tsc(uint64_t tsc_per_ms);
+
+// Enable/disable the timer from executing a special event once the time slice ends.
 //  The special event at the time of writing is context switch.
 void pit_enable_special_event();
 void pit_disable_special_event();
@@ -0,0 +1,148 @@
+#include "poll.h"
+#include "file_descriptor.h"
+#include "file_descriptor_hashmap.h"
+#include "kmalloc.h"
+#include "slab.h"
+#include "pcb.h"
+#include "pit.h"
+#include "scheduler.h"
+#include "wait_queue.h"
+#include "assert.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    usermode_mem *user_fds;
+    uint64_t count;
+    poll_Fd *fds; // A kernel copy of the user's.
+    WaitQueueEntry *entries; // One for every fd. In the wait queue of the fd, if it has one.
+} PollRefreshArgument;
+
+static slab_Cache g_poll_argument_cache = SLAB_CACHE_INIT("poll argument", PollRefreshArgument);
+
+/**
+ * @brief - Set `revents` of every fd.
+ *
+ * @param out_wait_queues - Optional. Set to the wait queue of every fd, NULL for the ones that don't have any.
+ *
+ * @return - The amount of fds with any event.
+ */
+static uint64_t poll_check(PCB *pcb, poll_Fd *fds, uint64_t count, WaitQueue **out_wait_queues)
+{
+    uint64_t ready = 0;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        WaitQueue *queue = NULL;
+        uint32_t events = 0;
+        if (fds[i].fd >= 0)
+        {
+            FileDescriptor *fd = file_descriptor_hashmap_get(&pcb->fd_map, fds[i].fd);
+            events = fd == NULL ? POLL_NVAL : file_descriptor_poll(fd, pcb, &queue);
+        }
+
+        fds[i].revents = events & (fds[i].events | POLL_ERR | POLL_HUP | POLL_NVAL);
+        if (fds[i].revents != 0)
+        {
+            ready++;
+        }
+
+        if (out_wait_queues != NULL)
+        {
+            out_wait_queues[i] = queue;
+        }
+    }
+
+    return ready;
+}
+
+static void poll_argument_free(PollRefreshArgument *arg)
+{
+    for (uint64_t i = 0; i < arg->count; i++)
+    {
+        wait_queue_remove(&arg->entries[i]); // The scheduler removes only the entry of the PCB.
+    }
+
+    kfree(arg->entries);
+    kfree(arg->fds);
+    slab_free(&g_poll_argument_cache, arg);
+}
+
+// @see pcb_IORefresh
+static pcb_IORefreshResult pcb_refresh_poll(PCB *pcb)
+{
+    PollRefreshArgument *arg = pcb->refresh_arg;
+    assert(arg != NULL);
+
+    const uint64_t ready = poll_check(pcb, arg->fds, arg->count, NULL);
+    if (ready == 0 && !pcb->io_timed_out)
+    {
+        return PCB_IO_REFRESH_CONTINUE;
+    }
+
+    res rs = usermode_copy_to_user(arg->user_fds, arg->fds, arg->count * sizeof(*arg->fds));
+    pcb->regs.rax = IS_OK(rs) ? ready : (uint64_t)-1;
+
+    poll_argument_free(arg);
+    return PCB_IO_REFRESH_DONE;
+}
+
+uint64_t poll(usermode_mem *fds, uint64_t count, int64_t timeout_ms)
+{
+    if (count > POLL_MAX_FDS)
+    {
+        return -1;
+    }
+
+    PCB *pcb = scheduler_current_pcb();
+
+    PollRefreshArgument *arg = slab_alloc(&g_poll_argument_cache);
+    if (arg == NULL)
+    {
+        return -1;
+    }
+    arg->user_fds = fds;
+    arg->count = count;
+    arg->fds = kcalloc(count + 1, sizeof(*arg->fds)); // +1, so there's always an allocation to free.
+    arg->entries = kcalloc(count + 1, sizeof(*arg->entries));
+    if (arg->fds == NULL || arg->entries == NULL)
+    {
+        poll_argument_free(arg);
+        return -1;
+    }
+
+    res rs = usermode_copy_from_user(arg->fds, fds, count * sizeof(*arg->fds));
+    if (IS_ERR(rs))
+    {
+        poll_argument_free(arg);
+        return -1;
+    }
+
+    WaitQueue *queues[POLL_MAX_FDS];
+    const uint64_t ready = poll_check(pcb, arg->fds, count, queues);
+    if (ready > 0 || timeout_ms == 0)
+    {
+        rs = usermode_copy_to_user(fds, arg->fds, count * sizeof(*arg->fds));
+        poll_argument_free(arg);
+        return IS_OK(rs) ? ready : (uint64_t)-1;
+    }
+
+    // Woken by any of the fds. An fd that is ready before we block is caught by the first refresh.
+    for (uint64_t i = 0; i < count; i++)
+    {
+        arg->entries[i].pcb = pcb;
+        if (queues[i] != NULL)
+        {
+            wait_queue_push(queues[i], &arg->entries[i]);
+        }
+    }
+
+    uint64_t deadline;
+    if (timeout_ms < 0 || __builtin_add_overflow(pit_ms_counter(), (uint64_t)timeout_ms, &deadline))
+    {
+        deadline = SCHEDULER_NO_DEADLINE;
+    }
+
+    pcb->refresh_arg = arg;
+
+    scheduler_move_current_process_to_io_queue_and_context_switch(NULL, pcb_refresh_poll, deadline);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "usermode.h"
+#include <stdint.h>
+
+// Wait for any of several file descriptors to be ready, instead of blocking on a single one.
+
+// Events of a file descriptor. The same values as Linux.
+#define POLL_IN   0x001 // There's data to read (or a read won't block).
+#define POLL_OUT  0x004 // A write won't block.
+#define POLL_ERR  0x008 // Always reported, even if not asked for. E.g. the read end of a pipe is closed.
+#define POLL_HUP  0x010 // Always reported. E.g. the write end of a pipe is closed.
+#define POLL_NVAL 0x020 // Always reported. The file descriptor isn't open.
+
+#define POLL_MAX_FDS 64
+
+#define POLL_NO_TIMEOUT -1
+
+// The same layout as `struct pollfd` in usermode.
+typedef struct {
+    int32_t fd; // Ignored if negative.
+    int16_t events; // Requested POLL_ events.
+    int16_t revents; // Set to the events that are ready.
+} poll_Fd;
+
+/**
+ * @brief - Block the current process until any of the `count` file descriptors in `fds`
+ *            is ready for any of its requested events, or `timeout_ms` passes.
+ *          Sets `revents` of every file descriptor.
+ *
+ * @param timeout_ms - POLL_NO_TIMEOUT to wait forever, 0 to not block at all.
+ *
+ * @return - The amount of ready file descriptors (0 on timeout), or -1 on error.
+ *             If the process blocks, the value is returned through its $rax.
+ */
+uint64_t poll(usermode_mem *fds, uint64_t count, int64_t timeout_ms);
@@ -10,6 +10,7 @@
 #include "mmap.h"
 #include "res.h"
 #include "scheduler.h"
+#include "vdso.h"
 
 static void *push_to_stack(void *stack_top, uint64_t value)
 {
@@ -65,7 +66,7 @@ static void *copy_argv_to_stack_and_push_argc(char **argv_to_copy, void *stack_t
     return stack_top;
 }
 
-res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel_pml, fat16_Ref *fat16, const char *path_to_file, char **argv)
+res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel_pml, fat16_Ref *fat16, const char *path_to_file, char **argv, FileDescriptor *const *stdio)
 {
     //pcb handle
     PCB* program_pcb = PCB_init(id, parent, 0, kernel_pml);
@@ -97,6 +98,26 @@ res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel
         PCB_cleanup(program_pcb);
     });
 
+    for (int i = 0; stdio != NULL && i < PROGRAM_STDIO_COUNT; i++)
+    {
+        program_pcb->last_fd = i + 1;
+        if (stdio[i] == NULL)
+        {
+            continue;
+        }
+
+        FileDescriptor *fd_desc = file_descriptor_hashmap_emplace(&program_pcb->fd_map, i + 1);
+        if (fd_desc == NULL)
+        {
+            should_defer_cleanup_pcb = true;
+            return res_program_OUT_OF_MEMORY;
+        }
+
+        *fd_desc = *stdio[i];
+        fd_desc->num = i + 1;
+        file_descriptor_ref(fd_desc);
+    }
+
     //switch PML
     mmu_load_virt_pml4(program_pcb->paging);
     defer({
@@ -129,15 +150,11 @@ res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel
 
     program_pcb->rip = (uint64_t)entry_point; //rip = Register Instruction Pointer and not Rest in peace
 
-    // Virtual memory consts for program stack
-    const size_t STACK_SIZE = PAGE_SIZE * 5;
-    const uint64_t STACK_VIRTUAL_BASE = 0x7FFFFFFFF000;
-
     //Program Stack handling
-    program_pcb->regs.rsp = STACK_VIRTUAL_BASE;
+    program_pcb->regs.rsp = PROGRAM_STACK_TOP;
 
-    void *const stack_end = (void *)(program_pcb->regs.rsp - STACK_SIZE);
-    rs = mmap(stack_end, STACK_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE);
+    void *const stack_end = (void *)(PROGRAM_STACK_TOP - PROGRAM_STACK_SIZE);
+    rs = mmap_lazy(stack_end, PROGRAM_STACK_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE); // Only the pages argv is copied to are backed now.
     if (!IS_OK(rs))
     {
         should_defer_cleanup_pcb = true;
@@ -147,7 +164,14 @@ res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel
     program_pcb->regs.rsp = (uint64_t)copy_argv_to_stack_and_push_argc(
         argv, (void *)program_pcb->regs.rsp);
 
-    rs = mprotect(stack_end, STACK_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE | MMAP_PROT_RING_3);
+    rs = mprotect(stack_end, PROGRAM_STACK_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE | MMAP_PROT_RING_3);
+    if (!IS_OK(rs))
+    {
+        should_defer_cleanup_pcb = true;
+        return rs;
+    }
+
+    rs = vdso_map(program_pcb, false);
     if (!IS_OK(rs))
     {
         should_defer_cleanup_pcb = true;
@@ -161,3 +185,9 @@ res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel
 
     return res_OK;
 }
+
+bool program_is_stack_guard(uint64_t address)
+{
+    const uint64_t stack_end = PROGRAM_STACK_TOP - PROGRAM_STACK_SIZE;
+    return address < stack_end && address >= stack_end - PROGRAM_STACK_GUARD_SIZE;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "pcb.h"
 #include "elf.h"
 #include "res.h"
@@ -5,7 +7,24 @@
 #define res_program_OUT_OF_MEMORY "Ran out of memory allocating program"
 #define res_program_GIVEN_FILE_DOESNT_EXIST "The given file doesn't exist"
 
+// The user stack grows down from PROGRAM_STACK_TOP. The whole range is reserved with mmap_lazy, so a page
+//  of it takes memory only once it's used. The page below it is never mapped, to catch overflows.
+#define PROGRAM_STACK_TOP        0x7FFFFFFFF000
+#define PROGRAM_STACK_SIZE       (8 * 1024 * 1024)
+#define PROGRAM_STACK_GUARD_SIZE PAGE_SIZE
+
+#define PROGRAM_STACK_OVERFLOW_RETURN_CODE (-1)
+
+#define PROGRAM_STDIO_COUNT 3 // stdin, stdout and stderr, which are the file descriptors 1, 2 and 3 of a process.
+
 /**
  * @param argv - The argv to copy into the process. Assume that `argv`'s content won't change (aka const). We can't specify so in C because of C limitations.
+ * @param stdio - Nullable. PROGRAM_STDIO_COUNT file descriptors (each nullable) to copy into the process,
+ *                  as its stdio. When given, the process opens its own files starting after them.
+ */
+res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel_pml, fat16_Ref *fat16, const char *path_to_file, char **argv, FileDescriptor *const *stdio);
+
+/**
+ * @brief - Whether `address` is in the guard page below the user stack, meaning that a fault on it is a stack overflow.
  */
-res program_setup_from_drive(uint64_t id,  PCB *parent, mmu_PageMapEntry *kernel_pml, fat16_Ref *fat16, const char *path_to_file, char **argv);
+bool program_is_stack_guard(uint64_t address);
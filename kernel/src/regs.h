@@ -20,16 +20,14 @@ typedef struct {
     uint64_t r14;
     uint64_t r15;
     uint64_t rflags;
-    __attribute__((aligned(16))) uint8_t sse[512];
+    // The FPU/SSE registers are not here, they are switched lazily. @see fpu.h
 } Regs; // NOTE: change this struct very carefully, as its offsets are hardcoded in inline assembly for usermode jumps and possibly more.
 
 // Push current cpu registers onto the stack to get the full `Regs`. Stack must
 // be aligned before executing.
 // In the end, `$rsp` will contain the pointer `Regs`.
 #define regs_PUSH() asm volatile(                                              \
-                "sub rsp, 512\n"                                               \
-                "fxsave [rsp]\n"                                               \
-                "push 0\n" /* Padding before the SSE (stack aligned) */        \
+                "push 0\n" /* Padding, to keep the stack aligned */            \
                                                                                \
                 "pushf\n"                                                      \
                 "push r15\n"                                                   \
@@ -70,8 +68,6 @@ typedef struct {
                 "pop r15\n"                                                    \
                 "popf\n"                                                       \
                                                                                \
-                "add rsp, 8\n" /* Padding before the SSE (stack aligned) */    \
-                "fxrstor [rsp]\n"                                              \
-                "add rsp, 512\n"                                               \
+                "add rsp, 8\n" /* Padding, to keep the stack aligned */        \
                                                                                \
             ::: "memory")
@@ -145,16 +145,14 @@ typedef struct {
     int cur_buffer_idx;
 } rtl_PacketBuffers;
 
-#define PACKET_BUFFER_VIRTUAL_ADDR 0xffff813900000000
-static uint32_t g_packet_buffers_phys_addr;
-static rtl_PacketBuffers *g_packet_buffers;
+static rtl_PacketBuffers *g_packet_buffers; // In the direct map, so the physical address the card needs is just arithmetic.
 
 __attribute__((pure))
 static uint32_t virtual_packet_buffer_addr_to_phys(void *ptr)
 {
     assert(ptr >= (void *)g_packet_buffers && ptr <= (void *)((char *)g_packet_buffers + sizeof(*g_packet_buffers)));
 
-    uint64_t phys_addr = (uint64_t)ptr - (PACKET_BUFFER_VIRTUAL_ADDR - g_packet_buffers_phys_addr);
+    uint64_t phys_addr = mmu_virt_to_phys(ptr);
     assert(phys_addr < UINT32_MAX);
 
     return (uint32_t)phys_addr;
@@ -192,13 +190,7 @@ static res rtl8139_init_recv_buffer()
         return res_rtl8139_PACKETS_BUFFER_NO_MEMORY;
     }
 
-    g_packet_buffers_phys_addr = physical_buffer_addresses_addr;
-
-    mmu_map_range(physical_buffer_addresses_addr,
-                  physical_buffer_addresses_addr + buffer_addresses_size,
-                  PACKET_BUFFER_VIRTUAL_ADDR, MMU_EXECUTE_DISABLE | MMU_READ_WRITE);
-
-    g_packet_buffers = (void *)PACKET_BUFFER_VIRTUAL_ADDR;
+    g_packet_buffers = mmu_phys_to_virt(physical_buffer_addresses_addr);
 
     write_recv_buffer_canary();
 
@@ -1,4 +1,5 @@
 #include "isr.h"
+#include "io.h"
 #include "kmalloc.h"
 #include "smartptr.h"
 #include "pit.h"
@@ -10,25 +11,283 @@
 #include "usermode.h"
 #include "shell.h"
 #include "string.h"
+#include "timer.h"
 #include "vga.h"
+#include "wait_queue.h"
+#include "window.h"
+#include "cpu.h"
+#include "kernel_lock.h"
+#include "lapic.h"
+#include "fpu.h"
 
-PCB *g_current_process; // Process queue head
-static PCB *g_process_queue_tail;
+// Every CPU has its own process queue, in its `CPU` (current_process is the head).
+//  The rest is shared, under the kernel lock.
 
 static PCB *g_io_head; // Process IO linked list
 
-static PCB *wait_until_one_IO_is_ready()
+// Processes from the IO list which were woken, and need to be refreshed. Linked by `io_woken_next`.
+static PCB *g_io_woken_head;
+static PCB *g_io_woken_tail;
+
+// Scheduling policy - a multilevel feedback queue.
+//  Every process has a priority level, 0 being the highest. A CPU runs the process with the
+//  highest level in its queue, round robin among the processes of the same level.
+//  - A process that uses its whole time slice moves a level down. The lower the level, the longer
+//      the slice, so CPU-bound processes run less often, but for longer.
+//  - A process that blocks before using half of its slice (IO-bound) moves a level up.
+//  - The process of the focused window runs at the top level, with a long slice, to stay responsive.
+//  - The nice value of the process shifts the level it runs at.
+//  - Every SCHEDULER_BOOST_PERIOD_MS all the processes go back to the top level, so none starves.
+#define SCHEDULER_LEVEL_COUNT 4
+#define SCHEDULER_DEFAULT_TIME_SLICE_MS 8
+#define SCHEDULER_FOCUSED_TIME_SLICE_FACTOR 4
+#define SCHEDULER_NICE_PER_LEVEL 5
+#define SCHEDULER_BOOST_PERIOD_MS 1000
+
+// When the timer fires in the kernel after the time slice ended, the process can't be preempted until
+//  it's back in usermode. Try again after this long, instead of flooding the CPU with interrupts.
+#define SCHEDULER_PREEMPT_RETRY_MS 4
+
+static uint64_t g_time_slice_ms = SCHEDULER_DEFAULT_TIME_SLICE_MS; // Of the top level, doubles with every level down.
+static uint64_t g_last_boost_ms;
+static bool g_is_enabled;
+
+static bool scheduler_is_focused(const PCB *pcb)
 {
-    if (g_io_head == NULL)
+    return pcb->window != NULL && pcb->window == g_focused_window;
+}
+
+static uint8_t scheduler_effective_level(const PCB *pcb)
+{
+    if (scheduler_is_focused(pcb))
+    {
+        return 0;
+    }
+
+    int level = (int)pcb->priority_level + pcb->nice / SCHEDULER_NICE_PER_LEVEL;
+    if (level < 0)
+    {
+        return 0;
+    }
+    if (level >= SCHEDULER_LEVEL_COUNT)
+    {
+        return SCHEDULER_LEVEL_COUNT - 1;
+    }
+
+    return level;
+}
+
+static uint64_t scheduler_time_slice_ms(const PCB *pcb)
+{
+    if (scheduler_is_focused(pcb))
+    {
+        return g_time_slice_ms * SCHEDULER_FOCUSED_TIME_SLICE_FACTOR;
+    }
+
+    return g_time_slice_ms << scheduler_effective_level(pcb);
+}
+
+static void scheduler_boost_all_if_due()
+{
+    uint64_t now = pit_ms_counter();
+    if (now - g_last_boost_ms < SCHEDULER_BOOST_PERIOD_MS)
+    {
+        return;
+    }
+    g_last_boost_ms = now;
+
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        CPU *cpu = &g_cpus[i];
+        if (cpu->process_queue_tail == NULL)
+        {
+            continue;
+        }
+
+        for (PCB *it = cpu->current_process; it != NULL; it = it->queue_next)
+        {
+            it->priority_level = 0;
+        }
+    }
+
+    for (PCB *it = g_io_head; it != NULL; it = it->queue_next)
+    {
+        it->priority_level = 0;
+    }
+}
+
+// Move the process with the highest priority in the queue of the CPU, which starts at `head`, to the head.
+//  The queue is round robin, so the first one of a level is the one that waited the longest.
+//  Returns the new head.
+static PCB *scheduler_queue_take_best(CPU *cpu, PCB *head)
+{
+    if (head == NULL)
     {
         return NULL;
     }
 
+    PCB *best = head;
+    PCB *best_prev = NULL;
+    uint8_t best_level = scheduler_effective_level(head);
+    for (PCB *prev = head, *it = head->queue_next; it != NULL && best_level > 0; prev = it, it = it->queue_next)
+    {
+        uint8_t level = scheduler_effective_level(it);
+        if (level < best_level)
+        {
+            best = it;
+            best_prev = prev;
+            best_level = level;
+        }
+    }
+
+    if (best == head)
+    {
+        return head;
+    }
+
+    best_prev->queue_next = best->queue_next;
+    if (best == cpu->process_queue_tail)
+    {
+        cpu->process_queue_tail = best_prev;
+    }
+    best->queue_next = head;
+
+    return best;
+}
+
+// Whether there's any process left, running or waiting, on any CPU.
+static bool scheduler_has_processes()
+{
+    if (g_io_head != NULL)
+    {
+        return true;
+    }
+
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        if (g_cpus[i].process_queue_tail != NULL)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Wake a halted CPU, if there's one, to take the work that's waiting.
+static void scheduler_wake_idle_cpu()
+{
+    CPU *self = cpu_current();
+
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        CPU *cpu = &g_cpus[i];
+        if (cpu != self && cpu->is_online && cpu->is_idle)
+        {
+            lapic_send_ipi(cpu->lapic_id, LAPIC_VECTOR_WAKEUP);
+            return;
+        }
+    }
+}
+
+// Take a process that waits for its turn in the queue of another CPU, and move it to ours.
+static PCB *scheduler_steal_process()
+{
+    CPU *thief = cpu_current();
+
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        CPU *victim = &g_cpus[i];
+        if (victim == thief || !victim->is_online)
+        {
+            continue;
+        }
+
+        // The head is running on the victim, only the ones after it are free to take.
+        PCB *head = victim->current_process;
+        if (victim->process_queue_tail == NULL || head == victim->process_queue_tail)
+        {
+            continue;
+        }
+
+        PCB *stolen = head->queue_next;
+        head->queue_next = stolen->queue_next;
+        if (stolen == victim->process_queue_tail)
+        {
+            victim->process_queue_tail = head;
+        }
+
+        scheduler_process_enqueue(stolen);
+        return stolen;
+    }
+
+    return NULL;
+}
+
+// Halt until there's a process for this CPU to run. Returns NULL if there are no processes left at all.
+static PCB *wait_until_a_process_is_ready()
+{
+    CPU *cpu = cpu_current();
+    uint64_t idle_start = pit_ms_counter();
+
     PCB *pcb = NULL;
-    while ((pcb = scheduler_io_refresh()) == NULL)
-        continue;
+    while ((pcb = scheduler_io_refresh()) == NULL && (pcb = scheduler_steal_process()) == NULL)
+    {
+        if (!scheduler_has_processes())
+        {
+            return NULL;
+        }
 
-    return pcb;
+        // The tables we have loaded may be of a process that another CPU frees meanwhile.
+        mmu_load_virt_pml4(g_kernel_pml4);
+
+        // Only an interrupt can wake an IO operation now, so sleep until one arrives: a device,
+        //  the timer of the next deadline, or LAPIC_VECTOR_WAKEUP once another CPU has work for us.
+        //  The other CPUs may need the kernel meanwhile.
+        //  `sti` takes effect only after `hlt`, so an interrupt can't sneak in between and leave us halted.
+        cpu->is_idle = true;
+        scheduler_arm_tick();
+        kernel_lock_release_all();
+        asm volatile("sti\n"
+                     "hlt\n"
+                     "cli" ::: "memory");
+        kernel_lock_acquire();
+    }
+
+    cpu->is_idle = false;
+    cpu->idle_ms += pit_ms_counter() - idle_start;
+
+    return scheduler_queue_take_best(cpu, pcb);
+}
+
+static void scheduler_send_eoi(int pic_number)
+{
+    if (pic_number == SCHEDULER_LAPIC_INTERRUPT)
+    {
+        lapic_send_eoi();
+    }
+    else if (pic_number != SCHEDULER_NOT_A_PIC_INTERRUPT)
+    {
+        pic_send_EOI(pic_number);
+    }
+}
+
+// Remove the running process from the head of the queue of the CPU.
+//  Returns the next process to run, NULL if the queue is now empty.
+static PCB *scheduler_dequeue_current(CPU *cpu)
+{
+    PCB *current = cpu->current_process;
+
+    if (current == cpu->process_queue_tail)
+    {
+        cpu->process_queue_tail = NULL;
+        return NULL;
+    }
+
+    PCB *next = current->queue_next;
+    current->queue_next = NULL;
+
+    return scheduler_queue_take_best(cpu, next);
 }
 
 void scheduler_io_push(PCB *pcb, pcb_IORefresh refresh_func)
@@ -85,18 +344,70 @@ void scheduler_io_remove(PCB *pcb)
     next->queue_prev = prev;
 }
 
+void scheduler_io_wake(PCB *pcb)
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+    defer({ set_cpu_flags(flags); });
+
+    if (pcb->is_io_woken)
+    {
+        return;
+    }
+
+    pcb->is_io_woken = true;
+    pcb->io_woken_next = NULL;
+
+    if (g_io_woken_tail != NULL)
+    {
+        g_io_woken_tail->io_woken_next = pcb;
+    }
+    else
+    {
+        g_io_woken_head = pcb;
+    }
+    g_io_woken_tail = pcb;
+
+    // It's refreshed by an idle CPU, or by us once the current time slice ends.
+    scheduler_wake_idle_cpu();
+    scheduler_arm_tick();
+}
+
 PCB *scheduler_io_refresh()
 {
+    uint64_t flags = get_cpu_flags();
+    cli();
+    defer({ set_cpu_flags(flags); });
+
+    PCB *woken = g_io_woken_head;
+    g_io_woken_head = NULL;
+    g_io_woken_tail = NULL;
+
     PCB *first_rescheduled = NULL;
-    for (PCB *it = g_io_head; it != NULL;)
+    for (PCB *it = woken; it != NULL;)
     {
-        PCB *next = it->queue_next;
+        PCB *next = it->io_woken_next;
+        it->io_woken_next = NULL;
+        it->is_io_woken = false;
+
+        if (it->state != PCB_STATE_WAITING_FOR_IO)
+        {
+            // Was woken again by a refresh of a process before it, after it was already rescheduled.
+            it = next;
+            continue;
+        }
 
         assert(it->refresh);
         mmu_load_virt_pml4(it->paging);
         if (it->refresh(it) == PCB_IO_REFRESH_DONE)
         {
-            first_rescheduled = it;
+            if (first_rescheduled == NULL)
+            {
+                first_rescheduled = it;
+            }
+            it->state = PCB_STATE_READY;
+            timer_cancel(&it->io_timer);
+            wait_queue_remove(&it->wait_entry);
             scheduler_io_remove(it);
             scheduler_process_enqueue(it);
         }
@@ -107,18 +418,59 @@ PCB *scheduler_io_refresh()
     return first_rescheduled;
 }
 
+uint64_t scheduler_idle_ms()
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        total += g_cpus[i].idle_ms;
+    }
+
+    return total / cpu_count();
+}
+
+void scheduler_account_time(bool was_in_usermode)
+{
+    CPU *cpu = cpu_current();
+    const uint64_t now = __builtin_ia32_rdtsc();
+
+    PCB *pcb = cpu->accounted_process;
+    if (pcb != NULL)
+    {
+        const uint64_t elapsed = now - cpu->accounted_since_tsc;
+        if (was_in_usermode)
+        {
+            pcb->stats.user_cycles += elapsed;
+        }
+        else
+        {
+            pcb->stats.kernel_cycles += elapsed;
+        }
+    }
+
+    cpu->accounted_since_tsc = now;
+}
+
 PCB *scheduler_current_pcb()
 {
-    return g_current_process;
+    return cpu_current()->current_process;
 }
 
 void scheduler_context_switch_to(PCB *pcb, int pic_number)
 {
     asm volatile("clac" ::: "memory"); // Ensure we are never returning to usermode with AC set.
 
+    scheduler_send_eoi(pic_number);
+
+    fpu_switch_out(pcb != NULL ? &pcb->fpu : NULL);
+
+    // The time until the process we switch to runs isn't charged to anyone, so idling isn't either.
+    scheduler_account_time(false);
+    cpu_current()->accounted_process = NULL;
+
     if (pcb == NULL)
     {
-        pcb = wait_until_one_IO_is_ready();
+        pcb = wait_until_a_process_is_ready();
         if (pcb == NULL)
         {
             assert(false && "No processes left to run; shutdown");
@@ -128,37 +480,67 @@ void scheduler_context_switch_to(PCB *pcb, int pic_number)
     }
     assert(pcb != NULL);
 
-    g_current_process = pcb;
+    CPU *cpu = cpu_current();
+
+    // A process that never stopped running (its IO was already done) continues its time slice.
+    if (pcb != cpu->current_process || pcb->state != PCB_STATE_RUNNING)
+    {
+        cpu->should_preempt = false;
+        cpu->slice_start_ms = pit_ms_counter();
+    }
+    cpu->current_process = pcb;
+    cpu->accounted_process = pcb;
+    cpu->accounted_since_tsc = __builtin_ia32_rdtsc();
 
     pcb->state = PCB_STATE_RUNNING;
     mmu_load_virt_pml4(pcb->paging);
 
-    if (pic_number != SCHEDULER_NOT_A_PIC_INTERRUPT) pic_send_EOI(pic_number);
+    scheduler_arm_tick();
+
+    // The kernel stack is abandoned, and with it whatever depth of the kernel lock we had.
+    cli();
+    kernel_lock_release_all();
 
     usermode_jump_to((void *)pcb->rip, &pcb->regs);
 }
 
 void scheduler_process_enqueue(PCB *pcb)
 {
+    CPU *cpu = cpu_current();
+
     pcb->queue_next = NULL;
-    if (g_process_queue_tail == NULL)
+    if (cpu->process_queue_tail == NULL)
     {
-        g_process_queue_tail = pcb;
+        cpu->current_process = pcb; // The queue is empty, it's the new head.
     }
+    else
+    {
+        cpu->process_queue_tail->queue_next = pcb;
+    }
+
+    cpu->process_queue_tail = pcb;
 
-    g_process_queue_tail->queue_next = pcb;
-    g_process_queue_tail = pcb;
+    if (cpu->current_process != pcb)
+    {
+        // There's a process waiting for its turn.
+        scheduler_wake_idle_cpu();
+    }
 }
 
 PCB *scheduler_get_next_process_and_requeue_current()
 {
+    CPU *cpu = cpu_current();
+
+    scheduler_boost_all_if_due();
+
     // When there's only one process is the queue, will always return it.
-    g_process_queue_tail->queue_next = g_current_process;
-    g_process_queue_tail = g_current_process;
-    PCB *next_pcb = g_current_process->queue_next;
-    g_current_process->queue_next = NULL;
+    cpu->process_queue_tail->queue_next = cpu->current_process;
+    cpu->process_queue_tail = cpu->current_process;
+    PCB *next_pcb = cpu->current_process->queue_next;
+    cpu->current_process->queue_next = NULL;
 
     assert(next_pcb != NULL);
+    next_pcb = scheduler_queue_take_best(cpu, next_pcb);
 
     return next_pcb;
 }
@@ -168,43 +550,88 @@ void scheduler_context_switch_from(Regs *regs, isr_InterruptFrame *frame, int pi
     regs->rflags = frame->flags;
     regs->rsp = frame->rsp;
 
-    assert(g_process_queue_tail != NULL);
-    assert(g_current_process    != NULL);
+    if (!kernel_lock_try_acquire())
+    {
+        // Another CPU is in the kernel. Don't wait for it in an interrupt, let the process run until the next tick.
+        scheduler_send_eoi(pic_number);
+        usermode_jump_to((void *)frame->rip, regs);
+    }
+
+    scheduler_account_time(true);
+
+    CPU *cpu = cpu_current();
+    assert(cpu->process_queue_tail != NULL);
+    assert(cpu->current_process    != NULL);
 
     // While we are here, refresh IO
     scheduler_io_refresh();
 
-    PCB *pcb = g_current_process;
+    PCB *pcb = cpu->current_process;
 
     pcb->rip = frame->rip;
     pcb->regs = *regs;
     pcb->state = PCB_STATE_READY;
 
+    // Used its whole time slice.
+    if (pcb->priority_level < SCHEDULER_LEVEL_COUNT - 1)
+    {
+        pcb->priority_level++;
+    }
 
     PCB *next_pcb = scheduler_get_next_process_and_requeue_current();
+    if (next_pcb != pcb)
+    {
+        pcb->stats.involuntary_switches++;
+    }
     scheduler_context_switch_to(next_pcb, pic_number);
 }
 
-void scheduler_move_current_process_to_io_queue_and_context_switch(pcb_IORefresh refresh_func)
+void scheduler_move_current_process_to_io_queue_and_context_switch(WaitQueue *queue, pcb_IORefresh refresh_func, uint64_t deadline_ms)
 {
-    assert(g_current_process != NULL);
+    // The wait queues are woken from ISRs. Must not miss a wake up between the
+    //  first refresh and getting into the queue.
+    cli();
 
-    PCB *target = g_current_process;
-    PCB *next_pcb = g_current_process->queue_next;
+    CPU *cpu = cpu_current();
+    assert(cpu->current_process != NULL);
 
-    // It's OK if next_pcb is null.
+    PCB *target = cpu->current_process;
+    target->io_timed_out = deadline_ms <= pit_ms_counter();
 
-    if (next_pcb == g_current_process)
+    if (refresh_func(target) == PCB_IO_REFRESH_DONE)
     {
-        next_pcb = NULL;
+        // Already done, no need to block.
+        scheduler_context_switch_to(target, SCHEDULER_NOT_A_PIC_INTERRUPT);
     }
 
-    if (target == g_process_queue_tail)
+    target->stats.voluntary_switches++;
+
+    // Gave up the CPU early, so it's probably IO-bound.
+    if (pit_ms_counter() - cpu->slice_start_ms < scheduler_time_slice_ms(target) / 2 && target->priority_level > 0)
     {
-        g_process_queue_tail = NULL;
+        target->priority_level--;
     }
 
+    PCB *next_pcb = scheduler_dequeue_current(cpu);
+    // It's OK if next_pcb is null.
+
+    target->state = PCB_STATE_WAITING_FOR_IO;
     scheduler_io_push(target, refresh_func);
+    if (queue != NULL)
+    {
+        wait_queue_push(queue, &target->wait_entry);
+    }
+
+    if (deadline_ms != SCHEDULER_NO_DEADLINE)
+    {
+        res rs = timer_arm(&target->io_timer, deadline_ms);
+        if (IS_ERR(rs))
+        {
+            // We can't wait for the deadline, so let it pass right away.
+            target->io_timed_out = true;
+            scheduler_io_wake(target);
+        }
+    }
 
     scheduler_context_switch_to(next_pcb, SCHEDULER_NOT_A_PIC_INTERRUPT);
 
@@ -213,88 +640,150 @@ void scheduler_move_current_process_to_io_queue_and_context_switch(pcb_IORefresh
 
 void scheduler_process_dequeue_current_and_context_switch()
 {
-    PCB *next_pcb = g_current_process->queue_next;
+    CPU *cpu = cpu_current();
+    PCB *pcb = cpu->current_process;
+
+    PCB *next_pcb = scheduler_dequeue_current(cpu);
     // It's OK if next_pcb is NULL.
 
-    if (next_pcb == g_current_process)
+    pcb->state = PCB_STATE_ZOMBIE;
+    file_descriptor_hashmap_cleanup(&pcb->fd_map); // Closed now and not once reaped, so the other end of a pipe sees we are gone.
+    wait_queue_wake_all(&pcb->exit_wait_queue);
+    if (pcb->parent == NULL)
     {
-        next_pcb = NULL;
+        // Its tables are freed, and may be handed out again right away, so they must not stay loaded.
+        mmu_load_virt_pml4(g_kernel_pml4);
+        cpu->pml4 = g_kernel_pml4;
+        PCB_cleanup(pcb);
     }
 
-    g_current_process->state = PCB_STATE_ZOMBIE;
-    if (g_current_process->parent == NULL)
+    scheduler_context_switch_to(next_pcb, SCHEDULER_NOT_A_PIC_INTERRUPT);
+}
+
+void scheduler_tick(isr_InterruptFrame *frame)
+{
+    CPU *cpu = cpu_current();
+    if (cpu->process_queue_tail == NULL)
     {
-        PCB_cleanup(g_current_process);
+        cpu->should_preempt = false; // Idle, nothing to preempt.
+        return;
     }
 
-    scheduler_context_switch_to(next_pcb, SCHEDULER_NOT_A_PIC_INTERRUPT);
+    cpu->should_preempt = pit_ms_counter() - cpu->slice_start_ms >= scheduler_time_slice_ms(cpu->current_process);
+}
+
+void scheduler_arm_tick()
+{
+    CPU *cpu = cpu_current();
+
+    uint64_t deadline = g_timer_next_deadline_ms;
+
+    // Preempt only if there's another process that may want the CPU.
+    const bool is_running = cpu->process_queue_tail != NULL;
+    const bool has_waiting = is_running && (cpu->current_process != cpu->process_queue_tail || g_io_woken_head != NULL);
+    if (g_is_enabled && has_waiting)
+    {
+        uint64_t slice_end = cpu->slice_start_ms + scheduler_time_slice_ms(cpu->current_process);
+        uint64_t earliest_retry = pit_ms_counter() + SCHEDULER_PREEMPT_RETRY_MS;
+        if (cpu->should_preempt && slice_end < earliest_retry)
+        {
+            slice_end = earliest_retry;
+        }
+
+        if (slice_end < deadline)
+        {
+            deadline = slice_end;
+        }
+    }
+
+    lapic_timer_arm(deadline);
+}
+
+void scheduler_set_time_slice_ms(uint64_t time_slice_ms)
+{
+    assert(time_slice_ms > 0);
+
+    g_time_slice_ms = time_slice_ms;
+}
+
+int scheduler_renice_current(int increment)
+{
+    PCB *pcb = scheduler_current_pcb();
+
+    int nice = pcb->nice + increment;
+    if (nice < PCB_NICE_MIN)
+    {
+        nice = PCB_NICE_MIN;
+    }
+    if (nice > PCB_NICE_MAX)
+    {
+        nice = PCB_NICE_MAX;
+    }
+
+    pcb->nice = nice;
+    return nice;
 }
 
 void scheduler_enable()
 {
+    g_is_enabled = true;
     pit_enable_special_event();
 }
 
 void scheduler_disable()
 {
+    g_is_enabled = false;
     pit_disable_special_event();
 }
 
 void scheduler_start()
 {
-    assert(g_process_queue_tail != NULL);
+    CPU *cpu = cpu_current();
+    assert(cpu->process_queue_tail != NULL);
 
     scheduler_enable();
-    scheduler_context_switch_to(g_process_queue_tail, SCHEDULER_NOT_A_PIC_INTERRUPT);
+    scheduler_context_switch_to(cpu->process_queue_tail, SCHEDULER_NOT_A_PIC_INTERRUPT);
+}
+
+void scheduler_start_ap()
+{
+    kernel_lock_acquire();
+
+    // Nothing to run yet, wait for work to steal.
+    scheduler_context_switch_to(NULL, SCHEDULER_NOT_A_PIC_INTERRUPT);
 }
 
 PCB *scheduler_find_by_pid(uint64_t pid)
 {
-    for (PCB *it = g_current_process; it != NULL; it = it->queue_next)
+    PCB *pcb = pcb_find_by_pid(pid);
+    if (pcb == NULL || pcb->state == PCB_STATE_ZOMBIE)
     {
-        if (it->id == pid)
-        {
-            return it;
-        }
+        return NULL; // Zombies are not scheduled anymore.
     }
 
-    for (PCB *it = g_io_head; it != NULL; it = it->queue_next)
-    {
-        if (it->id == pid)
-        {
-            return it;
-        }
-    }
+    return pcb;
+}
 
-    return NULL;
+static void scheduler_process_info_fill(ProcessInfo *info, const PCB *pcb)
+{
+    info->pid = pcb->id;
+    strncpy(info->name, pcb->exe_path, PROCESS_NAME_MAX_LEN);
+    strncpy(info->cwd, pcb->cwd, sizeof(info->cwd));
+    info->state = pcb->state;
+    info->stats = pcb->stats;
 }
 
 int scheduler_get_all_processes(ProcessInfo *out, int max)
 {
-    int count = 0;
+    // We hold the kernel lock, so no process is created or exits while we iterate.
+    assert(kernel_lock_is_held());
 
-    PCB *cur = g_current_process;
-    while (cur && count < max)
-    {
-        out[count].pid = cur->id;
-        strncpy(out[count].name, cur->exe_path, PROCESS_NAME_MAX_LEN);
-        strncpy(out[count].cwd, cur->cwd, sizeof(out[count].cwd));
-        out[count].state = cur->state;
-        count++;
-
-        cur = cur->queue_next;
-    }
-
-    PCB *io = g_io_head;
-    while (io && count < max)
+    int count = 0;
+    size_t cursor = 0;
+    for (PCB *pcb = pcb_next(&cursor); pcb != NULL && count < max; pcb = pcb_next(&cursor))
     {
-        out[count].pid = io->id;
-        strncpy(out[count].name, io->exe_path, PROCESS_NAME_MAX_LEN);
-        strncpy(out[count].cwd, io->cwd, sizeof(out[count].cwd));
-        out[count].state = io->state;
+        scheduler_process_info_fill(&out[count], pcb);
         count++;
-
-        io = io->queue_next;
     }
 
     return count;
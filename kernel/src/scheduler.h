@@ -2,17 +2,22 @@
 
 #include "isr.h"
 #include "pcb.h"
+#include "wait_queue.h"
 
 #define SCHEDULER_NOT_A_PIC_INTERRUPT -1
+#define SCHEDULER_LAPIC_INTERRUPT -2 // Used as a `pic_number`, for interrupts that need an EOI to the LAPIC instead.
+#define SCHEDULER_NO_DEADLINE UINT64_MAX
 
 
 #define PROCESS_NAME_MAX_LEN 32
 
+// NOTE: must match the libc definition.
 typedef struct {
     uint64_t pid;
     char cwd[50];
     char name[PROCESS_NAME_MAX_LEN];
     int state;
+    pcb_Stats stats;
 } ProcessInfo;
 
 /**
@@ -20,7 +25,8 @@ typedef struct {
  *
  * @param pcb - The PCB of the process to context switch to.
  * @param pic_number - If the request comes from a PIC interrupt, must be set to the
- *                          number of the PIC interrupt. Otherwise, set to SCHEDULER_NOT_A_PIC_INTERRUPT.
+ *                          number of the PIC interrupt. Otherwise, set to SCHEDULER_NOT_A_PIC_INTERRUPT
+ *                          (or SCHEDULER_LAPIC_INTERRUPT).
  */
 void scheduler_context_switch_to(PCB *pcb, int pic_number) __attribute__((noreturn));
 
@@ -37,7 +43,35 @@ void scheduler_context_switch_to(PCB *pcb, int pic_number) __attribute__((noretu
 void scheduler_context_switch_from(Regs *regs, isr_InterruptFrame *frame, int pic_number) __attribute__((used, sysv_abi)) __attribute__((noreturn));
 
 /**
- * @brief - Adds the process described by the PCB to the process queue.
+ * @brief - Account a timer tick of the current CPU, setting its `should_preempt`
+ *            once the current process used its time slice.
+ *          Called from the timer ISRs without the kernel lock, so touches only the data of the current CPU.
+ *
+ * @see isr_trampoline_without_lock
+ */
+void scheduler_tick(isr_InterruptFrame *frame) __attribute__((used, sysv_abi));
+
+/**
+ * @brief - Arm the timer of the current CPU for its next deadline: the earliest timer
+ *            (@see timer.h), or the end of the time slice of the current process, if
+ *            another process waits for the CPU. With neither, the CPU gets no timer interrupts.
+ */
+void scheduler_arm_tick();
+
+/**
+ * @brief - Set the time slice of the processes with the highest priority. The lower the priority, the longer the slice.
+ */
+void scheduler_set_time_slice_ms(uint64_t time_slice_ms);
+
+/**
+ * @brief - Add `increment` to the nice value of the current process, clamped to PCB_NICE_MIN..PCB_NICE_MAX.
+ *
+ * @return - The new nice value.
+ */
+int scheduler_renice_current(int increment);
+
+/**
+ * @brief - Adds the process described by the PCB to the process queue of the current CPU.
  *
  * @param pcb - The PCB of the process to enqueue.
  */
@@ -52,6 +86,18 @@ void scheduler_process_enqueue(PCB *pcb);
  */
 void scheduler_start() __attribute__((noreturn));
 
+/**
+ * @brief - Start scheduling on an application processor. Its queue starts empty,
+ *            so it waits for processes it can steal from the other CPUs. Doesn't return.
+ */
+void scheduler_start_ap() __attribute__((noreturn));
+
+/**
+ * @brief - Get the total time, in milliseconds, the CPUs were halted because no process was ready to run.
+ *            Averaged over the online CPUs.
+ */
+uint64_t scheduler_idle_ms();
+
 /**
  * @brief Get the PCB of the current running process.
  */
@@ -82,23 +128,53 @@ void scheduler_io_push(PCB *pcb, pcb_IORefresh refresh_func);
 void scheduler_io_remove(PCB *pcb);
 
 /**
- * @brief Refresh the IO list by going over each element and checking if the IO
+ * @brief - Mark a process from the IO list as needing a refresh. It will be
+ *            refreshed on the next context switch.
+ *          Safe to call from an ISR.
+ *
+ * @see wait_queue_wake_all
+ */
+void scheduler_io_wake(PCB *pcb);
+
+/**
+ * @brief Refresh the woken processes of the IO list by checking if their IO
  *          operation is complete. If it is, the PCB is rescheduled to the process
  *          queue.
+ *        Processes that were not woken are not touched.
  *
  * @return pointer to the first PCB rescheduled, if any. NULL otherwise.
  */
 PCB *scheduler_io_refresh();
 
-void scheduler_move_current_process_to_io_queue_and_context_switch(pcb_IORefresh refresh_func) __attribute__((noreturn));
+/**
+ * @brief - Block the current process until its IO operation completes, and context switch to the next one.
+ *          The refresh function is called right away, and then every time `queue` is woken,
+ *            until it returns PCB_IO_REFRESH_DONE.
+ *
+ * @param queue - The wait queue to block on. May be NULL if the process is woken
+ *                  directly with scheduler_io_wake, or only by the deadline.
+ * @param refresh_func - The function to refresh the PCB with.
+ * @param deadline_ms - When pit_ms_counter() reaches it, the process is woken with
+ *                        `io_timed_out` set, and its refresh function must finish.
+ *                        SCHEDULER_NO_DEADLINE to wait forever.
+ */
+void scheduler_move_current_process_to_io_queue_and_context_switch(WaitQueue *queue, pcb_IORefresh refresh_func, uint64_t deadline_ms) __attribute__((noreturn));
 
 /**
- * @brief Find a process with the given pid.
+ * @brief Find a process with the given pid, which wasn't terminated yet (not a zombie).
  * @return PCB of that process if found, NULL otherwise.
  */
 PCB *scheduler_find_by_pid(uint64_t pid);
 
+/**
+ * @brief - Fill `out` with a snapshot of up to `max` processes, zombies included.
+ * @return - The amount of processes written to `out`.
+ */
 int scheduler_get_all_processes(ProcessInfo *out, int max);
 
-// WARN: DO NOT MODIFY DIRECTLY! Use scheduler_current_pcb and scheduler_context_switch_to. extern only for the scheduler.
-extern PCB *g_current_process;
+/**
+ * @brief - Charge the time since the last call to the process this CPU runs, as
+ *            usermode time if `was_in_usermode`, otherwise as kernel time.
+ *          Called on every switch between usermode and the kernel.
+ */
+void scheduler_account_time(bool was_in_usermode);
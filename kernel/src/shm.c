@@ -0,0 +1,276 @@
+#include "shm.h"
+#include "kmalloc.h"
+#include "memory.h"
+#include "mmap.h"
+#include "mmu.h"
+#include "pcb.h"
+#include "scheduler.h"
+#include "string.h"
+#include "assert.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct shm_Object {
+    char name[SHM_NAME_MAX_LEN]; // Empty for an anonymous object.
+    uint64_t *pages; // Physical addresses. The object holds a reference to each of them.
+    uint64_t page_count;
+
+    uint32_t references; // Every mapping, and the name while it's linked.
+    bool is_linked;
+    shm_Object *next; // In g_shm_objects, while it's linked.
+};
+
+static shm_Object *g_shm_objects; // The named objects.
+
+static shm_Object *shm_find(const char *name)
+{
+    for (shm_Object *it = g_shm_objects; it != NULL; it = it->next)
+    {
+        if (strcmp(it->name, name) == 0)
+        {
+            return it;
+        }
+    }
+
+    return NULL;
+}
+
+static void shm_object_unref(shm_Object *object)
+{
+    assert(object->references > 0);
+    object->references--;
+    if (object->references > 0)
+    {
+        return;
+    }
+
+    assert(!object->is_linked);
+
+    for (uint64_t i = 0; i < object->page_count; i++)
+    {
+        mmap_phys_page_unref(object->pages[i]); // Freed here, unless a process still maps it.
+    }
+
+    kfree(object->pages);
+    kfree(object);
+}
+
+// Returns an object without any references, or NULL if ran out of memory.
+static shm_Object *shm_object_create(uint64_t page_count)
+{
+    shm_Object *object = kcalloc(1, sizeof(*object));
+    if (object == NULL)
+    {
+        return NULL;
+    }
+
+    object->pages = kcalloc(page_count, sizeof(*object->pages));
+    if (object->pages == NULL)
+    {
+        kfree(object);
+        return NULL;
+    }
+
+    for (; object->page_count < page_count; object->page_count++)
+    {
+        if (!mmap_allocate_zeroed_page(&object->pages[object->page_count]))
+        {
+            object->references = 1;
+            shm_object_unref(object); // Frees the pages allocated so far.
+            return NULL;
+        }
+    }
+
+    return object;
+}
+
+/**
+ * @brief - Find the lowest free addresses of `size` for a mapping in `pcb`.
+ *
+ * @param out_link[out] - Where in `pcb->shm_mappings` the mapping goes, to keep them sorted.
+ */
+static bool shm_find_room(PCB *pcb, uint64_t size, uint64_t *out_address, shm_Mapping ***out_link)
+{
+    uint64_t address = SHM_ADDRESS_BEGIN;
+    shm_Mapping **link = &pcb->shm_mappings;
+    while (*link != NULL && (*link)->address < address + size)
+    {
+        address = (*link)->address + (*link)->size;
+        link = &(*link)->next;
+    }
+
+    if (address + size > SHM_ADDRESS_END)
+    {
+        return false;
+    }
+
+    *out_address = address;
+    *out_link = link;
+    return true;
+}
+
+res shm_map(const char *name, uint64_t size, uint64_t *out_address)
+{
+    if (size == 0 || size > SHM_MAX_SIZE)
+    {
+        return res_shm_INVALID_SIZE;
+    }
+    size = PAGE_ALIGN_UP(size);
+
+    shm_Object *object = name != NULL ? shm_find(name) : NULL;
+    if (object != NULL && size > object->page_count * PAGE_SIZE)
+    {
+        return res_shm_INVALID_SIZE;
+    }
+
+    PCB *pcb = scheduler_current_pcb();
+
+    uint64_t address;
+    shm_Mapping **link;
+    if (!shm_find_room(pcb, size, &address, &link))
+    {
+        return res_shm_OUT_OF_ADDRESSES;
+    }
+
+    shm_Mapping *mapping = kcalloc(1, sizeof(*mapping));
+    if (mapping == NULL)
+    {
+        return res_shm_OUT_OF_MEMORY;
+    }
+
+    if (object == NULL)
+    {
+        object = shm_object_create(size / PAGE_SIZE);
+        if (object == NULL)
+        {
+            kfree(mapping);
+            return res_shm_OUT_OF_MEMORY;
+        }
+
+        if (name != NULL)
+        {
+            strncpy(object->name, name, sizeof(object->name) - 1);
+            object->is_linked = true;
+            object->references++;
+            object->next = g_shm_objects;
+            g_shm_objects = object;
+        }
+    }
+    object->references++;
+
+    for (uint64_t i = 0; i < size / PAGE_SIZE; i++)
+    {
+        const uint64_t page_address = address + i * PAGE_SIZE;
+        mmu_map_range(object->pages[i], object->pages[i] + PAGE_SIZE, page_address, MMU_READ_WRITE | MMU_USER_PAGE | MMU_EXECUTE_DISABLE);
+
+        mmu_PageTableEntry *page = mmu_page_existing((void *)page_address);
+        page->shared = 1;
+        page->copy_on_write = 0;
+        mmap_phys_page_ref(object->pages[i]);
+    }
+
+    mapping->object = object;
+    mapping->address = address;
+    mapping->size = size;
+    mapping->next = *link;
+    *link = mapping;
+
+    *out_address = address;
+    return res_OK;
+}
+
+res shm_unmap(uint64_t address)
+{
+    PCB *pcb = scheduler_current_pcb();
+
+    shm_Mapping **link = &pcb->shm_mappings;
+    while (*link != NULL && (*link)->address != address)
+    {
+        link = &(*link)->next;
+    }
+
+    shm_Mapping *mapping = *link;
+    if (mapping == NULL)
+    {
+        return res_shm_NOT_FOUND;
+    }
+
+    for (uint64_t it = mapping->address; it < mapping->address + mapping->size; it += PAGE_SIZE)
+    {
+        mmu_PageTableEntry *page = mmu_page_existing((void *)it);
+        const uint64_t phys = mmu_page_table_entry_address_get(page);
+
+        page->present = 0;
+        page->shared = 0;
+        mmu_tlb_flush((void *)it);
+
+        mmap_phys_page_unref(phys);
+    }
+
+    *link = mapping->next;
+    shm_object_unref(mapping->object);
+    kfree(mapping);
+
+    return res_OK;
+}
+
+res shm_unlink(const char *name)
+{
+    shm_Object **link = &g_shm_objects;
+    while (*link != NULL && strcmp((*link)->name, name) != 0)
+    {
+        link = &(*link)->next;
+    }
+
+    shm_Object *object = *link;
+    if (object == NULL)
+    {
+        return res_shm_NOT_FOUND;
+    }
+
+    *link = object->next;
+    object->next = NULL;
+    object->is_linked = false;
+    shm_object_unref(object);
+
+    return res_OK;
+}
+
+bool shm_fork(PCB *child, PCB *parent)
+{
+    assert(child->shm_mappings == NULL);
+
+    shm_Mapping **tail = &child->shm_mappings;
+    for (shm_Mapping *it = parent->shm_mappings; it != NULL; it = it->next)
+    {
+        shm_Mapping *mapping = kcalloc(1, sizeof(*mapping));
+        if (mapping == NULL)
+        {
+            return false; // The child is cleaned up along with whatever it already has.
+        }
+
+        *mapping = *it;
+        mapping->next = NULL;
+        mapping->object->references++;
+
+        *tail = mapping;
+        tail = &mapping->next;
+    }
+
+    return true;
+}
+
+void shm_detach_all(PCB *pcb)
+{
+    shm_Mapping *it = pcb->shm_mappings;
+    while (it != NULL)
+    {
+        shm_Mapping *next = it->next;
+        shm_object_unref(it->object);
+        kfree(it);
+        it = next;
+    }
+
+    pcb->shm_mappings = NULL;
+}
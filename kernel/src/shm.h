@@ -0,0 +1,68 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include "res.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Shared memory: a kernel object holding a list of physical pages, which several processes
+//  map at once. A named object is found by its name until it's unlinked, an anonymous one
+//  is shared only with the children forked after it was mapped.
+//  The object lives while it's mapped somewhere (or while it's named), and every mapping
+//  holds a reference to each of its pages, so they are never copied on write.
+
+typedef struct PCB PCB;
+typedef struct shm_Object shm_Object;
+
+#define SHM_NAME_MAX_LEN 32 // The null terminator included.
+#define SHM_MAX_SIZE (64 * 1024 * 1024)
+
+// Where the objects are mapped in the processes.
+#define SHM_ADDRESS_BEGIN 0x600000000000
+#define SHM_ADDRESS_END   0x700000000000
+
+#define res_shm_OUT_OF_MEMORY       "Ran out of memory for shared memory"
+#define res_shm_INVALID_SIZE        "The size of the shared memory is 0, too large, or larger than the existing object"
+#define res_shm_OUT_OF_ADDRESSES    "No room left for shared memory in the address space"
+#define res_shm_NOT_FOUND           "No shared memory is mapped at the address, or has the name"
+
+// An object mapped in a process. The mappings of a process are sorted by their address.
+typedef struct shm_Mapping {
+    shm_Object *object;
+    uint64_t address;
+    uint64_t size;
+    struct shm_Mapping *next;
+} shm_Mapping;
+
+/**
+ * @brief - Map the shared memory object called `name` into the current process,
+ *            creating it (zeroed) if there's none.
+ *
+ * @param name - The name of the object, or NULL for a new anonymous one.
+ * @param size - The size to map. Rounded up to pages. When creating, it's the size of the object.
+ * @param out_address[out] - Where it was mapped. Readable and writable by usermode.
+ */
+res shm_map(const char *name, uint64_t size, uint64_t *out_address) WUR;
+
+/**
+ * @brief - Unmap the shared memory mapped at `address` (as returned from shm_map) from the current process.
+ */
+res shm_unmap(uint64_t address) WUR;
+
+/**
+ * @brief - Remove the name of the object, so it's freed once it's no longer mapped anywhere.
+ */
+res shm_unlink(const char *name) WUR;
+
+/**
+ * @brief - Give `child` the shared memory mappings of `parent`, whose pages
+ *            it got from pcb_clone_user_pages.
+ *
+ * @return - true on success, false if ran out of memory.
+ */
+bool shm_fork(PCB *child, PCB *parent) WUR;
+
+/**
+ * @brief - Drop the objects mapped by `pcb`. Doesn't touch its pages, which PCB_cleanup releases.
+ */
+void shm_detach_all(PCB *pcb);
@@ -0,0 +1,299 @@
+#include "slab.h"
+#include "cpu.h"
+#include "io.h"
+#include "math.h"
+#include "memory.h"
+#include "mmap.h"
+#include "mmu.h"
+#include "range.h"
+#include "assert.h"
+
+#define PAGE_SIZE 0x1000
+
+#define SLAB_ALIGNMENT 16
+#define SLAB_MAX_ORDER 4 // Slabs of up to 64 KiB.
+#define SLAB_EMPTY_SLABS_MAX 1 // Empty slabs kept for the next allocations, the rest are freed.
+
+// The header at the start of every slab. The objects follow it.
+struct slab_Slab {
+    slab_Slab *next; // The partial list links.
+    slab_Slab *prev;
+    void *free; // The free objects, each holds the address of the next.
+    uint32_t in_use;
+    uint64_t phys;
+};
+
+#define SLAB_OBJECTS_OFFSET math_ALIGN_UP(sizeof(slab_Slab), SLAB_ALIGNMENT)
+
+static slab_Cache *g_caches; // Every cache that was used.
+
+static uint64_t slab_size(const slab_Cache *cache)
+{
+    return PAGE_SIZE << cache->slab_order;
+}
+
+static void slab_cache_init(slab_Cache *cache)
+{
+    cache->object_size = math_ALIGN_UP(MAX(cache->object_size, sizeof(void *)), SLAB_ALIGNMENT);
+
+    cache->slab_order = 0;
+    while (cache->slab_order < SLAB_MAX_ORDER &&
+           (slab_size(cache) - SLAB_OBJECTS_OFFSET) / cache->object_size < SLAB_MIN_OBJECTS_PER_SLAB)
+    {
+        cache->slab_order++;
+    }
+
+    cache->objects_per_slab = (slab_size(cache) - SLAB_OBJECTS_OFFSET) / cache->object_size;
+    assert(cache->objects_per_slab > 0 && "Object too large for a slab");
+
+    cache->next = g_caches;
+    g_caches = cache;
+}
+
+static void slab_partial_push(slab_Cache *cache, slab_Slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial != NULL)
+    {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+static void slab_partial_remove(slab_Cache *cache, slab_Slab *slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        cache->partial = slab->next;
+    }
+
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+}
+
+static bool slab_grow(slab_Cache *cache)
+{
+    uint64_t phys;
+    if (!mmap_allocate_contiguous(slab_size(cache), &phys))
+    {
+        return false;
+    }
+
+    slab_Slab *slab = mmu_phys_to_virt(phys); // Aligned to its size, like any buddy block.
+    *slab = (slab_Slab){.phys = phys};
+
+    uint8_t *objects = (uint8_t *)slab + SLAB_OBJECTS_OFFSET;
+    for (uint32_t i = cache->objects_per_slab; i > 0; i--)
+    {
+        void **object = (void **)(objects + (i - 1) * cache->object_size);
+        *object = slab->free;
+        slab->free = object;
+    }
+
+    slab_partial_push(cache, slab);
+    cache->empty_slab_count++;
+    cache->slab_count++;
+
+    return true;
+}
+
+static void *slab_take_object(slab_Cache *cache)
+{
+    if (cache->partial == NULL && !slab_grow(cache))
+    {
+        return NULL;
+    }
+
+    slab_Slab *slab = cache->partial;
+    void **object = slab->free;
+    slab->free = *object;
+
+    if (slab->in_use == 0)
+    {
+        cache->empty_slab_count--;
+    }
+    slab->in_use++;
+    if (slab->in_use == cache->objects_per_slab)
+    {
+        slab_partial_remove(cache, slab); // Full
+    }
+
+    return object;
+}
+
+static void slab_return_object(slab_Cache *cache, void *object)
+{
+    slab_Slab *slab = (void *)math_ALIGN_DOWN((uint64_t)object, slab_size(cache));
+
+    if (slab->in_use == cache->objects_per_slab)
+    {
+        slab_partial_push(cache, slab); // Was full
+    }
+
+    *(void **)object = slab->free;
+    slab->free = object;
+    slab->in_use--;
+
+    if (slab->in_use != 0)
+    {
+        return;
+    }
+
+    if (cache->empty_slab_count < SLAB_EMPTY_SLABS_MAX)
+    {
+        cache->empty_slab_count++;
+        return;
+    }
+
+    slab_partial_remove(cache, slab);
+    cache->slab_count--;
+    mmap_phys_memory_add(&(range_Range){.begin = slab->phys, .size = slab_size(cache)});
+}
+
+// The magazine of the current CPU. NULL until the CPUs are initialized.
+static slab_Magazine *slab_magazine(slab_Cache *cache)
+{
+    return cpu_count() > 0 ? &cache->magazines[cpu_current()->index] : NULL;
+}
+
+void *slab_alloc(slab_Cache *cache)
+{
+    if (cache->objects_per_slab == 0)
+    {
+        slab_cache_init(cache);
+    }
+
+    void *object;
+    slab_Magazine *magazine = slab_magazine(cache);
+    if (magazine != NULL && magazine->count > 0)
+    {
+        object = magazine->objects[--magazine->count];
+    }
+    else
+    {
+        object = slab_take_object(cache);
+        if (object == NULL)
+        {
+            return NULL;
+        }
+        cache->slab_allocations++;
+    }
+
+    cache->allocations++;
+    memset(object, 0, cache->object_size);
+    return object;
+}
+
+void slab_free(slab_Cache *cache, void *object)
+{
+    if (object == NULL)
+    {
+        return;
+    }
+
+    cache->frees++;
+
+    slab_Magazine *magazine = slab_magazine(cache);
+    if (magazine == NULL)
+    {
+        slab_return_object(cache, object);
+        return;
+    }
+
+    if (magazine->count == SLAB_MAGAZINE_CAPACITY)
+    {
+        // Give the older half back to the slabs.
+        const uint32_t half = SLAB_MAGAZINE_CAPACITY / 2;
+        for (uint32_t i = 0; i < half; i++)
+        {
+            slab_return_object(cache, magazine->objects[i]);
+        }
+        memmove(magazine->objects, magazine->objects + half, (SLAB_MAGAZINE_CAPACITY - half) * sizeof(*magazine->objects));
+        magazine->count -= half;
+    }
+
+    magazine->objects[magazine->count++] = object;
+}
+
+void slab_get_stats(const slab_Cache *cache, slab_Stats *out)
+{
+    *out = (slab_Stats){
+        .object_size = cache->object_size,
+        .objects_per_slab = cache->objects_per_slab,
+        .slab_count = cache->slab_count,
+        .objects_in_use = cache->allocations - cache->frees,
+        .allocations = cache->allocations,
+        .magazine_hits = cache->allocations - cache->slab_allocations,
+    };
+}
+
+void slab_print_stats()
+{
+    for (const slab_Cache *cache = g_caches; cache != NULL; cache = cache->next)
+    {
+        slab_Stats stats;
+        slab_get_stats(cache, &stats);
+        printf("%s: size %lld, in use %lld, slabs %lld, allocations %lld, magazine hits %lld\n",
+               cache->name, (long long)stats.object_size, (long long)stats.objects_in_use,
+               (long long)stats.slab_count, (long long)stats.allocations, (long long)stats.magazine_hits);
+    }
+}
+
+typedef struct {
+    uint64_t values[5];
+} TestSlabObject;
+
+void test_slab()
+{
+    static slab_Cache cache = SLAB_CACHE_INIT("test", TestSlabObject);
+
+#define TEST_SLAB_COUNT 100
+    TestSlabObject *objects[TEST_SLAB_COUNT];
+    for (int i = 0; i < TEST_SLAB_COUNT; i++)
+    {
+        objects[i] = slab_alloc(&cache);
+        assert(objects[i] != NULL);
+        for (int j = 0; j < 5; j++)
+        {
+            assert(objects[i]->values[j] == 0);
+            objects[i]->values[j] = i;
+        }
+    }
+
+    for (int i = 0; i < TEST_SLAB_COUNT; i++)
+    {
+        for (int j = 0; j < 5; j++)
+        {
+            assert(objects[i]->values[j] == (uint64_t)i); // No two overlap
+        }
+    }
+
+    slab_Stats stats;
+    slab_get_stats(&cache, &stats);
+    assert(stats.object_size == 48);
+    assert(stats.objects_in_use == TEST_SLAB_COUNT);
+    assert(stats.slab_count == math_ALIGN_UP(TEST_SLAB_COUNT, stats.objects_per_slab) / stats.objects_per_slab);
+
+    // Freed and allocated again, from the magazine.
+    slab_free(&cache, objects[7]);
+    TestSlabObject *again = slab_alloc(&cache);
+    assert(again == objects[7] && again->values[0] == 0);
+
+    for (int i = 0; i < TEST_SLAB_COUNT; i++)
+    {
+        slab_free(&cache, objects[i]);
+    }
+
+    // Only the objects left in the magazine keep their slabs.
+    slab_get_stats(&cache, &stats);
+    assert(stats.objects_in_use == 0);
+    assert(stats.slab_count <= SLAB_MAGAZINE_CAPACITY + SLAB_EMPTY_SLABS_MAX);
+#undef TEST_SLAB_COUNT
+}
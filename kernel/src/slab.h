@@ -0,0 +1,73 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include "cpu.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A cache of objects of a single type. Objects are carved out of slabs (blocks of
+//  physical pages, reached through the direct map), and every CPU keeps a magazine of
+//  recently freed objects, so most allocations and frees don't touch the slabs at all.
+
+#define SLAB_MAGAZINE_CAPACITY 8
+#define SLAB_MIN_OBJECTS_PER_SLAB 8
+
+typedef struct slab_Slab slab_Slab;
+
+typedef struct {
+    uint32_t count;
+    void *objects[SLAB_MAGAZINE_CAPACITY];
+} slab_Magazine;
+
+typedef struct slab_Cache {
+    const char *name;
+    size_t object_size;
+
+    // Set on the first allocation.
+    uint8_t slab_order; // Every slab is 2^slab_order pages, aligned to its size.
+    uint32_t objects_per_slab;
+    struct slab_Cache *next; // @see slab_print_stats
+
+    slab_Slab *partial; // Slabs with free objects, the empty ones included.
+    uint32_t empty_slab_count;
+    uint64_t slab_count;
+
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t slab_allocations; // Allocations that missed the magazine.
+
+    slab_Magazine magazines[CPU_MAX_COUNT];
+} slab_Cache;
+
+#define SLAB_CACHE_INIT(cache_name, type) { .name = (cache_name), .object_size = sizeof(type) }
+
+typedef struct {
+    size_t object_size;
+    uint32_t objects_per_slab;
+    uint64_t slab_count;
+    uint64_t objects_in_use;
+    uint64_t allocations;
+    uint64_t magazine_hits;
+} slab_Stats;
+
+/**
+ * @brief - Allocate a zeroed object of `cache`.
+ *
+ * @return - The object, or NULL if we ran out of memory.
+ */
+void *slab_alloc(slab_Cache *cache) WUR;
+
+/**
+ * @brief - Free an object allocated from `cache`. If `object` is NULL, does nothing.
+ */
+void slab_free(slab_Cache *cache, void *object);
+
+void slab_get_stats(const slab_Cache *cache, slab_Stats *out);
+
+/**
+ * @brief - Print the stats of every cache that was used.
+ */
+void slab_print_stats();
+
+void test_slab();
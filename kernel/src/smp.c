@@ -0,0 +1,254 @@
+#include "smp.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "lapic.h"
+#include "kernel_lock.h"
+#include "macro_utils.h"
+#include "memory.h"
+#include "mmap.h"
+#include "mmu.h"
+#include "pit.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "usermode.h"
+#include "assert.h"
+#include "io.h"
+#include <cpuid.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SMP_AP_STARTUP_TIMEOUT_MS 100
+
+// Filled by the BSP right after the trampoline, in the same page.
+typedef struct {
+    uint32_t cr0;
+    uint32_t cr3; // Must be below 4 GiB, loaded in protected mode.
+    uint32_t cr4;
+    uint32_t next_index; // Every AP atomically takes an index (and with it a stack) from here, while it's below max_index.
+    uint32_t max_index; // Never changes once the APs start. The BSP closes the trampoline through next_index.
+    uint32_t reserved;
+    uint64_t entry;
+    uint64_t stacks[CPU_MAX_COUNT];
+} SmpTrampolineParams;
+
+// NOTE: the offsets are hardcoded in the trampoline.
+#define SMP_PARAMS_CR0        0
+#define SMP_PARAMS_CR3        4
+#define SMP_PARAMS_CR4        8
+#define SMP_PARAMS_NEXT_INDEX 12
+#define SMP_PARAMS_MAX_INDEX  16
+#define SMP_PARAMS_ENTRY      24
+#define SMP_PARAMS_STACKS     32
+_Static_assert(offsetof(SmpTrampolineParams, cr0) == SMP_PARAMS_CR0, "Update SMP_PARAMS_CR0");
+_Static_assert(offsetof(SmpTrampolineParams, cr3) == SMP_PARAMS_CR3, "Update SMP_PARAMS_CR3");
+_Static_assert(offsetof(SmpTrampolineParams, cr4) == SMP_PARAMS_CR4, "Update SMP_PARAMS_CR4");
+_Static_assert(offsetof(SmpTrampolineParams, next_index) == SMP_PARAMS_NEXT_INDEX, "Update SMP_PARAMS_NEXT_INDEX");
+_Static_assert(offsetof(SmpTrampolineParams, max_index) == SMP_PARAMS_MAX_INDEX, "Update SMP_PARAMS_MAX_INDEX");
+_Static_assert(offsetof(SmpTrampolineParams, entry) == SMP_PARAMS_ENTRY, "Update SMP_PARAMS_ENTRY");
+_Static_assert(offsetof(SmpTrampolineParams, stacks) == SMP_PARAMS_STACKS, "Update SMP_PARAMS_STACKS");
+
+extern const char smp_trampoline_start[];
+extern const char smp_trampoline_params[];
+extern const char smp_trampoline_end[];
+
+// The trampoline is copied to SMP_TRAMPOLINE_PHYS (which is identity mapped while the APs start), so it
+//  must address itself with absolute addresses.
+#define SMP_TRAMPOLINE_ADDRESS(label) "(" STR(SMP_TRAMPOLINE_PHYS) " + " #label " - smp_trampoline_start)"
+#define SMP_TRAMPOLINE_PARAM(offset) "(" SMP_TRAMPOLINE_ADDRESS(smp_trampoline_params) " + " STR(offset) ")"
+
+// Real mode -> protected mode -> long mode, then jump to smp_ap_main on the stack of the AP.
+//  The GDT of the trampoline puts the 64 bit code segment at the same selector as the kernel GDT.
+asm(".pushsection .rodata\n"
+    ".balign 16\n"
+    "smp_trampoline_start:\n"
+    ".code16\n"
+    "    cli\n"
+    "    cld\n"
+    "    xor ax, ax\n"
+    "    mov ds, ax\n"
+    "    lgdt [" SMP_TRAMPOLINE_ADDRESS(smp_trampoline_gdtr) "]\n"
+    "    mov eax, cr0\n"
+    "    or eax, 1\n" // Protection Enable
+    "    mov cr0, eax\n"
+    "    .byte 0x66, 0xea\n" // jmp 0x18:smp_trampoline_protected_mode
+    "    .long " SMP_TRAMPOLINE_ADDRESS(smp_trampoline_protected_mode) "\n"
+    "    .word 0x18\n"
+
+    ".code32\n"
+    "smp_trampoline_protected_mode:\n"
+    "    mov ax, 0x10\n"
+    "    mov ds, ax\n"
+    "    mov es, ax\n"
+    "    mov ss, ax\n"
+    "    mov eax, [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_CR4) "]\n" // Includes PAE
+    "    mov cr4, eax\n"
+    "    mov eax, [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_CR3) "]\n"
+    "    mov cr3, eax\n"
+    "    mov ecx, 0xC0000080\n" // EFER
+    "    rdmsr\n"
+    "    or eax, (1 << 8) | (1 << 11)\n" // Long mode and no-execute enable, same as the BSP
+    "    wrmsr\n"
+    "    mov eax, [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_CR0) "]\n" // Includes PG
+    "    mov cr0, eax\n"
+    "    .byte 0xea\n" // jmp 0x8:smp_trampoline_long_mode
+    "    .long " SMP_TRAMPOLINE_ADDRESS(smp_trampoline_long_mode) "\n"
+    "    .word 0x8\n"
+
+    ".code64\n"
+    "smp_trampoline_long_mode:\n"
+    "    xor eax, eax\n"
+    "    mov ds, ax\n"
+    "    mov es, ax\n"
+    "    mov ss, ax\n"
+    "    mov eax, [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_NEXT_INDEX) "]\n"
+    "smp_trampoline_claim_index:\n" // The bound check and the claim are a single cmpxchg, so a claimed index is always in bounds.
+    "    cmp eax, [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_MAX_INDEX) "]\n"
+    "    jae smp_trampoline_halt\n" // More CPUs than we have room for (or the BSP gave up waiting), this one stays parked.
+    "    lea edx, [eax + 1]\n"
+    "    lock cmpxchg [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_NEXT_INDEX) "], edx\n" // On failure, eax is reloaded with the current value.
+    "    jne smp_trampoline_claim_index\n"
+    "    mov edi, eax\n"
+    "    mov rsp, [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_STACKS) " + rax * 8]\n"
+    "    mov rax, [" SMP_TRAMPOLINE_PARAM(SMP_PARAMS_ENTRY) "]\n"
+    "    call rax\n"
+    "smp_trampoline_halt:\n"
+    "    cli\n"
+    "    hlt\n"
+    "    jmp smp_trampoline_halt\n"
+
+    ".balign 8\n"
+    "smp_trampoline_gdt:\n"
+    "    .quad 0\n"
+    "    .quad 0x00209a0000000000\n" // 0x08: 64 bit code
+    "    .quad 0x00cf92000000ffff\n" // 0x10: data
+    "    .quad 0x00cf9a000000ffff\n" // 0x18: 32 bit code
+    "smp_trampoline_gdtr:\n"
+    "    .word smp_trampoline_gdtr - smp_trampoline_gdt - 1\n"
+    "    .long " SMP_TRAMPOLINE_ADDRESS(smp_trampoline_gdt) "\n"
+
+    ".balign 8\n"
+    "smp_trampoline_params:\n"
+    "    .skip " STR(SMP_PARAMS_STACKS) " + 8 * " STR(CPU_MAX_COUNT) "\n"
+    "smp_trampoline_end:\n"
+    ".popsection\n");
+
+_Static_assert(sizeof(SmpTrampolineParams) == SMP_PARAMS_STACKS + 8 * CPU_MAX_COUNT, "Update the size of smp_trampoline_params");
+
+static void __attribute__((used, sysv_abi, noreturn)) smp_ap_main(uint32_t index)
+{
+    CPU *cpu = cpu_init_ap(index, cpu_kernel_stack_top(index));
+
+    syscall_initialize();
+    usermode_init_smp();
+    fpu_init_ap();
+
+    lapic_init_ap();
+    lapic_timer_init_ap();
+    cpu->lapic_id = lapic_id();
+
+    scheduler_start_ap();
+}
+
+/**
+ * @brief - The amount of logical CPUs in the package, as reported by CPUID.
+ *          Without ACPI tables it's the best guess we have, and with QEMU it's exact.
+ */
+static uint32_t smp_logical_cpu_count()
+{
+#define CPUID_FEATURES_LEAF 1
+#define CPUID_FEATURES_EDX_HTT (1 << 28)
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+
+    __cpuid(CPUID_FEATURES_LEAF, eax, ebx, ecx, edx);
+
+    if ((edx & CPUID_FEATURES_EDX_HTT) == 0)
+    {
+        return 1;
+    }
+
+    return (ebx >> 16) & 0xff;
+}
+
+static uint64_t smp_read_cr(int number)
+{
+    uint64_t value = 0;
+    switch (number)
+    {
+        case 0: asm volatile("mov %0, cr0" : "=r"(value)); break;
+        case 3: asm volatile("mov %0, cr3" : "=r"(value)); break;
+        case 4: asm volatile("mov %0, cr4" : "=r"(value)); break;
+    }
+    return value;
+}
+
+void smp_init()
+{
+    assert(kernel_lock_is_held());
+
+    uint32_t max_cpus = smp_logical_cpu_count();
+    if (max_cpus > CPU_MAX_COUNT)
+    {
+        max_cpus = CPU_MAX_COUNT;
+    }
+
+    if (max_cpus <= 1)
+    {
+        mmap_phys_memory_add(&(range_Range){.begin = SMP_TRAMPOLINE_PHYS, .size = PAGE_SIZE}); // Not needed after all
+        return;
+    }
+
+    mmu_map_range(SMP_TRAMPOLINE_PHYS, SMP_TRAMPOLINE_PHYS + PAGE_SIZE, SMP_TRAMPOLINE_PHYS, MMU_READ_WRITE);
+
+    const size_t trampoline_size = smp_trampoline_end - smp_trampoline_start;
+    assert(trampoline_size <= PAGE_SIZE);
+    memmove((void *)SMP_TRAMPOLINE_PHYS, smp_trampoline_start, trampoline_size);
+
+    SmpTrampolineParams *params = (void *)(SMP_TRAMPOLINE_PHYS + (smp_trampoline_params - smp_trampoline_start));
+    const uint64_t cr3 = smp_read_cr(3);
+    assert(cr3 < UINT32_MAX && "The PML4 must be below 4 GiB for the trampoline");
+
+    *params = (SmpTrampolineParams){
+        .cr0 = smp_read_cr(0),
+        .cr3 = cr3,
+        .cr4 = smp_read_cr(4),
+        .next_index = 1, // 0 is the BSP
+        .max_index = max_cpus,
+        .entry = (uint64_t)smp_ap_main,
+    };
+
+    for (uint32_t i = 1; i < max_cpus; i++)
+    {
+        params->stacks[i] = cpu_kernel_stack_top(i);
+        res rs = mmap((void *)(params->stacks[i] - CPU_KERNEL_STACK_SIZE), CPU_KERNEL_STACK_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE);
+        assert(IS_OK(rs) && "Couldn't allocate a kernel stack for an AP");
+    }
+
+    lapic_broadcast_init_startup(SMP_TRAMPOLINE_PHYS);
+
+    // Wait for every AP that took an index to be out of the trampoline, so we can unmap it.
+    const uint64_t deadline = pit_ms_counter() + SMP_AP_STARTUP_TIMEOUT_MS;
+    while (pit_ms_counter() < deadline && cpu_count() < max_cpus)
+    {
+        asm volatile("pause");
+    }
+
+    // Park any late AP. The indices below what we swap out were claimed, and those APs will come online.
+    const uint32_t started = __atomic_exchange_n(&params->next_index, max_cpus, __ATOMIC_SEQ_CST);
+
+    while (cpu_count() < started)
+    {
+        asm volatile("pause");
+    }
+
+    for (uint32_t i = started; i < max_cpus; i++)
+    {
+        munmap((void *)(params->stacks[i] - CPU_KERNEL_STACK_SIZE), CPU_KERNEL_STACK_SIZE);
+    }
+
+    munmap((void *)SMP_TRAMPOLINE_PHYS, PAGE_SIZE); // Also returns the physical page.
+
+    printf("[*] %d CPUs online\n", cpu_count());
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// The application processors start in real mode, at a page below 1 MiB.
+//  Reserved by mmap_init before anything is allocated, and freed once they started.
+#define SMP_TRAMPOLINE_PHYS 0x7000
+
+/**
+ * @brief - Start the application processors with INIT-SIPI-SIPI, and wait for them to come online.
+ *          Each one gets its own `CPU`, kernel stack and TSS, and waits in the
+ *            scheduler for processes to run. The BSP must hold the kernel lock.
+ *
+ * @see scheduler_start_ap
+ */
+void smp_init();
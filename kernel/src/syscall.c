@@ -10,6 +10,7 @@
 #include "parsing.h"
 #include "math.h"
 #include "kmalloc.h"
+#include "slab.h"
 #include "mmap.h"
 #include "mmu.h"
 #include "regs.h"
@@ -27,10 +28,20 @@
 #include "time.h"
 #include "usermode.h"
 #include "execve.h"
+#include "fork.h"
+#include "futex.h"
+#include "poll.h"
+#include "pipe.h"
+#include "shm.h"
+#include "user_mmap.h"
+#include "char_device.h"
 #include "vga.h"
 #include "shell.h"
 #include "waitpid.h"
 #include "window.h"
+#include "cpu.h"
+#include "kernel_lock.h"
+#include "macro_utils.h"
 
 #define MSR_STAR   0xC0000081
 #define MSR_LSTAR  0xC0000082
@@ -40,8 +51,6 @@
 
 #define MAX_ARGV_LEN     128
 #define MAX_ARGV_ELEMENT_LEN 512
-// Here the RSP of the syscall caller will be stored.
-static uint64_t g_ring3_rsp;
 
 /**
  * @brief Read path from the usermode mem into the buffer, accounting for relative
@@ -212,6 +221,91 @@ static void syscall_open(Regs *regs)
     regs->rax = fd_num;
 }
 
+// Returns true on success, false if there's no such file descriptor.
+static bool close_file_descriptor(PCB *pcb, uint64_t fd_num)
+{
+    FileDescriptor *fd_desc = file_descriptor_hashmap_get(&pcb->fd_map, fd_num);
+    if (fd_desc == NULL)
+    {
+        return false;
+    }
+
+    file_descriptor_unref(fd_desc);
+
+    bool success = file_descriptor_hashmap_remove(&pcb->fd_map, fd_num);
+    assert(success);
+    return true;
+}
+
+static void syscall_close(Regs *regs)
+{
+    // Args:
+    uint64_t fd_num = regs->rdi;
+
+    regs->rax = close_file_descriptor(scheduler_current_pcb(), fd_num) ? 0 : -1;
+}
+
+static void syscall_pipe(Regs *regs)
+{
+    // Args:
+    usermode_mem *out_fds = (usermode_mem *)regs->rdi; // int[2], the read end and then the write end.
+
+    regs->rax = -1; // Failed
+
+    if (!is_usermode_address(out_fds, pipe_END_COUNT * sizeof(int)))
+    {
+        return;
+    }
+
+    FILE ends[pipe_END_COUNT];
+    res rs = pipe_create(ends);
+    if (!IS_OK(rs))
+    {
+        return;
+    }
+
+    PCB *pcb = scheduler_current_pcb();
+    int fds[pipe_END_COUNT] = {0};
+    for (pipe_End end = 0; end < pipe_END_COUNT; end++)
+    {
+        const uint64_t fd_num = pcb->last_fd + 1;
+        FileDescriptor *fd_desc = file_descriptor_hashmap_emplace(&pcb->fd_map, fd_num);
+        if (fd_desc == NULL)
+        {
+            for (pipe_End it = 0; it < pipe_END_COUNT; it++)
+            {
+                if (it < end)
+                {
+                    close_file_descriptor(pcb, fds[it]);
+                }
+                else
+                {
+                    char_device_unref(&ends[it].file);
+                }
+            }
+            return;
+        }
+
+        fd_desc->file = ends[end];
+        fd_desc->num = fd_num;
+        fd_desc->perms = end == pipe_END_READ ? file_descriptor_perm_READ : file_descriptor_perm_WRITE;
+        fd_desc->is_buffered = true;
+
+        pcb->last_fd = fd_num;
+        fds[end] = fd_num;
+    }
+
+    rs = usermode_copy_to_user(out_fds, fds, sizeof(fds));
+    if (!IS_OK(rs))
+    {
+        close_file_descriptor(pcb, fds[pipe_END_READ]);
+        close_file_descriptor(pcb, fds[pipe_END_WRITE]);
+        return;
+    }
+
+    regs->rax = 0;
+}
+
 static void syscall_mkdir(Regs *regs)
 {
     usermode_mem *filepath_user = (usermode_mem *)regs->rdi;
@@ -300,7 +394,115 @@ static void syscall_waitpid(Regs *regs)
     uint64_t pid = regs->rdi;
     usermode_mem *wstatus = (usermode_mem *)regs->rsi;
     int options = regs->rdx;
-    regs->rax = waitpid(pid, wstatus, options); // Normally won't return. Returns only on error or if NO HANG option is specified.
+    uint64_t timeout_ms = regs->r10; // Used only with WAITPID_OPTIONS_TIMEOUT
+    regs->rax = waitpid(pid, wstatus, options, timeout_ms); // Normally won't return. Returns only on error or if NO HANG option is specified.
+}
+
+static void syscall_poll(Regs *regs)
+{
+    usermode_mem *fds = (usermode_mem *)regs->rdi;
+    uint64_t count = regs->rsi;
+    int64_t timeout_ms = (int32_t)regs->rdx;
+    regs->rax = poll(fds, count, timeout_ms); // Returns only if didn't block.
+}
+
+static void syscall_futex_wait(Regs *regs)
+{
+    usermode_mem *address = (usermode_mem *)regs->rdi;
+    uint32_t expected = regs->rsi;
+    uint64_t timeout_ms = regs->rdx;
+    regs->rax = futex_wait(address, expected, timeout_ms); // Returns only if didn't block.
+}
+
+static void syscall_futex_wake(Regs *regs)
+{
+    usermode_mem *address = (usermode_mem *)regs->rdi;
+    uint64_t count = regs->rsi;
+    regs->rax = futex_wake(address, count);
+}
+
+// Returns true on success, false if `name_user` isn't a valid name.
+static bool read_shm_name(usermode_mem *name_user, char name[static SHM_NAME_MAX_LEN])
+{
+    uint64_t name_len;
+    if (!usermode_strlen(name_user, SHM_NAME_MAX_LEN - 1, &name_len) || name_len == 0)
+    {
+        return false;
+    }
+
+    res rs = usermode_copy_from_user(name, name_user, name_len);
+    assert(IS_OK(rs) && "checked before, should be good");
+    name[name_len] = '\0';
+
+    return true;
+}
+
+static void syscall_shm_map(Regs *regs)
+{
+    // Args:
+    usermode_mem *name_user = (usermode_mem *)regs->rdi; // NULL for anonymous shared memory.
+    uint64_t size = regs->rsi;
+
+    regs->rax = 0; // Failed
+
+    char name[SHM_NAME_MAX_LEN];
+    if (name_user != NULL && !read_shm_name(name_user, name))
+    {
+        return;
+    }
+
+    uint64_t address;
+    res rs = shm_map(name_user != NULL ? name : NULL, size, &address);
+    if (IS_OK(rs))
+    {
+        regs->rax = address;
+    }
+}
+
+static void syscall_shm_unmap(Regs *regs)
+{
+    // Args:
+    uint64_t address = regs->rdi;
+
+    res rs = shm_unmap(address);
+    regs->rax = IS_OK(rs) ? 0 : -1;
+}
+
+static void syscall_shm_unlink(Regs *regs)
+{
+    // Args:
+    usermode_mem *name_user = (usermode_mem *)regs->rdi;
+
+    regs->rax = -1; // Failed
+
+    char name[SHM_NAME_MAX_LEN];
+    if (!read_shm_name(name_user, name))
+    {
+        return;
+    }
+
+    res rs = shm_unlink(name);
+    regs->rax = IS_OK(rs) ? 0 : -1;
+}
+
+static void syscall_mmap(Regs *regs)
+{
+    // Args:
+    uint64_t size = regs->rdi;
+
+    uint64_t address;
+    res rs = user_mmap_map(size, &address);
+    regs->rax = IS_OK(rs) ? address : 0;
+}
+
+static void syscall_munmap(Regs *regs)
+{
+    // Args:
+    uint64_t address = regs->rdi;
+    uint64_t size = regs->rsi;
+
+    res rs = user_mmap_unmap(address, size);
+    regs->rax = IS_OK(rs) ? 0 : -1;
 }
 
 static void syscall_reboot(Regs *regs)
@@ -334,6 +536,20 @@ static void syscall_reboot(Regs *regs)
     cli_hlt(); // For good measure.
 }
 
+static void syscall_fork(Regs *regs)
+{
+    regs->rax = -1; // Return: failed.
+
+    uint64_t pid;
+    res rs = fork(scheduler_current_pcb(), &pid);
+    if (!IS_OK(rs))
+    {
+        return;
+    }
+
+    regs->rax = pid;
+}
+
 static void syscall_execute_program(Regs *regs)
 {
     res rs;
@@ -343,6 +559,34 @@ static void syscall_execute_program(Regs *regs)
     //Args:
     usermode_mem *path_to_file = (usermode_mem *)regs->rdi;
     usermode_mem *usermode_argv = (usermode_mem *)regs->rsi;
+    usermode_mem *usermode_stdio = (usermode_mem *)regs->rdx; // int[PROGRAM_STDIO_COUNT] of our file descriptors, for the stdio of the program. Nullable, 0 for none.
+
+    PCB *pcb = scheduler_current_pcb();
+
+    FileDescriptor *stdio[PROGRAM_STDIO_COUNT] = {0};
+    if (usermode_stdio != NULL)
+    {
+        int stdio_fds[PROGRAM_STDIO_COUNT];
+        rs = usermode_copy_from_user(stdio_fds, usermode_stdio, sizeof(stdio_fds));
+        if (!IS_OK(rs))
+        {
+            return;
+        }
+
+        for (int i = 0; i < PROGRAM_STDIO_COUNT; i++)
+        {
+            if (stdio_fds[i] == 0)
+            {
+                continue;
+            }
+
+            stdio[i] = file_descriptor_hashmap_get(&pcb->fd_map, stdio_fds[i]);
+            if (stdio[i] == NULL)
+            {
+                return;
+            }
+        }
+    }
 
     char filepath[FS_MAX_FILEPATH_LEN] = {0};
     bool success = read_path(path_to_file, filepath);
@@ -408,7 +652,7 @@ static void syscall_execute_program(Regs *regs)
     }
 
     uint64_t pid = 0;
-    rs = execve(filepath, (const char *const *)argv, scheduler_current_pcb(), &pid);
+    rs = execve(filepath, (const char *const *)argv, pcb, usermode_stdio != NULL ? stdio : NULL, &pid);
     regs->rax = IS_OK(rs) ? pid : -1;
 }
 
@@ -453,6 +697,12 @@ static void syscall_read_write(Regs *regs, typeof(process_fread) fread_fwrite_fu
     asm volatile("stac" ::: "memory");
     regs->rax = fread_fwrite_func(out_buffer, 1, buffer_size, file, fd_desc->is_buffered);
     asm volatile("clac" ::: "memory");
+
+    if ((int64_t)regs->rax > 0) // The devices return negative errors.
+    {
+        uint64_t *counter = needed_perm == file_descriptor_perm_READ ? &pcb->stats.bytes_read : &pcb->stats.bytes_written;
+        *counter += regs->rax;
+    }
 }
 
 static void syscall_read(Regs *regs)
@@ -506,6 +756,8 @@ typedef struct {
     uint64_t    target;
 } MSleepRefreshArgument;
 
+static slab_Cache g_msleep_argument_cache = SLAB_CACHE_INIT("msleep argument", MSleepRefreshArgument);
+
 // @see pcb_IORefresh
 static pcb_IORefreshResult pcb_refresh_msleep(PCB *pcb)
 {
@@ -518,7 +770,7 @@ static pcb_IORefreshResult pcb_refresh_msleep(PCB *pcb)
     }
 
     pcb->regs.rax = 0; // Return: success
-    kfree(arg);
+    slab_free(&g_msleep_argument_cache, arg);
     return PCB_IO_REFRESH_DONE;
 }
 
@@ -541,12 +793,13 @@ static void syscall_msleep(Regs *regs)
 
     PCB *pcb = scheduler_current_pcb();
 
-    MSleepRefreshArgument *arg = kcalloc(1, sizeof(*arg));
+    MSleepRefreshArgument *arg = slab_alloc(&g_msleep_argument_cache);
     arg->target = target;
 
     pcb->refresh_arg = arg;
 
-    scheduler_move_current_process_to_io_queue_and_context_switch(pcb_refresh_msleep);
+    // Nothing but the deadline can wake us up.
+    scheduler_move_current_process_to_io_queue_and_context_switch(NULL, pcb_refresh_msleep, target);
 }
 
 static void syscall_get_time_ms(Regs *regs)
@@ -554,6 +807,18 @@ static void syscall_get_time_ms(Regs *regs)
     regs->rax = pit_ms_counter();
 }
 
+static void syscall_get_idle_time(Regs *regs)
+{
+    regs->rax = scheduler_idle_ms();
+}
+
+static void syscall_nice(Regs *regs)
+{
+    int increment = (int)regs->rdi;
+
+    regs->rax = scheduler_renice_current(increment);
+}
+
 
 
 static void syscall_get_processes(Regs *regs)
@@ -561,8 +826,25 @@ static void syscall_get_processes(Regs *regs)
     usermode_mem *user_buf = (usermode_mem *)regs->rdi;
     int max = (int)regs->rsi;
 
-    ProcessInfo kernel_buf[10]; // safe upper bound
-    if (max > 10) max = 10;
+    if (max <= 0)
+    {
+        regs->rax = 0;
+        return;
+    }
+
+    // There is no point in a buffer bigger than the amount of processes.
+    if ((size_t)max > pcb_count())
+    {
+        max = pcb_count();
+    }
+
+    ProcessInfo *kernel_buf = kcalloc(max, sizeof(*kernel_buf));
+    if (kernel_buf == NULL)
+    {
+        regs->rax = -1;
+        return;
+    }
+    defer({ kfree(kernel_buf); });
 
     int count = scheduler_get_all_processes(kernel_buf, max);
 
@@ -627,7 +909,8 @@ static void syscall_destroy_window(Regs *regs)
 static void __attribute__((used, sysv_abi)) syscall_handler(Regs *user_regs)
 {
     sti();
-    user_regs->rsp = g_ring3_rsp; // Doesn't affect the process, just a nice thing for us.
+    kernel_lock_acquire();
+    user_regs->rsp = cpu_current()->user_rsp; // Doesn't affect the process, just a nice thing for us.
 
     // NOTE: caller_regs->r11 and caller_regs->rcx contain $RFLAGS and $rip respectively
     //          hence, the kernel probably should not modify them.
@@ -641,6 +924,9 @@ static void __attribute__((used, sysv_abi)) syscall_handler(Regs *user_regs)
     pcb->regs = *user_regs;
     pcb->regs.rflags = original_rflags;
 
+    scheduler_account_time(true);
+    pcb->stats.syscalls++;
+
     /* Calling convention:
      *     Syscall Number:  $rax
      *     Return Value:    $rax
@@ -664,9 +950,21 @@ static void __attribute__((used, sysv_abi)) syscall_handler(Regs *user_regs)
         case SYSCALL_OPEN:
             syscall_open(user_regs);
             break;
+        case SYSCALL_CLOSE:
+            syscall_close(user_regs);
+            break;
+        case SYSCALL_POLL:
+            syscall_poll(user_regs);
+            break;
+        case SYSCALL_PIPE:
+            syscall_pipe(user_regs);
+            break;
         case SYSCALL_BRK:
             syscall_brk(user_regs);
             break;
+        case SYSCALL_FORK:
+            syscall_fork(user_regs);
+            break;
         case SYSCALL_EXECUTE:
             syscall_execute_program(user_regs);
             break;
@@ -697,6 +995,27 @@ static void __attribute__((used, sysv_abi)) syscall_handler(Regs *user_regs)
         case SYSCALL_MSLEEP:
             syscall_msleep(user_regs);
             break;
+        case SYSCALL_FUTEX_WAIT:
+            syscall_futex_wait(user_regs);
+            break;
+        case SYSCALL_FUTEX_WAKE:
+            syscall_futex_wake(user_regs);
+            break;
+        case SYSCALL_SHM_MAP:
+            syscall_shm_map(user_regs);
+            break;
+        case SYSCALL_SHM_UNMAP:
+            syscall_shm_unmap(user_regs);
+            break;
+        case SYSCALL_SHM_UNLINK:
+            syscall_shm_unlink(user_regs);
+            break;
+        case SYSCALL_MMAP:
+            syscall_mmap(user_regs);
+            break;
+        case SYSCALL_MUNMAP:
+            syscall_munmap(user_regs);
+            break;
         case SYSCALL_GET_PIT_TIME:
             syscall_get_time_ms(user_regs);
             break;
@@ -709,22 +1028,30 @@ static void __attribute__((used, sysv_abi)) syscall_handler(Regs *user_regs)
         case SYSCALL_DESTROY_WINDOW:
             syscall_destroy_window(user_regs);
             break;
+        case SYSCALL_GET_IDLE_TIME:
+            syscall_get_idle_time(user_regs);
+            break;
+        case SYSCALL_NICE:
+            syscall_nice(user_regs);
+            break;
     }
 
     assert(original_rip == user_regs->rcx && original_rflags == user_regs->r11 && "The syscall is not expected to modify process $rip or $RFLAGS");
     cli();
+    scheduler_arm_tick(); // The syscall may have made another process ready to run.
+    scheduler_account_time(false);
+    kernel_lock_release();
 }
 
 static void __attribute__((naked)) syscall_handler_trampoline()
 {
-    // Store usermode RSP and replace it with kernel stack
-    asm volatile("mov %[ring3_rsp], rsp\n"
-                 "mov rsp, %[stack_begin]\n"
-                 : [ring3_rsp] "+m"(g_ring3_rsp)
-                 : [stack_begin] "i"(KERNEL_STACK_BASE)
-                 : "memory");
+    // Switch to the per-CPU data, store usermode RSP and replace it with the kernel stack of this CPU
+    asm volatile("swapgs\n"
+                 "mov gs:[" STR(CPU_OFFSET_USER_RSP) "], rsp\n"
+                 "mov rsp, gs:[" STR(CPU_OFFSET_KERNEL_STACK_TOP) "]\n"
+                 ::: "memory");
 
-    // KERNEL_STACK_BASE is aligned, so we don't need to worry about manually re-aligning the stack :)
+    // The kernel stacks are aligned, so we don't need to worry about manually re-aligning the stack :)
 
     regs_PUSH();
 
@@ -734,10 +1061,9 @@ static void __attribute__((naked)) syscall_handler_trampoline()
     regs_POP();
 
     // Restore RSP
-    asm volatile("mov rsp, %[ring3_rsp]\n"
-                 : [ring3_rsp] "+m"(g_ring3_rsp)
-                 :
-                 : "memory");
+    asm volatile("mov rsp, gs:[" STR(CPU_OFFSET_USER_RSP) "]\n"
+                 "swapgs\n"
+                 ::: "memory");
 
     asm volatile("sysretq\n");
 }
@@ -801,8 +1127,9 @@ static void set_syscall_segments()
 static void set_syscall_flags_mask()
 {
     #define INTERRUPT_FLAG 0x200
+    #define DIRECTION_FLAG 0x400
     #define RESUME_FLAG    0x10000
-    write_to_64bit_msr(MSR_SFMASK, (INTERRUPT_FLAG | RESUME_FLAG)); // Mask out the specified flags
+    write_to_64bit_msr(MSR_SFMASK, (INTERRUPT_FLAG | DIRECTION_FLAG | RESUME_FLAG)); // Mask out the specified flags
 }
 
 void syscall_initialize()
@@ -4,11 +4,21 @@ typedef enum {
     SYSCALL_READ    = 0,
     SYSCALL_WRITE   = 1,
     SYSCALL_OPEN    = 2,
+    SYSCALL_CLOSE   = 3,
+
+    SYSCALL_POLL    = 7,
 
     SYSCALL_LSEEK   = 8,
+    SYSCALL_MMAP    = 9,
+
+    SYSCALL_MUNMAP  = 11,
 
     SYSCALL_BRK     = 12,
 
+    SYSCALL_PIPE    = 22,
+
+    SYSCALL_FORK    = 57,
+
     SYSCALL_EXECUTE = 59,
     SYSCALL_EXIT    = 60,
 
@@ -31,6 +41,16 @@ typedef enum {
 
     SYSCALL_CREATE_WINDOW  = 1004,
     SYSCALL_DESTROY_WINDOW = 1005,
+
+    SYSCALL_GET_IDLE_TIME = 1006,
+    SYSCALL_NICE          = 1007,
+
+    SYSCALL_FUTEX_WAIT = 1008,
+    SYSCALL_FUTEX_WAKE = 1009,
+
+    SYSCALL_SHM_MAP    = 1010,
+    SYSCALL_SHM_UNMAP  = 1011,
+    SYSCALL_SHM_UNLINK = 1012,
 } syscall_Number;
 
 typedef enum {
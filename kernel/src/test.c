@@ -2,14 +2,24 @@
 
 // Includes for the test functions
 #include "kmalloc.h"
+#include "memory.h"
+#include "mmap.h"
+#include "slab.h"
+#include "user_mmap.h"
 #include "test_filesystem.h"
 #include "parsing.h"
+#include "timer.h"
 
 typedef void (*TestFunction)();
 static TestFunction test_funcs[] = {
+    test_mmap,
     test_kmalloc,
+    test_slab,
+    test_user_mmap,
+    test_memory,
     test_filesystem,
     test_parsing_filepath,
+    test_timer,
 };
 
 void test_perform_all()
@@ -1,13 +1,27 @@
 #include "time.h"
 #include "pit.h"
+#include "cpu.h"
+#include "kernel_lock.h"
+#include "lapic.h"
 
 void sleep_ms(const uint64_t delay_ms)
 {
     const uint64_t start = pit_ms_counter();
     const uint64_t target = start + delay_ms;
 
+    // Only the BSP gets the device interrupts, so only it may halt while holding the kernel lock (@see kernel_lock.h).
+    //  An AP lets go of the lock while it waits, as the interrupts that end the wait may need it.
+    const bool is_bsp = cpu_current()->index == 0;
+    const uint32_t lock_depth = is_bsp ? 0 : kernel_lock_release_all();
+
     while (pit_ms_counter() < target)
     {
-        asm ("hlt"); // hlt until next interrupt (most likely from the PIT)
+        lapic_timer_arm(target); // Until the PIT is stopped, it wakes us up on its own.
+        asm volatile("hlt"); // hlt until next interrupt (most likely from the timer)
+    }
+
+    if (!is_bsp)
+    {
+        kernel_lock_reacquire(lock_depth);
     }
 }
@@ -0,0 +1,248 @@
+#include "timer.h"
+#include "assert.h"
+#include "io.h"
+#include "kmalloc.h"
+#include "lapic.h"
+#include "smartptr.h"
+
+// Binary min-heap of the armed timers, keyed on their deadline.
+//  Each timer knows its index in the heap, so it can be cancelled in O(log n).
+static Timer **g_timer_heap;
+static size_t g_timer_heap_length;
+static size_t g_timer_heap_capacity;
+
+volatile uint64_t g_timer_next_deadline_ms = UINT64_MAX;
+
+#define TIMER_HEAP_INITIAL_CAPACITY 16
+
+static void timer_heap_set(size_t index, Timer *timer)
+{
+    g_timer_heap[index] = timer;
+    timer->heap_index = index;
+}
+
+static void timer_heap_sift_up(size_t index)
+{
+    Timer *timer = g_timer_heap[index];
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / 2;
+        if (g_timer_heap[parent]->deadline_ms <= timer->deadline_ms)
+        {
+            break;
+        }
+
+        timer_heap_set(index, g_timer_heap[parent]);
+        index = parent;
+    }
+
+    timer_heap_set(index, timer);
+}
+
+static void timer_heap_sift_down(size_t index)
+{
+    Timer *timer = g_timer_heap[index];
+    while (true)
+    {
+        size_t child = index * 2 + 1;
+        if (child >= g_timer_heap_length)
+        {
+            break;
+        }
+
+        if (child + 1 < g_timer_heap_length &&
+            g_timer_heap[child + 1]->deadline_ms < g_timer_heap[child]->deadline_ms)
+        {
+            child++;
+        }
+
+        if (timer->deadline_ms <= g_timer_heap[child]->deadline_ms)
+        {
+            break;
+        }
+
+        timer_heap_set(index, g_timer_heap[child]);
+        index = child;
+    }
+
+    timer_heap_set(index, timer);
+}
+
+static void timer_update_next_deadline()
+{
+    g_timer_next_deadline_ms = g_timer_heap_length == 0 ? UINT64_MAX : g_timer_heap[0]->deadline_ms;
+}
+
+// Must be called with interrupts disabled.
+static void timer_heap_remove(Timer *timer)
+{
+    size_t index = timer->heap_index;
+    assert(index < g_timer_heap_length && g_timer_heap[index] == timer);
+
+    timer->heap_index = TIMER_NOT_ARMED;
+    g_timer_heap_length--;
+    if (index == g_timer_heap_length)
+    {
+        return;
+    }
+
+    Timer *last = g_timer_heap[g_timer_heap_length];
+    timer_heap_set(index, last);
+    if (index > 0 && g_timer_heap[(index - 1) / 2]->deadline_ms > last->deadline_ms)
+    {
+        timer_heap_sift_up(index);
+    }
+    else
+    {
+        timer_heap_sift_down(index);
+    }
+}
+
+// May allocate, so it must not be called from an ISR. Timers are armed only
+//  from process context, so nobody can take the free slot before we use it.
+static res timer_heap_reserve_one()
+{
+    if (g_timer_heap_length < g_timer_heap_capacity)
+    {
+        return res_OK;
+    }
+
+    size_t new_capacity = g_timer_heap_capacity == 0 ? TIMER_HEAP_INITIAL_CAPACITY : g_timer_heap_capacity * 2;
+    Timer **new_heap = krealloc(g_timer_heap, new_capacity * sizeof(*new_heap));
+    if (new_heap == NULL)
+    {
+        return res_timer_OUT_OF_MEMORY;
+    }
+
+    uint64_t flags = get_cpu_flags();
+    cli();
+    g_timer_heap = new_heap;
+    g_timer_heap_capacity = new_capacity;
+    set_cpu_flags(flags);
+
+    return res_OK;
+}
+
+void timer_init(Timer *timer, timer_Callback callback, void *arg)
+{
+    timer->deadline_ms = UINT64_MAX;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->heap_index = TIMER_NOT_ARMED;
+}
+
+res timer_arm(Timer *timer, uint64_t deadline_ms)
+{
+    assert(timer->callback != NULL);
+
+    res rs = timer_heap_reserve_one();
+    if (IS_ERR(rs))
+    {
+        return rs;
+    }
+
+    uint64_t flags = get_cpu_flags();
+    cli();
+    defer({ set_cpu_flags(flags); });
+
+    if (timer_is_armed(timer))
+    {
+        timer_heap_remove(timer);
+    }
+
+    timer->deadline_ms = deadline_ms;
+    timer_heap_set(g_timer_heap_length, timer);
+    g_timer_heap_length++;
+    timer_heap_sift_up(timer->heap_index);
+
+    timer_update_next_deadline();
+    lapic_timer_arm(g_timer_next_deadline_ms); // The timer interrupt may be armed for a later deadline.
+
+    return res_OK;
+}
+
+void timer_cancel(Timer *timer)
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    if (timer_is_armed(timer))
+    {
+        timer_heap_remove(timer);
+        timer_update_next_deadline();
+    }
+
+    set_cpu_flags(flags);
+}
+
+bool timer_is_armed(const Timer *timer)
+{
+    return timer->heap_index != TIMER_NOT_ARMED;
+}
+
+void timer_run_expired(uint64_t now_ms)
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    while (g_timer_heap_length > 0 && g_timer_heap[0]->deadline_ms <= now_ms)
+    {
+        Timer *timer = g_timer_heap[0];
+        timer_heap_remove(timer);
+        timer->callback(timer);
+    }
+
+    timer_update_next_deadline();
+
+    set_cpu_flags(flags);
+}
+
+static void test_timer_record(Timer *timer)
+{
+    uint64_t **out = timer->arg;
+    **out = timer->deadline_ms;
+    (*out)++;
+}
+
+void test_timer()
+{
+    // Far in the future, so the PIT will not fire them by itself.
+    const uint64_t base = UINT64_MAX / 2;
+    const uint64_t deadlines[] = {5, 1, 4, 7, 2, 6, 3, 0};
+#define TEST_TIMER_COUNT (sizeof(deadlines) / sizeof(*deadlines))
+
+    uint64_t fired[TEST_TIMER_COUNT];
+    uint64_t *fired_it = fired;
+
+    Timer timers[TEST_TIMER_COUNT];
+    for (size_t i = 0; i < TEST_TIMER_COUNT; i++)
+    {
+        timer_init(&timers[i], test_timer_record, &fired_it);
+        assert(!timer_is_armed(&timers[i]));
+        assert(IS_OK(timer_arm(&timers[i], base + deadlines[i])));
+        assert(timer_is_armed(&timers[i]));
+    }
+    assert(g_timer_next_deadline_ms == base);
+
+    // Cancel from the middle, and re-arm a timer with a later deadline.
+    timer_cancel(&timers[2]); // 4
+    assert(!timer_is_armed(&timers[2]));
+    assert(IS_OK(timer_arm(&timers[1], base + 8))); // 1 -> 8
+
+    // Fires only the expired timers, earliest first.
+    timer_run_expired(base + 3);
+    assert(fired_it - fired == 3);
+    assert(fired[0] == base + 0 && fired[1] == base + 2 && fired[2] == base + 3);
+    assert(g_timer_next_deadline_ms == base + 5);
+
+    timer_run_expired(base + 8);
+    assert(fired_it - fired == 7);
+    assert(fired[3] == base + 5 && fired[4] == base + 6 && fired[5] == base + 7 && fired[6] == base + 8);
+    assert(g_timer_next_deadline_ms == UINT64_MAX);
+
+    for (size_t i = 0; i < TEST_TIMER_COUNT; i++)
+    {
+        assert(!timer_is_armed(&timers[i]));
+    }
+#undef TEST_TIMER_COUNT
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include "res.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Timer Timer;
+
+/**
+ * @brief - Called (from the timer interrupt) once the deadline of the timer passed.
+ *            The timer is disarmed before the callback is called, so it may re-arm it.
+ */
+typedef void (*timer_Callback)(Timer *timer);
+
+#define TIMER_NOT_ARMED ((size_t)-1)
+
+struct Timer {
+    uint64_t deadline_ms;
+    timer_Callback callback;
+    void *arg;
+    size_t heap_index; // TIMER_NOT_ARMED when the timer is not armed.
+};
+
+// The earliest deadline of all the armed timers, UINT64_MAX if none.
+//  Read by the timer interrupt to decide if it needs to call timer_run_expired.
+extern volatile uint64_t g_timer_next_deadline_ms;
+
+#define res_timer_OUT_OF_MEMORY "Ran out of memory for armed timers"
+
+void timer_init(Timer *timer, timer_Callback callback, void *arg);
+
+/**
+ * @brief - Arm the timer to fire once pit_ms_counter() reaches `deadline_ms`.
+ *          If the timer is already armed, it's re-armed with the new deadline.
+ */
+res timer_arm(Timer *timer, uint64_t deadline_ms) WUR;
+
+/**
+ * @brief - Disarm the timer. Does nothing if it's not armed.
+ */
+void timer_cancel(Timer *timer);
+
+bool timer_is_armed(const Timer *timer);
+
+/**
+ * @brief - Fire every armed timer whose deadline is at or before `now_ms`.
+ *          Called from the timer interrupt.
+ */
+void timer_run_expired(uint64_t now_ms);
+
+void test_timer();
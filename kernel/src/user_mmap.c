@@ -0,0 +1,216 @@
+#include "user_mmap.h"
+#include "kmalloc.h"
+#include "memory.h"
+#include "mmap.h"
+#include "pcb.h"
+#include "scheduler.h"
+#include "assert.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief - Find the lowest free addresses of `size` for a mapping in `pcb`.
+ *
+ * @param out_link[out] - Where in `pcb->user_mappings` the mapping goes, to keep them sorted.
+ */
+static bool user_mmap_find_room(PCB *pcb, uint64_t size, uint64_t *out_address, user_mmap_Mapping ***out_link)
+{
+    uint64_t address = USER_MMAP_ADDRESS_BEGIN;
+    user_mmap_Mapping **link = &pcb->user_mappings;
+    while (*link != NULL && (*link)->address < address + size)
+    {
+        address = (*link)->address + (*link)->size;
+        link = &(*link)->next;
+    }
+
+    if (address + size > USER_MMAP_ADDRESS_END)
+    {
+        return false;
+    }
+
+    *out_address = address;
+    *out_link = link;
+    return true;
+}
+
+res user_mmap_map(uint64_t size, uint64_t *out_address)
+{
+    if (size == 0 || size > USER_MMAP_MAX_SIZE)
+    {
+        return res_user_mmap_INVALID_SIZE;
+    }
+    size = PAGE_ALIGN_UP(size);
+
+    PCB *pcb = scheduler_current_pcb();
+
+    uint64_t address;
+    user_mmap_Mapping **link;
+    if (!user_mmap_find_room(pcb, size, &address, &link))
+    {
+        return res_user_mmap_OUT_OF_ADDRESSES;
+    }
+
+    user_mmap_Mapping *mapping = kcalloc(1, sizeof(*mapping));
+    if (mapping == NULL)
+    {
+        return res_user_mmap_OUT_OF_MEMORY;
+    }
+
+    res rs = mmap_lazy((void *)address, size, MMAP_PROT_READ | MMAP_PROT_WRITE | MMAP_PROT_RING_3);
+    if (!IS_OK(rs))
+    {
+        kfree(mapping);
+        return rs;
+    }
+
+    mapping->address = address;
+    mapping->size = size;
+    mapping->next = *link;
+    *link = mapping;
+
+    *out_address = address;
+    return res_OK;
+}
+
+/**
+ * @brief - Take [address, address + size) out of the mappings of `pcb`, without touching its pages.
+ */
+static res user_mmap_remove_range(PCB *pcb, uint64_t address, uint64_t size)
+{
+    if (size == 0 || size > USER_MMAP_MAX_SIZE)
+    {
+        return res_user_mmap_INVALID_SIZE;
+    }
+    size = PAGE_ALIGN_UP(size);
+
+    uint64_t end;
+    if ((address & (PAGE_SIZE - 1)) != 0 || __builtin_add_overflow(address, size, &end))
+    {
+        return res_user_mmap_NOT_FOUND;
+    }
+
+    user_mmap_Mapping **link = &pcb->user_mappings;
+    while (*link != NULL && (*link)->address + (*link)->size <= address)
+    {
+        link = &(*link)->next;
+    }
+
+    user_mmap_Mapping *mapping = *link;
+    if (mapping == NULL || address < mapping->address || end > mapping->address + mapping->size)
+    {
+        return res_user_mmap_NOT_FOUND;
+    }
+
+    const uint64_t mapping_end = mapping->address + mapping->size;
+    if (address > mapping->address && end < mapping_end)
+    {
+        // A hole in the middle, the part after it becomes a mapping of its own.
+        user_mmap_Mapping *after = kcalloc(1, sizeof(*after));
+        if (after == NULL)
+        {
+            return res_user_mmap_OUT_OF_MEMORY;
+        }
+
+        after->address = end;
+        after->size = mapping_end - end;
+        after->next = mapping->next;
+        mapping->next = after;
+        mapping->size = address - mapping->address;
+    }
+    else if (address > mapping->address)
+    {
+        mapping->size = address - mapping->address;
+    }
+    else if (end < mapping_end)
+    {
+        mapping->address = end;
+        mapping->size = mapping_end - end;
+    }
+    else
+    {
+        *link = mapping->next;
+        kfree(mapping);
+    }
+
+    return res_OK;
+}
+
+res user_mmap_unmap(uint64_t address, uint64_t size)
+{
+    res rs = user_mmap_remove_range(scheduler_current_pcb(), address, size);
+    if (!IS_OK(rs))
+    {
+        return rs;
+    }
+
+    // The range is never shared memory (that's above USER_MMAP_ADDRESS_END), but its pages
+    //  may be shared copy-on-write with a forked process, or not backed yet. munmap handles both.
+    munmap((void *)address, PAGE_ALIGN_UP(size));
+
+    return res_OK;
+}
+
+bool user_mmap_fork(PCB *child, PCB *parent)
+{
+    assert(child->user_mappings == NULL);
+
+    user_mmap_Mapping **tail = &child->user_mappings;
+    for (user_mmap_Mapping *it = parent->user_mappings; it != NULL; it = it->next)
+    {
+        user_mmap_Mapping *mapping = kcalloc(1, sizeof(*mapping));
+        if (mapping == NULL)
+        {
+            return false; // The child is cleaned up along with whatever it already has.
+        }
+
+        *mapping = *it;
+        mapping->next = NULL;
+
+        *tail = mapping;
+        tail = &mapping->next;
+    }
+
+    return true;
+}
+
+void user_mmap_detach_all(PCB *pcb)
+{
+    user_mmap_Mapping *it = pcb->user_mappings;
+    while (it != NULL)
+    {
+        user_mmap_Mapping *next = it->next;
+        kfree(it);
+        it = next;
+    }
+
+    pcb->user_mappings = NULL;
+}
+
+void test_user_mmap()
+{
+    static PCB pcb;
+    const uint64_t begin = USER_MMAP_ADDRESS_BEGIN;
+    const uint64_t size = 4 * PAGE_SIZE;
+
+    user_mmap_Mapping *mapping = kcalloc(1, sizeof(*mapping));
+    assert(mapping != NULL);
+    *mapping = (user_mmap_Mapping){.address = begin, .size = size};
+    pcb.user_mappings = mapping;
+
+    // Sizes that wrap around the address space, or are past any mapping, are rejected as a whole.
+    assert(!IS_OK(user_mmap_remove_range(&pcb, begin + 2 * PAGE_SIZE, 0xfffffffffffff000)));
+    assert(!IS_OK(user_mmap_remove_range(&pcb, 0xfffffffffffff000, 2 * PAGE_SIZE)));
+    assert(!IS_OK(user_mmap_remove_range(&pcb, begin, 0)));
+    assert(!IS_OK(user_mmap_remove_range(&pcb, begin + 1, PAGE_SIZE)));
+    assert(!IS_OK(user_mmap_remove_range(&pcb, begin + 2 * PAGE_SIZE, 3 * PAGE_SIZE)));
+    assert(pcb.user_mappings == mapping && mapping->next == NULL);
+    assert(mapping->address == begin && mapping->size == size);
+
+    // A hole in the middle splits the mapping.
+    assert(IS_OK(user_mmap_remove_range(&pcb, begin + PAGE_SIZE, PAGE_SIZE)));
+    assert(mapping->size == PAGE_SIZE);
+    assert(mapping->next != NULL && mapping->next->address == begin + 2 * PAGE_SIZE && mapping->next->size == 2 * PAGE_SIZE);
+
+    user_mmap_detach_all(&pcb);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include "res.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Anonymous memory mapped by a process for its own use (e.g. large malloc allocations),
+//  which, unlike the memory below the page break, can be released in any order.
+//  The pages are backed lazily (@see mmap_lazy), and a fork copies them on write like
+//  the rest of the user memory.
+
+typedef struct PCB PCB;
+
+#define USER_MMAP_MAX_SIZE (1024 * 1024 * 1024)
+
+// Where the memory is mapped in the processes. Right below the shared memory.
+#define USER_MMAP_ADDRESS_BEGIN 0x500000000000
+#define USER_MMAP_ADDRESS_END   0x600000000000
+
+#define res_user_mmap_OUT_OF_MEMORY    "Ran out of memory for the mapping"
+#define res_user_mmap_INVALID_SIZE     "The size of the mapping is 0 or too large"
+#define res_user_mmap_OUT_OF_ADDRESSES "No room left for the mapping in the address space"
+#define res_user_mmap_NOT_FOUND        "The range is not inside a single mapping"
+
+// A range mapped in a process. The mappings of a process are sorted by their address.
+typedef struct user_mmap_Mapping {
+    uint64_t address;
+    uint64_t size;
+    struct user_mmap_Mapping *next;
+} user_mmap_Mapping;
+
+/**
+ * @brief - Map zeroed memory into the current process, readable and writable by usermode.
+ *
+ * @param size - Rounded up to pages.
+ * @param out_address[out] - Where it was mapped.
+ */
+res user_mmap_map(uint64_t size, uint64_t *out_address) WUR;
+
+/**
+ * @brief - Unmap pages of the current process mapped by user_mmap_map, returning them
+ *            to the free physical memory. The range may be a part of a mapping, but not
+ *            span several.
+ *
+ * @param address - Page aligned.
+ * @param size - Rounded up to pages.
+ */
+res user_mmap_unmap(uint64_t address, uint64_t size) WUR;
+
+/**
+ * @brief - Give `child` the mappings of `parent`, whose pages it got from pcb_clone_user_pages.
+ *
+ * @return - true on success, false if ran out of memory.
+ */
+bool user_mmap_fork(PCB *child, PCB *parent) WUR;
+
+/**
+ * @brief - Drop the mappings of `pcb`. Doesn't touch its pages, which PCB_cleanup releases.
+ */
+void user_mmap_detach_all(PCB *pcb);
+
+void test_user_mmap();
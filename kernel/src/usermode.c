@@ -17,6 +17,9 @@ void usermode_jump_to(void *address, const Regs *regs)
 #define USERMODE_CS 0x20 | 3
 #define USERMODE_DS 0x18 | 3
     asm volatile (
+        // No interrupts once we swap $gs, they would think they interrupted the kernel.
+        "cli\n"
+
         // Prepare the iretq stack frame
         "push " STR(USERMODE_DS) "\n"
         "push %[stack]\n"
@@ -42,7 +45,7 @@ void usermode_jump_to(void *address, const Regs *regs)
         "mov r14, [ %[regs] + 112 ]\n"
         "mov r15, [ %[regs] + 120 ]\n"
 
-        "fxrstor  [ %[regs] + 144 ]\n" // SSE
+        // No FPU/SSE registers, they are restored lazily. @see fpu.h
 
         "mov rdi, [ %[regs] + 56  ]\n"
 
@@ -54,9 +57,10 @@ void usermode_jump_to(void *address, const Regs *regs)
         "mov ds, ax\n"
         "mov es, ax\n"
         "mov fs, ax\n"
-        "mov gs, ax\n"
+        // Not $gs - loading it would overwrite the kernel $gs base, which swapgs keeps for the next kernel entry.
         "pop rax\n" // Restore the user rax
 
+        "swapgs\n"
         "iretq\n"
         :
         : [address] "r"(address), [rflags] "r"(regs->rflags), [stack] "r"(regs->rsp),
@@ -81,7 +85,7 @@ bool usermode_is_mapped(uint64_t begin, uint64_t end)
     for (uint64_t it = PAGE_ALIGN_DOWN(begin); it < end; it += PAGE_SIZE)
     {
         mmu_PageTableEntry *page = mmu_page(it);
-        if (!page->present || !page->user_supervisor)
+        if (!(page->present || page->demand) || !page->user_supervisor)
         {
             return false;
         }
@@ -0,0 +1,64 @@
+#include "vdso.h"
+#include "memory.h"
+#include "mmap.h"
+#include "mmu.h"
+#include "pcb.h"
+#include "res.h"
+#include "assert.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+static uint64_t g_vdso_time_phys;
+static vdso_Time *g_vdso_time; // The kernel reaches the page through the direct map.
+
+void vdso_init()
+{
+    // The kernel holds a reference to it forever, so it's never freed when the processes unmap it.
+    bool success = mmap_allocate_contiguous(PAGE_SIZE, &g_vdso_time_phys);
+    assert(success && "Couldn't allocate the vDSO time page");
+
+    g_vdso_time = mmu_phys_to_virt(g_vdso_time_phys);
+    memset(g_vdso_time, 0, PAGE_SIZE);
+}
+
+void vdso_set_tsc_calibration(uint64_t tsc_base, uint64_t ms_at_tsc_base, uint64_t tsc_per_ms)
+{
+    vdso_Time *time = g_vdso_time;
+
+    __atomic_add_fetch(&time->sequence, 1, __ATOMIC_SEQ_CST);
+
+    time->tsc_base = tsc_base;
+    time->ms_at_tsc_base = ms_at_tsc_base;
+    time->tsc_per_ms = tsc_per_ms;
+    time->ns_per_tsc_mult = (1000000ull << VDSO_NS_SHIFT) / tsc_per_ms;
+
+    __atomic_add_fetch(&time->sequence, 1, __ATOMIC_SEQ_CST);
+}
+
+res vdso_map(PCB *pcb, bool replace_process_page)
+{
+    assert(g_vdso_time_phys != 0 && "vdso_init wasn't called");
+
+    if (!replace_process_page)
+    {
+        mmu_map_range(g_vdso_time_phys, g_vdso_time_phys + PAGE_SIZE, VDSO_TIME_ADDRESS, MMU_USER_PAGE | MMU_EXECUTE_DISABLE);
+        mmap_phys_page_ref(g_vdso_time_phys);
+    }
+    else
+    {
+        munmap((void *)VDSO_PROCESS_ADDRESS, PAGE_SIZE);
+    }
+
+    // Writable for us until it's filled, then read-only for the process.
+    res rs = mmap((void *)VDSO_PROCESS_ADDRESS, PAGE_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE);
+    if (!IS_OK(rs))
+    {
+        return rs;
+    }
+
+    vdso_Process *process = (vdso_Process *)VDSO_PROCESS_ADDRESS;
+    memset(process, 0, PAGE_SIZE);
+    process->pid = pcb->id;
+
+    return mprotect((void *)VDSO_PROCESS_ADDRESS, PAGE_SIZE, MMAP_PROT_READ | MMAP_PROT_RING_3);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "compiler_macros.h"
+#include "pcb.h"
+#include "res.h"
+#include <stdint.h>
+
+// Pages mapped read-only into every process, so libc can read the time (and
+//  what it knows about the process) without a syscall.
+//  NOTE: the addresses and the layouts must match the libc definitions (sys/vdso.h).
+
+#define VDSO_TIME_ADDRESS    0x7fff00000000 // Shared by every process.
+#define VDSO_PROCESS_ADDRESS 0x7fff00001000 // Private to the process.
+
+#define VDSO_NS_SHIFT 32
+
+typedef struct {
+    // Odd while the kernel updates the page. Read the fields until it's even and didn't change.
+    uint32_t sequence;
+    uint32_t reserved;
+
+    // pit_ms_counter() is `ms_at_tsc_base + (rdtsc - tsc_base) / tsc_per_ms`.
+    uint64_t tsc_base;
+    uint64_t ms_at_tsc_base;
+    uint64_t tsc_per_ms; // 0 until the TSC is calibrated, then the time is available only with a syscall.
+
+    // Nanoseconds since `tsc_base` are `((rdtsc - tsc_base) * ns_per_tsc_mult) >> VDSO_NS_SHIFT`.
+    uint64_t ns_per_tsc_mult;
+} vdso_Time;
+
+typedef struct {
+    uint64_t pid;
+} vdso_Process;
+
+/**
+ * @brief - Allocate the time page. Must be called before any process is created.
+ */
+void vdso_init();
+
+/**
+ * @brief - Publish the TSC calibration of the ms counter. @see pit_switch_to_tsc
+ */
+void vdso_set_tsc_calibration(uint64_t tsc_base, uint64_t ms_at_tsc_base, uint64_t tsc_per_ms);
+
+/**
+ * @brief - Map the vDSO pages into the address space of `pcb`, which must be loaded.
+ *
+ * @param replace_process_page - Whether `pcb` already has a process page, which is
+ *                                 unmapped, e.g. the page of the parent after a fork.
+ */
+res vdso_map(PCB *pcb, bool replace_process_page) WUR;
@@ -0,0 +1,89 @@
+#include "wait_queue.h"
+#include "scheduler.h"
+#include "assert.h"
+#include "io.h"
+#include <stddef.h>
+
+void wait_queue_push(WaitQueue *queue, WaitQueueEntry *entry)
+{
+    assert(queue != NULL && entry != NULL);
+    assert(entry->queue == NULL && "The entry is already in a wait queue");
+
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    entry->queue = queue;
+    entry->next = NULL;
+    entry->prev = queue->tail;
+
+    if (queue->tail != NULL)
+    {
+        queue->tail->next = entry;
+    }
+    else
+    {
+        queue->head = entry;
+    }
+    queue->tail = entry;
+
+    set_cpu_flags(flags);
+}
+
+void wait_queue_remove(WaitQueueEntry *entry)
+{
+    assert(entry != NULL);
+
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    WaitQueue *queue = entry->queue;
+    if (queue == NULL)
+    {
+        set_cpu_flags(flags);
+        return;
+    }
+
+    if (entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        assert(queue->head == entry);
+        queue->head = entry->next;
+    }
+
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        assert(queue->tail == entry);
+        queue->tail = entry->prev;
+    }
+
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->queue = NULL;
+
+    set_cpu_flags(flags);
+}
+
+bool wait_queue_is_empty(const WaitQueue *queue)
+{
+    return queue->head == NULL;
+}
+
+void wait_queue_wake_all(WaitQueue *queue)
+{
+    uint64_t flags = get_cpu_flags();
+    cli();
+
+    for (WaitQueueEntry *it = queue->head; it != NULL; it = it->next)
+    {
+        scheduler_io_wake(it->pcb);
+    }
+
+    set_cpu_flags(flags);
+}
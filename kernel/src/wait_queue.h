@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+
+typedef struct PCB PCB;
+typedef struct WaitQueue WaitQueue;
+
+// An entry of a process blocked on a wait queue. Every PCB embeds one, but a
+//  process can register additional entries to wait on several queues at once.
+typedef struct WaitQueueEntry {
+    struct WaitQueueEntry *next;
+    struct WaitQueueEntry *prev;
+    WaitQueue *queue; // The queue the entry is in. NULL if it's not in any.
+    PCB *pcb;
+} WaitQueueEntry;
+
+// A list of processes waiting for some event. Whoever produces the event
+//  (an ISR, another process, the timer...) wakes the queue, and only the
+//  processes in it are refreshed, instead of polling every blocked process.
+//
+// Zero initialized is an empty queue.
+struct WaitQueue {
+    WaitQueueEntry *head;
+    WaitQueueEntry *tail;
+};
+
+/**
+ * @brief - Add the entry to the end of the wait queue.
+ *            The entry must not be in any queue.
+ */
+void wait_queue_push(WaitQueue *queue, WaitQueueEntry *entry);
+
+/**
+ * @brief - Remove the entry from the queue it's in. Does nothing if it's not in any queue.
+ */
+void wait_queue_remove(WaitQueueEntry *entry);
+
+bool wait_queue_is_empty(const WaitQueue *queue);
+
+/**
+ * @brief - Wake every process waiting on the queue. The processes stay in the
+ *            queue until their IO refresh reports the operation as done.
+ *          Safe to call from an ISR.
+ *
+ * @see scheduler_io_wake
+ */
+void wait_queue_wake_all(WaitQueue *queue);
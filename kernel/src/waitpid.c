@@ -1,6 +1,7 @@
 #include "waitpid.h"
 #include "pcb.h"
-#include "kmalloc.h"
+#include "slab.h"
+#include "pit.h"
 #include "scheduler.h"
 #include "usermode.h"
 #include "assert.h"
@@ -33,33 +34,64 @@ static bool waitpid_oneshot(PCB *pcb, PCB *target_pcb, usermode_mem *wstatus, ui
     return true;
 }
 
+// Our children are found even once they are zombies, other processes only while they are alive.
+static PCB *waitpid_find_target(PCB *pcb, uint64_t pid)
+{
+    PCB *target = pcb_find_by_pid(pid);
+    if (target == NULL)
+    {
+        return NULL;
+    }
+
+    if (target->parent == pcb || target->state != PCB_STATE_ZOMBIE)
+    {
+        return target;
+    }
+
+    return NULL;
+}
+
 typedef struct {
-    PCB *target_pcb;
+    uint64_t target_pid; // Not a PCB, as someone else might clean it up before we are refreshed.
     usermode_mem *wstatus;
     int options;
 } WaitpidRefreshArgument;
 
+static slab_Cache g_waitpid_argument_cache = SLAB_CACHE_INIT("waitpid argument", WaitpidRefreshArgument);
+
 // @see pcb_IORefresh
 static pcb_IORefreshResult pcb_refresh_waitpid(PCB *pcb)
 {
     WaitpidRefreshArgument *arg = pcb->refresh_arg;
     assert(arg != NULL);
 
+    PCB *target_pcb = waitpid_find_target(pcb, arg->target_pid);
+    if (target_pcb == NULL)
+    {
+        pcb->regs.rax = -1; // Failed
+        slab_free(&g_waitpid_argument_cache, arg);
+        return PCB_IO_REFRESH_DONE;
+    }
+
     uint64_t ret;
-    bool process_exited = waitpid_oneshot(pcb, arg->target_pcb, arg->wstatus, &ret);
+    bool process_exited = waitpid_oneshot(pcb, target_pcb, arg->wstatus, &ret);
     if (!process_exited)
     {
-        return PCB_IO_REFRESH_CONTINUE;
+        if (!pcb->io_timed_out)
+        {
+            return PCB_IO_REFRESH_CONTINUE;
+        }
+
+        ret = 0; // Same as NO HANG
     }
 
     pcb->regs.rax = ret;
-    kfree(arg);
+    slab_free(&g_waitpid_argument_cache, arg);
     return PCB_IO_REFRESH_DONE;
 }
 
-uint64_t waitpid(uint64_t pid, usermode_mem *wstatus, int options)
+uint64_t waitpid(uint64_t pid, usermode_mem *wstatus, int options, uint64_t timeout_ms)
 {
-#define OPTIONS_NO_HANG (1 << 0)
     PCB *current_pcb = scheduler_current_pcb();
     PCB *target_pcb = NULL;
 
@@ -85,16 +117,7 @@ uint64_t waitpid(uint64_t pid, usermode_mem *wstatus, int options)
 
     if (target_pcb == NULL)
     {
-        target_pcb = scheduler_find_by_pid(pid);
-    }
-
-    if (target_pcb == NULL)
-    {
-        size_t target_idx = pcb_ProcessChildrenArray_find(&current_pcb->children, pid);
-        if (target_idx != current_pcb->children.length)
-        {
-            target_pcb = current_pcb->children.arr[target_idx].pcb;
-        }
+        target_pcb = waitpid_find_target(current_pcb, pid);
     }
 
     if (target_pcb == NULL)
@@ -102,7 +125,7 @@ uint64_t waitpid(uint64_t pid, usermode_mem *wstatus, int options)
         return -1; // Failed
     }
 
-    if (options & OPTIONS_NO_HANG)
+    if (options & WAITPID_OPTIONS_NO_HANG)
     {
         uint64_t ret;
         bool success = waitpid_oneshot(current_pcb, target_pcb, wstatus, &ret);
@@ -114,17 +137,23 @@ uint64_t waitpid(uint64_t pid, usermode_mem *wstatus, int options)
         return ret;
     }
 
-    WaitpidRefreshArgument *arg = kcalloc(1, sizeof(*arg));
+    WaitpidRefreshArgument *arg = slab_alloc(&g_waitpid_argument_cache);
     if (arg == NULL)
     {
         return -1; // Failed
     }
 
-    arg->target_pcb = target_pcb;
+    arg->target_pid = target_pcb->id;
     arg->wstatus = wstatus;
     arg->options = options;
 
     current_pcb->refresh_arg = arg;
 
-    scheduler_move_current_process_to_io_queue_and_context_switch(pcb_refresh_waitpid);
+    uint64_t deadline = SCHEDULER_NO_DEADLINE;
+    if ((options & WAITPID_OPTIONS_TIMEOUT) && __builtin_add_overflow(pit_ms_counter(), timeout_ms, &deadline))
+    {
+        deadline = SCHEDULER_NO_DEADLINE;
+    }
+
+    scheduler_move_current_process_to_io_queue_and_context_switch(&target_pcb->exit_wait_queue, pcb_refresh_waitpid, deadline);
 }
@@ -2,4 +2,7 @@
 
 #include "usermode.h"
 
-uint64_t waitpid(uint64_t pid, usermode_mem *wstatus, int options);
+#define WAITPID_OPTIONS_NO_HANG (1 << 0)
+#define WAITPID_OPTIONS_TIMEOUT (1 << 1) // Give up after `timeout_ms`, returning 0 like with NO_HANG.
+
+uint64_t waitpid(uint64_t pid, usermode_mem *wstatus, int options, uint64_t timeout_ms);
@@ -2,17 +2,19 @@
 #include "memory.h"
 #include "io.h"
 #include "kmalloc.h"
+#include "slab.h"
 #include "vga.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include "assert.h"
 
 static Window *g_windows;
+static slab_Cache g_window_cache = SLAB_CACHE_INIT("window", Window);
 Window *g_focused_window;
 
 Window *window_create(WindowMode mode)
 {
-    Window *window = kmalloc(sizeof(*window));
+    Window *window = slab_alloc(&g_window_cache);
     if (!window) return NULL;
 
     window->mode = mode;
@@ -52,7 +54,7 @@ void window_destroy(Window *window)
                 assert(false && "Unsupported window mode");
     }
 
-    kfree(window);
+    slab_free(&g_window_cache, window);
 }
 
 Window *window_get_focused_window()
@@ -68,10 +70,10 @@ static void display_window(Window *window)
     switch (window->mode)
     {
         case WINDOW_TEXT:
-            memmove((void *)VGA_TEXT_ADDRESS, window->text->buf, size);
+            memcpy_nontemporal((void *)VGA_TEXT_ADDRESS, window->text->buf, size);
             break;
         case WINDOW_GRAPHICS:
-            memmove((void *)VGA_GRAPHICS_ADDRESS, window->graphics->buf, size);
+            memcpy_nontemporal((void *)VGA_GRAPHICS_ADDRESS, window->graphics->buf, size); // Never read back, no point caching it.
             break;
         default:
             assert(false && "Unreachable");
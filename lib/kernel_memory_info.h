@@ -1,4 +1,5 @@
 #pragma once
 
 #define KERNEL_STACK_BASE 0xfffff7fffffff000
-#define KERNEL_MEMORY_MAP 0xffff808080000000
+#define KERNEL_PAGE_FRAMES 0xffff808090000000 // @see PageFrame in mmap.c
+#define KERNEL_DIRECT_MAP 0xffff900000000000 // All the physical memory is mapped from here, at its physical address. @see mmu_phys_to_virt
@@ -1,7 +1,5 @@
 #include "mmu.h"
 #include "range.h"
-#include "bitmap.h"
-#include "bitmap.h"
 #include "memory.h"
 #include "assert.h"
 #include "math.h"
@@ -14,10 +12,18 @@
 
 uint64_t g_mmu_map_base_address = 0; // NOTE: this has to be not in the bss, as we cannot map the bss pages without this variable, and cannot set this variable (if it were in the bss) without mapping the bss pages.
 uint64_t g_mmu_phys_delta = 0;
-Bitmap *mmu_tables_bitmap = 0;
 mmu_PageMapEntry *g_pml4 = 0;
 
-#define MMU_BITMAP_BASE (g_mmu_map_base_address + MMU_ALL_TABLES_SIZE)
+// NOTE: these too are set before the kernel bss is mapped, so they must not be in the bss either.
+static uint64_t *g_mmu_boot_table_count = 0; // Tables handed out of the chunk, in order. @see mmu_config.h
+static uint64_t g_mmu_free_tables = 0; // The physical address of the first free table, each holds the address of the next. 0 if there are none.
+static uint64_t g_mmu_free_table_count = 0;
+static uint64_t g_mmu_direct_map_base = 0; // 0 until mmu_init_direct_map
+static uint64_t g_mmu_direct_map_end = 0;
+static mmu_AllocatePageFunc g_mmu_allocate_page = 0;
+static mmu_FreePageFunc g_mmu_free_page = 0;
+
+#define MMU_BOOT_TABLE_COUNT_ADDRESS (g_mmu_map_base_address + MMU_ALL_TABLES_SIZE)
 
 #define MMU_STRUCTURES_START g_mmu_map_base_address
 #define MMU_STRUCTURES_END (MMU_STRUCTURES_START + MMU_TOTAL_CHUNK_SIZE)
@@ -31,29 +37,54 @@ mmu_PageMapEntry *g_pml4 = 0;
 #define VGA_BEGIN 0xb8000
 #define VGA_END 0xb8fa0
 
+#define MMU_LEGACY_HOLE_BEGIN 0xa0000
+#define MMU_LEGACY_HOLE_END   0x100000
+
 void mmu_unmap_range(uint64_t virtual_begin, uint64_t virtual_end);
 
 void *mmu_map_allocate()
 {
-    for (int i = 0; i < MMU_BITMAP_LENGTH; i++)
+    uint64_t phys;
+    if (g_mmu_free_tables != 0)
+    {
+        phys = g_mmu_free_tables;
+        g_mmu_free_tables = *(uint64_t *)mmu_phys_to_virt(phys);
+        g_mmu_free_table_count--;
+    }
+    else if (g_mmu_allocate_page != 0)
     {
-        if (!bitmap_test(mmu_tables_bitmap, i))
+        if (!g_mmu_allocate_page(&phys))
         {
-            bitmap_set(mmu_tables_bitmap, i);
-            void *addr = (void *)(g_mmu_map_base_address + i * TABLE_SIZE_BYTES);
-            memset(addr, 0, TABLE_SIZE_BYTES);
-            return addr;
+            return 0;
         }
     }
+    else
+    {
+        if (*g_mmu_boot_table_count == MMU_TABLE_COUNT)
+        {
+            return 0;
+        }
+        phys = g_mmu_map_base_address + *g_mmu_boot_table_count * TABLE_SIZE_BYTES;
+        (*g_mmu_boot_table_count)++;
+    }
 
-    // No block was found
-    return 0;
+    void *addr = mmu_phys_to_virt(phys);
+    memset(addr, 0, TABLE_SIZE_BYTES);
+    return addr;
 }
 
 void mmu_map_deallocate(void *address)
 {
-    int index = ((size_t)address - MMU_STRUCTURES_START) / TABLE_SIZE_BYTES;
-    bitmap_clear(mmu_tables_bitmap, index);
+    const uint64_t phys = mmu_virt_to_phys(address);
+    if (g_mmu_free_page != 0 && g_mmu_free_table_count >= MMU_FREE_TABLES_MAX)
+    {
+        g_mmu_free_page(phys);
+        return;
+    }
+
+    *(uint64_t *)address = g_mmu_free_tables;
+    g_mmu_free_tables = phys;
+    g_mmu_free_table_count++;
 }
 
 mmu_PageTableEntry *mmu_page_allocate(uint64_t virtual, uint64_t physical)
@@ -61,6 +92,7 @@ mmu_PageTableEntry *mmu_page_allocate(uint64_t virtual, uint64_t physical)
     mmu_PageTableEntry *page = mmu_page(virtual);
     mmu_page_table_entry_address_set(page, (uint64_t)physical);
     page->present = true;
+    page->demand = false;
 
     return page;
 }
@@ -84,21 +116,43 @@ void mmu_unmap_bootloader()
 void mmu_init_post_init(uint64_t mmu_map_base_address)
 {
     g_mmu_map_base_address = mmu_map_base_address;
-    mmu_tables_bitmap = (Bitmap *)MMU_BITMAP_BASE; // This macro depends on g_mmu_map_base_address
+    g_mmu_boot_table_count = (uint64_t *)MMU_BOOT_TABLE_COUNT_ADDRESS; // This macro depends on g_mmu_map_base_address
     g_pml4 = (mmu_PageMapEntry *)g_mmu_map_base_address; // As asserted bellow, this always will be the case.
 }
 
-void mmu_migrate_to_virt_mem(void *addr) // addr is of size MMU_TOTAL_CHUNK_SIZE
+void mmu_init_direct_map(uint64_t direct_map_base, uint64_t phys_end, mmu_AllocatePageFunc allocate_page, mmu_FreePageFunc free_page)
 {
-    mmu_map_range(g_mmu_map_base_address, g_mmu_map_base_address + MMU_TOTAL_CHUNK_SIZE, (uint64_t)addr, MMU_READ_WRITE);
+    assert(g_mmu_phys_delta == 0 && "The tables must still be identity mapped");
 
-    uint64_t old_phys = g_mmu_map_base_address;
-    g_mmu_phys_delta = (uint64_t)addr - g_mmu_map_base_address;
-    g_mmu_map_base_address = (uint64_t)addr;
-    mmu_tables_bitmap = (Bitmap *)MMU_BITMAP_BASE; // This macro depends on g_mmu_map_base_address
-    g_pml4 = (mmu_PageMapEntry *)g_mmu_map_base_address; // As asserted bellow, this always will be the case.
+    const uint64_t chunk_phys = g_mmu_map_base_address;
+    const uint64_t chunk_end = PAGE_ALIGN_UP(chunk_phys + MMU_TOTAL_CHUNK_SIZE);
+    phys_end = MAX(phys_end, chunk_end);
+
+    g_mmu_direct_map_base = direct_map_base;
+    g_mmu_direct_map_end = direct_map_base + phys_end;
 
-    mmu_unmap_range(old_phys, old_phys + MMU_TOTAL_CHUNK_SIZE);
+    // The legacy VGA memory and BIOS ROMs are never RAM, and must not be cached.
+    const int flags = MMU_READ_WRITE | MMU_EXECUTE_DISABLE;
+    mmu_map_range(0, MMU_LEGACY_HOLE_BEGIN, direct_map_base, flags);
+    mmu_map_range(MMU_LEGACY_HOLE_END, phys_end, direct_map_base + MMU_LEGACY_HOLE_END, flags);
+
+    // From now on the tables are reached through the direct map.
+    g_mmu_phys_delta = direct_map_base;
+    g_pml4 = (mmu_PageMapEntry *)((uint64_t)g_pml4 + direct_map_base);
+
+    const uint64_t boot_table_count = *g_mmu_boot_table_count;
+    g_mmu_boot_table_count = 0;
+    g_mmu_allocate_page = allocate_page;
+    g_mmu_free_page = free_page;
+
+    mmu_unmap_range(MMU_STRUCTURES_START, MMU_STRUCTURES_END);
+    mmu_tlb_flush_all();
+
+    for (uint64_t i = boot_table_count; i < MMU_TABLE_COUNT; i++)
+    {
+        free_page(chunk_phys + i * TABLE_SIZE_BYTES);
+    }
+    free_page(chunk_phys + MMU_ALL_TABLES_SIZE); // The page of the count
 }
 
 uint64_t mmu_init(range_Range *memory_map, uint64_t memory_map_length, uint64_t bootloader_end_addr)
@@ -106,9 +160,9 @@ uint64_t mmu_init(range_Range *memory_map, uint64_t memory_map_length, uint64_t
     bool success = range_pop_of_size(memory_map, memory_map_length, PAGE_ALIGN_UP(MMU_TOTAL_CHUNK_SIZE), &g_mmu_map_base_address);
     assert(success && "No consecutive physical RAM for the MMU structures were found\n");
 
-    mmu_tables_bitmap = (Bitmap *)MMU_BITMAP_BASE;
+    g_mmu_boot_table_count = (uint64_t *)MMU_BOOT_TABLE_COUNT_ADDRESS;
 
-    bitmap_init(mmu_tables_bitmap, MMU_BITMAP_SIZE);
+    *g_mmu_boot_table_count = 0;
     g_pml4 = mmu_map_allocate();
     assert((g_pml4 == (void *)g_mmu_map_base_address) && "Expected g_pml4 to be located at the first available address");
     mmu_table_init(g_pml4);
@@ -171,11 +225,13 @@ void mmu_tlb_flush_all()
 mmu_PageMapEntry *mmu_page_map_get_address_of(mmu_PageMapEntry *entry)
 {
     assert(entry->present && "The page map must be valid");
+    assert(!entry->page_size && "A 2 MiB page has no page table");
     return (mmu_PageMapEntry *)mmu_page_table_entry_address_get_virt(entry);
 }
 
 mmu_PageMapEntry *mmu_page_map_get_or_allocate_of(mmu_PageMapEntry *entry)
 {
+    assert(!entry->page_size && "A 2 MiB page has no page table");
     if (!entry->present)
     {
         uint64_t address = (uint64_t)mmu_map_allocate();
@@ -188,6 +244,79 @@ mmu_PageMapEntry *mmu_page_map_get_or_allocate_of(mmu_PageMapEntry *entry)
     return (mmu_PageMapEntry *)mmu_page_table_entry_address_get_virt(entry);
 }
 
+static uint64_t mmu_huge_page_address_get(mmu_PageMapEntry *entry)
+{
+    return mmu_page_table_entry_address_get((mmu_PageTableEntry *)entry) & ~(uint64_t)(MMU_HUGE_PAGE_SIZE - 1); // Bit 12 is the PAT bit of a 2 MiB page
+}
+
+static void mmu_huge_page_set(mmu_PageMapEntry *entry, uint64_t physical, int flags)
+{
+    *entry = (mmu_PageMapEntry){
+        .present = true,
+        .page_size = true,
+    };
+    mmu_page_table_entry_address_set((mmu_PageTableEntry *)entry, physical);
+    mmu_page_entry_set_flags((mmu_PageTableEntry *)entry, flags);
+}
+
+mmu_PageTableEntry *mmu_huge_page_split(mmu_PageMapEntry *entry)
+{
+    assert(entry->present && entry->page_size && "Not a 2 MiB page");
+
+    mmu_PageTableEntry *table = mmu_map_allocate();
+    assert(table && "mmu_map_allocate(): NULL");
+
+    const uint64_t physical = mmu_huge_page_address_get(entry);
+    for (int i = 0; i < TABLE_LENGTH; i++)
+    {
+        table[i] = (mmu_PageTableEntry){
+            .present = true,
+            .read_write = entry->read_write,
+            .user_supervisor = entry->user_supervisor,
+            .write_through = entry->write_through,
+            .cache_disable = entry->cache_disable,
+            .execute_disable = entry->execute_disable,
+        };
+        mmu_page_table_entry_address_set(&table[i], physical + i * PAGE_SIZE);
+    }
+
+    // The same translation as before, so the TLB doesn't have to be flushed. The permissions are now in the pages.
+    *entry = (mmu_PageMapEntry){
+        .present = true,
+        .read_write = true,
+        .user_supervisor = true,
+    };
+    mmu_page_table_entry_address_set_virt(entry, (uint64_t)table);
+
+    return table;
+}
+
+// The page directory entry of `address`, or NULL if any of the tables above it is not present.
+static mmu_PageMapEntry *mmu_page_directory_entry_find(uint64_t address)
+{
+    const bool is_valid_virtual_address = (address < 0x0000800000000000 || address > 0xFFFF7FFFFFFFFFFF);
+    if (!is_valid_virtual_address)
+    {
+        return NULL;
+    }
+
+    mmu_PageIndexes page_indexes = {0};
+    memmove(&page_indexes, &address, sizeof(address));
+
+    mmu_PageMapEntry *pml4_entry = g_pml4 + page_indexes.level4;
+    if (!pml4_entry->present) return NULL;
+    mmu_PageMapEntry *pml3_entry = mmu_page_map_get_address_of(pml4_entry) + page_indexes.level3;
+    if (!pml3_entry->present) return NULL;
+
+    return mmu_page_map_get_address_of(pml3_entry) + page_indexes.level2;
+}
+
+mmu_PageMapEntry *mmu_huge_page_find(void *address)
+{
+    mmu_PageMapEntry *entry = mmu_page_directory_entry_find((uint64_t)address);
+    return entry != NULL && entry->present && entry->page_size ? entry : NULL;
+}
+
 mmu_PageTableEntry *mmu_page_existing(void *address)
 {
     const bool is_valid_virtual_address = ((uint64_t)address < 0x0000800000000000 || (uint64_t)address > 0xFFFF7FFFFFFFFFFF);
@@ -201,6 +330,10 @@ mmu_PageTableEntry *mmu_page_existing(void *address)
     mmu_PageMapEntry *pml3_entry = pml3 + page_indexes.level3;
     mmu_PageMapEntry *pml2 = mmu_page_map_get_address_of(pml3_entry);
     mmu_PageMapEntry *pml2_entry = pml2 + page_indexes.level2;
+    if (pml2_entry->present && pml2_entry->page_size)
+    {
+        mmu_huge_page_split(pml2_entry);
+    }
     mmu_PageTableEntry *page_table = (mmu_PageTableEntry *)mmu_page_map_get_address_of(pml2_entry);
 
     mmu_PageTableEntry *entry = page_table + page_indexes.page;
@@ -208,7 +341,28 @@ mmu_PageTableEntry *mmu_page_existing(void *address)
     return entry;
 }
 
-mmu_PageTableEntry *mmu_page(uint64_t address)
+mmu_PageTableEntry *mmu_page_entry_find(void *address)
+{
+    mmu_PageMapEntry *pml2_entry = mmu_page_directory_entry_find((uint64_t)address);
+    if (pml2_entry == NULL || !pml2_entry->present) return NULL;
+    if (pml2_entry->page_size)
+    {
+        mmu_huge_page_split(pml2_entry);
+    }
+
+    mmu_PageIndexes page_indexes = {0};
+    memmove(&page_indexes, &address, sizeof(address));
+
+    return (mmu_PageTableEntry *)mmu_page_map_get_address_of(pml2_entry) + page_indexes.page;
+}
+
+mmu_PageTableEntry *mmu_page_find(void *address)
+{
+    mmu_PageTableEntry *entry = mmu_page_entry_find(address);
+    return entry != NULL && entry->present ? entry : NULL;
+}
+
+mmu_PageMapEntry *mmu_page_directory_entry(uint64_t address)
 {
     const bool is_valid_virtual_address = (address < 0x0000800000000000 || address > 0xFFFF7FFFFFFFFFFF);
     assert(is_valid_virtual_address && "Highest 16 bits of an address must be the same (aka either canonical address, or non-canonical)");
@@ -230,7 +384,19 @@ mmu_PageTableEntry *mmu_page(uint64_t address)
     pml3_entry->user_supervisor = true;
     mmu_PageMapEntry *pml2 = mmu_page_map_get_or_allocate_of(pml3_entry);
 
-    mmu_PageMapEntry *pml2_entry = pml2 + page_indexes.level2;
+    return pml2 + page_indexes.level2;
+}
+
+mmu_PageTableEntry *mmu_page(uint64_t address)
+{
+    mmu_PageIndexes page_indexes = {0};
+    memmove(&page_indexes, &address, sizeof(address));
+
+    mmu_PageMapEntry *pml2_entry = mmu_page_directory_entry(address);
+    if (pml2_entry->present && pml2_entry->page_size)
+    {
+        mmu_huge_page_split(pml2_entry);
+    }
     pml2_entry->read_write = true;
     pml2_entry->user_supervisor = true;
     mmu_PageTableEntry *page_table = (mmu_PageTableEntry *)mmu_page_map_get_or_allocate_of(pml2_entry);
@@ -257,20 +423,38 @@ uint64_t mmu_page_table_entry_address_get_virt(mmu_PageMapEntry *page_map_ptr)
 {
     uint64_t phys_address = (uint64_t)(((mmu_PageTableEntry *)page_map_ptr)->_address) << MMU_ENTRY_ADDRESS_BITSHIFT;
 
-    return phys_address + g_mmu_phys_delta;
+    return (uint64_t)mmu_phys_to_virt(phys_address);
 }
 
 void mmu_page_table_entry_address_set_virt(mmu_PageMapEntry *page_map_ptr, uint64_t address)
 {
-    uint64_t phys_address = address - g_mmu_phys_delta;
+    uint64_t phys_address = mmu_virt_to_phys((void *)address);
     ((mmu_PageTableEntry *)page_map_ptr)->_address = phys_address >> MMU_ENTRY_ADDRESS_BITSHIFT;
 }
 
+mmu_PageMapEntry *mmu_huge_page_covered(uint64_t virt, uint64_t end)
+{
+    if (virt % MMU_HUGE_PAGE_SIZE != 0 || end - virt < MMU_HUGE_PAGE_SIZE)
+    {
+        return NULL;
+    }
+
+    return mmu_huge_page_find((void *)virt);
+}
+
 void mmu_unmap_range(uint64_t virtual_begin, uint64_t virtual_end)
 {
     for (uint64_t virt = virtual_begin & (~0xfff);
          virt < virtual_end; virt += PAGE_SIZE)
     {
+        mmu_PageMapEntry *huge_page = mmu_huge_page_covered(virt, virtual_end);
+        if (huge_page != NULL)
+        {
+            huge_page->present = 0;
+            virt += MMU_HUGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+
         mmu_PageTableEntry *page = mmu_page_existing((void *)virt);
         page->present = 0;
     }
@@ -282,22 +466,36 @@ void mmu_map_range(uint64_t physical_begin, uint64_t physical_end,
     for (uint64_t virt = virtual_begin & (~0xfff), phys = physical_begin & (~0xfff);
          phys < physical_end; phys += PAGE_SIZE, virt += PAGE_SIZE)
     {
+        // A 2 MiB page where both addresses are aligned to it, unless there's a page table there already.
+        if (virt % MMU_HUGE_PAGE_SIZE == 0 && phys % MMU_HUGE_PAGE_SIZE == 0 && physical_end - phys >= MMU_HUGE_PAGE_SIZE)
+        {
+            mmu_PageMapEntry *entry = mmu_page_directory_entry(virt);
+            if (!entry->present || entry->page_size)
+            {
+                mmu_huge_page_set(entry, phys, flags);
+                phys += MMU_HUGE_PAGE_SIZE - PAGE_SIZE;
+                virt += MMU_HUGE_PAGE_SIZE - PAGE_SIZE;
+                continue;
+            }
+        }
+
         mmu_PageTableEntry *page = mmu_page_allocate(virt, phys);
-        page->read_write = (flags & MMU_READ_WRITE) != 0;
-        page->execute_disable = (flags & MMU_EXECUTE_DISABLE) != 0;
-        page->user_supervisor = (flags & MMU_USER_PAGE) != 0;
+        mmu_page_entry_set_flags(page, flags);
     }
 }
 
-void mmu_page_set_flags(void *virtual_address, int new_flags)
+void mmu_page_entry_set_flags(mmu_PageTableEntry *page, int new_flags)
 {
-    mmu_PageTableEntry *page = mmu_page_existing(virtual_address);
-
     page->read_write = (new_flags & MMU_READ_WRITE) != 0;
     page->execute_disable = (new_flags & MMU_EXECUTE_DISABLE) != 0;
     page->user_supervisor = (new_flags & MMU_USER_PAGE) != 0;
 }
 
+void mmu_page_set_flags(void *virtual_address, int new_flags)
+{
+    mmu_page_entry_set_flags(mmu_page_existing(virtual_address), new_flags);
+}
+
 void mmu_page_range_set_flags(void *virtual_address_begin, void *virtual_address_end, int new_flags)
 {
     uint64_t virtual_begin = (uint64_t)virtual_address_begin & (~0xfff);
@@ -305,12 +503,31 @@ void mmu_page_range_set_flags(void *virtual_address_begin, void *virtual_address
 
     for (uint64_t virt = virtual_begin; virt < virtual_end; virt += PAGE_SIZE)
     {
+        mmu_PageMapEntry *huge_page = mmu_huge_page_covered(virt, virtual_end);
+        if (huge_page != NULL)
+        {
+            mmu_page_entry_set_flags((mmu_PageTableEntry *)huge_page, new_flags);
+            virt += MMU_HUGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+
         mmu_page_set_flags((void *)virt, new_flags);
     }
 }
 
 uint64_t mmu_get_phys_addr_of(void *virt)
 {
+    if ((uint64_t)virt >= g_mmu_direct_map_base && (uint64_t)virt < g_mmu_direct_map_end)
+    {
+        return PAGE_ALIGN_DOWN((uint64_t)virt - g_mmu_direct_map_base);
+    }
+
+    mmu_PageMapEntry *huge_page = mmu_huge_page_find(virt);
+    if (huge_page != NULL)
+    {
+        return mmu_huge_page_address_get(huge_page) + PAGE_ALIGN_DOWN((uint64_t)virt % MMU_HUGE_PAGE_SIZE);
+    }
+
     mmu_PageTableEntry *page = mmu_page_existing(virt);
     return mmu_page_table_entry_address_get(page);
 }
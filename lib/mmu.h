@@ -4,6 +4,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define MMU_HUGE_PAGE_SIZE 0x200000 // Mapped by a page directory entry, instead of a page table.
+
 enum {
     MMU_READ_WRITE      = 0x1,
     MMU_EXECUTE_DISABLE = 0x2,
@@ -31,10 +33,11 @@ typedef struct
     uint64_t dirty : 1;
     uint64_t pat : 1;
     uint64_t global : 1;
-    uint64_t
-        available3 : 3; // unused by the MMU, can be used by the kernel (same for any of the fields called available)
+    uint64_t copy_on_write : 1; // Ignored by the MMU. Writable, but shared, so it's read-only until the first write copies it. @see mmap_copy_on_write
+    uint64_t shared : 1; // Ignored by the MMU. Shared on purpose, it stays writable and is never copied on write. @see shm.h
+    uint64_t demand : 1; // Ignored by the MMU. Reserved but not present, it's backed by a zeroed page on the first access. @see mmap_populate
     uint64_t _address : 40;
-    uint64_t available7 : 7;
+    uint64_t available7 : 7; // unused by the MMU, can be used by the kernel (same for any of the fields called available)
     uint64_t protection_key : 4;
     uint64_t execute_disable : 1;
 } mmu_PageTableEntry;
@@ -48,7 +51,7 @@ typedef struct
     uint64_t cache_disable : 1;
     uint64_t accessed : 1;
     uint64_t available1 : 1;
-    uint64_t page_size : 1; // set to 0
+    uint64_t page_size : 1; // Set only in page directory entries that map a 2 MiB page themselves.
     uint64_t available4 : 4;
     uint64_t _address : 40; // DO NOT ACCESS DIRECTLY! use mmu_page_table_entry_address_set or _get
     uint64_t available11 : 11;
@@ -57,6 +60,29 @@ typedef struct
 
 extern mmu_PageMapEntry *g_pml4;
 
+// Where physical memory is reached: KERNEL_DIRECT_MAP once mmu_init_direct_map ran, 0 (identity) before it.
+extern uint64_t g_mmu_phys_delta;
+
+/**
+ * @brief - The address physical memory at `phys` is reached at, without walking the tables.
+ *          Before mmu_init_direct_map only the MMU chunk (the page tables) is reachable this way.
+ */
+static inline void *mmu_phys_to_virt(uint64_t phys)
+{
+    return (void *)(phys + g_mmu_phys_delta);
+}
+
+/**
+ * @brief - The inverse of mmu_phys_to_virt. Only for addresses it returned, for anything else @see mmu_get_phys_addr_of
+ */
+static inline uint64_t mmu_virt_to_phys(const void *virt)
+{
+    return (uint64_t)virt - g_mmu_phys_delta;
+}
+
+typedef bool (*mmu_AllocatePageFunc)(uint64_t *out_phys);
+typedef void (*mmu_FreePageFunc)(uint64_t phys);
+
 void mmu_init_post_init(uint64_t mmu_map_base_address);
 uint64_t mmu_init(range_Range *memory_map, uint64_t memory_map_length, uint64_t bootloader_end_addr);
 uint64_t mmu_page_table_entry_address_get(mmu_PageTableEntry *page_map_ptr);
@@ -64,6 +90,38 @@ void mmu_page_table_entry_address_set(mmu_PageTableEntry *page_map_ptr, uint64_t
 uint64_t mmu_page_table_entry_address_get_virt(mmu_PageMapEntry *page_map_ptr);
 void mmu_page_table_entry_address_set_virt(mmu_PageMapEntry *page_map_ptr, uint64_t address);
 mmu_PageTableEntry *mmu_page_existing(void *address);
+
+/**
+ * @brief - Like mmu_page_existing, but doesn't assert that the page is mapped.
+ * @return - The entry of the page, or NULL if it (or any of its tables) is not present.
+ */
+mmu_PageTableEntry *mmu_page_find(void *address);
+
+/**
+ * @brief - Like mmu_page_find, but returns the entry even if the page itself is not present.
+ * @return - The entry of the page, or NULL if any of its tables is not present.
+ */
+mmu_PageTableEntry *mmu_page_entry_find(void *address);
+
+/**
+ * @brief - The page directory entry that maps `address` as part of a 2 MiB page.
+ * @return - NULL if `address` is not in a 2 MiB page.
+ */
+mmu_PageMapEntry *mmu_huge_page_find(void *address);
+
+/**
+ * @brief - The 2 MiB page at `virt` if [virt, end) covers all of it, so it can be handled as a whole instead of split.
+ * @return - NULL if there's no 2 MiB page at `virt`, or the range covers only a part of it.
+ */
+mmu_PageMapEntry *mmu_huge_page_covered(uint64_t virt, uint64_t end);
+
+/**
+ * @brief - Replace the 2 MiB page of `entry` with a page table of 4 KiB pages that map the same memory, with the same flags.
+ *          The functions that return the entry of a single page split the 2 MiB page it's in on their own.
+ */
+mmu_PageTableEntry *mmu_huge_page_split(mmu_PageMapEntry *entry);
+
+void mmu_page_entry_set_flags(mmu_PageTableEntry *page, int new_flags);
 void mmu_page_set_flags(void *virtual_address, int new_flags);
 void mmu_page_range_set_flags(void *virtual_address_begin, void *virtual_address_end, int new_flags);
 void mmu_table_init(void *address);
@@ -72,15 +130,26 @@ void mmu_tlb_flush_all();
 mmu_PageMapEntry *mmu_page_map_get_address_of(mmu_PageMapEntry *entry);
 mmu_PageTableEntry *mmu_page(uint64_t address);
 
-void mmu_migrate_to_virt_mem(void *addr);
+/**
+ * @brief - Get the page directory entry of `address`, allocating the tables above it if needed.
+ */
+mmu_PageMapEntry *mmu_page_directory_entry(uint64_t address);
+
+/**
+ * @brief - Map the physical memory below `phys_end` (and the MMU chunk) at `direct_map_base`, with 2 MiB pages
+ *            where possible, and reach the tables through it from now on. New tables are then allocated
+ *            with `allocate_page`, and the tables left in the MMU chunk are given to `free_page`.
+ *          Must be called once, while the tables are still identity mapped.
+ */
+void mmu_init_direct_map(uint64_t direct_map_base, uint64_t phys_end, mmu_AllocatePageFunc allocate_page, mmu_FreePageFunc free_page);
 void mmu_load_virt_pml4(void *pml4);
 
 uint64_t mmu_get_phys_addr_of(void *virt);
 
 /**
- * @brief Allocate a page for an MMU structure (like pml4).
+ * @brief Allocate a page for an MMU structure (like pml4). Freed tables are reused first.
  *
- * @return 4096 byte aligned address of size 4096.
+ * @return 4096 byte aligned address of size 4096, zeroed. NULL if out of memory.
  */
 void *mmu_map_allocate();
 
@@ -93,6 +162,9 @@ void *mmu_map_allocate();
  */
 void mmu_map_deallocate(void *address);
 
+/**
+ * @brief - Map [physical_begin, physical_end) at `virtual_begin`, with 2 MiB pages wherever both are aligned to one.
+ */
 void mmu_map_range(uint64_t physical_begin, uint64_t physical_end, uint64_t virtual_begin, int flags);
 void mmu_unmap_range(uint64_t virtual_begin, uint64_t virtual_end);
 
@@ -2,11 +2,13 @@
 
 #define TABLE_LENGTH 512
 
+// The tables for the boot are handed out in order, from a single chunk (the count of the used ones is right after them).
+//  Once the kernel sets up the direct map, new tables are allocated from the physical memory, and the rest of the chunk is freed.
 #define MMU_TABLE_COUNT 512
-#define MMU_BITMAP_SIZE (MMU_TABLE_COUNT / 8)
-#define MMU_BITMAP_LENGTH MMU_TABLE_COUNT
 
 #define TABLE_SIZE_BYTES (TABLE_LENGTH * sizeof(mmu_PageMapEntry))
 
 #define MMU_ALL_TABLES_SIZE (MMU_TABLE_COUNT * TABLE_SIZE_BYTES)
-#define MMU_TOTAL_CHUNK_SIZE (MMU_BITMAP_SIZE + MMU_ALL_TABLES_SIZE)
+#define MMU_TOTAL_CHUNK_SIZE (MMU_ALL_TABLES_SIZE + sizeof(uint64_t))
+
+#define MMU_FREE_TABLES_MAX 64 // Freed tables kept for reuse, the rest are given back to the physical memory allocator.
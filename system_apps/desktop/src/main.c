@@ -10,6 +10,7 @@
 #include <gx/palette.h>
 #include <gx/vec.h>
 #include <math.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -260,6 +261,11 @@ int main(int argc, char **argv)
     app_add_button(&g_app, NULL, "/bin/paint", (gx_Vec2){1, button_y += 18});
     app_add_button(&g_app, NULL, "/bin/sh", (gx_Vec2){1, button_y += 18});
 
+    struct pollfd input_fds[] = {
+        {.fd = g_tty_fd, .events = POLLIN},
+        {.fd = gx_mouse_fd(), .events = POLLIN},
+    };
+
     while (1)
     {
         input_handle(&g_app);
@@ -267,5 +273,8 @@ int main(int argc, char **argv)
         app_update(&g_app);
 
         app_display(&g_app);
+
+        // Nothing changes on the screen until there's input, so sleep until then.
+        poll(input_fds, sizeof(input_fds) / sizeof(*input_fds), -1);
     }
 }
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+#define POLLIN   0x001 // There's data to read.
+#define POLLOUT  0x004 // Writing won't block.
+#define POLLERR  0x008 // Always reported. E.g. the read end of a pipe is closed.
+#define POLLHUP  0x010 // Always reported. E.g. the write end of a pipe is closed.
+#define POLLNVAL 0x020 // Always reported. `fd` isn't open.
+
+#define POLL_MAX_FDS 64
+
+struct pollfd {
+    int fd; // Ignored if negative.
+    short events; // The requested POLL events.
+    short revents; // Set to the events that are ready.
+};
+
+typedef size_t nfds_t;
+
+/**
+ * @brief - Block until any of the `nfds` file descriptors in `fds` is ready for any of
+ *            its requested events, or `timeout_ms` passes. Sets `revents` of every one.
+ *
+ * @param timeout_ms - -1 to wait forever, 0 to not block at all.
+ *
+ * @return - The amount of ready file descriptors (0 on timeout), or -1 on error.
+ */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout_ms);
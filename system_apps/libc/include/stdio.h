@@ -22,7 +22,9 @@ int putc(int c, FILE *stream);
 int putchar(int c);
 
 FILE *fopen(const char *restrict path, const char *restrict mode);
+FILE *fdopen(int fd, const char *mode);
 int fclose(FILE *stream);
+int fileno(FILE *stream);
 
 #define SEEK_SET    0   /* Seek from beginning of file.  */
 #define SEEK_CUR    1   /* Seek from current position.   */
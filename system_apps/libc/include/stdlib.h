@@ -27,6 +27,17 @@ void *malloc(size_t size) __attribute_malloc(free) _WUR;
 void *calloc(size_t amount, size_t size) __attribute_malloc(free) _WUR;
 void *realloc(void *ptr, size_t size) _WUR;
 
+#define M_MXFAST          1 // The largest request served from the fastbins, 0 to disable them.
+#define M_TRIM_THRESHOLD -1 // How much free memory at the top of the heap is kept, before it's given back.
+#define M_MMAP_THRESHOLD -3 // The smallest request that's mapped on its own, and unmapped once freed.
+
+/**
+ * @brief - Tune the allocator. @see the M_ parameters above.
+ *
+ * @return - 1 on success, 0 if the parameter or the value are invalid.
+ */
+int mallopt(int param, int value);
+
 int rand(void);
 void srand(unsigned int seed);
 int rand_r(unsigned int *seed_ptr);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Blocking synchronization primitives, built on futex_wait/futex_wake (@see sys/futex.h).
+//  They work between processes that share the memory they are in.
+//  Zero initialized is unlocked, or a semaphore with a count of 0.
+
+typedef struct {
+    uint32_t state; // 0 - unlocked, 1 - locked, 2 - locked and someone might be waiting
+} mutex_t;
+
+typedef struct {
+    uint32_t sequence; // Changes on every signal, so a waiter knows if it missed one.
+} cond_t;
+
+typedef struct {
+    uint32_t count;
+} sem_t;
+
+void mutex_lock(mutex_t *mutex);
+bool mutex_trylock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+
+/**
+ * @brief - Unlock `mutex` and wait for a signal on `cond`, then lock `mutex` again.
+ *          Like with any condition variable, might return without a signal.
+ */
+void cond_wait(cond_t *cond, mutex_t *mutex);
+
+/**
+ * @brief - Like cond_wait, but gives up after `timeout_ms` milliseconds.
+ *
+ * @return - false if timed out, true otherwise.
+ */
+bool cond_timedwait(cond_t *cond, mutex_t *mutex, uint64_t timeout_ms);
+
+void cond_signal(cond_t *cond);
+void cond_broadcast(cond_t *cond);
+
+void sem_init(sem_t *sem, uint32_t count);
+void sem_wait(sem_t *sem);
+bool sem_trywait(sem_t *sem);
+void sem_post(sem_t *sem);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// Return values of futex_wait
+#define FUTEX_WAIT_WOKEN         0
+#define FUTEX_WAIT_VALUE_CHANGED 1 // `*addr` wasn't `expected`, didn't block.
+#define FUTEX_WAIT_TIMED_OUT     2
+
+#define FUTEX_NO_TIMEOUT UINT64_MAX
+
+/**
+ * @brief - Block while `*addr` is `expected`, until futex_wake is called on `addr` or `timeout_ms` passes.
+ *          The check and the blocking are atomic with futex_wake.
+ *
+ * @param addr - 4 byte aligned.
+ * @return - One of the FUTEX_WAIT_ values, or -1 if `addr` is invalid.
+ */
+int futex_wait(uint32_t *addr, uint32_t expected, uint64_t timeout_ms);
+
+/**
+ * @brief - Wake up to `count` of the processes blocked in futex_wait on `addr`.
+ *
+ * @return - The amount of woken processes, or -1 if `addr` is invalid.
+ */
+int futex_wake(uint32_t *addr, uint64_t count);
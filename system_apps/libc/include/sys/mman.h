@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief - Map zeroed memory, readable and writable. The pages are backed only once accessed.
+ *          Unlike memory from sbrk, it can be returned in any order, with munmap.
+ *
+ * @param size - Rounded up to pages.
+ *
+ * @return - The address it's mapped at, or NULL on failure.
+ */
+void *mmap(size_t size);
+
+/**
+ * @brief - Unmap pages mapped by mmap. The range may be a part of a mapping, but not span several.
+ *
+ * @param addr - Page aligned.
+ * @param size - Rounded up to pages.
+ *
+ * @return - 0 on success, -1 on failure.
+ */
+int munmap(void *addr, size_t size);
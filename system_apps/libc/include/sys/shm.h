@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+
+#define SHM_NAME_MAX_LEN 32 // The null terminator included.
+
+/**
+ * @brief - Map shared memory, which other processes may map at the same time.
+ *          Its pages are zeroed when it's created, and never copied: a fork shares them with the child.
+ *
+ * @param name - The object to map, created if there's none. Processes that map the same
+ *                 name share the memory, until it's unlinked. NULL for new anonymous memory,
+ *                 shared only with the children forked after this call.
+ * @param size - Rounded up to pages. When creating the object, it's its size.
+ *
+ * @return - The address it's mapped at, or NULL on failure.
+ */
+void *shm_map(const char *name, size_t size);
+
+// Unmap shared memory mapped at `addr` by shm_map. Returns 0 on success, -1 on failure.
+int shm_unmap(void *addr);
+
+// Remove the name, so the memory is freed once no process maps it. Returns 0 on success, -1 on failure.
+int shm_unlink(const char *name);
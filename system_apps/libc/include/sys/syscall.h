@@ -3,8 +3,14 @@
 #define SYS_read     0
 #define SYS_write    1
 #define SYS_open     2
+#define SYS_close    3
+#define SYS_poll     7
 #define SYS_lseek    8
+#define SYS_mmap     9
+#define SYS_munmap   11
 #define SYS_brk      12
+#define SYS_pipe     22
+#define SYS_fork     57
 #define SYS_execve   59
 #define SYS_exit     60
 #define SYS_getcwd   79
@@ -18,3 +24,10 @@
 #define SYS_pitTime 1003
 #define SYS_CreateWindow  1004
 #define SYS_DestroyWindow 1005
+#define SYS_idleTime 1006
+#define SYS_nice 1007
+#define SYS_futexWait 1008
+#define SYS_futexWake 1009
+#define SYS_shmMap    1010
+#define SYS_shmUnmap  1011
+#define SYS_shmUnlink 1012
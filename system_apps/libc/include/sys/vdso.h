@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Pages the kernel maps read-only into every process, read by libc instead of making syscalls.
+//  NOTE: must match the kernel definitions (vdso.h).
+
+#define VDSO_TIME_ADDRESS    0x7fff00000000 // Shared by every process.
+#define VDSO_PROCESS_ADDRESS 0x7fff00001000 // Private to the process.
+
+#define VDSO_NS_SHIFT 32
+
+typedef struct {
+    // Odd while the kernel updates the page. Read the fields until it's even and didn't change.
+    uint32_t sequence;
+    uint32_t reserved;
+
+    // The uptime in ms is `ms_at_tsc_base + (rdtsc - tsc_base) / tsc_per_ms`.
+    uint64_t tsc_base;
+    uint64_t ms_at_tsc_base;
+    uint64_t tsc_per_ms; // 0 until the TSC is calibrated, then the time is available only with a syscall.
+
+    // Nanoseconds since `tsc_base` are `((rdtsc - tsc_base) * ns_per_tsc_mult) >> VDSO_NS_SHIFT`.
+    uint64_t ns_per_tsc_mult;
+} vdso_Time;
+
+typedef struct {
+    uint64_t pid;
+} vdso_Process;
@@ -6,5 +6,11 @@
 #define WEXITSTATUS(wstatus) wstatus // MDS CORE only stores the return code
 
 #define WNOHANG (1 << 0)
+#define WTIMEOUT (1 << 1) // Set by waitpid_timeout
 
 pid_t waitpid(pid_t pid, int *wstatus, int options);
+
+/**
+ * @brief - Like waitpid, but gives up after `timeout_ms` milliseconds, and then returns 0 (like with WNOHANG).
+ */
+pid_t waitpid_timeout(pid_t pid, int *wstatus, int options, uint64_t timeout_ms);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef int clockid_t;
+typedef int64_t time_t;
+
+struct timespec {
+    time_t tv_sec;
+    long tv_nsec;
+};
+
+#define CLOCK_MONOTONIC 1 // Since boot. There is no real time clock.
+
+/**
+ * @brief - Get the time of `clock_id`, without a syscall.
+ *
+ * @return - 0 on success, -1 if `clock_id` is not supported.
+ */
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
@@ -14,9 +14,22 @@ long syscall(long syscall_number, ...);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
 
+// Copy the current process. Returns the pid of the child in the parent, 0 in the child, and -1 on failure.
+pid_t fork(void);
+
 // Similar to execve, but doesn't replace current process.
 pid_t execve_new(const char *path, char *const *argv);
 
+// Same as execve_new, but the stdin, stdout and stderr of the new process are copies of our
+//  file descriptors in `stdio`. Where it's 0, the process opens its own (the terminal).
+pid_t execve_new_with_stdio(const char *path, char *const *argv, const int stdio[3]);
+
+int close(int fd);
+
+// Create a pipe. fds[0] is its read end, and fds[1] its write end. Returns 0 on success, -1 on failure.
+//  Reading an empty pipe blocks until it's written to, or returns 0 once every write end is closed.
+int pipe(int fds[2]);
+
 void *sbrk(intptr_t increment);
 int brk(void *addr);
 
@@ -36,15 +49,37 @@ ssize_t lseek(int fd, ssize_t offset, int whence);
 
 int msleep(uint64_t delay_ms);
 
+// Milliseconds since boot. Doesn't make a syscall.
 float pit_time();
 
+pid_t getpid(void);
+
+// Total time, in milliseconds, the CPU spent idle since boot.
+uint64_t idle_time();
+
+// Add `inc` to the nice value of the process (-20 to 19, lower runs more often). Returns the new nice value.
+int nice(int inc);
+
 #define PROCESS_NAME_MAX_LEN 32
 
+// What the process did since it started.
+typedef struct {
+    uint64_t user_cycles;   // TSC cycles spent in usermode.
+    uint64_t kernel_cycles; // TSC cycles spent in the kernel, on behalf of the process.
+    uint64_t voluntary_switches;   // Gave up the CPU, to block.
+    uint64_t involuntary_switches; // Preempted at the end of its time slice.
+    uint64_t syscalls;
+    uint64_t page_faults;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} ProcessStats;
+
 typedef struct {
     uint64_t pid;
     char cwd[50];
     char name[PROCESS_NAME_MAX_LEN];
     int state;
+    ProcessStats stats;
 } ProcessInfo;
 
 int get_processes(ProcessInfo *out, size_t max);
@@ -161,10 +161,33 @@ FILE *fopen(const char *restrict path, const char *restrict mode)
     return fp;
 }
 
+FILE *fdopen(int fd, const char *mode)
+{
+    if (parse_mode_string_to_flags(mode) == -1)
+    {
+        return NULL;
+    }
+
+    FILE *fp = malloc(sizeof(*fp));
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    fp->fd = fd;
+    return fp;
+}
+
 int fclose(FILE *stream)
 {
+    int ret = close(stream->fd);
     free(stream);
-    return 0;
+    return ret;
+}
+
+int fileno(FILE *stream)
+{
+    return stream->fd;
 }
 
 int fseek(FILE *stream, long offset, int whence)
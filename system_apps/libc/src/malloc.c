@@ -5,10 +5,14 @@
 #include <sys/cdefs.h>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 #define PAGE_SIZE 0x1000
 #define math_ALIGN_UP(value, boundary)   (((value) + boundary - 1) & ~(boundary - 1))
+#define math_ALIGN_DOWN(value, boundary) ((value) & ~(boundary - 1))
 #define PAGE_ALIGN_UP(value)  math_ALIGN_UP(value, PAGE_SIZE)
+#define PAGE_ALIGN_DOWN(value) math_ALIGN_DOWN(value, PAGE_SIZE)
 
 typedef struct malloc_chunk malloc_chunk;
 typedef struct malloc_state malloc_state;
@@ -48,7 +52,9 @@ enum {
 #define CHUNK_OVERLAP_OFFSET    (sizeof(size_t)) // prev_chunk_size is located inside previous chunk
 
 #define chunk_size(chunk) ((chunk)->chunk_size & (~0x7))
-#define chunk_size_of_content(chunk) (chunk_size(chunk) - CHUNK_OVERLAP_OFFSET)
+#define chunk_is_mmaped(chunk) (((chunk)->chunk_size & MALLOC_CHUNK_MMAPED) != 0)
+// A mmaped chunk has no next chunk to overlap with.
+#define chunk_size_of_content(chunk) (chunk_size(chunk) - (chunk_is_mmaped(chunk) ? CHUNK_HEADER_SIZE : CHUNK_OVERLAP_OFFSET))
 #define chunk_flags(chunk) ((chunk)->chunk_size & (0x7))
 
 size_t request_size_to_chunk_size(size_t request_size)
@@ -170,7 +176,54 @@ typedef malloc_chunk malloc_bin;
    128) - 1)
 
 
+/* Tcache
+ * ------
+ * Recently freed small chunks are cached in the tcache, and checked before
+ * anything else. Each tcache bin is a singly linked list of up to
+ * `tcache_count` chunks of a single size, from MIN_CHUNK_SIZE up to
+ * TCACHE_MAX_CHUNK_SIZE. Chunks in the tcache are still marked in use, so they
+ * are never consolidated, and both putting and taking one is a list push/pop.
+ *
+ * Fastbins
+ * --------
+ * Small chunks freed when their tcache bin is full go to a fastbin. Like the
+ * tcache bins, each fastbin is a singly linked list of chunks of a single size
+ * which are still marked in use. That is, consolidating them with their
+ * neighbours is deferred until `malloc_consolidate`, which is called when a
+ * large chunk is requested or freed, or before growing the heap.
+ *
+ * The links of both are stored protected (@see TCACHE_PTR_PROTECT), so a
+ * corrupted link (say, by a use after free) is caught rather than followed.
+ */
+
+#define TCACHE_BIN_COUNT        64
+#define TCACHE_FILL_COUNT       7 // The default max amount of chunks in a tcache bin
+#define TCACHE_MAX_CHUNK_SIZE   (MIN_CHUNK_SIZE + (TCACHE_BIN_COUNT - 1) * CHUNK_SIZE_ALIGN)
+#define tcache_index(chunk_size) (((size_t)(chunk_size) - MIN_CHUNK_SIZE) / CHUNK_SIZE_ALIGN)
+
+#define FASTBIN_COUNT           7
+#define MAX_FAST_CHUNK_SIZE     (MIN_CHUNK_SIZE + (FASTBIN_COUNT - 1) * CHUNK_SIZE_ALIGN) // 0x80
+#define fastbin_index(chunk_size) (((size_t)(chunk_size) - MIN_CHUNK_SIZE) / CHUNK_SIZE_ALIGN)
+
+#define FASTBIN_CONSOLIDATION_THRESHOLD 0x10000 // Freeing a chunk at least this large consolidates the fastbins
+
 #define TCACHE_PTR_PROTECT(location, ptr) (((uint64_t)(location) >> 12) ^ (uint64_t)(ptr))
+#define TCACHE_PTR_REVEAL(location) ((void *)TCACHE_PTR_PROTECT((location), *(location)))
+
+// Put in the `key` of chunks in the tcache, to detect double frees.
+#define TCACHE_KEY 0x7463616368656b79
+
+typedef struct tcache_entry
+{
+    struct tcache_entry *next; // Protected
+    uint64_t key; // TCACHE_KEY while in the tcache
+} tcache_entry;
+
+typedef struct
+{
+    uint16_t counts[TCACHE_BIN_COUNT];
+    tcache_entry *entries[TCACHE_BIN_COUNT];
+} tcache_state;
 
 struct malloc_state
 {
@@ -180,6 +233,36 @@ struct malloc_state
         malloc_chunk *fd;
         malloc_chunk *bk;
     } bins[BIN_COUNT];
+
+    malloc_chunk *fastbins[FASTBIN_COUNT]; // Linked by `fd`, protected.
+    bool has_fast_chunks;
+};
+
+/* Mmaped chunks
+ * -------------
+ * Chunks of at least `mmap_threshold` are mapped on their own, with mmap, and
+ * unmapped as soon as they are freed, instead of living in the heap until the
+ * break is lowered past them. They are marked with MALLOC_CHUNK_MMAPED, and
+ * never go to any bin.
+ *
+ * The heap itself gives the end of the top chunk back with sbrk, once there's
+ * more than `trim_threshold` of it.
+ */
+
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+#define DEFAULT_TRIM_THRESHOLD (128 * 1024)
+
+static struct
+{
+    size_t tcache_count; // The max amount of chunks in a tcache bin
+    size_t max_fast; // The largest chunk put in a fastbin, 0 for none
+    size_t mmap_threshold; // The smallest chunk that's mmaped
+    size_t trim_threshold; // The top chunk is trimmed once it's at least this large
+} malloc_params = {
+    .tcache_count = TCACHE_FILL_COUNT,
+    .max_fast = MAX_FAST_CHUNK_SIZE,
+    .mmap_threshold = DEFAULT_MMAP_THRESHOLD,
+    .trim_threshold = DEFAULT_TRIM_THRESHOLD,
 };
 
 /**
@@ -231,6 +314,7 @@ void bin_insert_unsorted(malloc_bin *unsorted_bin, malloc_chunk *chunk)
 
 
 static malloc_state main_arena;
+static tcache_state tcache;
 static bool is_malloc_initialized = false;
 
 static void unlink_large_chunk(malloc_chunk *chunk)
@@ -696,6 +780,241 @@ malloc_chunk *try_consolidate(malloc_chunk *chunk, malloc_state *arena)
     return chunk;
 }
 
+/**
+ * @brief - Give the end of the top chunk back to the system, if it's at least
+ *              `trim_threshold` large. Keeps less than 2 pages of it.
+ */
+static void malloc_trim_top()
+{
+    size_t top_size = chunk_size(main_arena.top);
+    if (top_size < malloc_params.trim_threshold)
+    {
+        return;
+    }
+
+    if (sbrk(0) != (void *)main_arena.top + top_size)
+    {
+        return; // Someone else moved the break, the top chunk doesn't end at it.
+    }
+
+    size_t release_size = PAGE_ALIGN_DOWN(top_size - PAGE_SIZE);
+    if (release_size == 0 || sbrk(-(intptr_t)release_size) == (void *)-1)
+    {
+        return;
+    }
+
+    main_arena.top->chunk_size -= release_size;
+}
+
+/**
+ * @brief - Map a chunk of its own for the user request.
+ *
+ * @return - Pointer to the allocated memory (not chunk) or NULL.
+ */
+static void *malloc_mmap(size_t request_size)
+{
+    size_t size;
+    if (__builtin_add_overflow(request_size, CHUNK_HEADER_SIZE + PAGE_SIZE - 1, &size))
+    {
+        return NULL;
+    }
+    size = PAGE_ALIGN_DOWN(size);
+
+    malloc_chunk *chunk = mmap(size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+
+    chunk->prev_chunk_size = 0;
+    chunk->chunk_size = size | MALLOC_CHUNK_MMAPED;
+
+    return chunk2addr(chunk);
+}
+
+/**
+ * @brief - Free a chunk into the unsorted bin, consolidating it with its free
+ *              neighbours first.
+ *
+ * @param chunk - An in use chunk.
+ */
+static void free_chunk_into_bins(malloc_chunk *chunk)
+{
+    malloc_chunk *next = next_chunk(chunk);
+    next->prev_chunk_size = chunk_size(chunk);
+    next->chunk_size &= (~MALLOC_CHUNK_PREV_IN_USE);
+
+    malloc_bin *unsorted_bin = bin_at(&main_arena, 0);
+
+    chunk = try_consolidate(chunk, &main_arena);
+
+    if (chunk != main_arena.top)
+    {
+        bin_insert_unsorted(unsorted_bin, chunk);
+        return;
+    }
+
+    malloc_trim_top();
+}
+
+static void tcache_put(malloc_chunk *chunk)
+{
+    size_t index = tcache_index(chunk_size(chunk));
+    tcache_entry *entry = chunk2addr(chunk);
+
+    entry->key = TCACHE_KEY;
+    entry->next = (tcache_entry *)TCACHE_PTR_PROTECT(&entry->next, tcache.entries[index]);
+    tcache.entries[index] = entry;
+    tcache.counts[index]++;
+}
+
+static void *tcache_get(size_t index)
+{
+    tcache_entry *entry = tcache.entries[index];
+    assert(((uint64_t)entry & (CHUNK_SIZE_ALIGN - 1)) == 0 && "unaligned tcache chunk detected");
+
+    tcache.entries[index] = TCACHE_PTR_REVEAL(&entry->next);
+    tcache.counts[index]--;
+    entry->key = 0;
+
+    return entry;
+}
+
+/**
+ * @brief - Put the given chunk in the tcache, if there's room for it in the bin
+ *              of its size.
+ *
+ * @return - Whether the chunk was put in the tcache.
+ */
+static bool tcache_try_put(malloc_chunk *chunk)
+{
+    size_t size = chunk_size(chunk);
+    if (size > TCACHE_MAX_CHUNK_SIZE)
+    {
+        return false;
+    }
+
+    size_t index = tcache_index(size);
+    tcache_entry *entry = chunk2addr(chunk);
+    if (entry->key == TCACHE_KEY)
+    {
+        // Probably a double free, but the user might have just put the key there.
+        for (tcache_entry *cur = tcache.entries[index]; cur != NULL; cur = TCACHE_PTR_REVEAL(&cur->next))
+        {
+            assert(cur != entry && "double free detected in tcache");
+        }
+    }
+
+    if (tcache.counts[index] >= malloc_params.tcache_count)
+    {
+        return false;
+    }
+
+    tcache_put(chunk);
+    return true;
+}
+
+/**
+ * @brief - Malloc from the tcache, if possible.
+ *
+ * @param victim_size The size of the **chunk** (not the user request)
+ *                        that needs allocating
+ * @return - Pointer to the allocated memory (not chunk) or NULL.
+ */
+static void *malloc_from_tcache(size_t victim_size)
+{
+    if (victim_size > TCACHE_MAX_CHUNK_SIZE)
+    {
+        return NULL;
+    }
+
+    size_t index = tcache_index(victim_size);
+    if (tcache.counts[index] == 0)
+    {
+        return NULL;
+    }
+
+    return tcache_get(index);
+}
+
+static void fastbin_push(malloc_chunk *chunk)
+{
+    malloc_chunk **fastbin = &main_arena.fastbins[fastbin_index(chunk_size(chunk))];
+    assert(*fastbin != chunk && "double free or corruption (fasttop)");
+
+    chunk->fd = (malloc_chunk *)TCACHE_PTR_PROTECT(&chunk->fd, *fastbin);
+    *fastbin = chunk;
+    main_arena.has_fast_chunks = true;
+}
+
+static malloc_chunk *fastbin_pop(size_t index)
+{
+    malloc_chunk *chunk = main_arena.fastbins[index];
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+
+    assert(((uint64_t)chunk & (CHUNK_SIZE_ALIGN - 1)) == 0 && "unaligned fastbin chunk detected");
+    assert(fastbin_index(chunk_size(chunk)) == index && "memory corruption (fast)");
+
+    main_arena.fastbins[index] = TCACHE_PTR_REVEAL(&chunk->fd);
+    return chunk;
+}
+
+/**
+ * @brief - Malloc from the fastbins, if possible. The rest of the chunks in the
+ *              fastbin are moved to the tcache, while there's room for them.
+ *
+ * @param victim_size The size of the **chunk** (not the user request)
+ *                        that needs allocating
+ * @return - Pointer to the allocated memory (not chunk) or NULL.
+ */
+static void *malloc_from_fastbin(size_t victim_size)
+{
+    if (victim_size > MAX_FAST_CHUNK_SIZE)
+    {
+        return NULL;
+    }
+
+    size_t index = fastbin_index(victim_size);
+    malloc_chunk *victim = fastbin_pop(index);
+    if (victim == NULL)
+    {
+        return NULL;
+    }
+
+    size_t tcache_bin = tcache_index(victim_size);
+    while (tcache.counts[tcache_bin] < malloc_params.tcache_count && main_arena.fastbins[index] != NULL)
+    {
+        tcache_put(fastbin_pop(index));
+    }
+
+    return chunk2addr(victim);
+}
+
+/**
+ * @brief - Free the chunks of all of the fastbins into the regular bins,
+ *              consolidating them with their free neighbours.
+ */
+static void malloc_consolidate()
+{
+    if (!main_arena.has_fast_chunks)
+    {
+        return;
+    }
+    main_arena.has_fast_chunks = false;
+
+    for (size_t i = 0; i < FASTBIN_COUNT; i++)
+    {
+        malloc_chunk *chunk;
+        while ((chunk = fastbin_pop(i)) != NULL)
+        {
+            free_chunk_into_bins(chunk);
+        }
+    }
+}
+
 /*
                    malloc / free
 */
@@ -705,16 +1024,53 @@ void *malloc(size_t size)
     if (!is_malloc_initialized)
         malloc_initialize();
 
-    // TODO: if size is large enough, mmap it instead
-
     size_t victim_size = request_size_to_chunk_size(size);
 
-    void *victim = malloc_from_bins(victim_size);
+    void *victim;
+    if (victim_size >= malloc_params.mmap_threshold)
+    {
+        victim = malloc_mmap(size);
+        if (victim != NULL)
+        {
+            return victim;
+        }
+        // Fall back to the heap, there might still be room in it.
+    }
+
+    victim = malloc_from_tcache(victim_size);
+    if (victim != NULL)
+    {
+        return victim;
+    }
+
+    victim = malloc_from_fastbin(victim_size);
+    if (victim != NULL)
+    {
+        return victim;
+    }
+
+    if (!is_small_bin_size(victim_size))
+    {
+        malloc_consolidate(); // The fast chunks might consolidate into a large enough one.
+    }
+
+    victim = malloc_from_bins(victim_size);
     if (victim != NULL)
     {
         return victim;
     }
 
+    if (main_arena.has_fast_chunks && !is_heap_big_enough_for_chunk(victim_size))
+    {
+        malloc_consolidate(); // Before growing the heap, as it might merge into top.
+
+        victim = malloc_from_bins(victim_size);
+        if (victim != NULL)
+        {
+            return victim;
+        }
+    }
+
     return malloc_from_top(victim_size);
 }
 
@@ -728,19 +1084,33 @@ void free(void *addr)
     malloc_chunk *chunk = addr2chunk(addr);
 
     assert(chunk->chunk_size > 0 && "chunk size 0");
+    if (chunk_is_mmaped(chunk))
+    {
+        int rs = munmap(chunk, chunk_size(chunk));
+        assert(rs == 0 && "invalid mmaped chunk");
+        return;
+    }
+
     malloc_chunk *next = next_chunk(chunk);
     assert((next->chunk_size & MALLOC_CHUNK_PREV_IN_USE) == 1 && "next chunk doesn't think this one exists");
 
-    next->prev_chunk_size = chunk_size(chunk);
-    next->chunk_size &= (~MALLOC_CHUNK_PREV_IN_USE);
+    if (tcache_try_put(chunk))
+    {
+        return;
+    }
 
-    malloc_bin *unsorted_bin = bin_at(&main_arena, 0);
+    size_t size = chunk_size(chunk);
+    if (size <= malloc_params.max_fast)
+    {
+        fastbin_push(chunk);
+        return;
+    }
 
-    chunk = try_consolidate(chunk, &main_arena);
+    free_chunk_into_bins(chunk);
 
-    if (chunk != main_arena.top)
+    if (size >= FASTBIN_CONSOLIDATION_THRESHOLD)
     {
-        bin_insert_unsorted(unsorted_bin, chunk);
+        malloc_consolidate();
     }
 }
 
@@ -760,6 +1130,11 @@ void *calloc(size_t amount, size_t size)
         return NULL;
     }
 
+    if (chunk_is_mmaped(addr2chunk(p)))
+    {
+        return p; // Fresh pages are already zeroed, and are left unbacked until touched.
+    }
+
     memset(p, 0, total_size);
     return p;
 }
@@ -779,9 +1154,7 @@ void *realloc(void *ptr, size_t size)
 
     malloc_chunk *chunk = addr2chunk(ptr);
 
-    size_t required_chunk_size = request_size_to_chunk_size(size);
-    size_t current_chunk_size = chunk_size(chunk);
-    if (required_chunk_size <= current_chunk_size)
+    if (size <= chunk_size_of_content(chunk))
     {
         return ptr;
     }
@@ -797,3 +1170,38 @@ void *realloc(void *ptr, size_t size)
 
     return new_ptr;
 }
+
+int mallopt(int param, int value)
+{
+    if (value < 0)
+    {
+        return 0;
+    }
+
+    switch (param)
+    {
+        case M_MXFAST:
+            if (value == 0)
+            {
+                malloc_params.max_fast = 0;
+                return 1;
+            }
+            if (request_size_to_chunk_size(value) > MAX_FAST_CHUNK_SIZE)
+            {
+                return 0;
+            }
+            malloc_params.max_fast = request_size_to_chunk_size(value);
+            return 1;
+
+        case M_TRIM_THRESHOLD:
+            malloc_params.trim_threshold = value;
+            return 1;
+
+        case M_MMAP_THRESHOLD:
+            malloc_params.mmap_threshold = value;
+            return 1;
+
+        default:
+            return 0;
+    }
+}
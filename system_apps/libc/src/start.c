@@ -1,13 +1,25 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
 
 extern int __attribute__((sysv_abi, used)) main(int argc, char **argv);
 
+// Use the file descriptor our parent gave us for the stream (@see execve_new_with_stdio), or the terminal if there's none.
+static FILE *init_stdio_stream(int fd, const char *mode)
+{
+    if (lseek(fd, 0, SEEK_CUR) != -1)
+    {
+        return fdopen(fd, mode);
+    }
+
+    return fopen("/dev/tty", mode);
+}
+
 static void __attribute__((used)) init_stdio_streams()
 {
-    stdin  = fopen("/dev/tty", "r");
-    stdout = fopen("/dev/tty", "w");
-    stderr = fopen("/dev/tty", "w");
+    stdin  = init_stdio_stream(1, "r");
+    stdout = init_stdio_stream(2, "w");
+    stderr = init_stdio_stream(3, "w");
 }
 
 void __attribute__((naked)) _start()
@@ -1,5 +1,6 @@
 #include "string.h"
 #include "assert.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -132,30 +133,145 @@ int strncasecmp(const char *s1, const char *s2, size_t n)
     return result;
 }
 
-void *memmove(void *dest, const void *src, size_t n)
+// SSE2 is part of x86-64, so 16 byte vectors are always there. The types are unaligned (and
+//  may alias anything), so loads and stores through them work on any address.
+typedef uint8_t string_Vector __attribute__((vector_size(16), aligned(1), may_alias));
+typedef uint8_t string_AlignedVector __attribute__((vector_size(16), may_alias));
+typedef uint64_t string_Qword __attribute__((aligned(1), may_alias));
+typedef uint32_t string_Dword __attribute__((aligned(1), may_alias));
+typedef uint16_t string_Word __attribute__((aligned(1), may_alias));
+typedef char string_CharVector __attribute__((vector_size(16))); // What the SSE2 builtins take
+
+#define STRING_VECTOR_SIZE sizeof(string_Vector)
+#define STRING_SMALL_SIZE (2 * STRING_VECTOR_SIZE)
+
+// From this size on `rep movsb`/`rep stosb` beat the vector loops, when the CPU has ERMS.
+#define STRING_REP_MIN_SIZE 2048
+
+// The loops are the implementation of these functions, don't let the compiler turn them back into calls.
+#define STRING_NO_LIBCALL __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+static bool string_has_erms()
 {
-  char *d = dest;
-  const char *s = src;
-  if (d < s)
-    while (n--)
-      *d++ = *s++;
-  else
+    static int8_t has_erms = -1;
+    if (has_erms < 0)
     {
-      const char *lasts = s + (n-1);
-      char *lastd = d + (n-1);
-      while (n--)
-        *lastd-- = *lasts--;
+        uint32_t eax = 7, ebx, ecx = 0, edx;
+        asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+        has_erms = (ebx >> 9) & 1; // Enhanced REP MOVSB/STOSB
+    }
+
+    return has_erms;
+}
+
+/**
+ * @brief - Copy up to STRING_SMALL_SIZE bytes with a couple of (possibly overlapping) moves.
+ *          Every load is done before the stores, so the buffers may overlap.
+ */
+static inline void string_copy_small(uint8_t *d, const uint8_t *s, size_t n)
+{
+    if (n >= STRING_VECTOR_SIZE)
+    {
+        const string_Vector head = *(const string_Vector *)s;
+        const string_Vector tail = *(const string_Vector *)(s + n - STRING_VECTOR_SIZE);
+        *(string_Vector *)d = head;
+        *(string_Vector *)(d + n - STRING_VECTOR_SIZE) = tail;
+    }
+    else if (n >= sizeof(uint64_t))
+    {
+        const uint64_t head = *(const string_Qword *)s;
+        const uint64_t tail = *(const string_Qword *)(s + n - sizeof(uint64_t));
+        *(string_Qword *)d = head;
+        *(string_Qword *)(d + n - sizeof(uint64_t)) = tail;
+    }
+    else if (n >= sizeof(uint32_t))
+    {
+        const uint32_t head = *(const string_Dword *)s;
+        const uint32_t tail = *(const string_Dword *)(s + n - sizeof(uint32_t));
+        *(string_Dword *)d = head;
+        *(string_Dword *)(d + n - sizeof(uint32_t)) = tail;
+    }
+    else if (n >= sizeof(uint16_t))
+    {
+        const uint16_t head = *(const string_Word *)s;
+        const uint16_t tail = *(const string_Word *)(s + n - sizeof(uint16_t));
+        *(string_Word *)d = head;
+        *(string_Word *)(d + n - sizeof(uint16_t)) = tail;
+    }
+    else if (n == 1)
+    {
+        *d = *s;
     }
-  return dest;
 }
 
+STRING_NO_LIBCALL
+void *memmove(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (d == s)
+    {
+        return dest;
+    }
+
+    if (n <= STRING_SMALL_SIZE)
+    {
+        string_copy_small(d, s, n);
+        return dest;
+    }
+
+    // The first and last vectors are stored last, so the loops are left with whole aligned stores.
+    const string_Vector head = *(const string_Vector *)s;
+    const string_Vector tail = *(const string_Vector *)(s + n - STRING_VECTOR_SIZE);
+
+    if ((uintptr_t)d - (uintptr_t)s >= n) // `dest` isn't inside `src`, copy forward.
+    {
+        if (n >= STRING_REP_MIN_SIZE && string_has_erms())
+        {
+            asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+            return dest;
+        }
+
+        for (size_t i = STRING_VECTOR_SIZE - ((uintptr_t)d & (STRING_VECTOR_SIZE - 1)); i < n - STRING_VECTOR_SIZE; i += STRING_VECTOR_SIZE)
+        {
+            *(string_AlignedVector *)(d + i) = *(const string_Vector *)(s + i);
+        }
+    }
+    else // Copy backward, so the end of `src` is read before it's overwritten.
+    {
+        for (size_t i = n - ((uintptr_t)(d + n) & (STRING_VECTOR_SIZE - 1)); i > STRING_VECTOR_SIZE;)
+        {
+            i -= STRING_VECTOR_SIZE;
+            *(string_AlignedVector *)(d + i) = *(const string_Vector *)(s + i);
+        }
+    }
+
+    *(string_Vector *)(d + n - STRING_VECTOR_SIZE) = tail;
+    *(string_Vector *)d = head;
+
+    return dest;
+}
 
 int memcmp(const void *ptr1, const void *ptr2, size_t n)
 {
     const unsigned char *p1 = (const unsigned char *)ptr1;
     const unsigned char *p2 = (const unsigned char *)ptr2;
 
-    for (size_t i = 0; i < n; i++)
+    size_t i = 0;
+    for (; i + STRING_VECTOR_SIZE <= n; i += STRING_VECTOR_SIZE)
+    {
+        const string_Vector a = *(const string_Vector *)(p1 + i);
+        const string_Vector b = *(const string_Vector *)(p2 + i);
+        const int equal_mask = __builtin_ia32_pmovmskb128((string_CharVector)(a == b));
+        if (equal_mask != 0xffff)
+        {
+            const size_t diff = i + __builtin_ctz(~equal_mask);
+            return p1[diff] - p2[diff];
+        }
+    }
+
+    for (; i < n; i++)
     {
         if (p1[i] != p2[i])
         {
@@ -165,12 +281,49 @@ int memcmp(const void *ptr1, const void *ptr2, size_t n)
     return 0;
 }
 
+STRING_NO_LIBCALL
 void *memset(void *s, int c, size_t n)
 {
-  unsigned char *ptr = s;
-  while (n-- > 0)
-    *ptr++ = c;
-  return s;
+    uint8_t *d = s;
+
+    if (n >= STRING_REP_MIN_SIZE && string_has_erms())
+    {
+        asm volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+        return s;
+    }
+
+    const uint64_t pattern = (uint8_t)c * 0x0101010101010101ull;
+    if (n > STRING_VECTOR_SIZE)
+    {
+        const string_Vector vector = (string_Vector){} + (uint8_t)c; // Every byte is `c`
+        *(string_Vector *)d = vector;
+        *(string_Vector *)(d + n - STRING_VECTOR_SIZE) = vector;
+        for (size_t i = STRING_VECTOR_SIZE - ((uintptr_t)d & (STRING_VECTOR_SIZE - 1)); i < n - STRING_VECTOR_SIZE; i += STRING_VECTOR_SIZE)
+        {
+            *(string_AlignedVector *)(d + i) = vector;
+        }
+    }
+    else if (n >= sizeof(uint64_t))
+    {
+        *(string_Qword *)d = pattern;
+        *(string_Qword *)(d + n - sizeof(uint64_t)) = pattern;
+    }
+    else if (n >= sizeof(uint32_t))
+    {
+        *(string_Dword *)d = pattern;
+        *(string_Dword *)(d + n - sizeof(uint32_t)) = pattern;
+    }
+    else if (n >= sizeof(uint16_t))
+    {
+        *(string_Word *)d = pattern;
+        *(string_Word *)(d + n - sizeof(uint16_t)) = pattern;
+    }
+    else if (n == 1)
+    {
+        *d = c;
+    }
+
+    return s;
 }
 
 void *memchr(const void *s_in, int c_in, size_t n)
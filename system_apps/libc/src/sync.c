@@ -0,0 +1,114 @@
+#include <sync.h>
+#include <sys/futex.h>
+#include <stdint.h>
+
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1
+#define MUTEX_CONTENDED 2
+
+// Based on "Futexes Are Tricky" by Ulrich Drepper, mutex #3.
+//  Unlocking doesn't enter the kernel unless someone might be waiting.
+
+void mutex_lock(mutex_t *mutex)
+{
+    uint32_t state = MUTEX_UNLOCKED;
+    if (__atomic_compare_exchange_n(&mutex->state, &state, MUTEX_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    if (state != MUTEX_CONTENDED)
+    {
+        state = __atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+
+    while (state != MUTEX_UNLOCKED)
+    {
+        futex_wait(&mutex->state, MUTEX_CONTENDED, FUTEX_NO_TIMEOUT);
+        state = __atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+}
+
+bool mutex_trylock(mutex_t *mutex)
+{
+    uint32_t state = MUTEX_UNLOCKED;
+    return __atomic_compare_exchange_n(&mutex->state, &state, MUTEX_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_unlock(mutex_t *mutex)
+{
+    if (__atomic_exchange_n(&mutex->state, MUTEX_UNLOCKED, __ATOMIC_RELEASE) == MUTEX_CONTENDED)
+    {
+        futex_wake(&mutex->state, 1);
+    }
+}
+
+bool cond_timedwait(cond_t *cond, mutex_t *mutex, uint64_t timeout_ms)
+{
+    // Read before unlocking, so a signal between the unlock and the wait changes it, and we don't block.
+    uint32_t sequence = __atomic_load_n(&cond->sequence, __ATOMIC_RELAXED);
+
+    mutex_unlock(mutex);
+    int ret = futex_wait(&cond->sequence, sequence, timeout_ms);
+
+    // Others might be waiting on the mutex too (after cond_broadcast), so we can't
+    //  tell if it's contended, and must assume it is.
+    uint32_t state = __atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    while (state != MUTEX_UNLOCKED)
+    {
+        futex_wait(&mutex->state, MUTEX_CONTENDED, FUTEX_NO_TIMEOUT);
+        state = __atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+
+    return ret != FUTEX_WAIT_TIMED_OUT;
+}
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{
+    cond_timedwait(cond, mutex, FUTEX_NO_TIMEOUT);
+}
+
+void cond_signal(cond_t *cond)
+{
+    __atomic_add_fetch(&cond->sequence, 1, __ATOMIC_RELEASE);
+    futex_wake(&cond->sequence, 1);
+}
+
+void cond_broadcast(cond_t *cond)
+{
+    __atomic_add_fetch(&cond->sequence, 1, __ATOMIC_RELEASE);
+    futex_wake(&cond->sequence, UINT64_MAX);
+}
+
+void sem_init(sem_t *sem, uint32_t count)
+{
+    __atomic_store_n(&sem->count, count, __ATOMIC_RELEASE);
+}
+
+bool sem_trywait(sem_t *sem)
+{
+    uint32_t count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count > 0)
+    {
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void sem_wait(sem_t *sem)
+{
+    while (!sem_trywait(sem))
+    {
+        futex_wait(&sem->count, 0, FUTEX_NO_TIMEOUT);
+    }
+}
+
+void sem_post(sem_t *sem)
+{
+    __atomic_add_fetch(&sem->count, 1, __ATOMIC_RELEASE);
+    futex_wake(&sem->count, 1);
+}
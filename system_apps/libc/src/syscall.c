@@ -2,6 +2,11 @@
 #include <stdint.h>
 #include <sys/syscall.h>
 #include <sys/reboot.h>
+#include <sys/wait.h>
+#include <sys/futex.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <unistd.h>
 #include <stdbool.h>
 
@@ -73,9 +78,19 @@ void *sbrk(intptr_t increment)
     return prev_brk;
 }
 
+pid_t fork(void)
+{
+    return syscall(SYS_fork);
+}
+
 pid_t execve_new(const char *path, char *const *argv)
 {
-    return syscall(SYS_execve, path, argv);
+    return syscall(SYS_execve, path, argv, NULL);
+}
+
+pid_t execve_new_with_stdio(const char *path, char *const *argv, const int stdio[3])
+{
+    return syscall(SYS_execve, path, argv, stdio);
 }
 
 void exit(int status)
@@ -107,7 +122,12 @@ int chdir(const char *path)
 
 pid_t waitpid(pid_t pid, int *wstatus, int options)
 {
-    return syscall(SYS_waitpid, pid, wstatus, options);
+    return syscall(SYS_waitpid, pid, wstatus, options & ~WTIMEOUT);
+}
+
+pid_t waitpid_timeout(pid_t pid, int *wstatus, int options, uint64_t timeout_ms)
+{
+    return syscall(SYS_waitpid, pid, wstatus, options | WTIMEOUT, timeout_ms);
 }
 
 int open(const char *pathname, int flags)
@@ -115,6 +135,21 @@ int open(const char *pathname, int flags)
     return syscall(SYS_open, pathname, flags);
 }
 
+int close(int fd)
+{
+    return syscall(SYS_close, fd);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
+{
+    return syscall(SYS_poll, fds, nfds, timeout_ms);
+}
+
+int pipe(int fds[2])
+{
+    return syscall(SYS_pipe, fds);
+}
+
 int mkdir(const char *pathname)
 {
     return syscall(SYS_mkdir, pathname);
@@ -135,9 +170,49 @@ int msleep(uint64_t delay_ms)
     return syscall(SYS_msleep, delay_ms);
 }
 
-float pit_time()
+uint64_t idle_time()
+{
+    return syscall(SYS_idleTime);
+}
+
+int nice(int inc)
+{
+    return syscall(SYS_nice, inc);
+}
+
+int futex_wait(uint32_t *addr, uint32_t expected, uint64_t timeout_ms)
+{
+    return syscall(SYS_futexWait, addr, expected, timeout_ms);
+}
+
+int futex_wake(uint32_t *addr, uint64_t count)
+{
+    return syscall(SYS_futexWake, addr, count);
+}
+
+void *shm_map(const char *name, size_t size)
+{
+    return (void *)syscall(SYS_shmMap, name, size);
+}
+
+int shm_unmap(void *addr)
+{
+    return syscall(SYS_shmUnmap, addr);
+}
+
+int shm_unlink(const char *name)
+{
+    return syscall(SYS_shmUnlink, name);
+}
+
+void *mmap(size_t size)
+{
+    return (void *)syscall(SYS_mmap, size);
+}
+
+int munmap(void *addr, size_t size)
 {
-    return syscall(SYS_pitTime);
+    return syscall(SYS_munmap, addr, size);
 }
 
 
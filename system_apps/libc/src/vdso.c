@@ -0,0 +1,69 @@
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/vdso.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NS_PER_MS 1000000
+#define NS_PER_SEC 1000000000
+
+// Take a consistent copy of the time page.
+static vdso_Time vdso_read_time()
+{
+    const vdso_Time *page = (const vdso_Time *)VDSO_TIME_ADDRESS;
+
+    vdso_Time time;
+    uint32_t sequence;
+    do
+    {
+        sequence = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        time = *page;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    while ((sequence & 1) != 0 || sequence != __atomic_load_n(&page->sequence, __ATOMIC_RELAXED));
+
+    return time;
+}
+
+float pit_time()
+{
+    const vdso_Time time = vdso_read_time();
+    if (time.tsc_per_ms == 0)
+    {
+        return syscall(SYS_pitTime);
+    }
+
+    return time.ms_at_tsc_base + (__builtin_ia32_rdtsc() - time.tsc_base) / time.tsc_per_ms;
+}
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+    if (clock_id != CLOCK_MONOTONIC)
+    {
+        return -1;
+    }
+
+    const vdso_Time time = vdso_read_time();
+
+    uint64_t ns;
+    if (time.tsc_per_ms == 0)
+    {
+        ns = syscall(SYS_pitTime) * NS_PER_MS;
+    }
+    else
+    {
+        const uint64_t elapsed_tsc = __builtin_ia32_rdtsc() - time.tsc_base;
+        ns = time.ms_at_tsc_base * NS_PER_MS + (uint64_t)(((unsigned __int128)elapsed_tsc * time.ns_per_tsc_mult) >> VDSO_NS_SHIFT);
+    }
+
+    tp->tv_sec = ns / NS_PER_SEC;
+    tp->tv_nsec = ns % NS_PER_SEC;
+    return 0;
+}
+
+pid_t getpid()
+{
+    return ((const vdso_Process *)VDSO_PROCESS_ADDRESS)->pid;
+}
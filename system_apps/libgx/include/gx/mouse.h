@@ -15,3 +15,6 @@ int gx_mouse_init();
 #define gx_mouse_BUTTON_MIDDLE (1 << 2)
 
 gx_mouse_State gx_mouse_get_state() __attribute__((warn_unused_result));
+
+// The file descriptor of the mouse, to wait on with poll (POLLIN once the state changed since it was last read).
+int gx_mouse_fd();
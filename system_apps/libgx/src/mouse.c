@@ -26,3 +26,10 @@ gx_mouse_State gx_mouse_get_state()
 
     return mouse_pos;
 }
+
+int gx_mouse_fd()
+{
+    assert(g_mouse_fp != NULL && "Initialize first");
+
+    return fileno(g_mouse_fp);
+}
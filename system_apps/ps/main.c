@@ -3,8 +3,9 @@
 #include <stdbool.h>
 #include <sys/syscall.h>
 #include <stdint.h>
+#include <stdlib.h>
 
-#define MAX_PROCESSES 5
+#define STARTING_CAPACITY 16
 
 typedef enum
 {
@@ -29,11 +30,29 @@ const char *state_to_string(int state)
 
 int main(void)
 {
-    ProcessInfo processes[MAX_PROCESSES] = {0};
-    int count = get_processes(processes, MAX_PROCESSES);
+    // Grow the buffer until the whole snapshot fits in it.
+    ProcessInfo *processes = NULL;
+    int capacity = STARTING_CAPACITY / 2;
+    int count;
+    do
+    {
+        capacity *= 2;
+        ProcessInfo *new_processes = realloc(processes, capacity * sizeof(*processes));
+        if (new_processes == NULL)
+        {
+            free(processes);
+            printf("ps: out of memory\n");
+            return 1;
+        }
+        processes = new_processes;
+
+        count = get_processes(processes, capacity);
+    }
+    while (count == capacity);
 
     if (count < 0)
     {
+        free(processes);
         printf("ps: failed to retrieve processes\n");
         return 1;
     }
@@ -51,5 +70,13 @@ int main(void)
     }
 
     printf("\nTotal: %d processes\n", count);
+    free(processes);
+
+    uint64_t uptime = pit_time();
+    uint64_t idle = idle_time();
+    printf("Uptime: %lld ms, idle: %lld ms (%lld%%)\n",
+        (long long)uptime,
+        (long long)idle,
+        (long long)(uptime ? idle * 100 / uptime : 0));
     return 0;
 }
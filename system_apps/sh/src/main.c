@@ -88,6 +88,90 @@ typedef struct {
     bool execution_successful;
 } ExecutionResult;
 
+/**
+ * @brief Start `cmd`, looking for it in `path` unless it's a path itself.
+ *
+ * @param stdio - Nullable, @see execve_new_with_stdio
+ *
+ * @return The pid of the process, or -1 on failure (after printing why).
+ */
+pid_t spawn_command(ShellCommand *cmd, char *path, const int *stdio)
+{
+    pid_t pid = -1;
+    bool is_binary_path = strchr(cmd->shell_command[0], '/') != NULL;
+    if (is_binary_path)
+    {
+        pid = execve_new_with_stdio(cmd->shell_command[0], &cmd->shell_command[0], stdio);
+        if (pid == -1)
+        {
+            printf("Unknown command: '%s'\n", cmd->shell_command[0]);
+        }
+        return pid;
+    }
+
+    char *original_command = cmd->shell_command[0];
+    defer({ free(original_command); });
+    cmd->shell_command[0] = malloc(MAX_PATH_LENGTH);
+    if (cmd->shell_command[0] == NULL)
+    {
+        puts("Ran out of memory trying to run the command");
+
+        // The caller releases `cmd`, and the defer original_command. It's ok to free NULL.
+        return -1;
+    }
+
+    size_t path_idx = 0;
+    do
+    {
+        if (path[path_idx] == '\0')
+        {
+            break;
+        }
+
+        char *path_end = strchrnul(&path[path_idx], ':');
+
+        size_t path_end_idx = path_end - path;
+        size_t path_len = path_end_idx - path_idx;
+        size_t path_begin = path_idx;
+
+        if (path[path_end_idx] == '\0')
+        {
+            path_idx = path_end_idx;
+        }
+        else
+        {
+            path_idx = path_end_idx + 1;
+        }
+
+        if (path_len == 0)
+        {
+            continue; // Skip
+        }
+
+        if (path_len + 1 >= MAX_PATH_LENGTH)
+        {
+            puts("Path too long, aborting");
+            break;
+        }
+
+        memmove(cmd->shell_command[0], &path[path_begin], path_len);
+        cmd->shell_command[0][path_len] = '/';
+        cmd->shell_command[0][path_len + 1] = '\0';
+        strncat(cmd->shell_command[0], original_command, MAX_PATH_LENGTH);
+        pid = execve_new_with_stdio(cmd->shell_command[0], &cmd->shell_command[0], stdio);
+    }
+    while (pid == -1);
+
+    if (pid == -1)
+    {
+        printf("Unknown command: '%s'\n", cmd->shell_command[0]);
+    }
+
+    return pid;
+}
+
+#define MAX_PIPELINE_LENGTH 16
+
 ExecutionResult execute_expression(char *expr, size_t expr_length, char *path)
 {
     ShellCommand *cmd = parser_parse_shell_expression(expr, expr_length);
@@ -103,102 +187,98 @@ ExecutionResult execute_expression(char *expr, size_t expr_length, char *path)
     }
 
     // Special case for built-in `cd` command
-    if (strcmp(cmd->shell_command[0], "cd") == 0)
+    if (strcmp(cmd->shell_command[0], "cd") == 0 && cmd->pipe_to == NULL)
     {
         int ret = cd(cmd);
         return (ExecutionResult){.execution_successful = true, .return_code = ret};
     }
 
-    pid_t pid = -1;
-    bool is_binary_path = strchr(cmd->shell_command[0], '/') != NULL;
-    if (is_binary_path)
+    // Start every command of the pipeline, each reading what the one before it writes.
+    pid_t pids[MAX_PIPELINE_LENGTH];
+    size_t pid_count = 0;
+    bool is_async = false;
+    bool started_all = true;
+    int stdin_fd = 0; // The read end of the pipe from the previous command. 0 for none (the terminal).
+    for (ShellCommand *it = cmd; it != NULL; it = it->pipe_to)
     {
-        pid = execve_new(cmd->shell_command[0], &cmd->shell_command[0]);
-    }
-    else
-    {
-        char *original_command = cmd->shell_command[0];
-        defer({ free(original_command); });
-        cmd->shell_command[0] = malloc(MAX_PATH_LENGTH);
-        if (cmd->shell_command[0] == NULL)
+        if (pid_count == MAX_PIPELINE_LENGTH)
         {
-            puts("Ran out of memory trying to run the command");
-
-            // defer will cleanup `cmd` and original_command. It's ok to free NULL.
-            return (ExecutionResult){.execution_successful = false};
+            puts("shcore: pipeline too long");
+            started_all = false;
+            break;
         }
 
-        size_t path_idx = 0;
-        do
-        {
-            if (path[path_idx] == '\0')
-            {
-                break;
-            }
-
-            char *path_end = strchrnul(&path[path_idx], ':');
-
-            size_t path_end_idx = path_end - path;
-            size_t path_len = path_end_idx - path_idx;
-            size_t path_begin = path_idx;
+        is_async |= it->is_async;
 
-            if (path[path_end_idx] == '\0')
-            {
-                path_idx = path_end_idx;
-            }
-            else
-            {
-                path_idx = path_end_idx + 1;
-            }
+        int pipe_fds[2] = {0, 0};
+        if (it->pipe_to != NULL && pipe(pipe_fds) == -1)
+        {
+            puts("shcore: couldn't create a pipe");
+            started_all = false;
+            break;
+        }
 
-            if (path_len == 0)
-            {
-                continue; // Skip
-            }
+        const int stdio[3] = {stdin_fd, pipe_fds[1], 0};
+        const bool is_piped = stdin_fd != 0 || pipe_fds[1] != 0;
+        pid_t pid = spawn_command(it, path, is_piped ? stdio : NULL);
 
-            if (path_len + 1 >= MAX_PATH_LENGTH)
-            {
-                puts("Path too long, aborting");
-                break;
-            }
+        // The process has its own copies. Ours must be closed, or the reader never sees the end of its input.
+        if (stdin_fd != 0)
+        {
+            close(stdin_fd);
+        }
+        if (pipe_fds[1] != 0)
+        {
+            close(pipe_fds[1]);
+        }
+        stdin_fd = pipe_fds[0];
 
-            memmove(cmd->shell_command[0], &path[path_begin], path_len);
-            cmd->shell_command[0][path_len] = '/';
-            cmd->shell_command[0][path_len + 1] = '\0';
-            strncat(cmd->shell_command[0], original_command, MAX_PATH_LENGTH);
-            pid = execve_new(cmd->shell_command[0], &cmd->shell_command[0]);
+        if (pid == -1)
+        {
+            started_all = false;
+            break;
         }
-        while (pid == -1);
+
+        pids[pid_count] = pid;
+        pid_count++;
     }
 
-    if (pid == -1)
+    if (stdin_fd != 0)
     {
-        printf("Unknown command: '%s'\n", cmd->shell_command[0]);
-        return (ExecutionResult){.execution_successful = false};
+        close(stdin_fd);
     }
 
-    if (cmd->is_async)
+    if (is_async)
     {
         jobs_refresh();
-        bool success = jobs_insert(pid);
-        if (!success)
+        for (size_t i = 0; i < pid_count; i++)
         {
-            puts("shcore: warning: jobs list is full, this process will be lost");
+            bool success = jobs_insert(pids[i]);
+            if (!success)
+            {
+                puts("shcore: warning: jobs list is full, this process will be lost");
+            }
         }
-        return (ExecutionResult){.execution_successful = true, .return_code = 0};
+        return (ExecutionResult){.execution_successful = started_all, .return_code = 0};
     }
 
-    int wstatus;
-    pid_t child_pid = waitpid(pid, &wstatus, 0);
-    if (child_pid == -1)
+    int return_code = 0;
+    for (size_t i = 0; i < pid_count; i++)
     {
-        printf("waitpid: something went wrong\n");
-        return (ExecutionResult){.execution_successful = true, .return_code = -1};
+        int wstatus;
+        pid_t child_pid = waitpid(pids[i], &wstatus, 0);
+        if (child_pid == -1)
+        {
+            printf("waitpid: something went wrong\n");
+            return_code = -1;
+            continue;
+        }
+
+        assert(WIFEXITED(wstatus));
+        return_code = WEXITSTATUS(wstatus); // The pipeline returns what its last command returns.
     }
 
-    assert(WIFEXITED(wstatus));
-    int return_code = WEXITSTATUS(wstatus);
-    return (ExecutionResult){.execution_successful = true, .return_code = return_code};
+    return (ExecutionResult){.execution_successful = started_all, .return_code = return_code};
 }
 
 int main(int argc, char **argv)
@@ -20,6 +20,11 @@ void parser_release_parsed_expression(ShellCommand *cmd)
         free(cmd->shell_command);
     }
 
+    if (cmd->pipe_to != NULL)
+    {
+        parser_release_parsed_expression(cmd->pipe_to);
+    }
+
     cmd->shell_command = NULL;
     free(cmd);
 }
@@ -46,7 +51,9 @@ ShellCommand *parser_parse_shell_expression(const char *expression, size_t lengt
     size_t cur_token_capacity = 0;
     size_t cur_token_length = 0;
     bool currently_parsing_token = false;
-    for (const char *it = expression, *end = it + length; it != end; it++)
+    const char *piped_expression = NULL; // What comes after `|`
+    const char *const end = expression + length;
+    for (const char *it = expression; it != end; it++)
     {
         if (cur_token_ptr == NULL)
         {
@@ -117,6 +124,12 @@ ShellCommand *parser_parse_shell_expression(const char *expression, size_t lengt
             continue;
         }
 
+        if (*it == '|')
+        {
+            piped_expression = it + 1;
+            break;
+        }
+
         if (*it == ' ' || *it == '&')
         {
             if (*it == '&')
@@ -165,7 +178,7 @@ ShellCommand *parser_parse_shell_expression(const char *expression, size_t lengt
         if (!currently_parsing_token)
         {
             free(cmd->shell_command[cmd->length - 1]);
-            cmd->shell_command[cmd->length - 1] = NULL; // argv NULL
+            cmd->shell_command[cmd->length - 1] = NULL;
 
             cmd->length--;
         }
@@ -177,13 +190,27 @@ ShellCommand *parser_parse_shell_expression(const char *expression, size_t lengt
 
             *cur_token_ptr = new_buf;
             (*cur_token_ptr)[cur_token_length] = '\0';
+        }
+    }
 
-            new_buf = realloc(cmd->shell_command, cmd->length + 1); // Make sure there's enough space for argv NULL.
-            if (new_buf == NULL)
-                goto fail_oom;
+    // Make sure there's enough space for argv NULL, also when the last token was ended by a space.
+    void *new_buf = realloc(cmd->shell_command, (cmd->length + 1) * sizeof(char *));
+    if (new_buf == NULL)
+        goto fail_oom;
+
+    cmd->shell_command = new_buf;
+    cmd->shell_command[cmd->length] = NULL;
 
-            cmd->shell_command = new_buf;
-            cmd->shell_command[cmd->length] = NULL;
+    if (piped_expression != NULL)
+    {
+        cmd->pipe_to = parser_parse_shell_expression(piped_expression, end - piped_expression);
+        if (cmd->pipe_to == NULL)
+            goto fail;
+
+        if (cmd->length == 0 || cmd->pipe_to->length == 0)
+        {
+            puts("shcore: invalid syntax");
+            goto fail;
         }
     }
 
@@ -4,11 +4,13 @@
 #include <stddef.h>
 #include <sys/cdefs.h>
 
-typedef struct {
+typedef struct ShellCommand {
     char **shell_command;
     size_t length;
 
     bool is_async;
+
+    struct ShellCommand *pipe_to; // The command our output is piped into (`cmd | pipe_to`). NULL if none.
 } ShellCommand;
 
 /**
@@ -19,7 +21,7 @@ void parser_release_parsed_expression(ShellCommand *cmd);
 /**
  * @brief Parse the given `expression` of `length` into
  *          strings, separated by spaces, accounting for quotes and escaped
- *          characters.
+ *          characters. A `|` ends the command, and starts the one it's piped into.
  *
  * @return Dynamically allocated ShellCommand. Must be released with parser_release_parsed_expression.
  *          On failure returns NULL.
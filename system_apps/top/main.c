@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define STARTING_CAPACITY 16
+#define SAMPLE_INTERVAL_MS 1000
+#define DEFAULT_SAMPLE_COUNT 1
+
+#define PCB_STATE_ZOMBIE 4
+
+/**
+ * @brief - Take a snapshot of every process.
+ *
+ * @param out[out] - The snapshot, to be released with free.
+ * @return - The amount of processes, or -1 on failure.
+ */
+static int take_snapshot(ProcessInfo **out)
+{
+    // Grow the buffer until the whole snapshot fits in it.
+    ProcessInfo *processes = NULL;
+    int capacity = STARTING_CAPACITY / 2;
+    int count;
+    do
+    {
+        capacity *= 2;
+        ProcessInfo *new_processes = realloc(processes, capacity * sizeof(*processes));
+        if (new_processes == NULL)
+        {
+            free(processes);
+            return -1;
+        }
+        processes = new_processes;
+
+        count = get_processes(processes, capacity);
+    }
+    while (count == capacity);
+
+    if (count < 0)
+    {
+        free(processes);
+        return -1;
+    }
+
+    *out = processes;
+    return count;
+}
+
+static const ProcessInfo *find_process(const ProcessInfo *processes, int count, uint64_t pid)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (processes[i].pid == pid)
+        {
+            return &processes[i];
+        }
+    }
+
+    return NULL;
+}
+
+// printf has no field width, so the columns are aligned by hand.
+static void print_number(uint64_t num, int width)
+{
+    char digits[20];
+    int length = 0;
+    do
+    {
+        digits[length++] = '0' + num % 10;
+        num /= 10;
+    }
+    while (num != 0);
+
+    for (int i = length; i < width; i++)
+    {
+        putchar(' ');
+    }
+    while (length > 0)
+    {
+        putchar(digits[--length]);
+    }
+}
+
+static uint64_t parse_number(const char *str)
+{
+    uint64_t num = 0;
+    for (; *str >= '0' && *str <= '9'; str++)
+    {
+        num = num * 10 + (*str - '0');
+    }
+
+    return num;
+}
+
+typedef struct {
+    const ProcessInfo *process;
+    uint64_t user_cycles; // Since the previous snapshot.
+    uint64_t kernel_cycles;
+} Sample;
+
+static void print_sample(const ProcessInfo *before, int before_count, const ProcessInfo *after, int after_count,
+                         uint64_t elapsed_cycles, uint64_t cycles_per_ms)
+{
+    Sample *samples = calloc(after_count, sizeof(*samples));
+    if (samples == NULL)
+    {
+        printf("top: out of memory\n");
+        return;
+    }
+
+    int sample_count = 0;
+    for (int i = 0; i < after_count; i++)
+    {
+        if (after[i].state == PCB_STATE_ZOMBIE)
+        {
+            continue;
+        }
+
+        Sample sample = {
+            .process = &after[i],
+            .user_cycles = after[i].stats.user_cycles,
+            .kernel_cycles = after[i].stats.kernel_cycles,
+        };
+
+        const ProcessInfo *previous = find_process(before, before_count, after[i].pid);
+        if (previous != NULL)
+        {
+            sample.user_cycles -= previous->stats.user_cycles;
+            sample.kernel_cycles -= previous->stats.kernel_cycles;
+        }
+
+        // Insertion sort, the busiest process first.
+        int j = sample_count++;
+        for (; j > 0 && samples[j - 1].user_cycles + samples[j - 1].kernel_cycles < sample.user_cycles + sample.kernel_cycles; j--)
+        {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = sample;
+    }
+
+    printf("  PID %%CPU %%SYS  CPU ms VOLCSW INVCSW SYSCALLS FAULTS    READ WRITTEN NAME\n");
+    for (int i = 0; i < sample_count; i++)
+    {
+        const ProcessStats *stats = &samples[i].process->stats;
+
+        print_number(samples[i].process->pid, 5);
+        print_number((samples[i].user_cycles + samples[i].kernel_cycles) * 100 / elapsed_cycles, 5);
+        print_number(samples[i].kernel_cycles * 100 / elapsed_cycles, 5);
+        print_number((stats->user_cycles + stats->kernel_cycles) / cycles_per_ms, 8);
+        print_number(stats->voluntary_switches, 7);
+        print_number(stats->involuntary_switches, 7);
+        print_number(stats->syscalls, 9);
+        print_number(stats->page_faults, 7);
+        print_number(stats->bytes_read, 8);
+        print_number(stats->bytes_written, 8);
+        printf(" %s\n", samples[i].process->name);
+    }
+
+    free(samples);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t sample_count = DEFAULT_SAMPLE_COUNT;
+    if (argc > 1)
+    {
+        sample_count = parse_number(argv[1]);
+    }
+
+    ProcessInfo *before = NULL;
+    int before_count = take_snapshot(&before);
+    if (before_count < 0)
+    {
+        printf("top: failed to retrieve processes\n");
+        return 1;
+    }
+    uint64_t before_ms = pit_time();
+    uint64_t before_tsc = __builtin_ia32_rdtsc();
+    uint64_t before_idle_ms = idle_time();
+
+    for (uint64_t i = 0; i < sample_count; i++)
+    {
+        msleep(SAMPLE_INTERVAL_MS);
+
+        ProcessInfo *after = NULL;
+        int after_count = take_snapshot(&after);
+        if (after_count < 0)
+        {
+            free(before);
+            printf("top: failed to retrieve processes\n");
+            return 1;
+        }
+        uint64_t after_ms = pit_time();
+        uint64_t after_tsc = __builtin_ia32_rdtsc();
+        uint64_t after_idle_ms = idle_time();
+
+        // The counters are in TSC cycles, which we measure against the uptime ourselves.
+        uint64_t elapsed_ms = after_ms - before_ms;
+        uint64_t elapsed_cycles = after_tsc - before_tsc;
+        if (elapsed_ms == 0 || elapsed_cycles == 0)
+        {
+            elapsed_ms = 1;
+            elapsed_cycles = 1;
+        }
+
+        printf("\nUptime: %lld ms, idle: %lld%%\n",
+            (long long)after_ms,
+            (long long)((after_idle_ms - before_idle_ms) * 100 / elapsed_ms));
+        print_sample(before, before_count, after, after_count, elapsed_cycles, elapsed_cycles / elapsed_ms);
+
+        free(before);
+        before = after;
+        before_count = after_count;
+        before_ms = after_ms;
+        before_tsc = after_tsc;
+        before_idle_ms = after_idle_ms;
+    }
+
+    free(before);
+    return 0;
+}